@@ -6,6 +6,7 @@ apt-get update
 
 apt-get install g++-5 -y
 apt-get install automake make wget curl tar unzip autoconf libtool curl make -y
+apt-get install libpq-dev -y
 
 mkdir /usr/local/download
 cd /usr/local/download
@@ -41,6 +42,16 @@ cp * /usr/local/include/.
 
 cd /usr/local/download
 
+wget https://github.com/axboe/liburing/archive/liburing-2.3.tar.gz -O liburing.tar.gz
+mkdir liburing
+tar -xzf liburing.tar.gz -C liburing --strip-components=1
+cd liburing
+./configure
+make
+make install
+
+cd /usr/local/download
+
 rm protobuf.tar.gz
 rm -rf protobuf
 rm spdlog.tar.gz
@@ -49,3 +60,5 @@ rm boost.tar.gz
 rm -rf boost
 rm libuv.tar.gz
 rm -rf libuv
+rm liburing.tar.gz
+rm -rf liburing
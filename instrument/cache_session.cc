@@ -0,0 +1,35 @@
+#include "cache_session.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+namespace microtrace {
+
+const size_t CacheKeys::MAX_HASHES;
+const uint64_t CacheKeys::HASH_OFFSET;
+const uint64_t CacheKeys::HASH_PRIME;
+
+std::string CacheCommand::info(const bool hash_keys) const {
+    std::string info = std::string{protocol} + ": " + verb;
+    if (keys.count() == 0) {
+        return info;
+    }
+
+    info += " (" + std::to_string(keys.count()) +
+            (keys.count() == 1 ? " key" : " keys");
+    if (hash_keys) {
+        const size_t hashes = std::min(keys.count(), CacheKeys::MAX_HASHES);
+        for (size_t i = 0; i < hashes; ++i) {
+            char hex[17];
+            snprintf(hex, sizeof(hex), "%016llx",
+                     static_cast<unsigned long long>(keys.hash(i)));
+            info += i == 0 ? ": " : " ";
+            info += hex;
+        }
+        if (keys.count() > hashes) {
+            info += " ...";
+        }
+    }
+    return info + ")";
+}
+}
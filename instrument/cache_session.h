@@ -0,0 +1,242 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "context.h"
+#include "socket_handler.h"
+#include "txn_queue.h"
+
+namespace microtrace {
+
+/*
+ * The keys of a cache command. Only their number and the hashes of the first
+ * MAX_HASHES of them are kept, keys are never copied.
+ */
+class CacheKeys {
+   public:
+    static const size_t MAX_HASHES = 4;
+
+    /*
+     * FNV-1a, which can be computed while the key is streamed.
+     */
+    static const uint64_t HASH_OFFSET = 14695981039346656037ULL;
+    static const uint64_t HASH_PRIME = 1099511628211ULL;
+
+    static uint64_t Hash(uint64_t hash, const char* buf, size_t len) {
+        for (size_t i = 0; i < len; ++i) {
+            hash ^= static_cast<uint8_t>(buf[i]);
+            hash *= HASH_PRIME;
+        }
+        return hash;
+    }
+
+    void Clear() { count_ = 0; }
+
+    void Add(const uint64_t hash) {
+        if (count_ < MAX_HASHES) {
+            hashes_[count_] = hash;
+        }
+        ++count_;
+    }
+
+    size_t count() const { return count_; }
+
+    /*
+     * Returns the hash of the ith key, i must be less than MAX_HASHES.
+     */
+    uint64_t hash(const size_t i) const { return hashes_[i]; }
+
+   private:
+    size_t count_ = 0;
+    std::array<uint64_t, MAX_HASHES> hashes_;
+};
+
+/*
+ * A command sent to a cache, e.g. Redis or memcached, and its reply.
+ */
+struct CacheCommand {
+    /*
+     * Returns the info logged with the span, e.g. Redis: MGET (2 keys). If
+     * hash_keys is true, the hashes of the keys are included too.
+     */
+    std::string info(const bool hash_keys) const;
+
+    /*
+     * Name of the protocol, e.g. Redis.
+     */
+    const char* protocol = "";
+
+    std::string verb;
+    CacheKeys keys;
+
+    Transaction txn;
+    bool sampled = false;
+
+    /*
+     * Starts from zero because the default constructor would generate random
+     * uuids.
+     */
+    Context context{ContextStorage::Zero(), 0};
+
+    /*
+     * Indicates if the reply is an error.
+     */
+    bool error = false;
+};
+
+class CacheObserver {
+   public:
+    virtual ~CacheObserver() = default;
+
+    /*
+     * Called when a new command starts to be sent, it should decide if the
+     * command is sampled, and set its context.
+     */
+    virtual void CommandStarted(CacheCommand* command) = 0;
+
+    /*
+     * Called when the reply of a command has been received, or when a
+     * command that has no reply has been sent.
+     */
+    virtual void CommandCompleted(const CacheCommand& command) = 0;
+};
+
+/*
+ * Follows the commands sent to a cache and the replies received, using
+ * Tracker, e.g. RespTracker, to find the end of each of them. Replies arrive
+ * in the order of the commands, so every pipelined command is timed from its
+ * first byte until the end of its own reply.
+ *
+ * At most MAX_IN_FLIGHT commands are followed at the same time, the oldest one
+ * is completed early if a new one doesn't fit.
+ */
+template <class Tracker>
+class CacheSession {
+   public:
+    static const size_t MAX_IN_FLIGHT = 64;
+
+    CacheSession(CacheObserver* observer)
+        : observer_(observer),
+          requests_(Tracker::Type::COMMAND),
+          replies_(Tracker::Type::REPLY),
+          command_started_(false) {}
+
+    /*
+     * Processes commands written to the connection.
+     */
+    void Sent(const char* buf, size_t len) {
+        while (len > 0 && requests_.valid()) {
+            if (!command_started_) {
+                StartCommand();
+            }
+
+            const size_t processed = requests_.Process(buf, len);
+            if (requests_.complete()) {
+                CommandSent();
+            }
+            buf += processed;
+            len -= processed;
+        }
+    }
+
+    /*
+     * Processes replies read from the connection.
+     */
+    void Received(const char* buf, size_t len) {
+        while (len > 0 && replies_.valid()) {
+            const size_t processed = replies_.Process(buf, len);
+            if (replies_.complete()) {
+                // Replies without a command in flight are only framed
+                if (!in_flight_.empty()) {
+                    in_flight_.front().error = replies_.error();
+                    CompleteOldest();
+                }
+                replies_.Reset();
+            }
+            buf += processed;
+            len -= processed;
+        }
+    }
+
+    /*
+     * Completes the commands that are still in flight, called when the
+     * connection is closed.
+     */
+    void Close() {
+        while (!in_flight_.empty()) {
+            CompleteOldest();
+        }
+        command_started_ = false;
+    }
+
+    /*
+     * Returns false if the connection turned out not to use the protocol.
+     */
+    bool valid() const { return requests_.valid() && replies_.valid(); }
+
+   private:
+    void StartCommand() {
+        // A lost reply would otherwise keep every following command from
+        // being traced
+        if (in_flight_.full()) {
+            CompleteOldest();
+        }
+
+        CacheCommand& command = in_flight_.push();
+        command.protocol = Tracker::PROTOCOL;
+        command.verb.clear();
+        command.keys.Clear();
+        command.txn.Start();
+        command.error = false;
+        observer_->CommandStarted(&command);
+        command_started_ = true;
+    }
+
+    void CommandSent() {
+        // The command may have been completed early by an unexpected reply
+        if (!in_flight_.empty()) {
+            CacheCommand& command = in_flight_.back();
+            command.verb = requests_.verb();
+            command.keys = requests_.keys();
+
+            // Commands without a reply are completed once they have been
+            // sent, they are always the newest one
+            if (!requests_.expects_reply()) {
+                command.txn.End();
+                observer_->CommandCompleted(command);
+                in_flight_.pop_back();
+            }
+        }
+        requests_.Reset();
+        command_started_ = false;
+    }
+
+    void CompleteOldest() {
+        CacheCommand& command = in_flight_.front();
+        command.txn.End();
+        observer_->CommandCompleted(command);
+        in_flight_.pop();
+    }
+
+    CacheObserver* const observer_;
+
+    Tracker requests_;
+    Tracker replies_;
+
+    /*
+     * Indicates if the last command in in_flight_ is still being sent.
+     */
+    bool command_started_;
+
+    /*
+     * The commands whose reply hasn't been received yet.
+     */
+    TxnQueue<CacheCommand, MAX_IN_FLIGHT> in_flight_;
+};
+
+template <class Tracker>
+const size_t CacheSession<Tracker>::MAX_IN_FLIGHT;
+}
@@ -17,49 +17,165 @@ ClientSocket::ClientSocket(const int fd,
 
 void ClientSocket::Async() { handler_->Async(); }
 
+void ClientSocket::Rebind(int fd) {
+    fd_ = fd;
+    handler_->set_fd(fd);
+}
+
+void ClientSocket::NonBlocking(const bool non_blocking) {
+    handler_->set_non_blocking(non_blocking);
+}
+
+void ClientSocket::Ready() {
+    if (handler_->has_context()) {
+        set_current_context(handler_->context());
+    }
+}
+
 void ClientSocket::Connected(const std::string &ip) {
     handler_->HandleConnect(ip);
 }
 
+void ClientSocket::ConnectFailed(const int err) {
+    handler_->HandleConnectError(err);
+}
+
+void ClientSocket::SocketError(const int err) {
+    if (connect_pending_) {
+        EndConnect(err);
+    }
+}
+
+void ClientSocket::EndConnect(const int err) {
+    if (err == EINPROGRESS || err == EALREADY || err == EAGAIN ||
+        err == EWOULDBLOCK || err == EINTR) {
+        return;
+    }
+    connect_pending_ = false;
+    if (err != 0) {
+        const int saved = errno;
+        ConnectFailed(err);
+        errno = saved;
+    }
+}
+
 ssize_t ClientSocket::RecvFrom(void *buf, size_t len, int flags,
                                struct sockaddr *src_addr, socklen_t *addrlen) {
     handler_->BeforeRead(buf, len);
-    auto ret = orig_.recvfrom(fd(), buf, len, flags, src_addr, addrlen);
+    auto ret = CheckConnect(
+        orig_.recvfrom(fd(), buf, len, flags, src_addr, addrlen));
     handler_->AfterRead(buf, len, ret);
     return ret;
 }
 
 ssize_t ClientSocket::Recv(void *buf, size_t len, int flags) {
     handler_->BeforeRead(buf, len);
-    auto ret = orig_.recv(fd(), buf, len, flags);
+    auto ret = CheckConnect(orig_.recv(fd(), buf, len, flags));
     handler_->AfterRead(buf, len, ret);
     return ret;
 }
 
 ssize_t ClientSocket::Read(void *buf, size_t count) {
     handler_->BeforeRead(buf, count);
-    auto ret = orig_.read(fd(), buf, count);
+    auto ret = CheckConnect(orig_.read(fd(), buf, count));
     handler_->AfterRead(buf, count, ret);
     return ret;
 }
 
+ssize_t ClientSocket::Readv(const struct iovec *iov, int iovcnt) {
+    BeforeReadv(handler_.get(), iov, iovcnt);
+    auto ret = CheckConnect(orig_.readv(fd(), iov, iovcnt));
+    AfterReadv(handler_.get(), iov, iovcnt, ret);
+    return ret;
+}
+
+ssize_t ClientSocket::RecvMsg(struct msghdr *msg, int flags) {
+    BeforeReadv(handler_.get(), msg->msg_iov, msg->msg_iovlen);
+    auto ret = CheckConnect(orig_.recvmsg(fd(), msg, flags));
+    AfterReadv(handler_.get(), msg->msg_iov, msg->msg_iovlen, ret);
+    return ret;
+}
+
+int ClientSocket::RecvMMsg(struct mmsghdr *msgvec, unsigned int vlen,
+                           int flags, struct timespec *timeout) {
+    if (vlen > 0) {
+        BeforeReadv(handler_.get(), msgvec[0].msg_hdr.msg_iov,
+                    msgvec[0].msg_hdr.msg_iovlen);
+    }
+    auto ret =
+        CheckConnect(orig_.recvmmsg(fd(), msgvec, vlen, flags, timeout));
+    AfterRecvMMsg(handler_.get(), msgvec, ret);
+    return ret;
+}
+
+bool ClientSocket::BeforeWrite(const struct iovec *iov, int iovcnt) {
+    if (handler_->BeforeWrite(iov, iovcnt) == SocketHandler::Result::Ok) {
+        return true;
+    }
+    // The context the handler sent ahead of the request may have been the
+    // first write after a non-blocking connect
+    CheckConnect(-1);
+    return false;
+}
+
+ssize_t ClientSocket::WriteSpliced(const struct iovec *iov, int iovcnt,
+                                   int flags, const struct msghdr *msg) {
+    HeaderSplicer &splicer = handler_->header_splicer();
+    struct msghdr spliced_msg = {};
+    if (msg) {
+        spliced_msg = *msg;
+    }
+
+    // Writes that only got the header out are retried, because the
+    // application has to see some of its bytes written, or an error
+    ssize_t ret;
+    ssize_t written;
+    do {
+        const auto &spliced = splicer.Splice(iov, iovcnt);
+        spliced_msg.msg_iov = const_cast<struct iovec *>(spliced.data());
+        spliced_msg.msg_iovlen = spliced.size();
+        written = orig_.sendmsg(fd(), &spliced_msg, flags);
+        ret = splicer.Written(written);
+
+        // Ancillary data is only sent once
+        spliced_msg.msg_control = nullptr;
+        spliced_msg.msg_controllen = 0;
+    } while (ret == 0 && written > 0);
+    return ret;
+}
+
 ssize_t ClientSocket::Send(const void *buf, size_t len, int flags) {
-    handler_->BeforeWrite(set_iovec(buf, len), SINGLE_IOVEC);
-    auto ret = orig_.send(fd(), buf, len, flags);
+    if (!BeforeWrite(set_iovec(buf, len), SINGLE_IOVEC)) {
+        return -1;
+    }
+    auto ret = CheckConnect(
+        handler_->header_splicer().active()
+            ? WriteSpliced(set_iovec(buf, len), SINGLE_IOVEC, flags)
+            : orig_.send(fd(), buf, len, flags));
     handler_->AfterWrite(set_iovec(buf, len), SINGLE_IOVEC, ret);
     return ret;
 }
 
 ssize_t ClientSocket::Write(const void *buf, size_t count) {
-    handler_->BeforeWrite(set_iovec(buf, count), SINGLE_IOVEC);
-    auto ret = orig_.write(fd(), buf, count);
+    if (!BeforeWrite(set_iovec(buf, count), SINGLE_IOVEC)) {
+        return -1;
+    }
+    auto ret = CheckConnect(
+        handler_->header_splicer().active()
+            ? WriteSpliced(set_iovec(buf, count), SINGLE_IOVEC, 0)
+            : orig_.write(fd(), buf, count));
     handler_->AfterWrite(set_iovec(buf, count), SINGLE_IOVEC, ret);
     return ret;
 }
 
 ssize_t ClientSocket::Writev(const struct iovec *iov, int iovcnt) {
-    handler_->BeforeWrite(iov, iovcnt);
-    auto ret = orig_.writev(fd(), iov, iovcnt);
+    if (!BeforeWrite(iov, iovcnt)) {
+        return -1;
+    }
+    auto ret = CheckConnect(
+        handler_->header_splicer().active()
+            ? WriteSpliced(iov, iovcnt, 0)
+            : orig_.writev(fd(), iov, iovcnt));
     handler_->AfterWrite(iov, iovcnt, ret);
     return ret;
 }
@@ -67,19 +183,111 @@ ssize_t ClientSocket::Writev(const struct iovec *iov, int iovcnt) {
 ssize_t ClientSocket::SendTo(const void *buf, size_t len, int flags,
                              const struct sockaddr *dest_addr,
                              socklen_t addrlen) {
-    handler_->BeforeWrite(set_iovec(buf, len), SINGLE_IOVEC);
-    auto ret = orig_.sendto(this->fd(), buf, len, flags, dest_addr, addrlen);
+    if (!BeforeWrite(set_iovec(buf, len), SINGLE_IOVEC)) {
+        return -1;
+    }
+    // The destination of connected sockets is ignored
+    auto ret = CheckConnect(
+        handler_->header_splicer().active()
+            ? WriteSpliced(set_iovec(buf, len), SINGLE_IOVEC, flags)
+            : orig_.sendto(this->fd(), buf, len, flags, dest_addr, addrlen));
     handler_->AfterWrite(set_iovec(buf, len), SINGLE_IOVEC, ret);
     return ret;
 }
 
 ssize_t ClientSocket::SendMsg(const struct msghdr *msg, int flags) {
-    handler_->BeforeWrite(msg->msg_iov, msg->msg_iovlen);
-    auto ret = orig_.sendmsg(this->fd(), msg, flags);
+    if (!BeforeWrite(msg->msg_iov, msg->msg_iovlen)) {
+        return -1;
+    }
+    auto ret = CheckConnect(
+        handler_->header_splicer().active()
+            ? WriteSpliced(msg->msg_iov, msg->msg_iovlen, flags, msg)
+            : orig_.sendmsg(this->fd(), msg, flags));
     handler_->AfterWrite(msg->msg_iov, msg->msg_iovlen, ret);
     return ret;
 }
 
+int ClientSocket::SendMMsg(struct mmsghdr *msgvec, unsigned int vlen,
+                           int flags) {
+    if (vlen == 0) {
+        return orig_.sendmmsg(fd(), msgvec, vlen, flags);
+    }
+    struct msghdr &first = msgvec[0].msg_hdr;
+    if (!BeforeWrite(first.msg_iov, first.msg_iovlen)) {
+        return -1;
+    }
+
+    // The header is spliced into the first message, which is sent on its
+    // own. sendmmsg may send fewer messages than it was given, so the
+    // application sends the rest with its next call.
+    if (handler_->header_splicer().active()) {
+        auto ret = CheckConnect(
+            WriteSpliced(first.msg_iov, first.msg_iovlen, flags, &first));
+        handler_->AfterWrite(first.msg_iov, first.msg_iovlen, ret);
+        if (ret < 0) {
+            return ret;
+        }
+        msgvec[0].msg_len = ret;
+        return 1;
+    }
+
+    auto ret = CheckConnect(orig_.sendmmsg(fd(), msgvec, vlen, flags));
+    AfterSendMMsg(handler_.get(), msgvec, ret);
+    return ret;
+}
+
+ssize_t ClientSocket::SendFile(int in_fd, off_t *offset, size_t count) {
+    if (!BeforeWrite(nullptr, 0)) {
+        return -1;
+    }
+    auto ret = CheckConnect(orig_.sendfile(fd(), in_fd, offset, count));
+    handler_->AfterOpaqueWrite(ret);
+    return ret;
+}
+
+ssize_t ClientSocket::SpliceRead(loff_t *off_in, int fd_out, loff_t *off_out,
+                                 size_t len, unsigned int flags) {
+    handler_->BeforeRead(nullptr, len);
+    auto ret = CheckConnect(
+        orig_.splice(fd(), off_in, fd_out, off_out, len, flags));
+    handler_->AfterOpaqueRead(ret);
+    return ret;
+}
+
+ssize_t ClientSocket::SpliceWrite(int fd_in, loff_t *off_in, loff_t *off_out,
+                                  size_t len, unsigned int flags) {
+    if (!BeforeWrite(nullptr, 0)) {
+        return -1;
+    }
+    auto ret = CheckConnect(
+        orig_.splice(fd_in, off_in, fd(), off_out, len, flags));
+    handler_->AfterOpaqueWrite(ret);
+    return ret;
+}
+
+void ClientSocket::SubmitRead(const struct iovec *iov, int iovcnt) {
+    BeforeReadv(handler_.get(), iov, iovcnt);
+}
+
+void ClientSocket::CompleteRead(const struct iovec *iov, int iovcnt,
+                                ssize_t ret) {
+    AfterUringRead(handler_.get(), iov, iovcnt, ret);
+}
+
+void ClientSocket::SubmitWrite(const struct iovec *iov, int iovcnt) {
+    // The write is already in the ring and can't be stopped, which the
+    // handler never does since it writes nothing ahead of it
+    handler_->Uring();
+    const auto result = handler_->BeforeWrite(iov, iovcnt);
+    VERIFY(result == SocketHandler::Result::Ok,
+           "io_uring write was stopped after it was submitted");
+}
+
+void ClientSocket::CompleteWrite(const struct iovec *iov, int iovcnt,
+                                 ssize_t ret) {
+    AfterUringWrite(handler_.get(), iov, iovcnt, ret);
+}
+
 int ClientSocket::Close() {
     handler_->BeforeClose();
     auto ret = orig_.close(this->fd());
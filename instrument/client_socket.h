@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <sys/socket.h>
 #include <functional>
 #include <memory>
@@ -17,12 +18,27 @@ class ClientSocket : public InstrumentedSocket {
                  const OriginalFunctions &orig);
 
     void Async() override;
+    void Rebind(int fd) override;
+    void NonBlocking(const bool non_blocking) override;
+    void Ready() override;
+    void SocketError(const int err) override;
     void Connected(const std::string &ip);
+    void ConnectFailed(const int err);
+
+    /*
+     * Called when connect() returned EINPROGRESS. Its outcome is found with
+     * getsockopt(SO_ERROR), or from the first read or write on the socket.
+     */
+    void ConnectPending() { connect_pending_ = true; }
 
     ssize_t RecvFrom(void *buf, size_t len, int flags,
                      struct sockaddr *src_addr, socklen_t *addrlen) override;
     ssize_t Recv(void *buf, size_t len, int flags) override;
     ssize_t Read(void *buf, size_t count) override;
+    ssize_t Readv(const struct iovec *iov, int iovcnt) override;
+    ssize_t RecvMsg(struct msghdr *msg, int flags) override;
+    int RecvMMsg(struct mmsghdr *msgvec, unsigned int vlen, int flags,
+                 struct timespec *timeout) override;
     ssize_t Write(const void *buf, size_t count) override;
     ssize_t Writev(const struct iovec *iov, int iovcnt) override;
     ssize_t Send(const void *buf, size_t len, int flags) override;
@@ -30,10 +46,59 @@ class ClientSocket : public InstrumentedSocket {
                    const struct sockaddr *dest_addr,
                    socklen_t addrlen) override;
     ssize_t SendMsg(const struct msghdr *msg, int flags) override;
+    int SendMMsg(struct mmsghdr *msgvec, unsigned int vlen,
+                 int flags) override;
+    ssize_t SendFile(int in_fd, off_t *offset, size_t count) override;
+    ssize_t SpliceRead(loff_t *off_in, int fd_out, loff_t *off_out, size_t len,
+                       unsigned int flags) override;
+    ssize_t SpliceWrite(int fd_in, loff_t *off_in, loff_t *off_out, size_t len,
+                        unsigned int flags) override;
+
+    void SubmitRead(const struct iovec *iov, int iovcnt) override;
+    void CompleteRead(const struct iovec *iov, int iovcnt,
+                      ssize_t ret) override;
+    void SubmitWrite(const struct iovec *iov, int iovcnt) override;
+    void CompleteWrite(const struct iovec *iov, int iovcnt,
+                       ssize_t ret) override;
 
     int Close() override;
 
    private:
+    /*
+     * Calls the handler before a write. Returns false if the write has to
+     * fail with the errno the handler left, e.g. because the context
+     * couldn't be sent yet on a non-blocking socket.
+     */
+    bool BeforeWrite(const struct iovec *iov, int iovcnt);
+
+    /*
+     * Returns ret, the result of a read or write, after ending the pending
+     * connect with the error it failed with, if any.
+     */
+    template <typename T>
+    T CheckConnect(const T ret) {
+        if (connect_pending_) {
+            EndConnect(ret == -1 ? errno : 0);
+        }
+        return ret;
+    }
+
+    /*
+     * Logs the failure of the pending connect if err is an error other than
+     * the connect still being in progress. errno is left as it was.
+     */
+    void EndConnect(const int err);
+
+    /*
+     * Writes iov with the header of the handler's splicer spliced into it,
+     * using sendmsg with flags, and the rest of msg if it isn't nullptr.
+     * Returns the number of bytes of iov that have been written.
+     */
+    ssize_t WriteSpliced(const struct iovec *iov, int iovcnt, int flags,
+                         const struct msghdr *msg = nullptr);
+
     std::unique_ptr<ClientSocketHandler> handler_;
+
+    bool connect_pending_ = false;
 };
 }
@@ -1,5 +1,7 @@
 #include "client_socket_handler.h"
 
+#include <errno.h>
+#include <string.h>
 #include <unistd.h>
 #include <chrono>
 #include <iostream>
@@ -12,6 +14,16 @@ namespace microtrace {
 
 ServiceIpMap ClientSocketHandlerImpl::service_map_ = ServiceIpMap{};
 
+/*
+ * Keys are only logged as hashes, and only if MICROTRACE_HASH_CACHE_KEYS is
+ * set, because they may identify users.
+ */
+static bool HashCacheKeys() {
+    static const bool hash_keys =
+        GetEnvLong("MICROTRACE_HASH_CACHE_KEYS", 0) != 0;
+    return hash_keys;
+}
+
 ServiceIpMap::ServiceIpMap() {
     int i = 0;
     std::regex re("(.+)_SERVICE_HOST=(.+)");
@@ -40,20 +52,27 @@ const std::string* ServiceIpMap::Get(const std::string& ip) {
     return &(it->second);
 }
 
-ClientSocketHandlerImpl::ClientSocketHandlerImpl(int sockfd,
-                                                 TraceLogger* trace_logger,
-                                                 const OriginalFunctions& orig)
+ClientSocketHandlerImpl::ClientSocketHandlerImpl(
+    int sockfd, TraceLogger* trace_logger, OverheadBreaker* overhead_breaker,
+    const OriginalFunctions& orig)
     : ClientSocketHandler(sockfd, orig),
-      txn_(nullptr),
       trace_logger_(trace_logger),
-      kubernetes_socket_(false) {
+      overhead_breaker_(overhead_breaker),
+      kubernetes_socket_(false),
+      request_tracker_(HttpTracker::Type::REQUEST),
+      response_tracker_(HttpTracker::Type::RESPONSE),
+      response_started_(false),
+      sessions_(ProtocolSession::Role::CLIENT, {this, this, this}),
+      pending_context_size_(0),
+      pending_context_sent_(0),
+      uring_(false) {
     // We can already set the hostname, it is constant
     conn_.client_hostname = GetHostname();
 }
 
 void ClientSocketHandlerImpl::Async() {
     type_ = SocketType::ASYNC;
-    context_.reset(new Context(get_current_context()));
+    SetContext(get_current_context());
 }
 
 void ClientSocketHandlerImpl::HandleConnect(const std::string& ip) {
@@ -66,6 +85,29 @@ void ClientSocketHandlerImpl::HandleConnect(const std::string& ip) {
     }
 }
 
+void ClientSocketHandlerImpl::HandleConnectError(const int err) {
+    // Only log the failure if it happened as part of a traced request
+    if (is_context_undefined() || !get_current_context().sampled()) {
+        return;
+    }
+
+    SetContext(get_current_context());
+    txns_.clear();
+    StartTxn();
+    InFlightTxn& txn = txns_.back();
+    txn.txn.End();
+
+    RequestLogWrapper log;
+    FillRequestLog(log, txn);
+    log->set_error(true);
+    log->set_info("connect: " + std::string{strerror(err)});
+    trace_logger_->Log(log.get());
+    txns_.clear();
+
+    context_->NewSpan();
+    set_current_context(context());
+}
+
 SocketAction ClientSocketHandlerImpl::get_next_action(
     const SocketOperation op) const {
     if (op == SocketOperation::WRITE) {
@@ -80,50 +122,265 @@ SocketAction ClientSocketHandlerImpl::get_next_action(
     return SocketAction::NONE;
 }
 
-void ClientSocketHandlerImpl::FillRequestLog(RequestLogWrapper& log) {
+void ClientSocketHandlerImpl::FillRequestLog(RequestLogWrapper& log,
+                                             const Context& context,
+                                             const Transaction& txn) {
     proto::Connection* conn = log->mutable_conn();
     conn->set_allocated_server_hostname(&conn_.server_hostname);
     conn->set_allocated_client_hostname(&conn_.client_hostname);
 
     proto::Context* ctx = log->mutable_context();
-    ctx->mutable_trace_id()->set_high(context().trace().high());
-    ctx->mutable_trace_id()->set_low(context().trace().low());
-    ctx->mutable_span_id()->set_high(context().span().high());
-    ctx->mutable_span_id()->set_low(context().span().low());
-    ctx->mutable_parent_span()->set_high(context().parent_span().high());
-    ctx->mutable_parent_span()->set_low(context().parent_span().low());
-
-    if (http_processor_.has_url()) {
-        log->set_info("HTTP: " + http_processor_.url());
-    }
-    log->set_time(txn_->start());
-    log->set_duration(txn_->duration());
+    ctx->mutable_trace_id()->set_high(context.trace().high());
+    ctx->mutable_trace_id()->set_low(context.trace().low());
+    ctx->mutable_span_id()->set_high(context.span().high());
+    ctx->mutable_span_id()->set_low(context.span().low());
+    ctx->mutable_parent_span()->set_high(context.parent_span().high());
+    ctx->mutable_parent_span()->set_low(context.parent_span().low());
+
+    txn.Fill(&log.log);
     log->set_transaction_count(num_transactions_);
     log->set_role(proto::RequestLog::CLIENT);
+    if (context.debug()) {
+        log->set_debug(true);
+    }
+}
+
+void ClientSocketHandlerImpl::FillRequestLog(RequestLogWrapper& log,
+                                             const InFlightTxn& txn) {
+    FillRequestLog(log, txn.context, txn.txn);
+    if (txn.http_processor.has_url()) {
+        log->set_info("HTTP: " + txn.http_processor.method() + " " +
+                      txn.http_processor.url());
+    }
+    if (txn.status_code > 0) {
+        log->set_status_code(txn.status_code);
+        if (txn.status_code >= 500) {
+            log->set_error(true);
+        }
+    }
+}
+
+void ClientSocketHandlerImpl::StartTxn() {
+    // A stuck response would otherwise keep every following request from
+    // being traced
+    if (txns_.full()) {
+        FinishTxn();
+    }
+
+    InFlightTxn& txn = txns_.push();
+    txn.txn.Start();
+    txn.sampled = sampled_;
+    txn.context = context();
+    txn.http_processor = HttpProcessor{};
+    txn.head_request = false;
+    txn.status_code = 0;
+    request_tracker_.Reset();
+}
+
+void ClientSocketHandlerImpl::FinishTxn() {
+    const InFlightTxn& txn = txns_.front();
+    const bool sampled = txn.sampled;
+    if (sampled) {
+        RequestLogWrapper log;
+        FillRequestLog(log, txn);
+        trace_logger_->Log(log.get());
+    }
+    txns_.pop();
+    response_started_ = false;
+
+    // Start new span after we received the response
+    if (sampled) {
+        context_->NewSpan();
+        set_current_context(context());
+    }
+}
+
+void ClientSocketHandlerImpl::FinishAllTxns() {
+    while (!txns_.empty()) {
+        FinishTxn();
+    }
+    sessions_.Close();
+}
+
+void ClientSocketHandlerImpl::StreamStarted(Http2Stream* stream) {
+    stream->sampled = sampled_;
+    stream->context = context();
+    // Every stream gets its own span
+    if (sampled_) {
+        context_->NewSpan();
+    }
+}
+
+void ClientSocketHandlerImpl::StreamCompleted(const Http2Stream& stream) {
+    if (!stream.sampled) {
+        return;
+    }
+
+    RequestLogWrapper log;
+    FillRequestLog(log, stream.context, stream.txn);
+    log->set_info(stream.info());
+    if (stream.status > 0) {
+        log->set_status_code(stream.status);
+    }
+    if (stream.error()) {
+        log->set_error(true);
+    }
+    trace_logger_->Log(log.get());
+}
+
+void ClientSocketHandlerImpl::CallStarted(ThriftCall* call) {
+    call->sampled = sampled_;
+    call->context = context();
+    // Every call gets its own span
+    if (sampled_) {
+        context_->NewSpan();
+    }
+}
+
+void ClientSocketHandlerImpl::CallCompleted(const ThriftCall& call) {
+    if (!call.sampled) {
+        return;
+    }
+
+    RequestLogWrapper log;
+    FillRequestLog(log, call.context, call.txn);
+    log->set_info(call.info());
+    if (call.error) {
+        log->set_error(true);
+    }
+    trace_logger_->Log(log.get());
+}
+
+void ClientSocketHandlerImpl::CommandStarted(CacheCommand* command) {
+    command->sampled = sampled_;
+    command->context = context();
+    // Every command gets its own span
+    if (sampled_) {
+        context_->NewSpan();
+    }
+}
+
+void ClientSocketHandlerImpl::CommandCompleted(const CacheCommand& command) {
+    if (!command.sampled) {
+        return;
+    }
+
+    RequestLogWrapper log;
+    FillRequestLog(log, command.context, command.txn);
+    log->set_info(command.info(HashCacheKeys()));
+    if (command.error) {
+        log->set_error(true);
+    }
+    trace_logger_->Log(log.get());
+}
+
+void ClientSocketHandlerImpl::ProcessRequest(const char* buf, size_t len) {
+    while (len > 0) {
+        // A pipelined request, sent before the previous one was answered
+        if (request_tracker_.complete()) {
+            ++num_transactions_;
+            // It gets its own span in the same trace
+            context_->NewSpan();
+            StartTxn();
+        }
+
+        InFlightTxn& txn = txns_.back();
+        const size_t processed = request_tracker_.Process(buf, len);
+        // Only HTTP requests have a URL
+        if (txn.sampled && sessions_.protocol() == Protocol::HTTP) {
+            txn.http_processor.Process(buf, processed);
+        }
+        txn.head_request = request_tracker_.head_request();
+
+        // Requests of other protocols can't be told apart, they are handled
+        // as a single transaction
+        if (!request_tracker_.valid()) {
+            return;
+        }
+        buf += processed;
+        len -= processed;
+    }
+}
+
+void ClientSocketHandlerImpl::ProcessResponse(const char* buf, size_t len) {
+    while (len > 0 && !txns_.empty()) {
+        InFlightTxn& txn = txns_.front();
+        if (!response_started_) {
+            response_tracker_.Reset(txn.head_request);
+            response_started_ = true;
+        }
+
+        txn.txn.End();
+        const size_t processed = response_tracker_.Process(buf, len);
+        txn.status_code = response_tracker_.status_code();
+
+        // Responses of other protocols end at their first read
+        if (!response_tracker_.valid()) {
+            FinishTxn();
+            return;
+        }
+        if (!response_tracker_.complete()) {
+            return;
+        }
+        FinishTxn();
+        buf += processed;
+        len -= processed;
+    }
+}
+
+void ClientSocketHandlerImpl::SkipResponse(const uint64_t len) {
+    InFlightTxn& txn = txns_.front();
+    if (!response_started_) {
+        response_tracker_.Reset(txn.head_request);
+        response_started_ = true;
+    }
+
+    txn.txn.End();
+    response_tracker_.Skip(len);
+
+    // Responses whose head wasn't seen end at their first read, like the ones
+    // of other protocols
+    if (!response_tracker_.valid() || response_tracker_.complete()) {
+        FinishTxn();
+    }
 }
 
 bool ClientSocketHandlerImpl::SendContextBlocking() {
     // This should succeed at first - the send buffer is empty at this point
-    auto ret =
-        orig_.write(fd(), reinterpret_cast<const void*>(&context().storage()),
-                    sizeof(ContextStorage));
-    VERIFY(ret == sizeof(ContextStorage), "Could not send context in one send");
+    char buf[Context::MAX_WIRE_SIZE];
+    const size_t size = context().Serialize(buf);
+    auto ret = orig_.write(fd(), buf, size);
+    VERIFY(ret == static_cast<ssize_t>(size),
+           "Could not send context in one send");
     return true;
 }
 
-// TODO implement properly
 bool ClientSocketHandlerImpl::SendContextAsync() {
-    auto ret =
-        orig_.write(fd(), reinterpret_cast<const void*>(&context().storage()),
-                    sizeof(ContextStorage));
-    VERIFY(ret == sizeof(ContextStorage),
-           "Context couldn't be sent async in one send");
+    // The context is serialized once, the part that didn't fit into the send
+    // buffer goes out before the request when the write is retried
+    if (pending_context_size_ == 0) {
+        pending_context_size_ = context().Serialize(pending_context_.data());
+        pending_context_sent_ = 0;
+    }
+    while (pending_context_sent_ < pending_context_size_) {
+        auto ret = orig_.write(fd(),
+                               pending_context_.data() + pending_context_sent_,
+                               pending_context_size_ - pending_context_sent_);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        pending_context_sent_ += ret;
+    }
+    pending_context_size_ = 0;
     return true;
 }
 
 bool ClientSocketHandlerImpl::SendContext() {
     bool result;
-    if (type_ == SocketType::BLOCKING) {
+    if (type_ == SocketType::BLOCKING && !non_blocking_) {
         result = SendContextBlocking();
     } else {
         result = SendContextAsync();
@@ -145,13 +402,27 @@ bool ClientSocketHandlerImpl::SendContextIfNecessary() {
     return true;
 }
 
+void ClientSocketHandlerImpl::SpliceContextIfNecessary() {
+    if (is_context_processed() ||
+        get_next_action(SocketOperation::WRITE) != SocketAction::SEND_REQUEST) {
+        return;
+    }
+    // Unsampled requests are passed on without a header, which means the
+    // same to the server
+    if (sampled_ && sessions_.protocol() == Protocol::HTTP) {
+        char header[Traceparent::HEADER_SIZE];
+        const size_t size = Traceparent::Format(context(), header);
+        header_splicer_.Start(header, size);
+    }
+    context_processed_ = true;
+}
+
 SocketHandler::Result ClientSocketHandlerImpl::BeforeWrite(
     const struct iovec* iov, int iovcnt) {
+    OverheadScope overhead{overhead_breaker_};
+
     // New transaction
     if (get_next_action(SocketOperation::WRITE) == SocketAction::SEND_REQUEST) {
-        // Reset HTTP Processor
-        http_processor_ = HttpProcessor{};
-
         // Only copy current context if it is a blocking socket, because the
         // socket might be in a connection pool. Since in threaded servers, one
         // thread handles a single user request, current context is what we
@@ -164,21 +435,47 @@ SocketHandler::Result ClientSocketHandlerImpl::BeforeWrite(
             // In this case we assign a zero context to it, which means it won't
             // be traced.
             if (!is_context_undefined()) {
-                context_.reset(new Context(get_current_context()));
+                SetContext(get_current_context());
             } else {
-                context_ = Context::Zero();
+                SetUnsampledContext();
             }
         }
+
+        // The protocol is detected from the first request
+        if (num_transactions_ == 0 && iovcnt > 0 &&
+            sessions_.protocol() == Protocol::UNKNOWN) {
+            sessions_.Bind(DetectProtocol(
+                static_cast<const char*>(iov[0].iov_base), iov[0].iov_len));
+        }
     }
 
     set_current_context(context());
-    VERIFY(SendContextIfNecessary(), "Could not send context");
+    if (uring_) {
+        // Neither a binary context nor a traceparent header can be added to
+        // the request, the server handles it as unsampled
+        if (get_next_action(SocketOperation::WRITE) ==
+            SocketAction::SEND_REQUEST) {
+            context_processed_ = true;
+        }
+    } else if (GetPropagation() == Propagation::TRACEPARENT) {
+        // The header can't be spliced into data that isn't seen
+        if (iovcnt > 0) {
+            SpliceContextIfNecessary();
+        }
+    } else if (!SendContextIfNecessary()) {
+        // The request isn't written until its context has been, the
+        // application gets the error of the write, EAGAIN if the socket is
+        // full, and retries it
+        return Result::Stop;
+    }
 
     return Result::Ok;
 }
 
 void ClientSocketHandlerImpl::AfterWrite(const struct iovec* iov, int iovcnt,
                                          ssize_t ret) {
+    OverheadScope overhead{overhead_breaker_};
+
     if (ret == -1 || ret == 0) {
         return;
     }
@@ -186,22 +483,45 @@ void ClientSocketHandlerImpl::AfterWrite(const struct iovec* iov, int iovcnt,
     VERIFY(ret > 0, "write invalid return value");
 
     if (get_next_action(SocketOperation::WRITE) == SocketAction::SEND_REQUEST) {
-        txn_.reset(new Transaction);
-        txn_->Start();
         ++num_transactions_;
+        // Unsampled requests are neither timed nor parsed, only their context
+        // is passed on, unless they have to be matched with their response
+        if (!sessions_.bound() && (sampled_ || !txns_.empty())) {
+            StartTxn();
+        }
     }
 
-    // Feed data to http parser
-    for (int i = 0; i < iovcnt; ++i) {
-        http_processor_.Process(
-            static_cast<char*>(iov[i].iov_base),
-            // do not feed data that has not been sent
-            std::min(static_cast<size_t>(ret), iov[i].iov_len));
+    // Feed data that has been sent to the parsers
+    if (sessions_.bound()) {
+        if (iov) {
+            ForEachWritten(iov, iovcnt, ret,
+                           [this](const char* buf, size_t len) {
+                               sessions_.Sent(buf, len);
+                           });
+        } else {
+            sessions_.Skipped();
+        }
+    } else if (!txns_.empty()) {
+        if (iov) {
+            ForEachWritten(iov, iovcnt, ret,
+                           [this](const char* buf, size_t len) {
+                               ProcessRequest(buf, len);
+                           });
+        } else {
+            // Only the body of a request, e.g. an uploaded file, can be sent
+            // without being seen
+            request_tracker_.Skip(ret);
+        }
     }
 
     state_ = SocketState::WROTE;
 }
 
+void ClientSocketHandlerImpl::AfterOpaqueWrite(ssize_t ret) {
+    // The After handlers tell data that wasn't seen by its null buffer
+    AfterWrite(nullptr, 0, ret);
+}
+
 SocketHandler::Result ClientSocketHandlerImpl::BeforeRead(const void* buf,
                                                           size_t len) {
     LOG_ERROR_IF(
@@ -213,10 +533,13 @@ SocketHandler::Result ClientSocketHandlerImpl::BeforeRead(const void* buf,
 
 void ClientSocketHandlerImpl::AfterRead(const void* buf, size_t len,
                                         ssize_t ret) {
+    OverheadScope overhead{overhead_breaker_};
+
     set_current_context(context());
 
     if (ret == 0) {
-        // peer shutdown
+        // peer shutdown, which ends responses without framing
+        FinishAllTxns();
         return;
     }
     if (ret == -1) {
@@ -225,20 +548,20 @@ void ClientSocketHandlerImpl::AfterRead(const void* buf, size_t len,
 
     VERIFY(ret > 0, "read invalid return value");
 
-    // New incoming response
-    if (get_next_action(SocketOperation::READ) == SocketAction::RECV_RESPONSE) {
-        txn_->End();
-        // Log request only if we are not in an empty context, which indicates
-        // that this request shouldn't be traced
-        if (!context().is_zero()) {
-            RequestLogWrapper log;
-            FillRequestLog(log);
-            trace_logger_->Log(log.get());
+    // Unsampled requests have no transaction or spans, their context is
+    // already current
+    if (sessions_.bound()) {
+        if (buf) {
+            sessions_.Received(static_cast<const char*>(buf), ret);
+        } else {
+            sessions_.Skipped();
+        }
+    } else if (!txns_.empty()) {
+        if (buf) {
+            ProcessResponse(static_cast<const char*>(buf), ret);
+        } else {
+            SkipResponse(ret);
         }
-
-        // Start new span after we started recieving the response
-        context_->NewSpan();
-        set_current_context(context());
     }
 
     // After a read is successfully executed, we set context_processed to
@@ -248,7 +571,13 @@ void ClientSocketHandlerImpl::AfterRead(const void* buf, size_t len,
     state_ = SocketState::READ;
 }
 
+void ClientSocketHandlerImpl::AfterOpaqueRead(ssize_t ret) {
+    // The After handlers tell data that wasn't seen by its null buffer
+    AfterRead(nullptr, 0, ret);
+}
+
 SocketHandler::Result ClientSocketHandlerImpl::BeforeClose() {
+    FinishAllTxns();
     return Result::Ok;
 }
 
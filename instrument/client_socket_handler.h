@@ -1,8 +1,13 @@
 #pragma once
 
 #include "http_processor.h"
+#include "http_tracker.h"
+#include "overhead_breaker.h"
+#include "protocol_session.h"
 #include "socket_handler.h"
 #include "trace_logger.h"
+#include "traceparent.h"
+#include "txn_queue.h"
 
 namespace microtrace {
 
@@ -32,16 +37,40 @@ class ClientSocketHandler : public AbstractSocketHandler {
         : AbstractSocketHandler(sockfd, SocketState::WILL_WRITE, orig) {}
 
     virtual void HandleConnect(const std::string& ip) = 0;
+
+    /*
+     * Called when connect() failed with err.
+     */
+    virtual void HandleConnectError(const int err) = 0;
+
     virtual bool has_txn() const = 0;
+
+    /*
+     * Returns the splicer of headers into the requests being written, which
+     * the socket has to apply to its writes while it is active.
+     */
+    virtual HeaderSplicer& header_splicer() = 0;
+
+    /*
+     * Called before a write that was submitted to io_uring. The kernel writes
+     * requests as they were submitted, so no context is passed on with them.
+     */
+    virtual void Uring() = 0;
 };
 
-class ClientSocketHandlerImpl : public ClientSocketHandler {
+class ClientSocketHandlerImpl : public ClientSocketHandler,
+                                private Http2Session::Observer,
+                                private ThriftSession::Observer,
+                                private CacheObserver {
    public:
     ClientSocketHandlerImpl(int sockfd, TraceLogger* trace_logger,
+                            OverheadBreaker* overhead_breaker,
                             const OriginalFunctions& orig);
 
     virtual void Async() override;
+    void Uring() override { uring_ = true; }
     void HandleConnect(const std::string& ip) override;
+    void HandleConnectError(const int err) override;
 
     virtual Result BeforeRead(const void* buf, size_t len) override;
     virtual void AfterRead(const void* buf, size_t len, ssize_t ret) override;
@@ -50,15 +79,50 @@ class ClientSocketHandlerImpl : public ClientSocketHandler {
     virtual void AfterWrite(const struct iovec* iov, int iovcnt,
                             ssize_t ret) override;
 
+    virtual void AfterOpaqueRead(ssize_t ret) override;
+    virtual void AfterOpaqueWrite(ssize_t ret) override;
+
     virtual Result BeforeClose() override;
     virtual void AfterClose(int ret) override;
 
     virtual SocketAction get_next_action(
         const SocketOperation op) const override;
 
-    bool has_txn() const override { return static_cast<bool>(txn_); }
+    bool has_txn() const override { return !txns_.empty(); }
+
+    HeaderSplicer& header_splicer() override { return header_splicer_; }
 
    private:
+    /*
+     * A request that has been sent, and whose response hasn't been fully
+     * received yet.
+     */
+    struct InFlightTxn {
+        Transaction txn;
+
+        /*
+         * Unsampled requests are only kept in the queue while other requests
+         * are in flight, so that responses are matched to the right request.
+         */
+        bool sampled = false;
+
+        /*
+         * The context of the request, starts from zero because the default
+         * constructor would generate random uuids.
+         */
+        Context context{ContextStorage::Zero(), 0};
+
+        HttpProcessor http_processor;
+        bool head_request = false;
+        int status_code = 0;
+    };
+
+    /*
+     * Maximum number of pipelined requests that can be in flight, the oldest
+     * one is logged early if a new one doesn't fit.
+     */
+    static const size_t MAX_IN_FLIGHT = 8;
+
     int SetConnection();
 
     /*
@@ -69,6 +133,11 @@ class ClientSocketHandlerImpl : public ClientSocketHandler {
     bool SendContext();
 
     bool SendContextBlocking();
+
+    /*
+     * Sends as much of the context as the non-blocking socket takes, returns
+     * false with errno set if some of it is still pending.
+     */
     bool SendContextAsync();
 
     /*
@@ -79,7 +148,60 @@ class ClientSocketHandlerImpl : public ClientSocketHandler {
      */
     bool SendContextIfNecessary();
 
-    void FillRequestLog(RequestLogWrapper& log);
+    /*
+     * Splices the traceparent header into the request if it is the beginning
+     * of a new sampled HTTP request.
+     */
+    void SpliceContextIfNecessary();
+
+    void FillRequestLog(RequestLogWrapper& log, const Context& context,
+                        const Transaction& txn);
+    void FillRequestLog(RequestLogWrapper& log, const InFlightTxn& txn);
+
+    /*
+     * Adds a transaction for the request that is being sent.
+     */
+    void StartTxn();
+
+    /*
+     * Removes the oldest transaction once its response has been received, logs
+     * it if it is sampled, and starts a new span for the operations that
+     * follow it.
+     */
+    void FinishTxn();
+
+    /*
+     * Finishes every transaction that is still in flight, called when the
+     * connection ends.
+     */
+    void FinishAllTxns();
+
+    void StreamStarted(Http2Stream* stream) override;
+    void StreamCompleted(const Http2Stream& stream) override;
+
+    void CallStarted(ThriftCall* call) override;
+    void CallCompleted(const ThriftCall& call) override;
+
+    void CommandStarted(CacheCommand* command) override;
+    void CommandCompleted(const CacheCommand& command) override;
+
+    /*
+     * Follows the requests being sent. Every request that follows a complete
+     * one without waiting for its response gets a transaction of its own.
+     */
+    void ProcessRequest(const char* buf, size_t len);
+
+    /*
+     * Follows the responses being received, and finishes the transaction of
+     * every response that completes.
+     */
+    void ProcessResponse(const char* buf, size_t len);
+
+    /*
+     * Follows the response being received when len bytes of it couldn't be
+     * seen.
+     */
+    void SkipResponse(const uint64_t len);
 
     /*
      * The connection this socket represents. Remains the same throughout
@@ -96,18 +218,59 @@ class ClientSocketHandlerImpl : public ClientSocketHandler {
     static ServiceIpMap service_map_;
 
     /*
-     * Represents the current transaction that is going through this socket.
-     * It is initially empty.
+     * The transactions going through this socket whose response hasn't been
+     * received yet, there can be more than one if requests are pipelined.
      */
-    std::unique_ptr<Transaction> txn_;
+    TxnQueue<InFlightTxn, MAX_IN_FLIGHT> txns_;
 
     TraceLogger* const trace_logger_;
 
+    /*
+     * Measures the time spent in the handler.
+     */
+    OverheadBreaker* const overhead_breaker_;
+
     /*
      * Indicates if this socket is connected to another pod in Kubernetes.
      */
     bool kubernetes_socket_;
 
-    HttpProcessor http_processor_;
+    /*
+     * Follow the request being sent and the response being received, so every
+     * transaction ends when the last byte of its response has been read.
+     */
+    HttpTracker request_tracker_;
+    HttpTracker response_tracker_;
+
+    /*
+     * Indicates if response_tracker_ has been reset for the response of the
+     * oldest transaction.
+     */
+    bool response_started_;
+
+    /*
+     * Follows the requests instead of txns_ if the protocol of the connection
+     * has a session of its own, e.g. HTTP/2 or Redis.
+     */
+    ProtocolSession sessions_;
+
+    /*
+     * Passes the context on in the traceparent header of HTTP requests, if
+     * the traceparent propagation is used.
+     */
+    HeaderSplicer header_splicer_;
+
+    /*
+     * The serialized context that is being sent on a non-blocking socket,
+     * and how much of it has been written. The size is 0 if none is pending.
+     */
+    std::array<char, Context::MAX_WIRE_SIZE> pending_context_;
+    size_t pending_context_size_;
+    size_t pending_context_sent_;
+
+    /*
+     * The socket is written through io_uring.
+     */
+    bool uring_;
 };
 }
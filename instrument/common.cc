@@ -1,6 +1,7 @@
 #include "common.h"
 
 #include <netinet/in.h>
+#include <cstdlib>
 
 namespace microtrace {
 
@@ -32,4 +33,26 @@ std::string GetHostname() {
     VERIFY(gethostname(&hostname_buf[0], 400) == 0, "gethostname unsuccessful");
     return std::string{&hostname_buf[0], strlen(&hostname_buf[0])};
 }
+
+long GetEnvLong(const char* name, const long default_value) {
+    const char* value = std::getenv(name);
+    if (value == nullptr) {
+        return default_value;
+    }
+    char* end;
+    const long result = std::strtol(value, &end, 10);
+    VERIFY(end != value && *end == '\0', "invalid {} env {}", name, value);
+    return result;
+}
+
+double GetEnvDouble(const char* name, const double default_value) {
+    const char* value = std::getenv(name);
+    if (value == nullptr) {
+        return default_value;
+    }
+    char* end;
+    const double result = std::strtod(value, &end);
+    VERIFY(end != value && *end == '\0', "invalid {} env {}", name, value);
+    return result;
+}
 }
@@ -55,4 +55,11 @@ inline char* string_arr(std::string& str) { return &str[0]; }
 
 unsigned short get_port(const struct sockaddr* sa);
 bool is_localhost(const struct sockaddr* sa);
+
+/*
+ * Returns the value of the given environment variable, or default_value if it
+ * is not set.
+ */
+long GetEnvLong(const char* name, const long default_value);
+double GetEnvDouble(const char* name, const double default_value);
 }
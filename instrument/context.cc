@@ -1,6 +1,7 @@
 #include "context.h"
 
 #include <assert.h>
+#include <string.h>
 #include <bitset>
 #include <iostream>
 #include <string>
@@ -26,15 +27,20 @@ void set_current_context(const Context& context) {
     current_context = context;
 }
 
+void reset_current_context() { context_undefined = true; }
+
 bool is_context_undefined() { return context_undefined; }
 
-static boost::uuids::uuid new_boost_uuid() {
-    static thread_local boost::uuids::random_generator gen;
-    return gen();
-}
+static thread_local boost::uuids::random_generator uuid_generator;
+
+static boost::uuids::uuid new_boost_uuid() { return uuid_generator(); }
+
+void reseed_uuids() { uuid_generator = boost::uuids::random_generator(); }
 
 Uuid Uuid::Zero() { return Uuid{0, 0}; }
 
+Uuid Uuid::FromParts(uint64_t high, uint64_t low) { return Uuid{high, low}; }
+
 Uuid::Uuid() : high_(0), low_(0) {
     const auto uuid = new_boost_uuid();
     const int byte_size = 8;  // in bits
@@ -61,9 +67,29 @@ bool operator==(const Uuid& a, const Uuid& b) {
 
 bool operator!=(const Uuid& a, const Uuid& b) { return !operator==(a, b); }
 
-Context::Context() {}
+Context::Context() : flags_(SAMPLED_FLAG) {}
+
+Context::Context(ContextStorage ctx, const uint8_t flags)
+    : context_(std::move(ctx)), flags_(flags) {}
 
-Context::Context(ContextStorage ctx) : context_(std::move(ctx)) {}
+Context Context::Deserialize(const char* buf) {
+    const uint8_t flags = static_cast<uint8_t>(buf[0]) & ~WIRE_MARKER;
+    // Start from zero, the default constructor would generate random uuids
+    ContextStorage storage = ContextStorage::Zero();
+    if (flags & SAMPLED_FLAG) {
+        memcpy(&storage, buf + FLAGS_WIRE_SIZE, sizeof(ContextStorage));
+    }
+    return Context{storage, flags};
+}
+
+size_t Context::Serialize(char* buf) const {
+    buf[0] = static_cast<char>(WIRE_MARKER | flags_);
+    if (!sampled()) {
+        return FLAGS_WIRE_SIZE;
+    }
+    memcpy(buf + FLAGS_WIRE_SIZE, &context_, sizeof(ContextStorage));
+    return MAX_WIRE_SIZE;
+}
 
 void Context::NewSpan() {
     // Only generate new uuids if the context is not empty, otherwise it is
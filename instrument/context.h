@@ -17,6 +17,11 @@ class Uuid {
    public:
     static Uuid Zero();
 
+    /*
+     * Returns the Uuid with the given upper and lower 64 bits.
+     */
+    static Uuid FromParts(uint64_t high, uint64_t low);
+
     Uuid();
 
     uint64_t high() const { return high_; }
@@ -38,6 +43,16 @@ class Uuid {
 bool operator==(const Uuid& a, const Uuid& b);
 bool operator!=(const Uuid& a, const Uuid& b);
 
+/*
+ * Hash function for using Uuids as keys in unordered containers. Uuids are
+ * random, so there is no need for anything sophisticated.
+ */
+struct UuidHash {
+    size_t operator()(const Uuid& uuid) const {
+        return uuid.high() ^ (uuid.low() * 0x9e3779b97f4a7c15ULL);
+    }
+};
+
 typedef Uuid uuid_t;
 
 /*
@@ -72,24 +87,95 @@ struct ContextStorage {
 static_assert(sizeof(ContextStorage) == sizeof(uint64_t) * 2 * 3,
               "ContextStorage must be POD");
 
+/*
+ * Contexts are sent over the wire as a single flags byte, followed by the
+ * ContextStorage only if the SAMPLED flag is set. This way unsampled requests
+ * only cost a single byte to propagate. The flags byte carries WIRE_MARKER in
+ * its high bits, so that a server can tell a context from the start of a
+ * request that was pipelined without one.
+ */
 class Context {
    public:
     /*
-     * Returns a context that has zero in all its values
+     * The trace is recorded.
+     */
+    static constexpr uint8_t SAMPLED_FLAG = 1 << 0;
+
+    /*
+     * The trace was marked for debugging by the frontend, see Debug(). It is
+     * passed on unchanged to every service the request reaches through binary
+     * propagation, the traceparent header has no room for it.
+     */
+    static constexpr uint8_t DEBUG_FLAG = 1 << 1;
+
+    /*
+     * Set in the flags byte on the wire. None of the followed protocols starts
+     * a request with such a byte: HTTP and text protocols are ASCII, Thrift
+     * starts with 0x00 or 0x80 and above, HTTP/2 with its 'P' preface.
+     */
+    static constexpr uint8_t WIRE_MARKER = 0xc0;
+
+    static constexpr size_t FLAGS_WIRE_SIZE = sizeof(uint8_t);
+
+    /*
+     * Size of a sampled context on the wire, which is the largest possible.
+     */
+    static constexpr size_t MAX_WIRE_SIZE =
+        FLAGS_WIRE_SIZE + sizeof(ContextStorage);
+
+    /*
+     * Returns a context that has zero in all its values, and isn't sampled.
      */
     static std::unique_ptr<Context> Zero() {
-        return std::make_unique<Context>(ContextStorage::Zero());
+        return std::make_unique<Context>(ContextStorage::Zero(), 0);
+    }
+
+    /*
+     * Generates a random context that is marked for debugging. Debug traces
+     * are sampled regardless of the sampler, and kept by tail sampling.
+     */
+    static Context Debug() {
+        Context context;
+        context.flags_ |= DEBUG_FLAG;
+        return context;
+    }
+
+    /*
+     * Returns true if b is the flags byte of a context on the wire.
+     */
+    static bool IsWireFlags(const uint8_t b) {
+        return (b & WIRE_MARKER) == WIRE_MARKER &&
+               (b & ~(WIRE_MARKER | SAMPLED_FLAG | DEBUG_FLAG)) == 0;
+    }
+
+    /*
+     * Returns the size of a context on the wire whose flags byte is flags.
+     */
+    static size_t WireSize(const uint8_t flags) {
+        return (flags & SAMPLED_FLAG) ? MAX_WIRE_SIZE : FLAGS_WIRE_SIZE;
     }
 
     /*
-     * Generates a random context.
+     * Decodes a context from the wire format, buf must contain at least
+     * WireSize(buf[0]) bytes.
+     */
+    static Context Deserialize(const char* buf);
+
+    /*
+     * Generates a random, sampled context.
      */
     Context();
 
     /*
      * Returns a context filled with the values of ctx.
      */
-    Context(ContextStorage ctx);
+    Context(ContextStorage ctx, const uint8_t flags = SAMPLED_FLAG);
+
+    /*
+     * Writes the wire format of this context to buf, which must have room
+     * for MAX_WIRE_SIZE bytes. Returns the number of bytes written.
+     */
+    size_t Serialize(char* buf) const;
 
     static bool IsSameTrace(const Context& a, const Context& b) {
         return a.trace() == b.trace();
@@ -119,8 +205,13 @@ class Context {
 
     const ContextStorage& storage() const { return context_; }
 
+    uint8_t flags() const { return flags_; }
+    bool sampled() const { return flags_ & SAMPLED_FLAG; }
+    bool debug() const { return flags_ & DEBUG_FLAG; }
+
    private:
     ContextStorage context_;
+    uint8_t flags_;
 };
 
 bool operator==(const Context& a, const Context& b);
@@ -137,8 +228,20 @@ const Context& get_current_context();
  */
 void set_current_context(const Context& context);
 
+/*
+ * Makes the current context undefined again.
+ */
+void reset_current_context();
+
 /*
  * Returns true if the current context is not defined.
  */
 bool is_context_undefined();
+
+/*
+ * Makes the calling thread's generator of uuids pick a new seed. A child of
+ * fork starts with a copy of it, and would generate the ids of its parent
+ * otherwise.
+ */
+void reseed_uuids();
 }
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+namespace microtrace {
+
+/*
+ * EpollRegistry remembers which fd the events registered with an epoll
+ * instance belong to, because the events returned by epoll_wait only carry
+ * the data of the application.
+ *
+ * Registrations of fds that are closed without EPOLL_CTL_DEL stay until the
+ * data is registered again, or the epoll instance is closed. Lookups of them
+ * may return an fd that has been reused since.
+ */
+class EpollRegistry {
+   public:
+    EpollRegistry() : size_(0) {}
+
+    EpollRegistry(const EpollRegistry&) = delete;
+
+    /*
+     * Registers fd with data, for EPOLL_CTL_ADD and EPOLL_CTL_MOD.
+     */
+    void Add(const int epfd, const int fd, const uint64_t data) {
+        std::lock_guard<std::mutex> l(mu_);
+        auto& epoll = epolls_[epfd];
+        auto it = epoll.data.find(fd);
+        if (it != epoll.data.end()) {
+            epoll.fds.erase(it->second);
+        }
+        epoll.data[fd] = data;
+        epoll.fds[data] = fd;
+        size_.store(epolls_.size(), std::memory_order_relaxed);
+    }
+
+    /*
+     * Removes the registration of fd, for EPOLL_CTL_DEL.
+     */
+    void Delete(const int epfd, const int fd) {
+        std::lock_guard<std::mutex> l(mu_);
+        auto epoll = epolls_.find(epfd);
+        if (epoll == epolls_.end()) {
+            return;
+        }
+        auto it = epoll->second.data.find(fd);
+        if (it != epoll->second.data.end()) {
+            epoll->second.fds.erase(it->second);
+            epoll->second.data.erase(it);
+        }
+    }
+
+    /*
+     * Returns the fd registered with data, or -1 if there is none.
+     */
+    int Find(const int epfd, const uint64_t data) const {
+        if (empty()) {
+            return -1;
+        }
+        std::lock_guard<std::mutex> l(mu_);
+        auto epoll = epolls_.find(epfd);
+        if (epoll == epolls_.end()) {
+            return -1;
+        }
+        auto it = epoll->second.fds.find(data);
+        return it == epoll->second.fds.end() ? -1 : it->second;
+    }
+
+    /*
+     * Forgets every registration of epfd, called when a fd is closed. It
+     * doesn't lock while no epoll instance has registrations.
+     */
+    void Close(const int epfd) {
+        if (empty()) {
+            return;
+        }
+        std::lock_guard<std::mutex> l(mu_);
+        epolls_.erase(epfd);
+        size_.store(epolls_.size(), std::memory_order_relaxed);
+    }
+
+    bool empty() const { return size_.load(std::memory_order_relaxed) == 0; }
+
+    /*
+     * Called before fork, it holds the lock until AfterFork is called in the
+     * parent and in the child. The child keeps the registrations, since it
+     * inherits the epoll instances.
+     */
+    void PrepareFork() { mu_.lock(); }
+
+    void AfterFork() { mu_.unlock(); }
+
+   private:
+    struct Epoll {
+        std::unordered_map<uint64_t, int> fds;
+        std::unordered_map<int, uint64_t> data;
+    };
+
+    // Guards epolls_
+    mutable std::mutex mu_;
+
+    std::unordered_map<int, Epoll> epolls_;
+
+    /*
+     * The number of epoll instances in epolls_.
+     */
+    std::atomic<size_t> size_;
+};
+}
@@ -0,0 +1,82 @@
+#include "export_queue.h"
+
+#include "common.h"
+
+namespace microtrace {
+
+ExportQueue::Options ExportQueue::DefaultOptions() {
+    Options options;
+    options.express_budget = GetEnvLong("MICROTRACE_EXPRESS_BUDGET", 2000);
+    options.normal_budget = GetEnvLong("MICROTRACE_NORMAL_BUDGET", 10000);
+    options.batch_size = GetEnvLong("MICROTRACE_EXPORT_BATCH", 200);
+    options.slow_span_ms = GetEnvDouble("MICROTRACE_SLOW_SPAN_MS", 500);
+    return options;
+}
+
+ExportQueue::ExportQueue(const Options& options) : options_(options) {
+    VERIFY(options_.batch_size > 0, "export batch size must be positive");
+}
+
+Lane ExportQueue::Classify(const proto::RequestLog& log) const {
+    if (log.error() || log.duration() >= options_.slow_span_ms) {
+        return Lane::EXPRESS;
+    }
+    return Lane::NORMAL;
+}
+
+bool ExportQueue::Push(const Lane lane, std::string span) {
+    auto& spans = lane_spans(lane);
+    auto& stats = lane_stats(lane);
+    const size_t budget = lane == Lane::EXPRESS ? options_.express_budget
+                                                : options_.normal_budget;
+
+    if (budget == 0) {
+        ++stats.dropped;
+        return false;
+    }
+    if (spans.size() >= budget) {
+        spans.pop_front();
+        ++stats.dropped;
+    }
+    spans.push_back(std::move(span));
+    ++stats.queued;
+
+    return ready();
+}
+
+size_t ExportQueue::TakeBatch(std::vector<std::string>* batch) {
+    size_t express_count = 0;
+    while (batch->size() < options_.batch_size && !express_.empty()) {
+        batch->push_back(std::move(express_.front()));
+        express_.pop_front();
+        ++express_count;
+    }
+    while (batch->size() < options_.batch_size && !normal_.empty()) {
+        batch->push_back(std::move(normal_.front()));
+        normal_.pop_front();
+    }
+    return express_count;
+}
+
+void ExportQueue::Exported(const size_t express_count,
+                           const size_t normal_count) {
+    express_stats_.exported += express_count;
+    normal_stats_.exported += normal_count;
+}
+
+void ExportQueue::PutBack(std::vector<std::string>* batch,
+                          const size_t express_count) {
+    VERIFY(express_count <= batch->size(), "invalid express count");
+    normal_stats_.dropped += batch->size() - express_count;
+
+    // Iterate backwards so the original order is kept
+    for (size_t i = express_count; i > 0; --i) {
+        if (express_.size() >= options_.express_budget) {
+            ++express_stats_.dropped;
+        } else {
+            express_.push_front(std::move((*batch)[i - 1]));
+        }
+    }
+    batch->clear();
+}
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "request_log.pb.h"
+
+namespace microtrace {
+
+/*
+ * Spans are exported through lanes. Spans that are slow or that finished with
+ * an error go through the EXPRESS lane, everything else goes through the
+ * NORMAL lane.
+ */
+enum class Lane { EXPRESS, NORMAL };
+
+struct LaneStats {
+    /*
+     * Number of spans that were accepted by the lane.
+     */
+    std::atomic<uint64_t> queued{0};
+
+    /*
+     * Number of spans that were handed over to the exporter.
+     */
+    std::atomic<uint64_t> exported{0};
+
+    /*
+     * Number of spans that were discarded because the lane was over its
+     * budget.
+     */
+    std::atomic<uint64_t> dropped{0};
+};
+
+/*
+ * ExportQueue holds serialized spans waiting to be exported.
+ *
+ * Every lane has its own budget, so a flood of ordinary spans can never push
+ * out slow or failed ones. When a batch is taken, the EXPRESS lane is always
+ * drained first.
+ *
+ * It is not thread-safe, access must be synchronized by the caller.
+ */
+class ExportQueue {
+   public:
+    struct Options {
+        /*
+         * Maximum number of spans that can wait in each lane.
+         */
+        size_t express_budget;
+        size_t normal_budget;
+
+        /*
+         * Maximum number of spans handed out in a single batch.
+         */
+        size_t batch_size;
+
+        /*
+         * Spans taking at least this long are considered slow.
+         */
+        double slow_span_ms;
+    };
+
+    /*
+     * Returns the options set through the environment.
+     */
+    static Options DefaultOptions();
+
+    ExportQueue(const Options& options);
+
+    Lane Classify(const proto::RequestLog& log) const;
+
+    /*
+     * Adds span to lane. If the lane is full, the oldest span in it is
+     * dropped.
+     *
+     * Returns true if the exporter should flush without waiting for a full
+     * batch.
+     */
+    bool Push(const Lane lane, std::string span);
+
+    /*
+     * Moves at most batch_size spans into batch, starting with the EXPRESS
+     * lane. Returns the number of EXPRESS spans that were taken, they are
+     * always at the front of batch.
+     */
+    size_t TakeBatch(std::vector<std::string>* batch);
+
+    /*
+     * Records that a batch returned by TakeBatch has been exported.
+     */
+    void Exported(const size_t express_count, const size_t normal_count);
+
+    /*
+     * Puts a batch returned by TakeBatch that couldn't be exported back to the
+     * front of the EXPRESS lane. Only EXPRESS spans are put back, NORMAL spans
+     * are dropped.
+     */
+    void PutBack(std::vector<std::string>* batch, const size_t express_count);
+
+    /*
+     * Discards the spans that are waiting without counting them as dropped,
+     * e.g. in a child of fork, whose parent exports them.
+     */
+    void Clear() {
+        express_.clear();
+        normal_.clear();
+    }
+
+    /*
+     * Returns true if there are enough spans waiting to fill a batch, or if an
+     * EXPRESS span is waiting.
+     */
+    bool ready() const {
+        return !express_.empty() || normal_.size() >= options_.batch_size;
+    }
+
+    bool empty() const { return express_.empty() && normal_.empty(); }
+
+    size_t size(const Lane lane) const { return lane_spans(lane).size(); }
+
+    const LaneStats& stats(const Lane lane) const {
+        return lane == Lane::EXPRESS ? express_stats_ : normal_stats_;
+    }
+
+   private:
+    std::deque<std::string>& lane_spans(const Lane lane) {
+        return lane == Lane::EXPRESS ? express_ : normal_;
+    }
+    const std::deque<std::string>& lane_spans(const Lane lane) const {
+        return lane == Lane::EXPRESS ? express_ : normal_;
+    }
+    LaneStats& lane_stats(const Lane lane) {
+        return lane == Lane::EXPRESS ? express_stats_ : normal_stats_;
+    }
+
+    const Options options_;
+
+    std::deque<std::string> express_;
+    std::deque<std::string> normal_;
+
+    LaneStats express_stats_;
+    LaneStats normal_stats_;
+};
+}
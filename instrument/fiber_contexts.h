@@ -0,0 +1,177 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+
+#include "common.h"
+#include "context.h"
+
+namespace microtrace {
+
+/*
+ * FiberContexts keeps the current context of the fibers that are suspended,
+ * e.g. ucontexts, greenlets or coroutines that share an OS thread, so that
+ * each of them resumes with its own.
+ *
+ * Fibers are identified by any pointer that their runtime switches with. Only
+ * suspended fibers are kept, in a table of slots that is allocated once and
+ * isn't locked, so that a switch doesn't block other threads or allocate.
+ * A fiber takes the first free slot of the few that its pointer hashes to,
+ * its context is dropped if none is free.
+ *
+ * The slot of a fiber is claimed and released atomically. Its context is
+ * only written on suspend and read on resume, which the runtime of the fiber
+ * already orders, even if it is resumed by another thread.
+ */
+class FiberContexts {
+   public:
+    FiberContexts() : slots_(Allocate()) {}
+
+    // The slots are trivially destructible
+    ~FiberContexts() { free(slots_); }
+
+    FiberContexts(const FiberContexts&) = delete;
+
+    /*
+     * Saves the current context as the one of fiber, which is being suspended
+     * or has just been created.
+     */
+    void Suspend(const void* fiber) {
+        Slot* slot = Find(fiber);
+        if (slot == nullptr && (slot = Claim(fiber)) == nullptr) {
+            return;
+        }
+        slot->defined = !is_context_undefined();
+        if (slot->defined) {
+            const Context& context = get_current_context();
+            slot->storage = context.storage();
+            slot->flags = context.flags();
+        }
+    }
+
+    /*
+     * Makes the context of fiber, which is being resumed, current. It is
+     * undefined if fiber was suspended without one. A fiber that was never
+     * suspended is new, it keeps the current context if inherit is set, like
+     * a new thread, and starts without one otherwise.
+     */
+    void Resume(const void* fiber, const bool inherit = false) {
+        Slot* slot = Find(fiber);
+        if (slot == nullptr) {
+            if (!inherit) {
+                reset_current_context();
+            }
+            return;
+        }
+        if (slot->defined) {
+            set_current_context(Context{slot->storage, slot->flags});
+        } else {
+            reset_current_context();
+        }
+        Release(slot);
+    }
+
+    /*
+     * Switches from the running fiber to another one, see Resume.
+     */
+    void Switch(const void* from, const void* to, const bool inherit = false) {
+        Suspend(from);
+        Resume(to, inherit);
+    }
+
+    /*
+     * Forgets fiber, which won't be resumed again.
+     */
+    void Exit(const void* fiber) {
+        if (Slot* slot = Find(fiber)) {
+            Release(slot);
+        }
+    }
+
+    size_t size() const {
+        size_t size = 0;
+        for (size_t i = 0; i < CAPACITY; ++i) {
+            size += slots_[i].fiber.load(std::memory_order_relaxed) != nullptr;
+        }
+        return size;
+    }
+
+   private:
+    /*
+     * The number of slots, and how many of them a fiber may take.
+     */
+    static constexpr size_t CAPACITY = 1 << 14;
+    static constexpr size_t PROBES = 16;
+
+    /*
+     * A fiber and its context, null if the slot is free. The context is
+     * stored as its values, Context generates random ids when constructed.
+     */
+    struct alignas(64) Slot {
+        std::atomic<const void*> fiber;
+        ContextStorage storage;
+        uint8_t flags;
+        bool defined;
+    };
+
+    /*
+     * Returns the free slots of a table. Slots are aligned to cache lines,
+     * which new doesn't guarantee before C++17.
+     */
+    static Slot* Allocate() {
+        void* memory = nullptr;
+        VERIFY(posix_memalign(&memory, alignof(Slot),
+                              CAPACITY * sizeof(Slot)) == 0,
+               "could not allocate fiber contexts");
+        Slot* slots = static_cast<Slot*>(memory);
+        for (size_t i = 0; i < CAPACITY; ++i) {
+            new (&slots[i]) Slot();
+        }
+        return slots;
+    }
+
+    static size_t Hash(const void* fiber) {
+        // Fibers are aligned, the low bits of their pointers are the same
+        const uint64_t p = reinterpret_cast<uintptr_t>(fiber) >> 4;
+        return (p * 0x9e3779b97f4a7c15) >> (64 - 14);
+    }
+
+    Slot* Find(const void* fiber) const {
+        const size_t start = Hash(fiber);
+        for (size_t i = 0; i < PROBES; ++i) {
+            Slot* slot = &slots_[(start + i) % CAPACITY];
+            if (slot->fiber.load(std::memory_order_acquire) == fiber) {
+                return slot;
+            }
+        }
+        return nullptr;
+    }
+
+    /*
+     * Returns a free slot that now belongs to fiber, null if there is none.
+     */
+    Slot* Claim(const void* fiber) {
+        const size_t start = Hash(fiber);
+        for (size_t i = 0; i < PROBES; ++i) {
+            Slot* slot = &slots_[(start + i) % CAPACITY];
+            const void* expected = nullptr;
+            if (slot->fiber.compare_exchange_strong(
+                    expected, fiber, std::memory_order_acq_rel)) {
+                return slot;
+            }
+        }
+        return nullptr;
+    }
+
+    static void Release(Slot* slot) {
+        slot->fiber.store(nullptr, std::memory_order_release);
+    }
+
+    static_assert(CAPACITY == size_t{1} << 14,
+                  "Hash must return an index of the table");
+
+    Slot* const slots_;
+};
+}
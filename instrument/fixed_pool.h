@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace microtrace {
+
+/*
+ * FixedPool hands out N entries that it allocates up front, so that taking
+ * one doesn't allocate. It is lock-free, the free entries are looked for from
+ * an index that moves on with every Take.
+ */
+template <typename T, size_t N>
+class FixedPool {
+   public:
+    static const size_t SIZE = N;
+
+    FixedPool() : next_(0) {
+        for (auto& taken : taken_) {
+            taken.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    FixedPool(const FixedPool&) = delete;
+
+    /*
+     * Returns a free entry, or null if they are all taken.
+     */
+    T* Take() {
+        const size_t first = next_.fetch_add(1, std::memory_order_relaxed);
+        for (size_t i = 0; i < SIZE; ++i) {
+            const size_t index = (first + i) % SIZE;
+            if (!taken_[index].load(std::memory_order_relaxed) &&
+                !taken_[index].exchange(true, std::memory_order_acquire)) {
+                return &entries_[index];
+            }
+        }
+        return nullptr;
+    }
+
+    /*
+     * Gives back entry, which must have been taken from this pool.
+     */
+    void Give(T* entry) {
+        taken_[entry - entries_.data()].store(false, std::memory_order_release);
+    }
+
+    /*
+     * Returns ptr as an entry if it points to a taken entry of this pool, or
+     * null. ptr may be any value.
+     */
+    T* Find(const void* ptr) {
+        const auto begin = reinterpret_cast<uintptr_t>(entries_.data());
+        const auto addr = reinterpret_cast<uintptr_t>(ptr);
+        if (addr < begin || addr >= begin + sizeof(entries_) ||
+            (addr - begin) % sizeof(T) != 0) {
+            return nullptr;
+        }
+        const size_t index = (addr - begin) / sizeof(T);
+        if (!taken_[index].load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &entries_[index];
+    }
+
+    /*
+     * Returns the number of free entries.
+     */
+    size_t available() const {
+        size_t n = 0;
+        for (const auto& taken : taken_) {
+            n += !taken.load(std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+   private:
+    std::array<T, SIZE> entries_;
+    std::array<std::atomic<bool>, SIZE> taken_;
+
+    /*
+     * The index from which the next free entry is looked for.
+     */
+    std::atomic<size_t> next_;
+};
+
+template <typename T, size_t N>
+const size_t FixedPool<T, N>::SIZE;
+}
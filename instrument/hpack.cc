@@ -0,0 +1,389 @@
+#include "hpack.h"
+
+#include <string.h>
+#include <algorithm>
+#include <utility>
+
+namespace microtrace {
+
+const size_t HpackDecoder::MAX_TABLE_SIZE;
+
+/*
+ * The HPACK Huffman code is canonical, so it is fully described by the number
+ * of codes of each length, and the symbols in the order of their codes.
+ */
+static const uint16_t HUFFMAN_COUNTS[31] = {
+    0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+    0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4
+};
+
+static const uint16_t HUFFMAN_SYMBOLS[257] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37,
+    45, 46, 47, 51, 52, 53, 54, 55, 56, 57, 61, 65,
+    95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+    58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+    77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89,
+    106, 107, 113, 118, 119, 120, 121, 122, 38, 42, 44, 59,
+    88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62,
+    0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+    195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+    167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+    132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+    173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+    233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+    151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+    183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159,
+    171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+    200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+    255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+    246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5,
+    6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+    21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220,
+    249, 10, 13, 22, 256
+};
+
+static const uint16_t HUFFMAN_EOS = 256;
+
+struct StaticEntry {
+    const char* name;
+    const char* value;
+};
+
+static const StaticEntry STATIC_TABLE[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+static const size_t STATIC_TABLE_LEN =
+    sizeof(STATIC_TABLE) / sizeof(STATIC_TABLE[0]);
+
+/*
+ * Overhead of every dynamic table entry, see RFC 7541 4.1.
+ */
+static const size_t ENTRY_OVERHEAD = 32;
+
+static const char GRPC_CONTENT_TYPE[] = "application/grpc";
+
+static bool equals(const char* a, const size_t a_len, const char* b) {
+    return a_len == strlen(b) && memcmp(a, b, a_len) == 0;
+}
+
+static int parse_int(const char* str, const size_t len) {
+    int value = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (str[i] < '0' || str[i] > '9' || i >= 9) {
+            return -1;
+        }
+        value = value * 10 + (str[i] - '0');
+    }
+    return len > 0 ? value : -1;
+}
+
+/*
+ * Stores the header in headers if it is used for tracing.
+ */
+static void SetHeader(const char* name, const size_t name_len,
+                      const char* value, const size_t value_len,
+                      Http2Headers* headers) {
+    if (name_len == 0) {
+        return;
+    }
+    if (name[0] == ':') {
+        if (equals(name, name_len, ":method")) {
+            headers->method.assign(value, value_len);
+        } else if (equals(name, name_len, ":path")) {
+            headers->path.assign(value, value_len);
+        } else if (equals(name, name_len, ":status")) {
+            headers->status = std::max(parse_int(value, value_len), 0);
+        }
+    } else if (equals(name, name_len, "content-type")) {
+        const size_t len = sizeof(GRPC_CONTENT_TYPE) - 1;
+        headers->grpc =
+            value_len >= len && memcmp(value, GRPC_CONTENT_TYPE, len) == 0;
+    } else if (equals(name, name_len, "grpc-status")) {
+        headers->grpc_status = parse_int(value, value_len);
+    }
+}
+
+void Http2Headers::Reset() {
+    method.clear();
+    path.clear();
+    status = 0;
+    grpc = false;
+    grpc_status = -1;
+}
+
+bool HpackReadInteger(const uint8_t** pos, const uint8_t* end, const int prefix,
+                      uint64_t* value) {
+    if (*pos == end) {
+        return false;
+    }
+    const uint8_t mask = (1 << prefix) - 1;
+    *value = **pos & mask;
+    ++*pos;
+    if (*value < mask) {
+        return true;
+    }
+
+    int shift = 0;
+    while (*pos != end) {
+        const uint8_t byte = **pos;
+        ++*pos;
+        *value += static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+        shift += 7;
+        // Nothing we track needs more than 32 bits
+        if (shift > 28) {
+            return false;
+        }
+    }
+    return false;
+}
+
+bool HpackHuffmanDecode(const uint8_t* begin, const uint8_t* end,
+                        std::string* out) {
+    // Canonical decoding: code is compared with the first code of every
+    // length, shortest first
+    uint32_t code = 0;
+    uint32_t first = 0;
+    uint32_t index = 0;
+    int len = 0;
+    // Bits of the symbol being decoded, used to validate the padding
+    int bits = 0;
+    bool all_ones = true;
+
+    for (const uint8_t* pos = begin; pos != end; ++pos) {
+        for (int i = 7; i >= 0; --i) {
+            const uint32_t bit = (*pos >> i) & 1;
+            code |= bit;
+            all_ones = all_ones && bit;
+            ++len;
+            ++bits;
+            const uint32_t count = HUFFMAN_COUNTS[len];
+            if (code - first < count) {
+                const uint16_t symbol = HUFFMAN_SYMBOLS[index + code - first];
+                if (symbol == HUFFMAN_EOS) {
+                    return false;
+                }
+                out->push_back(static_cast<char>(symbol));
+                code = first = index = 0;
+                len = bits = 0;
+                all_ones = true;
+                continue;
+            }
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+            if (len == 30) {
+                return false;
+            }
+        }
+    }
+    // The padding is a prefix of EOS, which is all ones, shorter than a byte
+    return bits < 8 && all_ones;
+}
+
+HpackDecoder::HpackDecoder()
+    : table_size_(0), max_size_(MAX_TABLE_SIZE), valid_(true) {}
+
+bool HpackDecoder::Lookup(uint64_t index, const char** name, size_t* name_len,
+                          const char** value, size_t* value_len) const {
+    if (index == 0) {
+        return false;
+    }
+    if (index <= STATIC_TABLE_LEN) {
+        const StaticEntry& entry = STATIC_TABLE[index - 1];
+        *name = entry.name;
+        *name_len = strlen(entry.name);
+        *value = entry.value;
+        *value_len = strlen(entry.value);
+        return true;
+    }
+    index -= STATIC_TABLE_LEN + 1;
+    if (index >= table_.size()) {
+        return false;
+    }
+    const Entry& entry = table_[index];
+    *name = entry.name.data();
+    *name_len = entry.name.size();
+    *value = entry.value.data();
+    *value_len = entry.value.size();
+    return true;
+}
+
+void HpackDecoder::Evict(const size_t size) {
+    while (table_size_ > size) {
+        const Entry& entry = table_.back();
+        table_size_ -= entry.name.size() + entry.value.size() + ENTRY_OVERHEAD;
+        table_.pop_back();
+    }
+}
+
+void HpackDecoder::Insert(std::string name, std::string value) {
+    const size_t size = name.size() + value.size() + ENTRY_OVERHEAD;
+    // An entry larger than the table empties it, and is not added
+    if (size > max_size_) {
+        Evict(0);
+        return;
+    }
+    Evict(max_size_ - size);
+    table_.push_front(Entry{std::move(name), std::move(value)});
+    table_size_ += size;
+}
+
+bool HpackDecoder::ReadString(const uint8_t** pos, const uint8_t* end,
+                              std::string* str) {
+    if (*pos == end) {
+        return false;
+    }
+    const bool huffman = **pos & 0x80;
+    uint64_t len;
+    if (!HpackReadInteger(pos, end, 7, &len) ||
+        len > static_cast<uint64_t>(end - *pos)) {
+        return false;
+    }
+
+    str->clear();
+    bool ok = true;
+    if (huffman) {
+        ok = HpackHuffmanDecode(*pos, *pos + len, str);
+    } else {
+        str->assign(reinterpret_cast<const char*>(*pos), len);
+    }
+    *pos += len;
+    return ok;
+}
+
+bool HpackDecoder::Decode(const char* block, size_t len,
+                          Http2Headers* headers) {
+    const uint8_t* pos = reinterpret_cast<const uint8_t*>(block);
+    const uint8_t* end = pos + len;
+    std::string name;
+    std::string value;
+
+    while (valid_ && pos != end) {
+        const uint8_t byte = *pos;
+        uint64_t index;
+
+        if (byte & 0x80) {
+            // Indexed header field
+            const char* name_ptr;
+            const char* value_ptr;
+            size_t name_len, value_len;
+            if (!HpackReadInteger(&pos, end, 7, &index) ||
+                !Lookup(index, &name_ptr, &name_len, &value_ptr, &value_len)) {
+                valid_ = false;
+                break;
+            }
+            SetHeader(name_ptr, name_len, value_ptr, value_len, headers);
+            continue;
+        }
+
+        if ((byte & 0xe0) == 0x20) {
+            // Dynamic table size update
+            uint64_t size;
+            if (!HpackReadInteger(&pos, end, 5, &size) ||
+                size > MAX_TABLE_SIZE) {
+                valid_ = false;
+                break;
+            }
+            max_size_ = size;
+            Evict(max_size_);
+            continue;
+        }
+
+        // Literal header field, with incremental indexing, without indexing
+        // or never indexed
+        const bool indexing = (byte & 0xc0) == 0x40;
+        if (!HpackReadInteger(&pos, end, indexing ? 6 : 4, &index)) {
+            valid_ = false;
+            break;
+        }
+        if (index > 0) {
+            const char* name_ptr;
+            const char* value_ptr;
+            size_t name_len, value_len;
+            if (!Lookup(index, &name_ptr, &name_len, &value_ptr, &value_len)) {
+                valid_ = false;
+                break;
+            }
+            name.assign(name_ptr, name_len);
+        } else if (!ReadString(&pos, end, &name)) {
+            valid_ = false;
+            break;
+        }
+        if (!ReadString(&pos, end, &value)) {
+            valid_ = false;
+            break;
+        }
+
+        SetHeader(name.data(), name.size(), value.data(), value.size(),
+                  headers);
+        if (indexing) {
+            Insert(std::move(name), std::move(value));
+        }
+    }
+    return valid_;
+}
+}
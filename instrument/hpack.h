@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+namespace microtrace {
+
+/*
+ * The headers of an HTTP/2 request or response that are used for tracing.
+ */
+struct Http2Headers {
+    void Reset();
+
+    std::string method;
+    std::string path;
+
+    /*
+     * Status of a response, or 0 if it is not known.
+     */
+    int status;
+
+    /*
+     * Indicates if the message is a gRPC call, i.e. its content-type is
+     * application/grpc.
+     */
+    bool grpc;
+
+    /*
+     * The grpc-status trailer of a gRPC response, or -1 if it is not known.
+     */
+    int grpc_status;
+};
+
+/*
+ * Decodes HPACK (RFC 7541) header blocks of one direction of an HTTP/2
+ * connection.
+ *
+ * Every header has to be decoded to keep the dynamic table in sync with the
+ * encoder, but only the ones in Http2Headers are kept. The dynamic table is
+ * bounded by MAX_TABLE_SIZE. If the encoder uses a larger table, or a block
+ * can't be decoded, the decoder is out of sync for good, and becomes invalid.
+ */
+class HpackDecoder {
+   public:
+    /*
+     * The default table size of HTTP/2, which is also the largest one kept.
+     */
+    static const size_t MAX_TABLE_SIZE = 4096;
+
+    HpackDecoder();
+
+    /*
+     * Decodes a complete header block. Returns false if the decoder is, or
+     * became, invalid.
+     */
+    bool Decode(const char* block, size_t len, Http2Headers* headers);
+
+    /*
+     * Makes the decoder invalid, e.g. if a header block had to be skipped.
+     */
+    void Invalidate() { valid_ = false; }
+
+    bool valid() const { return valid_; }
+
+    /*
+     * Returns the size of the dynamic table as defined by HPACK.
+     */
+    size_t table_size() const { return table_size_; }
+
+   private:
+    struct Entry {
+        std::string name;
+        std::string value;
+    };
+
+    /*
+     * Points name and value to the entry at index, which counts the static
+     * table first. Returns false if there is no such entry.
+     */
+    bool Lookup(uint64_t index, const char** name, size_t* name_len,
+                const char** value, size_t* value_len) const;
+
+    /*
+     * Adds an entry to the dynamic table, evicting the oldest ones if
+     * necessary.
+     */
+    void Insert(std::string name, std::string value);
+
+    /*
+     * Evicts entries until the table fits into size.
+     */
+    void Evict(const size_t size);
+
+    /*
+     * Decodes a string literal at pos and advances pos past it.
+     */
+    bool ReadString(const uint8_t** pos, const uint8_t* end, std::string* str);
+
+    /*
+     * Newest entry first.
+     */
+    std::deque<Entry> table_;
+    size_t table_size_;
+    size_t max_size_;
+    bool valid_;
+};
+
+/*
+ * Decodes an integer with an N-bit prefix at pos and advances pos past it.
+ * Returns false if the integer is incomplete or too large.
+ */
+bool HpackReadInteger(const uint8_t** pos, const uint8_t* end, const int prefix,
+                      uint64_t* value);
+
+/*
+ * Decodes the Huffman coded string [begin, end) and appends it to out.
+ * Returns false if it is not a valid HPACK Huffman code.
+ */
+bool HpackHuffmanDecode(const uint8_t* begin, const uint8_t* end,
+                        std::string* out);
+}
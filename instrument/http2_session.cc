@@ -0,0 +1,131 @@
+#include "http2_session.h"
+
+namespace microtrace {
+
+const size_t Http2Session::MAX_STREAMS;
+
+std::string Http2Stream::info() const {
+    if (request.grpc) {
+        return "gRPC: " + request.path;
+    }
+    return "HTTP/2: " + request.method + " " + request.path;
+}
+
+bool Http2Stream::error() const {
+    return reset || status >= 500 || grpc_status > 0;
+}
+
+Http2Session::Http2Session(const Role role, Observer* observer)
+    : role_(role),
+      observer_(observer),
+      requests_(Http2Tracker::Direction::CLIENT_TO_SERVER, this),
+      responses_(Http2Tracker::Direction::SERVER_TO_CLIENT, this) {}
+
+void Http2Session::Sent(const char* buf, size_t len) {
+    if (role_ == Role::CLIENT) {
+        requests_.Process(buf, len);
+    } else {
+        responses_.Process(buf, len);
+    }
+}
+
+void Http2Session::Received(const char* buf, size_t len) {
+    if (role_ == Role::CLIENT) {
+        responses_.Process(buf, len);
+    } else {
+        requests_.Process(buf, len);
+    }
+}
+
+void Http2Session::Close() {
+    for (auto& stream : streams_) {
+        if (stream.id != 0) {
+            Complete(&stream);
+        }
+    }
+}
+
+Http2Stream* Http2Session::Find(const uint32_t stream_id) {
+    // Zero marks free slots
+    for (auto& stream : streams_) {
+        if (stream.id == stream_id) {
+            return &stream;
+        }
+    }
+    return nullptr;
+}
+
+void Http2Session::Complete(Http2Stream* stream) {
+    stream->txn.End();
+    observer_->StreamCompleted(*stream);
+    stream->id = 0;
+}
+
+void Http2Session::StreamHeaders(const Http2Tracker::Direction direction,
+                                 const uint32_t stream_id,
+                                 const Http2Headers& headers,
+                                 const bool end_stream) {
+    // Frames of stream 0 belong to the connection
+    if (stream_id == 0) {
+        return;
+    }
+    Http2Stream* stream = Find(stream_id);
+
+    if (direction == Http2Tracker::Direction::CLIENT_TO_SERVER) {
+        // Trailers of a request that has already started
+        if (stream) {
+            return;
+        }
+        // Look for a free slot
+        stream = Find(0);
+        if (!stream) {
+            return;
+        }
+        stream->id = stream_id;
+        stream->txn.Start();
+        stream->request = headers;
+        stream->status = 0;
+        stream->grpc_status = -1;
+        stream->reset = false;
+        observer_->StreamStarted(stream);
+        return;
+    }
+
+    if (!stream) {
+        return;
+    }
+    // Response headers, or trailers which carry the status of gRPC calls
+    if (headers.status > 0) {
+        stream->status = headers.status;
+    }
+    if (headers.grpc_status >= 0) {
+        stream->grpc_status = headers.grpc_status;
+    }
+    if (end_stream) {
+        Complete(stream);
+    }
+}
+
+void Http2Session::StreamEnd(const Http2Tracker::Direction direction,
+                             const uint32_t stream_id) {
+    if (direction != Http2Tracker::Direction::SERVER_TO_CLIENT ||
+        stream_id == 0) {
+        return;
+    }
+    Http2Stream* stream = Find(stream_id);
+    if (stream) {
+        Complete(stream);
+    }
+}
+
+void Http2Session::StreamReset(const uint32_t stream_id) {
+    if (stream_id == 0) {
+        return;
+    }
+    Http2Stream* stream = Find(stream_id);
+    if (stream) {
+        stream->reset = true;
+        Complete(stream);
+    }
+}
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "context.h"
+#include "http2_tracker.h"
+#include "socket_handler.h"
+
+namespace microtrace {
+
+/*
+ * A stream of an HTTP/2 connection, i.e. a single request and its response.
+ */
+struct Http2Stream {
+    /*
+     * Returns the info logged with the span, e.g. gRPC: /pkg.Service/Method
+     */
+    std::string info() const;
+
+    /*
+     * Returns true if the stream was reset, or its response indicates an
+     * error.
+     */
+    bool error() const;
+
+    /*
+     * Zero if the slot is free.
+     */
+    uint32_t id = 0;
+
+    Transaction txn;
+    bool sampled = false;
+
+    /*
+     * Starts from zero because the default constructor would generate random
+     * uuids.
+     */
+    Context context{ContextStorage::Zero(), 0};
+
+    Http2Headers request;
+
+    int status = 0;
+    int grpc_status = -1;
+    bool reset = false;
+};
+
+/*
+ * Follows the streams of an HTTP/2 connection, e.g. gRPC calls. Streams are
+ * multiplexed, so every one of them is timed separately, from its request
+ * headers to the end of its response.
+ *
+ * At most MAX_STREAMS streams are followed at the same time, streams that
+ * start while all slots are taken are not traced.
+ */
+class Http2Session : private Http2Tracker::Listener {
+   public:
+    /*
+     * Indicates which end of the connection we are.
+     */
+    enum class Role { CLIENT, SERVER };
+
+    class Observer {
+       public:
+        virtual ~Observer() = default;
+
+        /*
+         * Called when the request headers of a new stream have been sent or
+         * received, it should decide if the stream is sampled, and set its
+         * context.
+         */
+        virtual void StreamStarted(Http2Stream* stream) = 0;
+
+        /*
+         * Called when the response of a stream has ended, or the stream has
+         * been reset.
+         */
+        virtual void StreamCompleted(const Http2Stream& stream) = 0;
+    };
+
+    static const size_t MAX_STREAMS = 32;
+
+    Http2Session(const Role role, Observer* observer);
+
+    /*
+     * Processes data written to the connection.
+     */
+    void Sent(const char* buf, size_t len);
+
+    /*
+     * Processes data read from the connection.
+     */
+    void Received(const char* buf, size_t len);
+
+    /*
+     * Completes the streams that are still open, called when the connection
+     * is closed.
+     */
+    void Close();
+
+    /*
+     * Returns false if the connection turned out not to be HTTP/2.
+     */
+    bool valid() const { return requests_.valid() && responses_.valid(); }
+
+   private:
+    void StreamHeaders(const Http2Tracker::Direction direction,
+                       const uint32_t stream_id, const Http2Headers& headers,
+                       const bool end_stream) override;
+    void StreamEnd(const Http2Tracker::Direction direction,
+                   const uint32_t stream_id) override;
+    void StreamReset(const uint32_t stream_id) override;
+
+    /*
+     * Returns the open stream with the given id, or nullptr. Returns a free
+     * slot if stream_id is zero.
+     */
+    Http2Stream* Find(const uint32_t stream_id);
+
+    void Complete(Http2Stream* stream);
+
+    const Role role_;
+    Observer* const observer_;
+
+    Http2Tracker requests_;
+    Http2Tracker responses_;
+
+    std::array<Http2Stream, MAX_STREAMS> streams_;
+};
+}
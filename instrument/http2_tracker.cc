@@ -0,0 +1,210 @@
+#include "http2_tracker.h"
+
+#include <string.h>
+#include <algorithm>
+
+namespace microtrace {
+
+const char Http2Tracker::PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+const size_t Http2Tracker::PREFACE_LEN;
+const size_t Http2Tracker::FRAME_HEADER_LEN;
+const size_t Http2Tracker::MAX_HEADER_BLOCK;
+
+static_assert(sizeof(Http2Tracker::PREFACE) - 1 == Http2Tracker::PREFACE_LEN,
+              "Invalid HTTP/2 preface length");
+
+// Frame types
+static const uint8_t DATA = 0x0;
+static const uint8_t HEADERS = 0x1;
+static const uint8_t RST_STREAM = 0x3;
+static const uint8_t PUSH_PROMISE = 0x5;
+static const uint8_t CONTINUATION = 0x9;
+
+// Frame flags
+static const uint8_t END_STREAM = 0x1;
+static const uint8_t END_HEADERS = 0x4;
+static const uint8_t PADDED = 0x8;
+static const uint8_t PRIORITY = 0x20;
+
+bool Http2Tracker::StartsWithPreface(const char* buf, size_t len) {
+    return len >= PREFACE_LEN && memcmp(buf, PREFACE, PREFACE_LEN) == 0;
+}
+
+Http2Tracker::Http2Tracker(const Direction direction, Listener* listener)
+    : direction_(direction),
+      listener_(listener),
+      state_(direction == Direction::CLIENT_TO_SERVER ? State::PREFACE
+                                                      : State::FRAME_HEADER),
+      preface_read_(0),
+      header_len_(0),
+      payload_read_(0),
+      in_block_(false),
+      block_skipped_(false) {}
+
+void Http2Tracker::Process(const char* buf, size_t len) {
+    size_t processed = 0;
+    while (processed < len) {
+        const char* data = buf + processed;
+        const size_t left = len - processed;
+
+        switch (state_) {
+            case State::PREFACE: {
+                const size_t count = std::min(left, PREFACE_LEN - preface_read_);
+                if (memcmp(data, PREFACE + preface_read_, count) != 0) {
+                    state_ = State::INVALID;
+                    return;
+                }
+                preface_read_ += count;
+                processed += count;
+                if (preface_read_ == PREFACE_LEN) {
+                    state_ = State::FRAME_HEADER;
+                }
+                break;
+            }
+            case State::FRAME_HEADER: {
+                const size_t count =
+                    std::min(left, FRAME_HEADER_LEN - header_len_);
+                memcpy(header_.data() + header_len_, data, count);
+                header_len_ += count;
+                processed += count;
+                if (header_len_ == FRAME_HEADER_LEN) {
+                    header_len_ = 0;
+                    FrameStarted();
+                }
+                break;
+            }
+            case State::PAYLOAD: {
+                const size_t count = std::min<size_t>(
+                    left, static_cast<size_t>(frame_len_) - payload_read_);
+                if (in_block_ && !block_skipped_) {
+                    if (block_.size() + count > MAX_HEADER_BLOCK) {
+                        block_skipped_ = true;
+                    } else {
+                        block_.insert(block_.end(), data, data + count);
+                    }
+                }
+                payload_read_ += count;
+                processed += count;
+                if (payload_read_ == frame_len_) {
+                    FrameDone();
+                }
+                break;
+            }
+            case State::INVALID:
+                return;
+        }
+    }
+}
+
+void Http2Tracker::FrameStarted() {
+    frame_len_ = (static_cast<uint32_t>(header_[0]) << 16) |
+                 (static_cast<uint32_t>(header_[1]) << 8) | header_[2];
+    frame_type_ = header_[3];
+    frame_flags_ = header_[4];
+    frame_stream_ = ((static_cast<uint32_t>(header_[5]) << 24) |
+                     (static_cast<uint32_t>(header_[6]) << 16) |
+                     (static_cast<uint32_t>(header_[7]) << 8) | header_[8]) &
+                    0x7fffffff;
+    payload_read_ = 0;
+
+    // A header block must be continued by CONTINUATION frames of the same
+    // stream, with nothing in between
+    if (in_block_ != (frame_type_ == CONTINUATION) ||
+        (in_block_ && frame_stream_ != block_stream_)) {
+        state_ = State::INVALID;
+        return;
+    }
+
+    if (frame_type_ == HEADERS || frame_type_ == PUSH_PROMISE) {
+        in_block_ = true;
+        block_.clear();
+        block_skipped_ = false;
+        block_stream_ = frame_stream_;
+        block_end_stream_ = frame_flags_ & END_STREAM;
+        block_push_promise_ = frame_type_ == PUSH_PROMISE;
+    }
+    block_frame_start_ = block_.size();
+
+    state_ = State::PAYLOAD;
+    if (frame_len_ == 0) {
+        FrameDone();
+    }
+}
+
+bool Http2Tracker::TrimHeaderFrame() {
+    const size_t frame_len = block_.size() - block_frame_start_;
+    size_t skip = 0;
+    size_t pad = 0;
+    if (frame_flags_ & PADDED) {
+        if (frame_len < 1) {
+            return false;
+        }
+        pad = static_cast<uint8_t>(block_[block_frame_start_]);
+        skip += 1;
+    }
+    if (frame_type_ == HEADERS && (frame_flags_ & PRIORITY)) {
+        skip += 5;
+    } else if (frame_type_ == PUSH_PROMISE) {
+        // Promised stream id
+        skip += 4;
+    }
+    if (skip + pad > frame_len) {
+        return false;
+    }
+
+    block_.resize(block_.size() - pad);
+    block_.erase(block_.begin() + block_frame_start_,
+                 block_.begin() + block_frame_start_ + skip);
+    return true;
+}
+
+void Http2Tracker::FrameDone() {
+    state_ = State::FRAME_HEADER;
+
+    switch (frame_type_) {
+        case HEADERS:
+        case PUSH_PROMISE:
+        case CONTINUATION:
+            if (!block_skipped_ && frame_type_ != CONTINUATION &&
+                !TrimHeaderFrame()) {
+                state_ = State::INVALID;
+                return;
+            }
+            if (frame_flags_ & END_HEADERS) {
+                HeaderBlockDone();
+            }
+            break;
+        case DATA:
+            if (frame_flags_ & END_STREAM) {
+                listener_->StreamEnd(direction_, frame_stream_);
+            }
+            break;
+        case RST_STREAM:
+            listener_->StreamReset(frame_stream_);
+            break;
+        default:
+            break;
+    }
+}
+
+void Http2Tracker::HeaderBlockDone() {
+    in_block_ = false;
+
+    headers_.Reset();
+    if (block_skipped_) {
+        hpack_.Invalidate();
+    } else {
+        hpack_.Decode(block_.data(), block_.size(), &headers_);
+    }
+    // Headers are kept only while the decoder is in sync
+    if (!hpack_.valid()) {
+        headers_.Reset();
+    }
+
+    // Promised streams are reported when their response starts
+    if (!block_push_promise_) {
+        listener_->StreamHeaders(direction_, block_stream_, headers_,
+                                 block_end_stream_);
+    }
+}
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "hpack.h"
+
+namespace microtrace {
+
+/*
+ * Follows the frames of one direction of an HTTP/2 connection, and reports
+ * the beginning and the end of streams. Frames can be passed in pieces of any
+ * size.
+ *
+ * Header blocks are decoded with HpackDecoder, payloads of other frames are
+ * skipped without being copied.
+ */
+class Http2Tracker {
+   public:
+    enum class Direction { CLIENT_TO_SERVER, SERVER_TO_CLIENT };
+
+    class Listener {
+       public:
+        virtual ~Listener() = default;
+
+        /*
+         * Called when a complete header block of stream has been processed.
+         * The headers are only valid during the call.
+         */
+        virtual void StreamHeaders(const Direction direction,
+                                   const uint32_t stream_id,
+                                   const Http2Headers& headers,
+                                   const bool end_stream) = 0;
+
+        /*
+         * Called when the last DATA frame of stream has been processed.
+         */
+        virtual void StreamEnd(const Direction direction,
+                               const uint32_t stream_id) = 0;
+
+        /*
+         * Called when stream has been reset by either end.
+         */
+        virtual void StreamReset(const uint32_t stream_id) = 0;
+    };
+
+    /*
+     * The client connection preface, sent before the first frame.
+     */
+    static const char PREFACE[];
+    static const size_t PREFACE_LEN = 24;
+
+    static const size_t FRAME_HEADER_LEN = 9;
+
+    /*
+     * Longer header blocks are skipped, which leaves the HPACK decoder out of
+     * sync, so streams are still followed, without their headers.
+     */
+    static const size_t MAX_HEADER_BLOCK = 16384;
+
+    /*
+     * Returns true if buf starts with the client connection preface.
+     */
+    static bool StartsWithPreface(const char* buf, size_t len);
+
+    Http2Tracker(const Direction direction, Listener* listener);
+
+    void Process(const char* buf, size_t len);
+
+    /*
+     * Returns false if the data turned out not to be HTTP/2.
+     */
+    bool valid() const { return state_ != State::INVALID; }
+
+   private:
+    enum class State { PREFACE, FRAME_HEADER, PAYLOAD, INVALID };
+
+    /*
+     * Called when the frame header has been read.
+     */
+    void FrameStarted();
+
+    /*
+     * Called when the whole payload of the frame has been read.
+     */
+    void FrameDone();
+
+    /*
+     * Removes the padding and the fields before the header block fragment of
+     * the frame from block_.
+     */
+    bool TrimHeaderFrame();
+
+    void HeaderBlockDone();
+
+    const Direction direction_;
+    Listener* const listener_;
+    State state_;
+
+    size_t preface_read_;
+
+    std::array<uint8_t, FRAME_HEADER_LEN> header_;
+    size_t header_len_;
+
+    uint32_t frame_len_;
+    uint8_t frame_type_;
+    uint8_t frame_flags_;
+    uint32_t frame_stream_;
+    size_t payload_read_;
+
+    /*
+     * The header block being collected from HEADERS, PUSH_PROMISE and
+     * CONTINUATION frames.
+     */
+    std::vector<char> block_;
+    bool in_block_;
+    bool block_skipped_;
+    size_t block_frame_start_;
+    uint32_t block_stream_;
+    bool block_end_stream_;
+    bool block_push_promise_;
+
+    HpackDecoder hpack_;
+    Http2Headers headers_;
+};
+}
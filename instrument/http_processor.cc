@@ -1,93 +1,190 @@
 #include "http_processor.h"
 
+#include <string.h>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace microtrace {
 
-static PrefixTreeNode BuildTree(const std::vector<std::string>& list);
+const size_t HttpProcessor::MAX_METHOD_LEN;
+const size_t HttpProcessor::MAX_URL_LEN;
 
-static const std::vector<std::string> METHODS{
-    "GET", "POST", "PUT", "DELETE", "HEAD", "OPTIONS", "TRACE"};
+/*
+ * A method packed into an integer, its first char in the lowest byte.
+ */
+struct MethodEntry {
+    uint64_t key;
+    size_t len;
+};
 
-const PrefixTreeNode& tree() {
-    static const PrefixTreeNode tree_ = BuildTree(METHODS);
-    return tree_;
+static constexpr MethodEntry Pack(const char* name) {
+    MethodEntry entry{0, 0};
+    for (; name[entry.len] != '\0'; ++entry.len) {
+        entry.key |= static_cast<uint64_t>(
+                         static_cast<unsigned char>(name[entry.len]))
+                     << (8 * entry.len);
+    }
+    return entry;
 }
 
-static PrefixTreeNode BuildTree(const std::vector<std::string>& list) {
-    PrefixTreeNode head;
-
-    for (const auto& str : list) {
-        PrefixTreeNode* curr = &head;
-        for (size_t i = 0; i < str.size(); ++i) {
-            auto* n = curr->Get(str[i]);
-            if (n == nullptr) {
-                curr->Add(str[i]);
-            }
-            curr = curr->Get(str[i]);
+static constexpr MethodEntry METHODS[] = {
+    Pack("GET"),   Pack("POST"),    Pack("PUT"),   Pack("DELETE"),
+    Pack("HEAD"),  Pack("OPTIONS"), Pack("TRACE"), Pack("PATCH"),
+    Pack("CONNECT")};
+
+static constexpr bool MethodsFit() {
+    for (const auto& method : METHODS) {
+        if (method.len > HttpProcessor::MAX_METHOD_LEN) {
+            return false;
         }
-        curr->mark_finish();
     }
-    return head;
+    return true;
 }
+static_assert(MethodsFit(), "methods must fit into MAX_METHOD_LEN");
 
-void PrefixTreeNode::Add(const char c) {
-    VERIFY(c >= 0 && c <= MAX_CHAR, "char outside range: {}", c);
-    children_[c] = std::make_unique<PrefixTreeNode>();
+static uint64_t prefix_mask(const size_t len) {
+    return len >= sizeof(uint64_t) ? ~0ULL : (1ULL << (8 * len)) - 1;
 }
 
-PrefixTreeNode* PrefixTreeNode::Get(const char c) const {
-    if (!(c >= 0 && c < MAX_CHAR)) {
-        return nullptr;
+/*
+ * Returns true if the first len chars of a known method are packed in key.
+ */
+static bool IsMethodPrefix(const uint64_t key, const size_t len) {
+    const uint64_t mask = prefix_mask(len);
+    for (const auto& method : METHODS) {
+        if (method.len >= len && (method.key & mask) == key) {
+            return true;
+        }
     }
-    if (!children_[c]) {
-        return nullptr;
+    return false;
+}
+
+static bool IsMethod(const uint64_t key, const size_t len) {
+    for (const auto& method : METHODS) {
+        if (method.len == len && method.key == key) {
+            return true;
+        }
     }
-    return children_[c].get();
+    return false;
 }
 
-PrefixTree::PrefixTree(const PrefixTreeNode* head) : current_(head) {}
+const char* FindChar(const char* begin, const char* end, const char c) {
+#if defined(__AVX2__)
+    const __m256i needle = _mm256_set1_epi8(c);
+    for (; end - begin >= 32; begin += 32) {
+        const __m256i chunk =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        const uint32_t mask =
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+        if (mask != 0) {
+            return begin + __builtin_ctz(mask);
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i needle = _mm_set1_epi8(c);
+    for (; end - begin >= 16; begin += 16) {
+        const __m128i chunk =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        const uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if (mask != 0) {
+            return begin + __builtin_ctz(mask);
+        }
+    }
+#endif
+    // Remaining bytes, or the whole buffer without SIMD
+    for (; begin != end; ++begin) {
+        if (*begin == c) {
+            return begin;
+        }
+    }
+    return end;
+}
 
-bool PrefixTree::Advance(const char c) {
-    VERIFY(current_, "Advance called");
-    current_ = current_->Get(c);
-    return current_;
+bool HttpProcessor::StartsWithRequest(const char* buf, size_t len) {
+    uint64_t key = 0;
+    size_t i = 0;
+    for (; i < len && i < MAX_METHOD_LEN && buf[i] != SPACE; ++i) {
+        key |= static_cast<uint64_t>(static_cast<unsigned char>(buf[i]))
+               << (8 * i);
+    }
+    if (i < len && buf[i] == SPACE) {
+        return IsMethod(key, i);
+    }
+    // The rest of the method may be in the next write
+    return i == len && i > 0 && IsMethodPrefix(key, i);
 }
 
 HttpProcessor::HttpProcessor()
-    : state_(State::METHOD), valid_(true), has_url_(false), tree_(&tree()) {}
+    : state_(State::METHOD),
+      valid_(true),
+      method_key_(0),
+      method_len_(0),
+      has_url_(false) {}
+
+size_t HttpProcessor::ProcessMethod(const char* buf, size_t len) {
+    // Methods are short, there is no point in a vectorized search
+    const char* space = static_cast<const char*>(memchr(buf, SPACE, len));
+    const size_t count = space ? space - buf : len;
+
+    if (method_len_ + count > MAX_METHOD_LEN) {
+        valid_ = false;
+        return len;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        method_key_ |= static_cast<uint64_t>(static_cast<unsigned char>(buf[i]))
+                       << (8 * (method_len_ + i));
+    }
+    method_len_ += count;
+
+    if (!IsMethodPrefix(method_key_, method_len_)) {
+        valid_ = false;
+        return len;
+    }
+    if (space == nullptr) {
+        return len;
+    }
+    if (!IsMethod(method_key_, method_len_)) {
+        valid_ = false;
+        return len;
+    }
+
+    for (size_t i = 0; i < method_len_; ++i) {
+        method_buffer_ += static_cast<char>(method_key_ >> (8 * i));
+    }
+    state_ = State::URL;
+    return count + 1;
+}
+
+size_t HttpProcessor::ProcessUrl(const char* buf, size_t len) {
+    const char* end = buf + len;
+    const char* space = FindChar(buf, end, SPACE);
+
+    // Anything above MAX_URL_LEN is skipped
+    const size_t room = MAX_URL_LEN - url_buffer_.size();
+    url_buffer_.append(buf, std::min(static_cast<size_t>(space - buf), room));
+
+    if (space != end) {
+        // URL cannot be empty
+        if (!url_buffer_.empty()) {
+            has_url_ = true;
+        }
+        valid_ = false;
+    }
+    return len;
+}
 
 bool HttpProcessor::Process(const char* buf, size_t len) {
-    for (size_t i = 0; i < len; ++i) {
-        if (!valid_) break;
-
-        switch (state_) {
-            case State::METHOD:
-                if (buf[i] == SPACE) {
-                    if (!tree_.is_finish()) {
-                        valid_ = false;
-                        break;
-                    } else {
-                        state_ = State::URL;
-                    }
-                } else {
-                    valid_ = tree_.Advance(buf[i]);
-                    // Add HTTP method to url
-                    url_buffer_ += buf[i];
-                }
-                break;
-            case State::URL:
-                // Indicates end of URL
-                if (buf[i] == SPACE) {
-                    // URL cannot be empty
-                    if (!url_buffer_.empty()) {
-                        has_url_ = true;
-                    }
-                    valid_ = false;
-                } else {
-                    // space after HTTP method
-                    url_buffer_ += " ";
-                    url_buffer_ += buf[i];
-                }
-                break;
+    size_t processed = 0;
+    while (valid_ && processed < len) {
+        if (state_ == State::METHOD) {
+            processed += ProcessMethod(buf + processed, len - processed);
+        } else {
+            processed += ProcessUrl(buf + processed, len - processed);
         }
     }
     return valid_;
@@ -1,50 +1,44 @@
 #pragma once
 
-#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
 #include "common.h"
 
 namespace microtrace {
 
-class PrefixTreeNode {
-   public:
-    // Adds a char to the tree
-    void Add(const char c);
-
-    // Returns the node assoc. to c, nullptr if empty.
-    PrefixTreeNode* Get(const char c) const;
-
-    void mark_finish() { finish_ = true; }
-    bool is_finish() const { return finish_; }
-
-   private:
-    static const int MAX_CHAR = 256;
-
-    bool finish_;
-
-    std::array<std::unique_ptr<PrefixTreeNode>, MAX_CHAR> children_;
-};
-
-class PrefixTree {
+/*
+ * Returns a pointer to the first occurrence of c in [begin, end), or end if
+ * it is not found. Uses AVX2 or SSE2 if available, a scalar loop otherwise.
+ */
+const char* FindChar(const char* begin, const char* end, const char c);
+
+/*
+ * Extracts the method and the URL from the request line of an HTTP request.
+ * The request can be passed in multiple pieces.
+ *
+ * The URL is located with a vectorized search for the space that ends it, and
+ * is copied in one go, up to MAX_URL_LEN bytes.
+ */
+class HttpProcessor {
    public:
-    PrefixTree(const PrefixTreeNode* head);
-
-    bool Advance(char c);
+    static const size_t MAX_METHOD_LEN = 8;
+    static const size_t MAX_URL_LEN = 2048;
 
-    bool is_finish() const {
-        if (!current_) return false;
-        return current_->is_finish();
-    }
+    /*
+     * Returns true if buf starts with the method of an HTTP request, or with
+     * the beginning of one if buf ends before the method does.
+     */
+    static bool StartsWithRequest(const char* buf, size_t len);
 
-   private:
-    const PrefixTreeNode* current_;
-};
-
-class HttpProcessor {
-   public:
     HttpProcessor();
 
+    /*
+     * Processes the next len bytes of the request. Returns false once there is
+     * nothing more to process, either because the URL has been found or
+     * because the request is invalid.
+     */
     bool Process(const char* buf, size_t len);
 
     bool has_url() const { return has_url_; }
@@ -54,16 +48,40 @@ class HttpProcessor {
         return url_buffer_;
     }
 
+    /*
+     * Returns the HTTP method of the request, only valid if has_url() is true.
+     */
+    const std::string& method() const {
+        VERIFY(has_url_, "method called when url not set");
+        return method_buffer_;
+    }
+
    private:
     static const char SPACE = ' ';
     enum class State { METHOD, URL };
 
+    /*
+     * Processes bytes of the method, returns the number of bytes consumed.
+     */
+    size_t ProcessMethod(const char* buf, size_t len);
+
+    /*
+     * Processes bytes of the URL, returns the number of bytes consumed.
+     */
+    size_t ProcessUrl(const char* buf, size_t len);
+
     State state_;
     bool valid_;
 
+    /*
+     * The method read so far, packed into an integer in the same way as the
+     * entries of the method table.
+     */
+    uint64_t method_key_;
+    size_t method_len_;
+
+    std::string method_buffer_;
     std::string url_buffer_;
     bool has_url_;
-
-    PrefixTree tree_;
 };
 }
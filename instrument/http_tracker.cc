@@ -0,0 +1,319 @@
+#include "http_tracker.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "http_processor.h"
+
+namespace microtrace {
+
+const size_t HttpTracker::LINE_CAP;
+
+static const char CONTENT_LENGTH[] = "content-length";
+static const char TRANSFER_ENCODING[] = "transfer-encoding";
+static const char CHUNKED[] = "chunked";
+
+static char to_lower(const char c) {
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+/*
+ * Compares a and the lowercase string b of the same length, ignoring case.
+ */
+static bool equals_lower(const char* a, const char* b, const size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        if (to_lower(a[i]) != b[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool is_space(const char c) { return c == ' ' || c == '\t'; }
+
+static void trim(const char** str, size_t* len) {
+    while (*len > 0 && is_space((*str)[0])) {
+        ++*str;
+        --*len;
+    }
+    while (*len > 0 && is_space((*str)[*len - 1])) {
+        --*len;
+    }
+}
+
+static int hex_value(const char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+HttpTracker::HttpTracker(const Type type) : type_(type) { Reset(); }
+
+void HttpTracker::Reset(const bool head_request) {
+    state_ = State::START_LINE;
+    line_len_ = 0;
+    remaining_ = 0;
+    has_length_ = false;
+    chunked_ = false;
+    head_request_ = head_request;
+    status_code_ = 0;
+}
+
+size_t HttpTracker::ReadLine(const char* buf, size_t len,
+                             bool* line_complete) {
+    const char* end = buf + len;
+    const char* lf = FindChar(buf, end, '\n');
+
+    const size_t count = lf - buf;
+    const size_t copied = std::min(count, LINE_CAP - line_len_);
+    memcpy(line_.data() + line_len_, buf, copied);
+    line_len_ += copied;
+
+    *line_complete = lf != end;
+    return *line_complete ? count + 1 : count;
+}
+
+uint64_t HttpTracker::Skip(const uint64_t len) {
+    switch (state_) {
+        case State::BODY:
+        case State::CHUNK_DATA: {
+            const uint64_t count = std::min(remaining_, len);
+            remaining_ -= count;
+            if (remaining_ == 0) {
+                state_ = state_ == State::BODY ? State::DONE
+                                               : State::CHUNK_DATA_END;
+            }
+            // The size of the next chunk is in the skipped bytes
+            if (count < len && state_ != State::DONE) {
+                state_ = State::INVALID;
+            }
+            return count;
+        }
+        case State::BODY_UNTIL_CLOSE:
+            return len;
+        case State::DONE:
+        case State::INVALID:
+            return 0;
+        default:
+            state_ = State::INVALID;
+            return 0;
+    }
+}
+
+size_t HttpTracker::Process(const char* buf, size_t len) {
+    size_t processed = 0;
+    while (processed < len) {
+        const char* data = buf + processed;
+        const size_t left = len - processed;
+
+        switch (state_) {
+            case State::BODY:
+            case State::CHUNK_DATA: {
+                const size_t count =
+                    static_cast<size_t>(std::min<uint64_t>(remaining_, left));
+                remaining_ -= count;
+                processed += count;
+                if (remaining_ == 0) {
+                    state_ = state_ == State::BODY ? State::DONE
+                                                   : State::CHUNK_DATA_END;
+                }
+                break;
+            }
+            case State::BODY_UNTIL_CLOSE:
+                return len;
+            case State::DONE:
+            case State::INVALID:
+                return processed;
+            default: {
+                bool line_complete;
+                processed += ReadLine(data, left, &line_complete);
+                // Give up on other protocols without waiting for a whole line
+                if (state_ == State::START_LINE && !StartLineMayBeValid()) {
+                    state_ = State::INVALID;
+                    return processed;
+                }
+                if (line_complete) {
+                    size_t line_len = line_len_;
+                    if (line_len > 0 && line_[line_len - 1] == '\r') {
+                        --line_len;
+                    }
+                    line_len_ = 0;
+                    HandleLine(line_.data(), line_len);
+                }
+                break;
+            }
+        }
+    }
+    return processed;
+}
+
+bool HttpTracker::StartLineMayBeValid() const {
+    const size_t len = std::min(line_len_, LINE_CAP);
+    // Empty lines before the start line are allowed
+    if (len > 0 && line_[0] == '\r') {
+        return true;
+    }
+    if (type_ == Type::RESPONSE) {
+        static const char VERSION[] = "HTTP/1.";
+        const size_t n = std::min(len, sizeof(VERSION) - 1);
+        return memcmp(line_.data(), VERSION, n) == 0;
+    }
+    // Methods are at most 7 uppercase chars
+    for (size_t i = 0; i < len && i < 8; ++i) {
+        if (line_[i] == ' ') {
+            return i > 0;
+        }
+        if (line_[i] < 'A' || line_[i] > 'Z') {
+            return false;
+        }
+    }
+    return len < 8;
+}
+
+void HttpTracker::HandleLine(const char* line, size_t len) {
+    switch (state_) {
+        case State::START_LINE:
+            HandleStartLine(line, len);
+            break;
+        case State::HEADERS:
+            HandleHeader(line, len);
+            break;
+        case State::CHUNK_SIZE:
+            HandleChunkSize(line, len);
+            break;
+        case State::CHUNK_DATA_END:
+            state_ = len == 0 ? State::CHUNK_SIZE : State::INVALID;
+            break;
+        case State::TRAILERS:
+            if (len == 0) {
+                state_ = State::DONE;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void HttpTracker::HandleStartLine(const char* line, size_t len) {
+    // Empty lines before the start line are ignored
+    if (len == 0) {
+        return;
+    }
+
+    if (type_ == Type::RESPONSE) {
+        // e.g. HTTP/1.1 200 OK
+        static const char VERSION[] = "HTTP/1.";
+        const size_t version_len = sizeof(VERSION) - 1;
+        if (len < version_len + 5 || memcmp(line, VERSION, version_len) != 0 ||
+            line[version_len + 1] != ' ') {
+            state_ = State::INVALID;
+            return;
+        }
+        int status = 0;
+        for (size_t i = version_len + 2; i < version_len + 5; ++i) {
+            if (line[i] < '0' || line[i] > '9') {
+                state_ = State::INVALID;
+                return;
+            }
+            status = status * 10 + (line[i] - '0');
+        }
+        status_code_ = status;
+    } else {
+        // e.g. GET /index.html HTTP/1.1, methods are uppercase tokens
+        size_t i = 0;
+        while (i < len && line[i] >= 'A' && line[i] <= 'Z') {
+            ++i;
+        }
+        if (i == 0 || i == len || line[i] != ' ') {
+            state_ = State::INVALID;
+            return;
+        }
+        head_request_ = i == 4 && memcmp(line, "HEAD", 4) == 0;
+    }
+    state_ = State::HEADERS;
+}
+
+void HttpTracker::HandleHeader(const char* line, size_t len) {
+    if (len == 0) {
+        HeadersDone();
+        return;
+    }
+
+    const char* colon = static_cast<const char*>(memchr(line, ':', len));
+    if (colon == nullptr) {
+        return;
+    }
+    const char* name = line;
+    size_t name_len = colon - line;
+    trim(&name, &name_len);
+    const char* value = colon + 1;
+    size_t value_len = line + len - value;
+    trim(&value, &value_len);
+
+    if (name_len == sizeof(CONTENT_LENGTH) - 1 &&
+        equals_lower(name, CONTENT_LENGTH, name_len)) {
+        uint64_t length = 0;
+        for (size_t i = 0; i < value_len; ++i) {
+            if (value[i] < '0' || value[i] > '9') {
+                state_ = State::INVALID;
+                return;
+            }
+            length = length * 10 + (value[i] - '0');
+        }
+        has_length_ = value_len > 0;
+        remaining_ = length;
+    } else if (name_len == sizeof(TRANSFER_ENCODING) - 1 &&
+               equals_lower(name, TRANSFER_ENCODING, name_len)) {
+        // chunked must be the last encoding
+        const size_t chunked_len = sizeof(CHUNKED) - 1;
+        chunked_ = value_len >= chunked_len &&
+                   equals_lower(value + value_len - chunked_len, CHUNKED,
+                                chunked_len);
+    }
+}
+
+void HttpTracker::HandleChunkSize(const char* line, size_t len) {
+    // e.g. 1a2b;extension=value
+    uint64_t size = 0;
+    size_t i = 0;
+    for (; i < len && hex_value(line[i]) >= 0; ++i) {
+        size = size * 16 + hex_value(line[i]);
+    }
+    if (i == 0) {
+        state_ = State::INVALID;
+        return;
+    }
+    if (size == 0) {
+        state_ = State::TRAILERS;
+    } else {
+        remaining_ = size;
+        state_ = State::CHUNK_DATA;
+    }
+}
+
+void HttpTracker::HeadersDone() {
+    if (type_ == Type::RESPONSE) {
+        // Interim responses are followed by the final one
+        if (status_code_ >= 100 && status_code_ < 200 && status_code_ != 101) {
+            Reset(head_request_);
+            return;
+        }
+        if (head_request_ || status_code_ < 200 || status_code_ == 204 ||
+            status_code_ == 304) {
+            state_ = State::DONE;
+            return;
+        }
+    }
+
+    if (chunked_) {
+        state_ = State::CHUNK_SIZE;
+    } else if (has_length_) {
+        state_ = remaining_ == 0 ? State::DONE : State::BODY;
+    } else if (type_ == Type::RESPONSE) {
+        state_ = State::BODY_UNTIL_CLOSE;
+    } else {
+        state_ = State::DONE;
+    }
+}
+}
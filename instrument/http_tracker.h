@@ -0,0 +1,131 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace microtrace {
+
+/*
+ * Follows a single HTTP/1.1 request or response as it is sent or received, to
+ * find out where it ends. Messages can be passed in pieces of any size.
+ *
+ * Bodies are framed by Content-Length, chunked Transfer-Encoding, or for
+ * responses without either, by the end of the connection. Responses to HEAD
+ * requests, and responses with status 1xx, 204 or 304 have no body.
+ *
+ * Only the first LINE_CAP bytes of every line are kept, which is enough for
+ * the headers that affect framing, so the tracker never allocates.
+ */
+class HttpTracker {
+   public:
+    enum class Type { REQUEST, RESPONSE };
+
+    static const size_t LINE_CAP = 64;
+
+    HttpTracker(const Type type);
+
+    /*
+     * Starts tracking a new message. head_request must be true for the
+     * response of a HEAD request.
+     */
+    void Reset(const bool head_request = false);
+
+    /*
+     * Processes the next len bytes of the message. Returns the number of bytes
+     * that belong to it, which is less than len only if the message has
+     * completed or turned out to be invalid.
+     */
+    size_t Process(const char* buf, size_t len);
+
+    /*
+     * Accounts for the next len bytes of the message without seeing them,
+     * e.g. a body sent with sendfile. Only bytes of the body can be skipped,
+     * the message turns invalid if the skipped bytes contain anything that
+     * affects framing. Returns the number of bytes that belong to it.
+     */
+    uint64_t Skip(const uint64_t len);
+
+    /*
+     * Returns true if the whole message has been processed.
+     */
+    bool complete() const { return state_ == State::DONE; }
+
+    /*
+     * Returns false if the data is not an HTTP/1.x message.
+     */
+    bool valid() const { return state_ != State::INVALID; }
+
+    /*
+     * Returns true if the body of the message lasts until the connection is
+     * closed.
+     */
+    bool until_close() const { return state_ == State::BODY_UNTIL_CLOSE; }
+
+    /*
+     * Returns the status code of a response, or 0 if it is not known yet.
+     */
+    int status_code() const { return status_code_; }
+
+    /*
+     * Returns true if the request's method is HEAD.
+     */
+    bool head_request() const { return head_request_; }
+
+   private:
+    enum class State {
+        START_LINE,
+        HEADERS,
+        BODY,
+        CHUNK_SIZE,
+        CHUNK_DATA,
+        CHUNK_DATA_END,
+        TRAILERS,
+        BODY_UNTIL_CLOSE,
+        DONE,
+        INVALID
+    };
+
+    /*
+     * Adds bytes up to and including the next LF to line_. Returns the number
+     * of bytes consumed, and sets line_complete if the LF was found.
+     */
+    size_t ReadLine(const char* buf, size_t len, bool* line_complete);
+
+    /*
+     * Returns false if the part of the start line read so far shows that the
+     * message is not HTTP/1.x.
+     */
+    bool StartLineMayBeValid() const;
+
+    /*
+     * Handles the line in line_ according to the state.
+     */
+    void HandleLine(const char* line, size_t len);
+
+    void HandleStartLine(const char* line, size_t len);
+    void HandleHeader(const char* line, size_t len);
+    void HandleChunkSize(const char* line, size_t len);
+
+    /*
+     * Chooses how the body is framed once all headers have been read.
+     */
+    void HeadersDone();
+
+    const Type type_;
+    State state_;
+
+    std::array<char, LINE_CAP> line_;
+    size_t line_len_;
+
+    /*
+     * Bytes left of the body, or of the current chunk.
+     */
+    uint64_t remaining_;
+
+    bool has_length_;
+    bool chunked_;
+    bool head_request_;
+    int status_code_;
+};
+}
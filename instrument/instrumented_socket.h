@@ -38,7 +38,103 @@ class InstrumentedSocket : public SocketInterface {
         return &iov;
     }
 
-    const int fd_;
+    /*
+     * Calls the Before handler of a read into iov.
+     */
+    static void BeforeReadv(SocketHandler *handler, const struct iovec *iov,
+                            int iovcnt) {
+        if (iovcnt > 0) {
+            handler->BeforeRead(iov[0].iov_base, iov[0].iov_len);
+        } else {
+            handler->BeforeRead(nullptr, 0);
+        }
+    }
+
+    /*
+     * Calls the After handler of a read into iov that returned ret, as if
+     * every buffer that it filled had been read separately.
+     */
+    static void AfterReadv(SocketHandler *handler, const struct iovec *iov,
+                           int iovcnt, ssize_t ret) {
+        if (ret <= 0) {
+            handler->AfterRead(iovcnt > 0 ? iov[0].iov_base : nullptr, 0, ret);
+            return;
+        }
+        bool first = true;
+        ForEachWritten(iov, iovcnt, ret, [&](const char *buf, size_t len) {
+            if (len == 0) {
+                return;
+            }
+            if (!first) {
+                handler->BeforeRead(buf, len);
+            }
+            first = false;
+            handler->AfterRead(buf, len, len);
+        });
+    }
+
+    /*
+     * Calls the After handler of a read or a write that io_uring completed
+     * with ret. iov is empty if its data couldn't be seen.
+     */
+    static void AfterUringRead(SocketHandler *handler, const struct iovec *iov,
+                               int iovcnt, ssize_t ret) {
+        if (iovcnt > 0) {
+            AfterReadv(handler, iov, iovcnt, ret);
+        } else {
+            handler->AfterOpaqueRead(ret);
+        }
+    }
+
+    static void AfterUringWrite(SocketHandler *handler,
+                                const struct iovec *iov, int iovcnt,
+                                ssize_t ret) {
+        if (iovcnt > 0) {
+            handler->AfterWrite(iov, iovcnt, ret);
+        } else {
+            handler->AfterOpaqueWrite(ret);
+        }
+    }
+
+    /*
+     * Calls the After handlers of the messages that recvmmsg returned ret
+     * for. The Before handler of the first one must have been called.
+     */
+    static void AfterRecvMMsg(SocketHandler *handler,
+                              const struct mmsghdr *msgvec, int ret) {
+        if (ret < 0) {
+            handler->AfterRead(nullptr, 0, ret);
+        }
+        for (int i = 0; i < ret; ++i) {
+            const struct msghdr &msg = msgvec[i].msg_hdr;
+            if (i > 0) {
+                BeforeReadv(handler, msg.msg_iov, msg.msg_iovlen);
+            }
+            AfterReadv(handler, msg.msg_iov, msg.msg_iovlen,
+                       msgvec[i].msg_len);
+        }
+    }
+
+    /*
+     * Calls the After handlers of the messages that sendmmsg returned ret
+     * for. The Before handler of the first one must have been called.
+     */
+    static void AfterSendMMsg(SocketHandler *handler,
+                              const struct mmsghdr *msgvec, int ret) {
+        if (ret < 0) {
+            handler->AfterWrite(nullptr, 0, ret);
+        }
+        for (int i = 0; i < ret; ++i) {
+            const struct msghdr &msg = msgvec[i].msg_hdr;
+            if (i > 0) {
+                handler->BeforeWrite(msg.msg_iov, msg.msg_iovlen);
+            }
+            handler->AfterWrite(msg.msg_iov, msg.msg_iovlen,
+                                msgvec[i].msg_len);
+        }
+    }
+
+    int fd_;
 
     /*
      * Cache for iovec struct
@@ -0,0 +1,258 @@
+#include "memcached_tracker.h"
+
+#include <string.h>
+#include <algorithm>
+
+namespace microtrace {
+
+const char MemcachedTracker::PROTOCOL[] = "Memcached";
+const size_t MemcachedTracker::WORD_CAP;
+
+/*
+ * Describes the words of a command line, by their index, the verb being the
+ * 0th word. Negative indices mean there is no such word.
+ */
+struct MemcachedCommandSpec {
+    const char* verb;
+
+    /*
+     * The keys are the words from first_key to last_key, or to the end of the
+     * line if last_key is negative. Zero first_key means there are no keys.
+     */
+    int first_key;
+    int last_key;
+
+    /*
+     * The length of the data block that follows the line.
+     */
+    int data_len;
+
+    /*
+     * The first flag of meta commands.
+     */
+    int first_flag;
+
+    bool reply;
+};
+
+static const MemcachedCommandSpec COMMAND_SPECS[] = {
+    // Retrieval
+    {"get", 1, -1, -1, -1, true},
+    {"gets", 1, -1, -1, -1, true},
+    {"gat", 2, -1, -1, -1, true},
+    {"gats", 2, -1, -1, -1, true},
+    // Storage
+    {"set", 1, 1, 4, -1, true},
+    {"add", 1, 1, 4, -1, true},
+    {"replace", 1, 1, 4, -1, true},
+    {"append", 1, 1, 4, -1, true},
+    {"prepend", 1, 1, 4, -1, true},
+    {"cas", 1, 1, 4, -1, true},
+    {"delete", 1, 1, -1, -1, true},
+    {"incr", 1, 1, -1, -1, true},
+    {"decr", 1, 1, -1, -1, true},
+    {"touch", 1, 1, -1, -1, true},
+    // Meta commands
+    {"mg", 1, 1, -1, 2, true},
+    {"ms", 1, 1, 2, 3, true},
+    {"md", 1, 1, -1, 2, true},
+    {"ma", 1, 1, -1, 2, true},
+    {"mn", 0, 0, -1, -1, true},
+    // Other commands
+    {"stats", 0, 0, -1, -1, true},
+    {"version", 0, 0, -1, -1, true},
+    {"verbosity", 0, 0, -1, -1, true},
+    {"flush_all", 0, 0, -1, -1, true},
+    {"quit", 0, 0, -1, -1, false},
+};
+
+static const MemcachedCommandSpec* FindCommandSpec(const char* verb,
+                                                   size_t len) {
+    for (const auto& spec : COMMAND_SPECS) {
+        if (strlen(spec.verb) == len && memcmp(spec.verb, verb, len) == 0) {
+            return &spec;
+        }
+    }
+    return nullptr;
+}
+
+/*
+ * Parses a decimal length, returns -1 if it is invalid.
+ */
+static int64_t ParseLength(const char* word, size_t len) {
+    if (len == 0 || len > 18) {
+        return -1;
+    }
+    int64_t value = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (word[i] < '0' || word[i] > '9') {
+            return -1;
+        }
+        value = value * 10 + (word[i] - '0');
+    }
+    return value;
+}
+
+bool MemcachedTracker::StartsWithCommand(const char* buf, size_t len) {
+    const char* end = buf + std::min(len, WORD_CAP);
+    const char* verb_end = std::find_if(
+        buf, end, [](const char c) { return c == ' ' || c == '\r'; });
+    return verb_end != end &&
+           FindCommandSpec(buf, verb_end - buf) != nullptr;
+}
+
+MemcachedTracker::MemcachedTracker(const Type type) : type_(type) {
+    Reset();
+}
+
+void MemcachedTracker::Reset() {
+    state_ = State::LINE;
+    word_len_ = 0;
+    in_word_ = false;
+    word_index_ = 0;
+    key_hash_ = CacheKeys::HASH_OFFSET;
+    spec_ = nullptr;
+    data_len_ = -1;
+    data_remaining_ = 0;
+    more_lines_ = false;
+    noreply_ = false;
+    quiet_ = false;
+    verb_.clear();
+    keys_.Clear();
+    error_ = false;
+}
+
+bool MemcachedTracker::expects_reply() const {
+    return spec_ && spec_->reply && !noreply_ && !quiet_;
+}
+
+bool MemcachedTracker::WordIs(const char* str) const {
+    return strlen(str) == word_len_ &&
+           memcmp(str, word_.data(), word_len_) == 0;
+}
+
+bool MemcachedTracker::IsKey(const size_t word) const {
+    if (!spec_ || spec_->first_key == 0) {
+        return false;
+    }
+    return word >= static_cast<size_t>(spec_->first_key) &&
+           (spec_->last_key < 0 ||
+            word <= static_cast<size_t>(spec_->last_key));
+}
+
+size_t MemcachedTracker::Process(const char* buf, size_t len) {
+    size_t processed = 0;
+    while (processed < len && valid() && !complete()) {
+        if (state_ == State::DATA) {
+            const size_t count =
+                std::min<uint64_t>(len - processed, data_remaining_);
+            data_remaining_ -= count;
+            processed += count;
+            if (data_remaining_ == 0) {
+                DataDone();
+            }
+            continue;
+        }
+
+        const char c = buf[processed++];
+        if (c == '\n' || c == ' ' || c == '\r') {
+            if (in_word_) {
+                WordDone();
+            }
+            if (c == '\n' && valid()) {
+                LineDone();
+            }
+            continue;
+        }
+
+        if (!in_word_) {
+            in_word_ = true;
+            word_len_ = 0;
+            key_hash_ = CacheKeys::HASH_OFFSET;
+        }
+        if (word_len_ < WORD_CAP) {
+            word_[word_len_] = c;
+        }
+        ++word_len_;
+        if (type_ == Type::COMMAND && IsKey(word_index_)) {
+            key_hash_ = CacheKeys::Hash(key_hash_, &c, 1);
+        }
+    }
+    return processed;
+}
+
+void MemcachedTracker::WordDone() {
+    in_word_ = false;
+    word_len_ = std::min(word_len_, WORD_CAP);
+    const size_t index = word_index_++;
+
+    if (index == 0) {
+        verb_.assign(word_.data(), word_len_);
+        if (type_ == Type::COMMAND) {
+            spec_ = FindCommandSpec(word_.data(), word_len_);
+            if (!spec_) {
+                state_ = State::INVALID;
+            }
+        } else if (WordIs("VALUE") || WordIs("STAT") || WordIs("ITEM")) {
+            more_lines_ = true;
+        } else if (WordIs("ERROR") || WordIs("CLIENT_ERROR") ||
+                   WordIs("SERVER_ERROR")) {
+            error_ = true;
+        }
+        return;
+    }
+
+    if (type_ == Type::REPLY) {
+        // Values of get are followed by a data block, and so are the values
+        // of meta commands
+        if ((verb_ == "VALUE" && index == 3) || (verb_ == "VA" && index == 1)) {
+            data_len_ = ParseLength(word_.data(), word_len_);
+        }
+        return;
+    }
+
+    if (IsKey(index)) {
+        keys_.Add(key_hash_);
+    } else if (static_cast<int>(index) == spec_->data_len) {
+        data_len_ = ParseLength(word_.data(), word_len_);
+        if (data_len_ < 0) {
+            state_ = State::INVALID;
+        }
+    } else if (WordIs("noreply")) {
+        noreply_ = true;
+    } else if (spec_->first_flag > 0 &&
+               static_cast<int>(index) >= spec_->first_flag &&
+               word_[0] == 'q') {
+        // Quiet meta commands are only replied to on failure
+        quiet_ = true;
+    }
+}
+
+void MemcachedTracker::LineDone() {
+    const bool empty = word_index_ == 0;
+    word_index_ = 0;
+    if (empty) {
+        return;
+    }
+
+    if (data_len_ >= 0) {
+        data_remaining_ = data_len_ + 2;
+        data_len_ = -1;
+        state_ = State::DATA;
+        return;
+    }
+    if (type_ == Type::COMMAND && spec_->data_len >= 0) {
+        // Storage commands must have a data block
+        state_ = State::INVALID;
+        return;
+    }
+    // Lists of values end with END
+    if (!more_lines_ || verb_ == "END") {
+        state_ = State::DONE;
+    }
+}
+
+void MemcachedTracker::DataDone() {
+    state_ = more_lines_ ? State::LINE : State::DONE;
+}
+}
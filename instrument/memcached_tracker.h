@@ -0,0 +1,126 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "cache_session.h"
+
+namespace microtrace {
+
+struct MemcachedCommandSpec;
+
+/*
+ * Follows a single command or reply of the memcached text protocol, including
+ * meta commands, as it is sent or received, to find out where it ends.
+ * Messages can be passed in pieces of any size.
+ *
+ * Lines are split into words as they stream by, the keys of commands are
+ * counted and hashed, and only the first WORD_CAP bytes of other words are
+ * kept. Data blocks are skipped without being copied.
+ */
+class MemcachedTracker {
+   public:
+    enum class Type { COMMAND, REPLY };
+
+    static const char PROTOCOL[];
+
+    /*
+     * Enough for verbs, lengths, and flags.
+     */
+    static const size_t WORD_CAP = 24;
+
+    /*
+     * Returns true if buf starts with a memcached command.
+     */
+    static bool StartsWithCommand(const char* buf, size_t len);
+
+    MemcachedTracker(const Type type);
+
+    /*
+     * Starts tracking a new message.
+     */
+    void Reset();
+
+    /*
+     * Processes the next len bytes of the message. Returns the number of bytes
+     * that belong to it, which is less than len only if the message has
+     * completed or turned out to be invalid.
+     */
+    size_t Process(const char* buf, size_t len);
+
+    bool complete() const { return state_ == State::DONE; }
+    bool valid() const { return state_ != State::INVALID; }
+
+    /*
+     * Returns the verb of a command, e.g. get.
+     */
+    const std::string& verb() const { return verb_; }
+
+    const CacheKeys& keys() const { return keys_; }
+
+    /*
+     * Returns false for commands that are not replied to, e.g. ones with
+     * noreply, or quiet meta commands.
+     */
+    bool expects_reply() const;
+
+    /*
+     * Returns true if the reply is an error.
+     */
+    bool error() const { return error_; }
+
+   private:
+    enum class State { LINE, DATA, DONE, INVALID };
+
+    void WordDone();
+    void LineDone();
+
+    /*
+     * Called when a data block has been read, with its CRLF.
+     */
+    void DataDone();
+
+    bool IsKey(const size_t word) const;
+
+    /*
+     * Returns true if the current word equals str.
+     */
+    bool WordIs(const char* str) const;
+
+    const Type type_;
+    State state_;
+
+    /*
+     * The word being read, and its index in the line.
+     */
+    std::array<char, WORD_CAP> word_;
+    size_t word_len_;
+    bool in_word_;
+    size_t word_index_;
+    uint64_t key_hash_;
+
+    const MemcachedCommandSpec* spec_;
+
+    /*
+     * The length of the data block that follows the line, or -1 if there is
+     * none.
+     */
+    int64_t data_len_;
+    uint64_t data_remaining_;
+
+    /*
+     * Indicates if the line of a reply is followed by more lines, e.g. VALUE
+     * lines of a get.
+     */
+    bool more_lines_;
+
+    bool noreply_;
+    bool quiet_;
+
+    std::string verb_;
+    CacheKeys keys_;
+    bool error_;
+};
+}
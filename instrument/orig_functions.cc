@@ -20,21 +20,56 @@ OriginalFunctionsImpl::OriginalFunctionsImpl() {
     ORIG(orig_socket, "socket");
     ORIG(orig_connect, "connect");
     ORIG(orig_close, "close");
+    ORIG(orig_dup, "dup");
+    ORIG(orig_dup2, "dup2");
+    ORIG(orig_dup3, "dup3");
     ORIG(orig_recvfrom, "recvfrom");
     ORIG(orig_accept, "accept");
     ORIG(orig_accept4, "accept4");
     ORIG(orig_recv, "recv");
     ORIG(orig_read, "read");
+    ORIG(orig_readv, "readv");
+    ORIG(orig_recvmsg, "recvmsg");
+    ORIG(orig_recvmmsg, "recvmmsg");
     ORIG(orig_write, "write");
     ORIG(orig_writev, "writev");
     ORIG(orig_send, "send");
     ORIG(orig_sendto, "sendto");
     ORIG(orig_sendmsg, "sendmsg");
     ORIG(orig_sendmmsg, "sendmmsg");
+    ORIG(orig_sendfile, "sendfile");
+    ORIG(orig_splice, "splice");
+    ORIG(orig_fcntl, "fcntl");
+    ORIG(orig_ioctl, "ioctl");
+    ORIG(orig_getsockopt, "getsockopt");
+    ORIG(orig_epoll_ctl, "epoll_ctl");
+    ORIG(orig_epoll_wait, "epoll_wait");
+
+    ORIG(orig_pthread_create, "pthread_create");
+
+    ORIG(orig_swapcontext, "swapcontext");
+    ORIG(orig_setcontext, "setcontext");
+
+    ORIG(orig_io_uring_submit, "io_uring_submit");
+    ORIG(orig_io_uring_submit_and_wait, "io_uring_submit_and_wait");
+    ORIG(orig___io_uring_get_cqe, "__io_uring_get_cqe");
+    ORIG(orig_io_uring_wait_cqes, "io_uring_wait_cqes");
+    ORIG(orig_io_uring_peek_batch_cqe, "io_uring_peek_batch_cqe");
+    ORIG(orig_io_uring_queue_exit, "io_uring_queue_exit");
 
     ORIG(orig_uv_tcp_connect, "uv_tcp_connect");
     ORIG(orig_uv_accept, "uv_accept");
     ORIG(orig_uv_getaddrinfo, "uv_getaddrinfo");
+    ORIG(orig_uv_write, "uv_write");
+    ORIG(orig_uv_queue_work, "uv_queue_work");
+    ORIG(orig_uv_timer_start, "uv_timer_start");
+    ORIG(orig_uv_close, "uv_close");
+    ORIG(orig_uv_fs_open, "uv_fs_open");
+    ORIG(orig_uv_fs_close, "uv_fs_close");
+    ORIG(orig_uv_fs_read, "uv_fs_read");
+    ORIG(orig_uv_fs_write, "uv_fs_write");
+    ORIG(orig_uv_fs_stat, "uv_fs_stat");
+    ORIG(orig_uv_fs_fstat, "uv_fs_fstat");
 
     ORIG(orig_getpeername, "getpeername");
     ORIG(orig_getsockname, "getsockname");
@@ -51,6 +86,16 @@ int OriginalFunctionsImpl::connect(int sockfd, const struct sockaddr *addr,
 
 int OriginalFunctionsImpl::close(int fd) const { return orig_close(fd); }
 
+int OriginalFunctionsImpl::dup(int oldfd) const { return orig_dup(oldfd); }
+
+int OriginalFunctionsImpl::dup2(int oldfd, int newfd) const {
+    return orig_dup2(oldfd, newfd);
+}
+
+int OriginalFunctionsImpl::dup3(int oldfd, int newfd, int flags) const {
+    return orig_dup3(oldfd, newfd, flags);
+}
+
 int OriginalFunctionsImpl::accept(int sockfd, struct sockaddr *addr,
                                   socklen_t *addrlen) const {
     return orig_accept(sockfd, addr, addrlen);
@@ -76,6 +121,22 @@ ssize_t OriginalFunctionsImpl::recvfrom(int sockfd, void *buf, size_t len,
     return orig_recvfrom(sockfd, buf, len, flags, src_addr, addrlen);
 }
 
+ssize_t OriginalFunctionsImpl::readv(int fd, const struct iovec *iov,
+                                     int iovcnt) const {
+    return orig_readv(fd, iov, iovcnt);
+}
+
+ssize_t OriginalFunctionsImpl::recvmsg(int sockfd, struct msghdr *msg,
+                                       int flags) const {
+    return orig_recvmsg(sockfd, msg, flags);
+}
+
+int OriginalFunctionsImpl::recvmmsg(int sockfd, struct mmsghdr *msgvec,
+                                    unsigned int vlen, int flags,
+                                    struct timespec *timeout) const {
+    return orig_recvmmsg(sockfd, msgvec, vlen, flags, timeout);
+}
+
 ssize_t OriginalFunctionsImpl::write(int fd, const void *buf,
                                      size_t count) const {
     return orig_write(fd, buf, count);
@@ -108,6 +169,91 @@ int OriginalFunctionsImpl::sendmmsg(int sockfd, struct mmsghdr *msgvec,
     return orig_sendmmsg(sockfd, msgvec, vlen, flags);
 }
 
+ssize_t OriginalFunctionsImpl::sendfile(int out_fd, int in_fd, off_t *offset,
+                                        size_t count) const {
+    return orig_sendfile(out_fd, in_fd, offset, count);
+}
+
+ssize_t OriginalFunctionsImpl::splice(int fd_in, loff_t *off_in, int fd_out,
+                                      loff_t *off_out, size_t len,
+                                      unsigned int flags) const {
+    return orig_splice(fd_in, off_in, fd_out, off_out, len, flags);
+}
+
+int OriginalFunctionsImpl::fcntl(int fd, int cmd, void *arg) const {
+    return orig_fcntl(fd, cmd, arg);
+}
+
+int OriginalFunctionsImpl::ioctl(int fd, unsigned long request,
+                                 void *arg) const {
+    return orig_ioctl(fd, request, arg);
+}
+
+int OriginalFunctionsImpl::getsockopt(int sockfd, int level, int optname,
+                                      void *optval, socklen_t *optlen) const {
+    return orig_getsockopt(sockfd, level, optname, optval, optlen);
+}
+
+int OriginalFunctionsImpl::epoll_ctl(int epfd, int op, int fd,
+                                     struct epoll_event *event) const {
+    return orig_epoll_ctl(epfd, op, fd, event);
+}
+
+int OriginalFunctionsImpl::epoll_wait(int epfd, struct epoll_event *events,
+                                      int maxevents, int timeout) const {
+    return orig_epoll_wait(epfd, events, maxevents, timeout);
+}
+
+int OriginalFunctionsImpl::pthread_create(pthread_t *thread,
+                                          const pthread_attr_t *attr,
+                                          void *(*start_routine)(void *),
+                                          void *arg) const {
+    return orig_pthread_create(thread, attr, start_routine, arg);
+}
+
+int OriginalFunctionsImpl::swapcontext(ucontext_t *oucp,
+                                       const ucontext_t *ucp) const {
+    return orig_swapcontext(oucp, ucp);
+}
+
+int OriginalFunctionsImpl::setcontext(const ucontext_t *ucp) const {
+    return orig_setcontext(ucp);
+}
+
+int OriginalFunctionsImpl::io_uring_submit(struct io_uring *ring) const {
+    return orig_io_uring_submit(ring);
+}
+
+int OriginalFunctionsImpl::io_uring_submit_and_wait(struct io_uring *ring,
+                                                    unsigned wait_nr) const {
+    return orig_io_uring_submit_and_wait(ring, wait_nr);
+}
+
+int OriginalFunctionsImpl::__io_uring_get_cqe(struct io_uring *ring,
+                                              struct io_uring_cqe **cqe_ptr,
+                                              unsigned submit,
+                                              unsigned wait_nr,
+                                              sigset_t *sigmask) const {
+    return orig___io_uring_get_cqe(ring, cqe_ptr, submit, wait_nr, sigmask);
+}
+
+int OriginalFunctionsImpl::io_uring_wait_cqes(struct io_uring *ring,
+                                              struct io_uring_cqe **cqe_ptr,
+                                              unsigned wait_nr,
+                                              struct __kernel_timespec *ts,
+                                              sigset_t *sigmask) const {
+    return orig_io_uring_wait_cqes(ring, cqe_ptr, wait_nr, ts, sigmask);
+}
+
+unsigned OriginalFunctionsImpl::io_uring_peek_batch_cqe(
+    struct io_uring *ring, struct io_uring_cqe **cqes, unsigned count) const {
+    return orig_io_uring_peek_batch_cqe(ring, cqes, count);
+}
+
+void OriginalFunctionsImpl::io_uring_queue_exit(struct io_uring *ring) const {
+    orig_io_uring_queue_exit(ring);
+}
+
 int OriginalFunctionsImpl::uv_tcp_connect(uv_connect_t *req, uv_tcp_t *handle,
                                           const struct sockaddr *addr,
                                           uv_connect_cb cb) const {
@@ -127,6 +273,64 @@ int OriginalFunctionsImpl::uv_getaddrinfo(uv_loop_t *loop,
     return orig_uv_getaddrinfo(loop, req, getaddrinfo_cb, node, service, hints);
 }
 
+int OriginalFunctionsImpl::uv_write(uv_write_t *req, uv_stream_t *handle,
+                                    const uv_buf_t *bufs, unsigned int nbufs,
+                                    uv_write_cb cb) const {
+    return orig_uv_write(req, handle, bufs, nbufs, cb);
+}
+
+int OriginalFunctionsImpl::uv_queue_work(uv_loop_t *loop, uv_work_t *req,
+                                         uv_work_cb work_cb,
+                                         uv_after_work_cb after_work_cb) const {
+    return orig_uv_queue_work(loop, req, work_cb, after_work_cb);
+}
+
+int OriginalFunctionsImpl::uv_timer_start(uv_timer_t *handle, uv_timer_cb cb,
+                                          uint64_t timeout,
+                                          uint64_t repeat) const {
+    return orig_uv_timer_start(handle, cb, timeout, repeat);
+}
+
+void OriginalFunctionsImpl::uv_close(uv_handle_t *handle,
+                                     uv_close_cb close_cb) const {
+    orig_uv_close(handle, close_cb);
+}
+
+int OriginalFunctionsImpl::uv_fs_open(uv_loop_t *loop, uv_fs_t *req,
+                                      const char *path, int flags, int mode,
+                                      uv_fs_cb cb) const {
+    return orig_uv_fs_open(loop, req, path, flags, mode, cb);
+}
+
+int OriginalFunctionsImpl::uv_fs_close(uv_loop_t *loop, uv_fs_t *req,
+                                       uv_file file, uv_fs_cb cb) const {
+    return orig_uv_fs_close(loop, req, file, cb);
+}
+
+int OriginalFunctionsImpl::uv_fs_read(uv_loop_t *loop, uv_fs_t *req,
+                                      uv_file file, const uv_buf_t *bufs,
+                                      unsigned int nbufs, int64_t offset,
+                                      uv_fs_cb cb) const {
+    return orig_uv_fs_read(loop, req, file, bufs, nbufs, offset, cb);
+}
+
+int OriginalFunctionsImpl::uv_fs_write(uv_loop_t *loop, uv_fs_t *req,
+                                       uv_file file, const uv_buf_t *bufs,
+                                       unsigned int nbufs, int64_t offset,
+                                       uv_fs_cb cb) const {
+    return orig_uv_fs_write(loop, req, file, bufs, nbufs, offset, cb);
+}
+
+int OriginalFunctionsImpl::uv_fs_stat(uv_loop_t *loop, uv_fs_t *req,
+                                      const char *path, uv_fs_cb cb) const {
+    return orig_uv_fs_stat(loop, req, path, cb);
+}
+
+int OriginalFunctionsImpl::uv_fs_fstat(uv_loop_t *loop, uv_fs_t *req,
+                                       uv_file file, uv_fs_cb cb) const {
+    return orig_uv_fs_fstat(loop, req, file, cb);
+}
+
 int OriginalFunctionsImpl::getpeername(int sockfd, struct sockaddr *addr,
                                        socklen_t *addrlen) const {
     return orig_getpeername(sockfd, addr, addrlen);
@@ -2,8 +2,15 @@
 
 #include <arpa/inet.h>
 #include <dlfcn.h>
+#include <liburing.h>
 #include <netinet/in.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <ucontext.h>
 
 #include "uv.h"
 
@@ -28,6 +35,9 @@ class OriginalFunctions {
     virtual int connect(int sockfd, const struct sockaddr *addr,
                         socklen_t addrlen) const = 0;
     virtual int close(int fd) const = 0;
+    virtual int dup(int oldfd) const = 0;
+    virtual int dup2(int oldfd, int newfd) const = 0;
+    virtual int dup3(int oldfd, int newfd, int flags) const = 0;
     virtual int accept(int sockfd, struct sockaddr *addr,
                        socklen_t *addrlen) const = 0;
     virtual int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen,
@@ -38,6 +48,12 @@ class OriginalFunctions {
     virtual ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags,
                              struct sockaddr *src_addr,
                              socklen_t *addrlen) const = 0;
+    virtual ssize_t readv(int fd, const struct iovec *iov,
+                          int iovcnt) const = 0;
+    virtual ssize_t recvmsg(int sockfd, struct msghdr *msg,
+                            int flags) const = 0;
+    virtual int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
+                         int flags, struct timespec *timeout) const = 0;
     virtual ssize_t write(int fd, const void *buf, size_t count) const = 0;
     virtual ssize_t writev(int fd, const struct iovec *iov,
                            int iovcnt) const = 0;
@@ -50,6 +66,48 @@ class OriginalFunctions {
                             int flags) const = 0;
     virtual int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
                          int flags) const = 0;
+    virtual ssize_t sendfile(int out_fd, int in_fd, off_t *offset,
+                             size_t count) const = 0;
+    virtual ssize_t splice(int fd_in, loff_t *off_in, int fd_out,
+                           loff_t *off_out, size_t len,
+                           unsigned int flags) const = 0;
+
+    /*
+     * The variadic argument of fcntl and ioctl is passed on as a pointer,
+     * which also carries the integer arguments in the calling convention.
+     */
+    virtual int fcntl(int fd, int cmd, void *arg) const = 0;
+    virtual int ioctl(int fd, unsigned long request, void *arg) const = 0;
+    virtual int getsockopt(int sockfd, int level, int optname, void *optval,
+                           socklen_t *optlen) const = 0;
+    virtual int epoll_ctl(int epfd, int op, int fd,
+                          struct epoll_event *event) const = 0;
+    virtual int epoll_wait(int epfd, struct epoll_event *events,
+                           int maxevents, int timeout) const = 0;
+
+    virtual int pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                               void *(*start_routine)(void *),
+                               void *arg) const = 0;
+
+    virtual int swapcontext(ucontext_t *oucp, const ucontext_t *ucp) const = 0;
+    virtual int setcontext(const ucontext_t *ucp) const = 0;
+
+    virtual int io_uring_submit(struct io_uring *ring) const = 0;
+    virtual int io_uring_submit_and_wait(struct io_uring *ring,
+                                         unsigned wait_nr) const = 0;
+    virtual int __io_uring_get_cqe(struct io_uring *ring,
+                                   struct io_uring_cqe **cqe_ptr,
+                                   unsigned submit, unsigned wait_nr,
+                                   sigset_t *sigmask) const = 0;
+    virtual int io_uring_wait_cqes(struct io_uring *ring,
+                                   struct io_uring_cqe **cqe_ptr,
+                                   unsigned wait_nr,
+                                   struct __kernel_timespec *ts,
+                                   sigset_t *sigmask) const = 0;
+    virtual unsigned io_uring_peek_batch_cqe(struct io_uring *ring,
+                                             struct io_uring_cqe **cqes,
+                                             unsigned count) const = 0;
+    virtual void io_uring_queue_exit(struct io_uring *ring) const = 0;
 
     virtual int uv_tcp_connect(uv_connect_t *req, uv_tcp_t *handle,
                                const struct sockaddr *addr,
@@ -59,6 +117,29 @@ class OriginalFunctions {
                                uv_getaddrinfo_cb getaddrinfo_cb,
                                const char *node, const char *service,
                                const struct addrinfo *hints) const = 0;
+    virtual int uv_write(uv_write_t *req, uv_stream_t *handle,
+                         const uv_buf_t *bufs, unsigned int nbufs,
+                         uv_write_cb cb) const = 0;
+    virtual int uv_queue_work(uv_loop_t *loop, uv_work_t *req,
+                              uv_work_cb work_cb,
+                              uv_after_work_cb after_work_cb) const = 0;
+    virtual int uv_timer_start(uv_timer_t *handle, uv_timer_cb cb,
+                               uint64_t timeout, uint64_t repeat) const = 0;
+    virtual void uv_close(uv_handle_t *handle, uv_close_cb close_cb) const = 0;
+    virtual int uv_fs_open(uv_loop_t *loop, uv_fs_t *req, const char *path,
+                           int flags, int mode, uv_fs_cb cb) const = 0;
+    virtual int uv_fs_close(uv_loop_t *loop, uv_fs_t *req, uv_file file,
+                            uv_fs_cb cb) const = 0;
+    virtual int uv_fs_read(uv_loop_t *loop, uv_fs_t *req, uv_file file,
+                           const uv_buf_t *bufs, unsigned int nbufs,
+                           int64_t offset, uv_fs_cb cb) const = 0;
+    virtual int uv_fs_write(uv_loop_t *loop, uv_fs_t *req, uv_file file,
+                            const uv_buf_t *bufs, unsigned int nbufs,
+                            int64_t offset, uv_fs_cb cb) const = 0;
+    virtual int uv_fs_stat(uv_loop_t *loop, uv_fs_t *req, const char *path,
+                           uv_fs_cb cb) const = 0;
+    virtual int uv_fs_fstat(uv_loop_t *loop, uv_fs_t *req, uv_file file,
+                            uv_fs_cb cb) const = 0;
 
     virtual int getpeername(int sockfd, struct sockaddr *addr,
                             socklen_t *addrlen) const = 0;
@@ -74,6 +155,9 @@ class OriginalFunctionsImpl : public OriginalFunctions {
     typedef int (*orig_connect_t)(int sockfd, const struct sockaddr *addr,
                                   socklen_t addrlen);
     typedef int (*orig_close_t)(int fd);
+    typedef int (*orig_dup_t)(int oldfd);
+    typedef int (*orig_dup2_t)(int oldfd, int newfd);
+    typedef int (*orig_dup3_t)(int oldfd, int newfd, int flags);
     typedef int (*orig_accept_t)(int sockfd, struct sockaddr *addr,
                                  socklen_t *addrlen);
     typedef int (*orig_accept4_t)(int sockfd, struct sockaddr *addr,
@@ -84,6 +168,13 @@ class OriginalFunctionsImpl : public OriginalFunctions {
     typedef ssize_t (*orig_recvfrom_t)(int sockfd, void *buf, size_t len,
                                        int flags, struct sockaddr *src_addr,
                                        socklen_t *addrlen);
+    typedef ssize_t (*orig_readv_t)(int fd, const struct iovec *iov,
+                                    int iovcnt);
+    typedef ssize_t (*orig_recvmsg_t)(int sockfd, struct msghdr *msg,
+                                      int flags);
+    typedef int (*orig_recvmmsg_t)(int sockfd, struct mmsghdr *msgvec,
+                                   unsigned int vlen, int flags,
+                                   struct timespec *timeout);
     typedef ssize_t (*orig_write_t)(int fd, const void *buf, size_t count);
     typedef ssize_t (*orig_writev_t)(int fd, const struct iovec *iov,
                                      int iovcnt);
@@ -97,6 +188,46 @@ class OriginalFunctionsImpl : public OriginalFunctions {
                                       int flags);
     typedef int (*orig_sendmmsg_t)(int sockfd, struct mmsghdr *msgvec,
                                    unsigned int vlen, int flags);
+    typedef ssize_t (*orig_sendfile_t)(int out_fd, int in_fd, off_t *offset,
+                                       size_t count);
+    typedef ssize_t (*orig_splice_t)(int fd_in, loff_t *off_in, int fd_out,
+                                     loff_t *off_out, size_t len,
+                                     unsigned int flags);
+    typedef int (*orig_fcntl_t)(int fd, int cmd, ...);
+    typedef int (*orig_ioctl_t)(int fd, unsigned long request, ...);
+    typedef int (*orig_getsockopt_t)(int sockfd, int level, int optname,
+                                     void *optval, socklen_t *optlen);
+    typedef int (*orig_epoll_ctl_t)(int epfd, int op, int fd,
+                                    struct epoll_event *event);
+    typedef int (*orig_epoll_wait_t)(int epfd, struct epoll_event *events,
+                                     int maxevents, int timeout);
+
+    /* Libpthread functions */
+    typedef int (*orig_pthread_create_t)(pthread_t *thread,
+                                         const pthread_attr_t *attr,
+                                         void *(*start_routine)(void *),
+                                         void *arg);
+
+    /* Ucontext functions */
+    typedef int (*orig_swapcontext_t)(ucontext_t *oucp, const ucontext_t *ucp);
+    typedef int (*orig_setcontext_t)(const ucontext_t *ucp);
+
+    /* Liburing functions */
+    typedef int (*orig_io_uring_submit_t)(struct io_uring *ring);
+    typedef int (*orig_io_uring_submit_and_wait_t)(struct io_uring *ring,
+                                                   unsigned wait_nr);
+    typedef int (*orig___io_uring_get_cqe_t)(struct io_uring *ring,
+                                             struct io_uring_cqe **cqe_ptr,
+                                             unsigned submit, unsigned wait_nr,
+                                             sigset_t *sigmask);
+    typedef int (*orig_io_uring_wait_cqes_t)(struct io_uring *ring,
+                                             struct io_uring_cqe **cqe_ptr,
+                                             unsigned wait_nr,
+                                             struct __kernel_timespec *ts,
+                                             sigset_t *sigmask);
+    typedef unsigned (*orig_io_uring_peek_batch_cqe_t)(
+        struct io_uring *ring, struct io_uring_cqe **cqes, unsigned count);
+    typedef void (*orig_io_uring_queue_exit_t)(struct io_uring *ring);
 
     /* Libuv functions */
     typedef int (*orig_uv_tcp_connect_t)(uv_connect_t *req, uv_tcp_t *handle,
@@ -107,6 +238,32 @@ class OriginalFunctionsImpl : public OriginalFunctions {
                                          uv_getaddrinfo_cb getaddrinfo_cb,
                                          const char *node, const char *service,
                                          const struct addrinfo *hints);
+    typedef int (*orig_uv_write_t)(uv_write_t *req, uv_stream_t *handle,
+                                   const uv_buf_t *bufs, unsigned int nbufs,
+                                   uv_write_cb cb);
+    typedef int (*orig_uv_queue_work_t)(uv_loop_t *loop, uv_work_t *req,
+                                        uv_work_cb work_cb,
+                                        uv_after_work_cb after_work_cb);
+    typedef int (*orig_uv_timer_start_t)(uv_timer_t *handle, uv_timer_cb cb,
+                                         uint64_t timeout, uint64_t repeat);
+    typedef void (*orig_uv_close_t)(uv_handle_t *handle, uv_close_cb close_cb);
+    typedef int (*orig_uv_fs_open_t)(uv_loop_t *loop, uv_fs_t *req,
+                                     const char *path, int flags, int mode,
+                                     uv_fs_cb cb);
+    typedef int (*orig_uv_fs_close_t)(uv_loop_t *loop, uv_fs_t *req,
+                                      uv_file file, uv_fs_cb cb);
+    typedef int (*orig_uv_fs_read_t)(uv_loop_t *loop, uv_fs_t *req,
+                                     uv_file file, const uv_buf_t *bufs,
+                                     unsigned int nbufs, int64_t offset,
+                                     uv_fs_cb cb);
+    typedef int (*orig_uv_fs_write_t)(uv_loop_t *loop, uv_fs_t *req,
+                                      uv_file file, const uv_buf_t *bufs,
+                                      unsigned int nbufs, int64_t offset,
+                                      uv_fs_cb cb);
+    typedef int (*orig_uv_fs_stat_t)(uv_loop_t *loop, uv_fs_t *req,
+                                     const char *path, uv_fs_cb cb);
+    typedef int (*orig_uv_fs_fstat_t)(uv_loop_t *loop, uv_fs_t *req,
+                                      uv_file file, uv_fs_cb cb);
 
     /* Functions that need to be mocked for unit testing */
     typedef int (*orig_getpeername_t)(int sockfd, struct sockaddr *addr,
@@ -121,6 +278,9 @@ class OriginalFunctionsImpl : public OriginalFunctions {
     int connect(int sockfd, const struct sockaddr *addr,
                 socklen_t addrlen) const override;
     int close(int fd) const override;
+    int dup(int oldfd) const override;
+    int dup2(int oldfd, int newfd) const override;
+    int dup3(int oldfd, int newfd, int flags) const override;
     int accept(int sockfd, struct sockaddr *addr,
                socklen_t *addrlen) const override;
     int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen,
@@ -130,6 +290,10 @@ class OriginalFunctionsImpl : public OriginalFunctions {
     ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags,
                      struct sockaddr *src_addr,
                      socklen_t *addrlen) const override;
+    ssize_t readv(int fd, const struct iovec *iov, int iovcnt) const override;
+    ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) const override;
+    int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
+                 int flags, struct timespec *timeout) const override;
     ssize_t write(int fd, const void *buf, size_t count) const override;
     ssize_t writev(int fd, const struct iovec *iov, int iovcnt) const override;
     ssize_t send(int sockfd, const void *buf, size_t len,
@@ -141,6 +305,41 @@ class OriginalFunctionsImpl : public OriginalFunctions {
                     int flags) const override;
     int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
                  int flags) const override;
+    ssize_t sendfile(int out_fd, int in_fd, off_t *offset,
+                     size_t count) const override;
+    ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out,
+                   size_t len, unsigned int flags) const override;
+    int fcntl(int fd, int cmd, void *arg) const override;
+    int ioctl(int fd, unsigned long request, void *arg) const override;
+    int getsockopt(int sockfd, int level, int optname, void *optval,
+                   socklen_t *optlen) const override;
+    int epoll_ctl(int epfd, int op, int fd,
+                  struct epoll_event *event) const override;
+    int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+                   int timeout) const override;
+
+    int pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                       void *(*start_routine)(void *),
+                       void *arg) const override;
+
+    int swapcontext(ucontext_t *oucp, const ucontext_t *ucp) const override;
+    int setcontext(const ucontext_t *ucp) const override;
+
+    int io_uring_submit(struct io_uring *ring) const override;
+    int io_uring_submit_and_wait(struct io_uring *ring,
+                                 unsigned wait_nr) const override;
+    int __io_uring_get_cqe(struct io_uring *ring,
+                           struct io_uring_cqe **cqe_ptr, unsigned submit,
+                           unsigned wait_nr,
+                           sigset_t *sigmask) const override;
+    int io_uring_wait_cqes(struct io_uring *ring,
+                           struct io_uring_cqe **cqe_ptr, unsigned wait_nr,
+                           struct __kernel_timespec *ts,
+                           sigset_t *sigmask) const override;
+    unsigned io_uring_peek_batch_cqe(struct io_uring *ring,
+                                     struct io_uring_cqe **cqes,
+                                     unsigned count) const override;
+    void io_uring_queue_exit(struct io_uring *ring) const override;
 
     int uv_tcp_connect(uv_connect_t *req, uv_tcp_t *handle,
                        const struct sockaddr *addr,
@@ -150,6 +349,27 @@ class OriginalFunctionsImpl : public OriginalFunctions {
                        uv_getaddrinfo_cb getaddrinfo_cb, const char *node,
                        const char *service,
                        const struct addrinfo *hints) const override;
+    int uv_write(uv_write_t *req, uv_stream_t *handle, const uv_buf_t *bufs,
+                 unsigned int nbufs, uv_write_cb cb) const override;
+    int uv_queue_work(uv_loop_t *loop, uv_work_t *req, uv_work_cb work_cb,
+                      uv_after_work_cb after_work_cb) const override;
+    int uv_timer_start(uv_timer_t *handle, uv_timer_cb cb, uint64_t timeout,
+                       uint64_t repeat) const override;
+    void uv_close(uv_handle_t *handle, uv_close_cb close_cb) const override;
+    int uv_fs_open(uv_loop_t *loop, uv_fs_t *req, const char *path, int flags,
+                   int mode, uv_fs_cb cb) const override;
+    int uv_fs_close(uv_loop_t *loop, uv_fs_t *req, uv_file file,
+                    uv_fs_cb cb) const override;
+    int uv_fs_read(uv_loop_t *loop, uv_fs_t *req, uv_file file,
+                   const uv_buf_t *bufs, unsigned int nbufs, int64_t offset,
+                   uv_fs_cb cb) const override;
+    int uv_fs_write(uv_loop_t *loop, uv_fs_t *req, uv_file file,
+                    const uv_buf_t *bufs, unsigned int nbufs, int64_t offset,
+                    uv_fs_cb cb) const override;
+    int uv_fs_stat(uv_loop_t *loop, uv_fs_t *req, const char *path,
+                   uv_fs_cb cb) const override;
+    int uv_fs_fstat(uv_loop_t *loop, uv_fs_t *req, uv_file file,
+                    uv_fs_cb cb) const override;
 
     int getpeername(int sockfd, struct sockaddr *addr,
                     socklen_t *addrlen) const override;
@@ -160,20 +380,52 @@ class OriginalFunctionsImpl : public OriginalFunctions {
     orig_socket_t orig_socket;
     orig_connect_t orig_connect;
     orig_close_t orig_close;
+    orig_dup_t orig_dup;
+    orig_dup2_t orig_dup2;
+    orig_dup3_t orig_dup3;
     orig_recvfrom_t orig_recvfrom;
     orig_accept_t orig_accept;
     orig_accept4_t orig_accept4;
     orig_recv_t orig_recv;
     orig_read_t orig_read;
+    orig_readv_t orig_readv;
+    orig_recvmsg_t orig_recvmsg;
+    orig_recvmmsg_t orig_recvmmsg;
     orig_write_t orig_write;
     orig_writev_t orig_writev;
     orig_send_t orig_send;
     orig_sendto_t orig_sendto;
     orig_sendmsg_t orig_sendmsg;
     orig_sendmmsg_t orig_sendmmsg;
+    orig_sendfile_t orig_sendfile;
+    orig_splice_t orig_splice;
+    orig_fcntl_t orig_fcntl;
+    orig_ioctl_t orig_ioctl;
+    orig_getsockopt_t orig_getsockopt;
+    orig_epoll_ctl_t orig_epoll_ctl;
+    orig_epoll_wait_t orig_epoll_wait;
+    orig_pthread_create_t orig_pthread_create;
+    orig_swapcontext_t orig_swapcontext;
+    orig_setcontext_t orig_setcontext;
+    orig_io_uring_submit_t orig_io_uring_submit;
+    orig_io_uring_submit_and_wait_t orig_io_uring_submit_and_wait;
+    orig___io_uring_get_cqe_t orig___io_uring_get_cqe;
+    orig_io_uring_wait_cqes_t orig_io_uring_wait_cqes;
+    orig_io_uring_peek_batch_cqe_t orig_io_uring_peek_batch_cqe;
+    orig_io_uring_queue_exit_t orig_io_uring_queue_exit;
     orig_uv_tcp_connect_t orig_uv_tcp_connect;
     orig_uv_accept_t orig_uv_accept;
     orig_uv_getaddrinfo_t orig_uv_getaddrinfo;
+    orig_uv_write_t orig_uv_write;
+    orig_uv_queue_work_t orig_uv_queue_work;
+    orig_uv_timer_start_t orig_uv_timer_start;
+    orig_uv_close_t orig_uv_close;
+    orig_uv_fs_open_t orig_uv_fs_open;
+    orig_uv_fs_close_t orig_uv_fs_close;
+    orig_uv_fs_read_t orig_uv_fs_read;
+    orig_uv_fs_write_t orig_uv_fs_write;
+    orig_uv_fs_stat_t orig_uv_fs_stat;
+    orig_uv_fs_fstat_t orig_uv_fs_fstat;
     orig_getpeername_t orig_getpeername;
     orig_getsockname_t orig_getsockname;
 };
@@ -0,0 +1,145 @@
+#include "overhead_breaker.h"
+
+#include <algorithm>
+
+#include "common.h"
+
+namespace microtrace {
+
+/* OverheadBreaker */
+
+const uint32_t OverheadBreaker::FLUSH_EVERY;
+const int OverheadBreaker::PASS_THROUGH_LEVEL;
+
+OverheadBreaker::Options OverheadBreaker::DefaultOptions() {
+    Options options;
+    options.budget = GetEnvDouble("MICROTRACE_OVERHEAD_BUDGET", 0);
+    options.window_ns =
+        GetEnvLong("MICROTRACE_OVERHEAD_WINDOW_MS", 1000) * 1000000;
+    return options;
+}
+
+/*
+ * Cycles recorded by the current thread that haven't been flushed yet.
+ */
+struct LocalOverhead {
+    const OverheadBreaker* owner;
+    uint64_t cycles;
+    uint32_t hooks;
+};
+
+static thread_local LocalOverhead local_overhead = {nullptr, 0, 0};
+
+OverheadBreaker::OverheadBreaker(const Options& options, const Clock clock,
+                                 const CycleClock cycle_clock)
+    : options_(options),
+      enabled_(options.budget > 0),
+      clock_(clock),
+      cycle_clock_(cycle_clock),
+      level_(0),
+      spent_cycles_(0),
+      window_start_(clock()),
+      window_start_cycles_(cycle_clock()),
+      window_end_cycles_(window_start_cycles_ + options.window_ns) {
+    VERIFY(!enabled_ || options_.window_ns > 0,
+           "overhead window must be positive");
+}
+
+void OverheadBreaker::Record(const uint64_t start, const uint64_t end) {
+    auto& local = local_overhead;
+    if (local.owner != this) {
+        local = LocalOverhead{this, 0, 0};
+    }
+    local.cycles += end - start;
+    if (++local.hooks >= FLUSH_EVERY ||
+        end >= window_end_cycles_.load(std::memory_order_relaxed)) {
+        Flush(local.cycles, end);
+        local.cycles = 0;
+        local.hooks = 0;
+    }
+}
+
+void OverheadBreaker::Flush(const uint64_t cycles, const uint64_t now_cycles) {
+    spent_cycles_.fetch_add(cycles, std::memory_order_relaxed);
+
+    const int64_t now = clock_();
+    int64_t start = window_start_.load(std::memory_order_relaxed);
+    const int64_t elapsed = now - start;
+    if (elapsed < options_.window_ns) {
+        // Moves the estimated end of the window on the cycle clock to where
+        // the cycles that elapsed so far put it
+        const uint64_t elapsed_cycles =
+            now_cycles - window_start_cycles_.load(std::memory_order_relaxed);
+        if (elapsed > 0) {
+            const double left = static_cast<double>(options_.window_ns -
+                                                    elapsed) *
+                                elapsed_cycles / elapsed;
+            window_end_cycles_.store(now_cycles + static_cast<uint64_t>(left),
+                                     std::memory_order_relaxed);
+        }
+        return;
+    }
+    // Only the thread that manages to start the new window evaluates it
+    if (!window_start_.compare_exchange_strong(start, now)) {
+        return;
+    }
+
+    // The window is measured in cycles as well, so the cycle counter doesn't
+    // have to be calibrated
+    const uint64_t window_cycles =
+        now_cycles - window_start_cycles_.exchange(now_cycles);
+    window_end_cycles_.store(now_cycles + window_cycles,
+                             std::memory_order_relaxed);
+    const uint64_t spent = spent_cycles_.exchange(0);
+    if (window_cycles == 0) {
+        return;
+    }
+    Evaluate(static_cast<double>(spent) / window_cycles);
+}
+
+void OverheadBreaker::Evaluate(const double overhead) {
+    const int prev = level_.load(std::memory_order_relaxed);
+    int level = prev;
+    if (overhead > options_.budget) {
+        level = std::min(level + 1, PASS_THROUGH_LEVEL);
+        ++stats_.over_budget_windows;
+    } else if (overhead < options_.budget / 2) {
+        level = std::max(level - 1, 0);
+    }
+    level_.store(level, std::memory_order_relaxed);
+
+    stats_.level = level;
+    stats_.last_overhead_ppm = static_cast<uint64_t>(overhead * 1e6);
+    ++stats_.windows;
+
+    if (level != prev) {
+        console_log->warn("tracing overhead {} of wall time, throttle level {}",
+                          overhead, level);
+    }
+}
+
+/* ThrottledSampler */
+
+ThrottledSampler::ThrottledSampler(std::unique_ptr<Sampler> sampler,
+                                   const OverheadBreaker* breaker)
+    : sampler_(std::move(sampler)), breaker_(breaker) {}
+
+bool ThrottledSampler::Throttle(const int level) const {
+    if (level == 0) {
+        return true;
+    }
+    if (level >= OverheadBreaker::PASS_THROUGH_LEVEL) {
+        return false;
+    }
+    // Keeps one in every 4^level requests
+    return (next_random() >> (64 - 2 * level)) == 0;
+}
+
+bool ThrottledSampler::ShouldSample() {
+    return Throttle(breaker_->level()) && sampler_->ShouldSample();
+}
+
+bool ThrottledSampler::ShouldSampleUrl(const std::string& url) {
+    return Throttle(breaker_->level()) && sampler_->ShouldSampleUrl(url);
+}
+}
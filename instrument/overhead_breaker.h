@@ -0,0 +1,175 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "sampler.h"
+
+namespace microtrace {
+
+/*
+ * Returns the value of a cheap, monotonic cycle counter. Only differences
+ * between two values are meaningful.
+ */
+inline uint64_t cycle_count() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return steady_now_ns();
+#endif
+}
+
+/*
+ * Measures the time this library spends inside its hooks, and throttles
+ * tracing if it takes more than budget of the wall time.
+ *
+ * At the end of every window, the fraction of time spent in hooks is compared
+ * to the budget. If it is over, the level is raised by one, otherwise, if it
+ * is below half of the budget, it is lowered by one. At level 0, tracing is
+ * unaffected, every further level samples 4 times fewer requests, and at
+ * PASS_THROUGH_LEVEL nothing is traced, only the context is passed on.
+ *
+ * Threads add up their time locally, and only add it to the shared counter
+ * every FLUSH_EVERY hooks, or once the window is over. Hooks find out when the
+ * window is over from the cycle counter they read anyway, the end of the
+ * window on it is estimated from the clock whenever a thread flushes.
+ */
+class OverheadBreaker {
+   public:
+    typedef int64_t (*Clock)();
+    typedef uint64_t (*CycleClock)();
+
+    static const uint32_t FLUSH_EVERY = 64;
+    static const int PASS_THROUGH_LEVEL = 4;
+
+    struct Options {
+        /*
+         * Fraction of wall time that can be spent in hooks, the breaker is
+         * disabled if it is not positive.
+         */
+        double budget;
+
+        int64_t window_ns;
+    };
+
+    struct Stats {
+        std::atomic<int> level{0};
+
+        /*
+         * Time spent in hooks during the last window, in parts per million of
+         * the window.
+         */
+        std::atomic<uint64_t> last_overhead_ppm{0};
+
+        std::atomic<uint64_t> windows{0};
+        std::atomic<uint64_t> over_budget_windows{0};
+    };
+
+    /*
+     * Returns the options set through the environment.
+     */
+    static Options DefaultOptions();
+
+    OverheadBreaker(const Options& options, const Clock clock = &steady_now_ns,
+                    const CycleClock cycle_clock = &cycle_count);
+
+    /*
+     * Records that a hook ran from start to end on the cycle clock.
+     */
+    void Record(const uint64_t start, const uint64_t end);
+
+    bool enabled() const { return enabled_; }
+
+    int level() const { return level_.load(std::memory_order_relaxed); }
+
+    bool pass_through() const { return level() >= PASS_THROUGH_LEVEL; }
+
+    CycleClock cycle_clock() const { return cycle_clock_; }
+
+    const Stats& stats() const { return stats_; }
+
+   private:
+    /*
+     * Adds the calling thread's local cycles to the shared counter, and
+     * evaluates the window if it is over. now_cycles is the current value of
+     * the cycle clock.
+     */
+    void Flush(const uint64_t cycles, const uint64_t now_cycles);
+
+    void Evaluate(const double overhead);
+
+    const Options options_;
+    const bool enabled_;
+    const Clock clock_;
+    const CycleClock cycle_clock_;
+
+    std::atomic<int> level_;
+
+    std::atomic<uint64_t> spent_cycles_;
+    std::atomic<int64_t> window_start_;
+    std::atomic<uint64_t> window_start_cycles_;
+
+    // The estimated end of the window on the cycle clock, a cycle per
+    // nanosecond is assumed until the first flush
+    std::atomic<uint64_t> window_end_cycles_;
+
+    Stats stats_;
+};
+
+/*
+ * Measures the time from its construction until its destruction as time spent
+ * in a hook. It does nothing if breaker is disabled.
+ */
+class OverheadScope {
+   public:
+    OverheadScope(OverheadBreaker* breaker)
+        : breaker_(breaker->enabled() ? breaker : nullptr),
+          start_(breaker_ ? breaker_->cycle_clock()() : 0) {}
+
+    ~OverheadScope() {
+        if (breaker_) {
+            breaker_->Record(start_, breaker_->cycle_clock()());
+        }
+    }
+
+    OverheadScope(const OverheadScope&) = delete;
+
+   private:
+    OverheadBreaker* const breaker_;
+    const uint64_t start_;
+};
+
+/*
+ * Lowers the sampling rate of sampler according to the level of breaker.
+ */
+class ThrottledSampler : public Sampler {
+   public:
+    ThrottledSampler(std::unique_ptr<Sampler> sampler,
+                     const OverheadBreaker* breaker);
+
+    bool ShouldSample() override;
+
+    bool ShouldSampleUrl(const std::string& url) override;
+
+    /*
+     * Requests are not parsed in pass-through mode.
+     */
+    bool uses_url() const override {
+        return sampler_->uses_url() && !breaker_->pass_through();
+    }
+
+   private:
+    /*
+     * Returns false if the request must be dropped because of the level.
+     */
+    bool Throttle(const int level) const;
+
+    const std::unique_ptr<Sampler> sampler_;
+    const OverheadBreaker* const breaker_;
+};
+}
@@ -0,0 +1,291 @@
+#include "pq_tracker.h"
+
+#include <dlfcn.h>
+#include <link.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+#define PQ(func, name)                                 \
+    do {                                               \
+        func = (decltype(func))dlsym(handle, name);    \
+        VERIFY(func != nullptr, "{} not found", name); \
+    } while (0)
+
+namespace microtrace {
+
+/*
+ * Saves the path of the first loaded object whose name starts with libpq in
+ * data.
+ */
+static int FindLibpq(struct dl_phdr_info* info, size_t size, void* data) {
+    const char* slash = strrchr(info->dlpi_name, '/');
+    const char* name = slash == nullptr ? info->dlpi_name : slash + 1;
+    if (strncmp(name, "libpq.", 6) != 0 && strncmp(name, "libpq-", 6) != 0) {
+        return 0;
+    }
+    *static_cast<std::string*>(data) = info->dlpi_name;
+    return 1;
+}
+
+PqFunctions PqFunctions::Find() {
+    void* handle = RTLD_NEXT;
+    if (dlsym(handle, "PQexec") == nullptr) {
+        std::string path;
+        dl_iterate_phdr(&FindLibpq, &path);
+        VERIFY(!path.empty(), "libpq is not loaded");
+
+        // Only takes a reference, which is kept since the functions are used
+        // until exit
+        handle = dlopen(path.c_str(), RTLD_NOW | RTLD_NOLOAD);
+        VERIFY(handle != nullptr, "{} can't be opened", path);
+    }
+
+    PqFunctions pq;
+    PQ(pq.exec, "PQexec");
+    PQ(pq.exec_params, "PQexecParams");
+    PQ(pq.exec_prepared, "PQexecPrepared");
+    PQ(pq.send_query, "PQsendQuery");
+    PQ(pq.send_query_params, "PQsendQueryParams");
+    PQ(pq.send_query_prepared, "PQsendQueryPrepared");
+    PQ(pq.get_result, "PQgetResult");
+    PQ(pq.finish, "PQfinish");
+    PQ(pq.result_status, "PQresultStatus");
+    PQ(pq.ntuples, "PQntuples");
+    PQ(pq.nfields, "PQnfields");
+    PQ(pq.get_length, "PQgetlength");
+    PQ(pq.cmd_tuples, "PQcmdTuples");
+    return pq;
+}
+
+/*
+ * The depth of the blocking calls to libpq that the calling thread is in.
+ */
+static thread_local int in_libpq = 0;
+
+PqTracker::PqTracker(TraceLogger* logger, const Finder find)
+    : logger_(logger), find_(find), pending_count_(0) {}
+
+const PqFunctions& PqTracker::pq() {
+    std::call_once(found_, [this]() { pq_ = find_(); });
+    return pq_;
+}
+
+bool PqTracker::ShouldTrace() const {
+    return in_libpq == 0 && !is_context_undefined() &&
+           get_current_context().sampled();
+}
+
+PqQuery PqTracker::Start(const char* command, const bool prepared) {
+    PqQuery query;
+    query.context = get_current_context();
+    query.info = prepared ? "SQL: EXECUTE " : "SQL: ";
+    query.info += command;
+
+    Context next = query.context;
+    next.NewSpan();
+    set_current_context(next);
+
+    query.txn.Start();
+    return query;
+}
+
+template <typename F>
+PGresult* PqTracker::Blocking(const char* command, const bool prepared,
+                              F exec) {
+    if (!ShouldTrace()) {
+        return exec();
+    }
+    PqQuery query = Start(command, prepared);
+
+    ++in_libpq;
+    PGresult* res = exec();
+    --in_libpq;
+    query.txn.End();
+
+    // Only null if the query couldn't be sent, otherwise it is the last
+    // result
+    if (res == nullptr) {
+        query.error = true;
+    } else {
+        AddResult(&query, res);
+    }
+    Log(query);
+    return res;
+}
+
+template <typename F>
+int PqTracker::Send(PGconn* conn, const char* command, const bool prepared,
+                    F send) {
+    if (!ShouldTrace()) {
+        return send();
+    }
+    PqQuery query = Start(command, prepared);
+
+    ++in_libpq;
+    const int ret = send();
+    --in_libpq;
+
+    if (ret != 1) {
+        query.txn.End();
+        query.error = true;
+        Log(query);
+        return ret;
+    }
+
+    std::lock_guard<std::mutex> l(mu_);
+    pending_[conn] = std::move(query);
+    pending_count_.store(pending_.size(), std::memory_order_relaxed);
+    return ret;
+}
+
+PGresult* PqTracker::Exec(PGconn* conn, const char* command) {
+    return Blocking(command, false,
+                    [&]() { return pq().exec(conn, command); });
+}
+
+PGresult* PqTracker::ExecParams(PGconn* conn, const char* command,
+                                int nParams, const Oid* paramTypes,
+                                const char* const* paramValues,
+                                const int* paramLengths,
+                                const int* paramFormats, int resultFormat) {
+    return Blocking(command, false, [&]() {
+        return pq().exec_params(conn, command, nParams, paramTypes,
+                                paramValues, paramLengths, paramFormats,
+                                resultFormat);
+    });
+}
+
+PGresult* PqTracker::ExecPrepared(PGconn* conn, const char* stmtName,
+                                  int nParams, const char* const* paramValues,
+                                  const int* paramLengths,
+                                  const int* paramFormats, int resultFormat) {
+    return Blocking(stmtName, true, [&]() {
+        return pq().exec_prepared(conn, stmtName, nParams, paramValues,
+                                  paramLengths, paramFormats, resultFormat);
+    });
+}
+
+int PqTracker::SendQuery(PGconn* conn, const char* command) {
+    return Send(conn, command, false,
+                [&]() { return pq().send_query(conn, command); });
+}
+
+int PqTracker::SendQueryParams(PGconn* conn, const char* command, int nParams,
+                               const Oid* paramTypes,
+                               const char* const* paramValues,
+                               const int* paramLengths,
+                               const int* paramFormats, int resultFormat) {
+    return Send(conn, command, false, [&]() {
+        return pq().send_query_params(conn, command, nParams, paramTypes,
+                                      paramValues, paramLengths, paramFormats,
+                                      resultFormat);
+    });
+}
+
+int PqTracker::SendQueryPrepared(PGconn* conn, const char* stmtName,
+                                 int nParams, const char* const* paramValues,
+                                 const int* paramLengths,
+                                 const int* paramFormats, int resultFormat) {
+    return Send(conn, stmtName, true, [&]() {
+        return pq().send_query_prepared(conn, stmtName, nParams, paramValues,
+                                        paramLengths, paramFormats,
+                                        resultFormat);
+    });
+}
+
+PGresult* PqTracker::GetResult(PGconn* conn) {
+    PGresult* res = pq().get_result(conn);
+    if (in_libpq > 0 ||
+        pending_count_.load(std::memory_order_relaxed) == 0) {
+        return res;
+    }
+
+    PqQuery query;
+    {
+        std::lock_guard<std::mutex> l(mu_);
+        auto it = pending_.find(conn);
+        if (it == pending_.end()) {
+            return res;
+        }
+        if (res != nullptr) {
+            AddResult(&it->second, res);
+            return res;
+        }
+        query = std::move(it->second);
+        pending_.erase(it);
+        pending_count_.store(pending_.size(), std::memory_order_relaxed);
+    }
+
+    query.txn.End();
+    Log(query);
+    return res;
+}
+
+void PqTracker::Finish(PGconn* conn) {
+    if (pending_count_.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> l(mu_);
+        pending_.erase(conn);
+        pending_count_.store(pending_.size(), std::memory_order_relaxed);
+    }
+    pq().finish(conn);
+}
+
+void PqTracker::AddResult(PqQuery* query, const PGresult* res) {
+    const PqFunctions& pq = this->pq();
+    switch (pq.result_status(res)) {
+        case PGRES_TUPLES_OK:
+        case PGRES_SINGLE_TUPLE: {
+            const int rows = pq.ntuples(res);
+            const int fields = pq.nfields(res);
+            query->rows += rows;
+            for (int row = 0; row < rows; ++row) {
+                for (int field = 0; field < fields; ++field) {
+                    query->bytes += pq.get_length(res, row, field);
+                }
+            }
+            break;
+        }
+        case PGRES_COMMAND_OK:
+            // Empty for commands that don't affect rows
+            query->rows += strtoull(pq.cmd_tuples(const_cast<PGresult*>(res)),
+                                    nullptr, 10);
+            break;
+        case PGRES_BAD_RESPONSE:
+        case PGRES_FATAL_ERROR:
+            query->error = true;
+            break;
+        default:
+            break;
+    }
+}
+
+void PqTracker::Log(const PqQuery& query) {
+    proto::RequestLog log;
+    proto::Connection* log_conn = log.mutable_conn();
+    log_conn->set_server_hostname("Postgres Database");
+    log_conn->set_client_hostname(GetHostname());
+
+    const Context& context = query.context;
+    proto::Context* ctx = log.mutable_context();
+    ctx->mutable_trace_id()->set_high(context.trace().high());
+    ctx->mutable_trace_id()->set_low(context.trace().low());
+    ctx->mutable_span_id()->set_high(context.span().high());
+    ctx->mutable_span_id()->set_low(context.span().low());
+    ctx->mutable_parent_span()->set_high(context.parent_span().high());
+    ctx->mutable_parent_span()->set_low(context.parent_span().low());
+
+    log.set_transaction_count(1);
+    log.set_role(proto::RequestLog::CLIENT);
+    log.set_info(query.info);
+    query.txn.Fill(&log);
+    if (query.error) {
+        log.set_error(true);
+    }
+    log.set_row_count(query.rows);
+    log.set_result_bytes(query.bytes);
+
+    logger_->Log(log);
+}
+}
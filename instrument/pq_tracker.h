@@ -0,0 +1,177 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <libpq-fe.h>
+
+#include "context.h"
+#include "socket_handler.h"
+#include "trace_logger.h"
+
+namespace microtrace {
+
+/*
+ * The functions of libpq that are traced, and those that results are read
+ * with.
+ */
+struct PqFunctions {
+    /*
+     * Finds the functions of the libpq that the application uses. They are
+     * looked up with RTLD_NEXT, and among the loaded objects if that fails,
+     * since Python loads libraries such as the libpq of psycopg2 locally.
+     * Aborts if no libpq is loaded.
+     */
+    static PqFunctions Find();
+
+    decltype(&::PQexec) exec;
+    decltype(&::PQexecParams) exec_params;
+    decltype(&::PQexecPrepared) exec_prepared;
+    decltype(&::PQsendQuery) send_query;
+    decltype(&::PQsendQueryParams) send_query_params;
+    decltype(&::PQsendQueryPrepared) send_query_prepared;
+    decltype(&::PQgetResult) get_result;
+    decltype(&::PQfinish) finish;
+
+    decltype(&::PQresultStatus) result_status;
+    decltype(&::PQntuples) ntuples;
+    decltype(&::PQnfields) nfields;
+    decltype(&::PQgetlength) get_length;
+    decltype(&::PQcmdTuples) cmd_tuples;
+};
+
+/*
+ * A query whose span hasn't been logged yet.
+ */
+struct PqQuery {
+    PqQuery() : context(ContextStorage::Zero(), 0) {}
+
+    Context context;
+    std::string info;
+    Transaction txn;
+
+    uint64_t rows = 0;
+    uint64_t bytes = 0;
+    bool error = false;
+};
+
+/*
+ * PqTracker logs a span for every query that is sent through libpq while the
+ * current context is sampled. The Postgres sockets themselves aren't traced.
+ *
+ * The methods take the place of the libpq functions of the same name.
+ * Blocking queries are timed around the call. A query that is sent
+ * asynchronously completes when PQgetResult returns null, its span is logged
+ * with the context that was current when it was sent.
+ *
+ * The blocking functions of libpq are made of the asynchronous ones, those
+ * calls aren't traced a second time. Pipeline mode isn't followed, only the
+ * last query that was sent on a connection is.
+ */
+class PqTracker {
+   public:
+    typedef PqFunctions (*Finder)();
+
+    /*
+     * The functions are found with find when the first query is made, the
+     * application may load libpq after this library.
+     */
+    PqTracker(TraceLogger* logger, const Finder find = &PqFunctions::Find);
+
+    PqTracker(const PqTracker&) = delete;
+
+    PGresult* Exec(PGconn* conn, const char* command);
+    PGresult* ExecParams(PGconn* conn, const char* command, int nParams,
+                         const Oid* paramTypes, const char* const* paramValues,
+                         const int* paramLengths, const int* paramFormats,
+                         int resultFormat);
+    PGresult* ExecPrepared(PGconn* conn, const char* stmtName, int nParams,
+                           const char* const* paramValues,
+                           const int* paramLengths, const int* paramFormats,
+                           int resultFormat);
+
+    int SendQuery(PGconn* conn, const char* command);
+    int SendQueryParams(PGconn* conn, const char* command, int nParams,
+                        const Oid* paramTypes, const char* const* paramValues,
+                        const int* paramLengths, const int* paramFormats,
+                        int resultFormat);
+    int SendQueryPrepared(PGconn* conn, const char* stmtName, int nParams,
+                          const char* const* paramValues,
+                          const int* paramLengths, const int* paramFormats,
+                          int resultFormat);
+
+    PGresult* GetResult(PGconn* conn);
+
+    /*
+     * Forgets the query in flight on conn, which is closed.
+     */
+    void Finish(PGconn* conn);
+
+    /*
+     * Lock and unlock around fork, queries in flight are kept in the child,
+     * which shares their connections.
+     */
+    void PrepareFork() { mu_.lock(); }
+
+    void AfterFork() { mu_.unlock(); }
+
+    size_t pending() const { return pending_count_; }
+
+   private:
+    const PqFunctions& pq();
+
+    /*
+     * Returns true if a query that is sent now should be traced, i.e. the
+     * current context is sampled and libpq isn't calling itself.
+     */
+    bool ShouldTrace() const;
+
+    /*
+     * Starts the span of a query. command is either SQL or the name of a
+     * prepared statement. The current context moves on to a new span.
+     */
+    PqQuery Start(const char* command, const bool prepared);
+
+    /*
+     * Makes a blocking query with exec, and logs its span.
+     */
+    template <typename F>
+    PGresult* Blocking(const char* command, const bool prepared, F exec);
+
+    /*
+     * Sends a query with send, its span is logged when the last result has
+     * been read.
+     */
+    template <typename F>
+    int Send(PGconn* conn, const char* command, const bool prepared, F send);
+
+    /*
+     * Adds the rows and the size of res to query.
+     */
+    void AddResult(PqQuery* query, const PGresult* res);
+
+    void Log(const PqQuery& query);
+
+    TraceLogger* const logger_;
+
+    const Finder find_;
+    std::once_flag found_;
+    PqFunctions pq_;
+
+    // Guards pending_
+    std::mutex mu_;
+
+    /*
+     * The queries that were sent asynchronously, by connection.
+     */
+    std::unordered_map<const PGconn*, PqQuery> pending_;
+
+    /*
+     * The size of pending_, so that results are read without locking while
+     * no query is in flight.
+     */
+    std::atomic<size_t> pending_count_;
+};
+}
@@ -0,0 +1,93 @@
+#include "protocol_session.h"
+
+#include "common.h"
+#include "http2_tracker.h"
+#include "http_processor.h"
+#include "thrift_tracker.h"
+
+namespace microtrace {
+
+/*
+ * Returns true if buf starts with the header of a TLS handshake record, which
+ * is what clients send first.
+ */
+static bool StartsWithTlsHandshake(const char* buf, size_t len) {
+    static const char HANDSHAKE = 0x16;
+    static const char MAJOR_VERSION = 0x03;
+    return len >= 3 && buf[0] == HANDSHAKE && buf[1] == MAJOR_VERSION &&
+           static_cast<unsigned char>(buf[2]) <= 0x04;
+}
+
+Protocol DetectProtocol(const char* buf, size_t len) {
+    // The HTTP/2 preface looks like an HTTP/1.1 request, so it comes first
+    if (Http2Tracker::StartsWithPreface(buf, len)) {
+        return Protocol::HTTP2;
+    }
+    if (HttpProcessor::StartsWithRequest(buf, len)) {
+        return Protocol::HTTP;
+    }
+    if (StartsWithTlsHandshake(buf, len)) {
+        return Protocol::TLS;
+    }
+    if (ThriftTracker::StartsWithMessage(buf, len)) {
+        return Protocol::THRIFT;
+    }
+    if (RespTracker::StartsWithCommand(buf, len)) {
+        return Protocol::REDIS;
+    }
+    if (MemcachedTracker::StartsWithCommand(buf, len)) {
+        return Protocol::MEMCACHED;
+    }
+    return Protocol::UNKNOWN;
+}
+
+ProtocolSession::ProtocolSession(const Role role, const Observers& observers)
+    : role_(role),
+      observers_(observers),
+      protocol_(Protocol::UNKNOWN),
+      bound_(false),
+      lost_(false) {}
+
+bool ProtocolSession::Bind(const Protocol protocol) {
+    VERIFY(!bound_, "ProtocolSession is already bound");
+    protocol_ = protocol;
+
+    switch (protocol) {
+        case Protocol::HTTP2:
+            if (observers_.http2) {
+                http2_.reset(new Http2Session{
+                    role_ == Role::CLIENT ? Http2Session::Role::CLIENT
+                                          : Http2Session::Role::SERVER,
+                    observers_.http2});
+            }
+            bound_ = http2_ != nullptr;
+            break;
+        case Protocol::THRIFT:
+            if (observers_.thrift) {
+                thrift_.reset(new ThriftSession{
+                    role_ == Role::CLIENT ? ThriftSession::Role::CLIENT
+                                          : ThriftSession::Role::SERVER,
+                    observers_.thrift});
+            }
+            bound_ = thrift_ != nullptr;
+            break;
+        // Only commands sent to a cache are followed
+        case Protocol::REDIS:
+            if (observers_.cache && role_ == Role::CLIENT) {
+                redis_.reset(new CacheSession<RespTracker>{observers_.cache});
+            }
+            bound_ = redis_ != nullptr;
+            break;
+        case Protocol::MEMCACHED:
+            if (observers_.cache && role_ == Role::CLIENT) {
+                memcached_.reset(
+                    new CacheSession<MemcachedTracker>{observers_.cache});
+            }
+            bound_ = memcached_ != nullptr;
+            break;
+        default:
+            break;
+    }
+    return bound_;
+}
+}
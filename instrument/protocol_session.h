@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#include "cache_session.h"
+#include "http2_session.h"
+#include "memcached_tracker.h"
+#include "resp_tracker.h"
+#include "thrift_session.h"
+
+namespace microtrace {
+
+/*
+ * The application protocols that can be recognized from the first bytes a
+ * client sends on a connection.
+ */
+enum class Protocol { UNKNOWN, HTTP, HTTP2, TLS, THRIFT, REDIS, MEMCACHED };
+
+/*
+ * Returns the protocol of the connection whose first request starts with buf.
+ */
+Protocol DetectProtocol(const char* buf, size_t len);
+
+/*
+ * Follows the connections whose protocol has a session of its own, e.g.
+ * HTTP/2 or Thrift, instead of the transactions of the socket handlers. The
+ * protocol is detected once, from the first request, and the matching session
+ * is bound to the connection for the rest of its life.
+ *
+ * Data is passed to the bound session through a switch over the protocol
+ * rather than a virtual interface, so every session is called directly and
+ * can be inlined, and supporting another protocol doesn't cost a virtual call
+ * per buffer.
+ */
+class ProtocolSession {
+   public:
+    /*
+     * Indicates which end of the connection we are.
+     */
+    enum class Role { CLIENT, SERVER };
+
+    /*
+     * The observers of the sessions. Protocols whose observer is nullptr are
+     * not followed.
+     */
+    struct Observers {
+        Http2Session::Observer* http2;
+        ThriftSession::Observer* thrift;
+        CacheObserver* cache;
+    };
+
+    ProtocolSession(const Role role, const Observers& observers);
+
+    /*
+     * Binds the session of protocol. Returns false if the protocol has no
+     * session, e.g. HTTP/1.1 or TLS, or if it isn't followed.
+     */
+    bool Bind(const Protocol protocol);
+
+    /*
+     * Indicates if a session has been bound.
+     */
+    bool bound() const { return bound_; }
+
+    /*
+     * The protocol passed to Bind, UNKNOWN before that.
+     */
+    Protocol protocol() const { return protocol_; }
+
+    /*
+     * Processes data written to the connection.
+     */
+    void Sent(const char* buf, size_t len) {
+        Visit([buf, len](auto& session) { session.Sent(buf, len); });
+    }
+
+    /*
+     * Processes data read from the connection.
+     */
+    void Received(const char* buf, size_t len) {
+        Visit([buf, len](auto& session) { session.Received(buf, len); });
+    }
+
+    /*
+     * Completes everything that is still in flight, called when the
+     * connection is closed.
+     */
+    void Close() {
+        Visit([](auto& session) { session.Close(); });
+    }
+
+    /*
+     * Called when data went through the connection without being seen, e.g.
+     * with sendfile. The session can't find its framing after that, so
+     * everything in flight is completed and the connection isn't followed
+     * anymore.
+     */
+    void Skipped() {
+        Close();
+        lost_ = true;
+    }
+
+   private:
+    /*
+     * Calls f with the bound session, does nothing if there is none.
+     */
+    template <class F>
+    void Visit(F f) {
+        if (!bound_ || lost_) {
+            return;
+        }
+        switch (protocol_) {
+            case Protocol::HTTP2:
+                f(*http2_);
+                break;
+            case Protocol::THRIFT:
+                f(*thrift_);
+                break;
+            case Protocol::REDIS:
+                f(*redis_);
+                break;
+            case Protocol::MEMCACHED:
+                f(*memcached_);
+                break;
+            default:
+                break;
+        }
+    }
+
+    const Role role_;
+    const Observers observers_;
+
+    Protocol protocol_;
+    bool bound_;
+    bool lost_;
+
+    /*
+     * Only the session of the bound protocol is allocated.
+     */
+    std::unique_ptr<Http2Session> http2_;
+    std::unique_ptr<ThriftSession> thrift_;
+    std::unique_ptr<CacheSession<RespTracker>> redis_;
+    std::unique_ptr<CacheSession<MemcachedTracker>> memcached_;
+};
+}
@@ -0,0 +1,329 @@
+#include "resp_tracker.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+
+namespace microtrace {
+
+const char RespTracker::PROTOCOL[] = "Redis";
+const size_t RespTracker::LINE_CAP;
+const size_t RespTracker::MAX_VERB_LEN;
+const size_t RespTracker::MAX_DEPTH;
+
+/*
+ * Positions of the keys among the arguments of a command, the verb being the
+ * 0th argument. Negative positions count from the end.
+ */
+struct KeySpec {
+    const char* verb;
+    int first;
+    int last;
+    int step;
+};
+
+/*
+ * Commands whose keys aren't just their first argument. Commands whose keys
+ * depend on other arguments, e.g. EVAL, are handled as if they had none.
+ */
+static const KeySpec KEY_SPECS[] = {
+    // No keys
+    {"PING", 0, 0, 0},
+    {"ECHO", 0, 0, 0},
+    {"AUTH", 0, 0, 0},
+    {"HELLO", 0, 0, 0},
+    {"SELECT", 0, 0, 0},
+    {"QUIT", 0, 0, 0},
+    {"INFO", 0, 0, 0},
+    {"TIME", 0, 0, 0},
+    {"CLIENT", 0, 0, 0},
+    {"CONFIG", 0, 0, 0},
+    {"CLUSTER", 0, 0, 0},
+    {"COMMAND", 0, 0, 0},
+    {"DBSIZE", 0, 0, 0},
+    {"FLUSHDB", 0, 0, 0},
+    {"FLUSHALL", 0, 0, 0},
+    {"MULTI", 0, 0, 0},
+    {"EXEC", 0, 0, 0},
+    {"DISCARD", 0, 0, 0},
+    {"UNWATCH", 0, 0, 0},
+    {"SCAN", 0, 0, 0},
+    {"KEYS", 0, 0, 0},
+    {"RANDOMKEY", 0, 0, 0},
+    {"READONLY", 0, 0, 0},
+    {"PUBLISH", 0, 0, 0},
+    {"SUBSCRIBE", 0, 0, 0},
+    {"UNSUBSCRIBE", 0, 0, 0},
+    {"PSUBSCRIBE", 0, 0, 0},
+    {"PUNSUBSCRIBE", 0, 0, 0},
+    {"SCRIPT", 0, 0, 0},
+    {"EVAL", 0, 0, 0},
+    {"EVALSHA", 0, 0, 0},
+    // Every argument is a key
+    {"MGET", 1, -1, 1},
+    {"DEL", 1, -1, 1},
+    {"UNLINK", 1, -1, 1},
+    {"EXISTS", 1, -1, 1},
+    {"TOUCH", 1, -1, 1},
+    {"WATCH", 1, -1, 1},
+    {"SINTER", 1, -1, 1},
+    {"SUNION", 1, -1, 1},
+    {"SDIFF", 1, -1, 1},
+    {"SINTERSTORE", 1, -1, 1},
+    {"SUNIONSTORE", 1, -1, 1},
+    {"SDIFFSTORE", 1, -1, 1},
+    {"PFCOUNT", 1, -1, 1},
+    // Keys alternate with values
+    {"MSET", 1, -1, 2},
+    {"MSETNX", 1, -1, 2},
+    // Every argument but the timeout is a key
+    {"BLPOP", 1, -2, 1},
+    {"BRPOP", 1, -2, 1},
+    {"BZPOPMIN", 1, -2, 1},
+    {"BZPOPMAX", 1, -2, 1},
+    // Source and destination
+    {"RENAME", 1, 2, 1},
+    {"RENAMENX", 1, 2, 1},
+    {"RPOPLPUSH", 1, 2, 1},
+    {"LMOVE", 1, 2, 1},
+    {"SMOVE", 1, 2, 1},
+    {"COPY", 1, 2, 1},
+};
+
+/*
+ * Most commands have a single key, their first argument.
+ */
+static const KeySpec DEFAULT_KEY_SPEC = {"", 1, 1, 1};
+
+bool RespTracker::StartsWithCommand(const char* buf, size_t len) {
+    if (len < 4 || buf[0] != '*' || !isdigit(buf[1])) {
+        return false;
+    }
+    size_t i = 1;
+    while (i < len && isdigit(buf[i])) {
+        ++i;
+    }
+    return i < len && buf[i] == '\r';
+}
+
+RespTracker::RespTracker(const Type type) : type_(type) { Reset(); }
+
+void RespTracker::Reset() {
+    state_ = State::LINE;
+    line_len_ = 0;
+    bulk_remaining_ = 0;
+    depth_ = 0;
+    argc_ = 0;
+    arg_ = 0;
+    key_hash_ = CacheKeys::HASH_OFFSET;
+    first_key_ = 0;
+    last_key_ = 0;
+    key_step_ = 1;
+    verb_.clear();
+    keys_.Clear();
+    error_ = false;
+}
+
+size_t RespTracker::Process(const char* buf, size_t len) {
+    size_t processed = 0;
+    while (processed < len && valid() && !complete()) {
+        if (state_ == State::LINE) {
+            const char* lf = static_cast<const char*>(
+                memchr(buf + processed, '\n', len - processed));
+            const size_t end = lf ? static_cast<size_t>(lf - buf) + 1 : len;
+            const size_t keep =
+                std::min(end - processed, LINE_CAP - line_len_);
+            memcpy(line_.data() + line_len_, buf + processed, keep);
+            line_len_ += keep;
+            processed = end;
+
+            if (lf) {
+                LineDone();
+                line_len_ = 0;
+            }
+            continue;
+        }
+
+        // Bulk string, followed by CRLF
+        const size_t count =
+            std::min<uint64_t>(len - processed, bulk_remaining_);
+        if (type_ == Type::COMMAND) {
+            const size_t data_left =
+                bulk_remaining_ > 2 ? bulk_remaining_ - 2 : 0;
+            const char* data = buf + processed;
+            const size_t data_len = std::min(count, data_left);
+            if (arg_ == 0) {
+                for (size_t i = 0;
+                     i < data_len && verb_.size() < MAX_VERB_LEN; ++i) {
+                    verb_.push_back(toupper(data[i]));
+                }
+            } else if (IsKey(arg_)) {
+                key_hash_ = CacheKeys::Hash(key_hash_, data, data_len);
+            }
+        }
+        bulk_remaining_ -= count;
+        processed += count;
+        if (bulk_remaining_ == 0) {
+            state_ = State::LINE;
+            BulkDone();
+        }
+    }
+    return processed;
+}
+
+bool RespTracker::ParseLength(int64_t* length) const {
+    size_t i = 1;
+    bool negative = false;
+    if (i < line_len_ && line_[i] == '-') {
+        negative = true;
+        ++i;
+    }
+    int64_t value = 0;
+    size_t digits = 0;
+    for (; i < line_len_ && isdigit(line_[i]); ++i, ++digits) {
+        value = value * 10 + (line_[i] - '0');
+    }
+    // The number must be followed by the end of the line
+    if (digits == 0 || digits > 18 || i == line_len_ ||
+        (line_[i] != '\r' && line_[i] != '\n')) {
+        return false;
+    }
+    *length = negative ? -value : value;
+    return true;
+}
+
+void RespTracker::LineDone() {
+    const char type = line_[0];
+    int64_t length = 0;
+
+    if (type_ == Type::COMMAND) {
+        // Commands are non-empty arrays of bulk strings
+        if (depth_ == 0 && type == '*' && ParseLength(&length) &&
+            length > 0) {
+            argc_ = length;
+            Push(length, false);
+        } else if (depth_ == 1 && type == '$' && ParseLength(&length) &&
+                   length >= 0) {
+            bulk_remaining_ = length + 2;
+            state_ = State::BULK;
+        } else {
+            state_ = State::INVALID;
+        }
+        return;
+    }
+
+    switch (type) {
+        case '-':
+            error_ = error_ || depth_ == 0;
+            ValueDone();
+            return;
+        case '+':
+        case ':':
+        case '_':
+        case ',':
+        case '#':
+        case '(':
+            ValueDone();
+            return;
+        case '$':
+        case '=':
+        case '!':
+            if (!ParseLength(&length)) {
+                state_ = State::INVALID;
+                return;
+            }
+            error_ = error_ || (type == '!' && depth_ == 0);
+            // Null bulk string
+            if (length < 0) {
+                ValueDone();
+                return;
+            }
+            bulk_remaining_ = length + 2;
+            state_ = State::BULK;
+            return;
+        case '*':
+        case '~':
+        case '>':
+        case '%':
+        case '|':
+            if (!ParseLength(&length)) {
+                state_ = State::INVALID;
+                return;
+            }
+            // Maps and attributes have a key and a value for each entry
+            if (type == '%' || type == '|') {
+                length *= 2;
+            }
+            if (length > 0) {
+                Push(length, type == '|');
+            } else if (type != '|') {
+                // Null or empty aggregate
+                ValueDone();
+            }
+            return;
+        default:
+            state_ = State::INVALID;
+            return;
+    }
+}
+
+void RespTracker::BulkDone() {
+    if (type_ == Type::COMMAND) {
+        if (arg_ == 0) {
+            VerbDone();
+        } else if (IsKey(arg_)) {
+            keys_.Add(key_hash_);
+        }
+        ++arg_;
+        key_hash_ = CacheKeys::HASH_OFFSET;
+    }
+    ValueDone();
+}
+
+void RespTracker::ValueDone() {
+    while (depth_ > 0) {
+        Level& level = levels_[depth_ - 1];
+        if (--level.remaining > 0) {
+            return;
+        }
+        --depth_;
+        // The value the attribute belongs to is still to come
+        if (level.attribute) {
+            return;
+        }
+    }
+    state_ = State::DONE;
+}
+
+void RespTracker::Push(const int64_t count, const bool attribute) {
+    if (depth_ == MAX_DEPTH) {
+        state_ = State::INVALID;
+        return;
+    }
+    Level& level = levels_[depth_++];
+    level.remaining = count;
+    level.attribute = attribute;
+}
+
+void RespTracker::VerbDone() {
+    const KeySpec* spec = &DEFAULT_KEY_SPEC;
+    for (const auto& key_spec : KEY_SPECS) {
+        if (verb_ == key_spec.verb) {
+            spec = &key_spec;
+            break;
+        }
+    }
+    first_key_ = spec->first;
+    last_key_ = spec->last;
+    key_step_ = spec->step;
+}
+
+bool RespTracker::IsKey(const int64_t arg) const {
+    if (first_key_ == 0) {
+        return false;
+    }
+    const int64_t last = last_key_ < 0 ? argc_ + last_key_ : last_key_;
+    return arg >= first_key_ && arg <= last &&
+           (arg - first_key_) % key_step_ == 0;
+}
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "cache_session.h"
+
+namespace microtrace {
+
+/*
+ * Follows a single Redis command or reply in RESP (versions 2 and 3) as it is
+ * sent or received, to find out where it ends. Messages can be passed in
+ * pieces of any size.
+ *
+ * Commands are arrays of bulk strings, their verb is kept, and their keys are
+ * counted and hashed as they stream by, using the key positions of the
+ * command. Bulk strings are otherwise skipped without being copied.
+ */
+class RespTracker {
+   public:
+    enum class Type { COMMAND, REPLY };
+
+    static const char PROTOCOL[];
+
+    /*
+     * Only the first LINE_CAP bytes of every line are kept, which is enough for
+     * the lengths and counts in them.
+     */
+    static const size_t LINE_CAP = 32;
+
+    static const size_t MAX_VERB_LEN = 32;
+
+    /*
+     * Maximum number of nested aggregates in a reply.
+     */
+    static const size_t MAX_DEPTH = 16;
+
+    /*
+     * Returns true if buf starts with a command in RESP.
+     */
+    static bool StartsWithCommand(const char* buf, size_t len);
+
+    RespTracker(const Type type);
+
+    /*
+     * Starts tracking a new message.
+     */
+    void Reset();
+
+    /*
+     * Processes the next len bytes of the message. Returns the number of bytes
+     * that belong to it, which is less than len only if the message has
+     * completed or turned out to be invalid.
+     */
+    size_t Process(const char* buf, size_t len);
+
+    bool complete() const { return state_ == State::DONE; }
+    bool valid() const { return state_ != State::INVALID; }
+
+    /*
+     * Returns the verb of a command in upper case, e.g. GET.
+     */
+    const std::string& verb() const { return verb_; }
+
+    const CacheKeys& keys() const { return keys_; }
+
+    /*
+     * Every Redis command is replied to.
+     */
+    bool expects_reply() const { return true; }
+
+    /*
+     * Returns true if the reply is an error.
+     */
+    bool error() const { return error_; }
+
+   private:
+    enum class State { LINE, BULK, DONE, INVALID };
+
+    /*
+     * An aggregate, e.g. an array, whose elements are being read.
+     */
+    struct Level {
+        int64_t remaining;
+
+        /*
+         * Attributes are followed by the value they belong to.
+         */
+        bool attribute;
+    };
+
+    void LineDone();
+
+    /*
+     * Called when the bulk string has been read, without its CRLF.
+     */
+    void BulkDone();
+
+    /*
+     * Called when a value has been read, moves on to the next element.
+     */
+    void ValueDone();
+
+    void Push(const int64_t count, const bool attribute);
+
+    /*
+     * Parses the length or count in line_, returns false if it is invalid.
+     */
+    bool ParseLength(int64_t* length) const;
+
+    /*
+     * Looks up which arguments of the command are keys once its verb is known.
+     */
+    void VerbDone();
+
+    bool IsKey(const int64_t arg) const;
+
+    const Type type_;
+    State state_;
+
+    std::array<char, LINE_CAP> line_;
+    size_t line_len_;
+
+    /*
+     * Bytes left of the bulk string, including its CRLF.
+     */
+    uint64_t bulk_remaining_;
+
+    std::array<Level, MAX_DEPTH> levels_;
+    size_t depth_;
+
+    /*
+     * The arguments of a command, and the index of the one being read.
+     */
+    int64_t argc_;
+    int64_t arg_;
+    uint64_t key_hash_;
+
+    /*
+     * Key positions of the command, as in the output of COMMAND INFO. Zero
+     * first_key_ means the command has no keys.
+     */
+    int first_key_;
+    int last_key_;
+    int key_step_;
+
+    std::string verb_;
+    CacheKeys keys_;
+    bool error_;
+};
+}
@@ -0,0 +1,356 @@
+#include "sampler.h"
+
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <tuple>
+#include <unordered_set>
+
+#include "common.h"
+
+namespace microtrace {
+
+int64_t steady_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// The state of next_random, it is seeded when it is 0
+static thread_local uint64_t random_state = 0;
+
+uint64_t next_random() {
+    if (random_state == 0) {
+        random_state =
+            splitmix64(reinterpret_cast<uintptr_t>(&random_state) ^
+                       static_cast<uint64_t>(steady_now_ns()));
+        if (random_state == 0) {
+            random_state = 1;
+        }
+    }
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return random_state * 0x2545f4914f6cdd1dULL;
+}
+
+void reseed_random() { random_state = 0; }
+
+/*
+ * Maps a probability to the range of uint64_t.
+ */
+static uint64_t to_threshold(const double rate) {
+    if (rate <= 0) {
+        return 0;
+    }
+    if (rate >= 1) {
+        return UINT64_MAX;
+    }
+    return static_cast<uint64_t>(rate * 18446744073709551616.0);
+}
+
+SamplingMode GetSamplingMode() {
+    const char* mode = std::getenv("MICROTRACE_SAMPLING_MODE");
+    if (mode == nullptr || strcmp(mode, "head") == 0) {
+        return SamplingMode::HEAD;
+    } else if (strcmp(mode, "tail") == 0) {
+        return SamplingMode::TAIL;
+    }
+    VERIFY(false, "invalid MICROTRACE_SAMPLING_MODE env {}", mode);
+}
+
+static std::unique_ptr<Sampler> NewHeadSamplerFromEnv(
+    std::function<uint64_t()> span_count) {
+    const char* type = std::getenv("MICROTRACE_SAMPLER");
+    const double rate = GetEnvDouble("MICROTRACE_SAMPLE_RATE", 0.01);
+
+    if (type == nullptr || strcmp(type, "probabilistic") == 0) {
+        return std::make_unique<ProbabilisticSampler>(rate);
+    } else if (strcmp(type, "ratelimiting") == 0) {
+        return std::make_unique<RateLimitingSampler>(
+            GetEnvDouble("MICROTRACE_TRACES_PER_SEC", 10),
+            GetEnvLong("MICROTRACE_TRACES_BURST", 10));
+    } else if (strcmp(type, "adaptive") == 0) {
+        return std::make_unique<AdaptiveSampler>(
+            GetEnvDouble("MICROTRACE_TARGET_SPANS_PER_SEC", 100),
+            std::move(span_count), rate);
+    }
+    VERIFY(false, "invalid MICROTRACE_SAMPLER env {}", type);
+}
+
+std::unique_ptr<Sampler> NewSamplerFromEnv(
+    std::function<uint64_t()> span_count) {
+    if (GetSamplingMode() == SamplingMode::TAIL) {
+        return std::make_unique<ProbabilisticSampler>(1);
+    }
+
+    auto sampler = NewHeadSamplerFromEnv(std::move(span_count));
+
+    const char* rates = std::getenv("MICROTRACE_ENDPOINT_RATES");
+    const long min_interval_ms =
+        GetEnvLong("MICROTRACE_ENDPOINT_MIN_INTERVAL_MS", 0);
+    if (rates == nullptr && min_interval_ms <= 0) {
+        return sampler;
+    }
+    return std::make_unique<EndpointSampler>(
+        std::move(sampler),
+        ParseEndpointRates(rates != nullptr ? rates : ""),
+        min_interval_ms * 1000000);
+}
+
+/* ProbabilisticSampler */
+
+ProbabilisticSampler::ProbabilisticSampler(const double rate)
+    : rate_(rate), threshold_(to_threshold(rate)), always_(rate >= 1) {}
+
+bool ProbabilisticSampler::ShouldSample() {
+    return always_ || next_random() < threshold_;
+}
+
+/* RateLimitingSampler */
+
+static int64_t interval_ns(const double traces_per_sec) {
+    VERIFY(traces_per_sec > 0, "traces per second must be positive");
+    return static_cast<int64_t>(1e9 / traces_per_sec);
+}
+
+RateLimitingSampler::RateLimitingSampler(const double traces_per_sec,
+                                         const int burst, const Clock clock)
+    : clock_(clock),
+      interval_(interval_ns(traces_per_sec)),
+      tolerance_(interval_ * (burst - 1)),
+      tat_(clock()) {
+    VERIFY(burst >= 1, "burst must be at least 1");
+}
+
+bool RateLimitingSampler::ShouldSample() {
+    const int64_t now = clock_();
+    int64_t tat = tat_.load(std::memory_order_relaxed);
+    while (true) {
+        if (now < tat - tolerance_) {
+            return false;
+        }
+        const int64_t next = std::max(tat, now) + interval_;
+        if (tat_.compare_exchange_weak(tat, next, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+}
+
+/* AdaptiveSampler */
+
+constexpr double AdaptiveSampler::MIN_RATE;
+
+/*
+ * The adaptive samplers that haven't been destroyed, so that exiting threads
+ * only flush into live ones. They are never freed, because threads may exit
+ * after static destructors have run.
+ */
+static std::mutex& live_samplers_mu() {
+    static auto* mu = new std::mutex;
+    return *mu;
+}
+
+static std::unordered_set<const AdaptiveSampler*>& live_samplers() {
+    static auto* samplers = new std::unordered_set<const AdaptiveSampler*>;
+    return *samplers;
+}
+
+/*
+ * Decisions made by the current thread that haven't been flushed yet. They
+ * are flushed when the thread exits, so that they count in the window.
+ */
+struct LocalDecisions {
+    ~LocalDecisions() {
+        if (owner == nullptr || decisions == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> l(live_samplers_mu());
+        if (live_samplers().count(owner) > 0) {
+            owner->Flush(decisions, sampled, owner->clock_());
+        }
+    }
+
+    AdaptiveSampler* owner;
+    uint32_t decisions;
+    uint32_t sampled;
+};
+
+static thread_local LocalDecisions local_decisions = {nullptr, 0, 0};
+
+AdaptiveSampler::AdaptiveSampler(const double target_spans_per_sec,
+                                 std::function<uint64_t()> span_count,
+                                 const double initial_rate,
+                                 const int64_t window_ns, const Clock clock)
+    : target_spans_per_sec_(target_spans_per_sec),
+      span_count_(std::move(span_count)),
+      window_ns_(window_ns),
+      clock_(clock),
+      threshold_(to_threshold(initial_rate)),
+      decisions_(0),
+      sampled_(0),
+      window_start_(clock()),
+      window_spans_(span_count_()) {
+    std::lock_guard<std::mutex> l(live_samplers_mu());
+    live_samplers().insert(this);
+}
+
+AdaptiveSampler::~AdaptiveSampler() {
+    std::lock_guard<std::mutex> l(live_samplers_mu());
+    live_samplers().erase(this);
+}
+
+double AdaptiveSampler::rate() const {
+    return threshold_.load(std::memory_order_relaxed) / 18446744073709551616.0;
+}
+
+bool AdaptiveSampler::ShouldSample() {
+    const bool sample =
+        next_random() < threshold_.load(std::memory_order_relaxed);
+
+    auto& local = local_decisions;
+    if (local.owner != this) {
+        local = LocalDecisions{this, 0, 0};
+    }
+    ++local.decisions;
+    if (sample) {
+        ++local.sampled;
+    }
+    // Threads that see few requests flush when the window is over, so that
+    // the rate isn't adjusted without their decisions
+    const int64_t now = clock_();
+    if (local.decisions >= FLUSH_EVERY ||
+        now - window_start_.load(std::memory_order_relaxed) >= window_ns_) {
+        Flush(local.decisions, local.sampled, now);
+        local.decisions = 0;
+        local.sampled = 0;
+    }
+    return sample;
+}
+
+void AdaptiveSampler::Flush(const uint32_t decisions, const uint32_t sampled,
+                            const int64_t now) {
+    decisions_.fetch_add(decisions, std::memory_order_relaxed);
+    sampled_.fetch_add(sampled, std::memory_order_relaxed);
+
+    int64_t start = window_start_.load(std::memory_order_relaxed);
+    // Only the thread that manages to start the new window adjusts the rate
+    if (now - start >= window_ns_ &&
+        window_start_.compare_exchange_strong(start, now)) {
+        Adjust(now - start);
+    }
+}
+
+void AdaptiveSampler::Adjust(const int64_t elapsed_ns) {
+    const uint64_t decisions = decisions_.exchange(0);
+    const uint64_t sampled = sampled_.exchange(0);
+    const uint64_t span_count = span_count_();
+    const uint64_t spans = span_count - window_spans_;
+    window_spans_ = span_count;
+
+    if (decisions == 0) {
+        return;
+    }
+
+    const double requests_per_sec = decisions / (elapsed_ns / 1e9);
+    // Until a sampled request has produced spans, assume that it produces one
+    const double spans_per_request =
+        (sampled > 0 && spans > 0) ? static_cast<double>(spans) / sampled : 1;
+
+    double new_rate =
+        target_spans_per_sec_ / (requests_per_sec * spans_per_request);
+    new_rate = std::min(1.0, std::max(MIN_RATE, new_rate));
+    threshold_.store(to_threshold(new_rate), std::memory_order_relaxed);
+}
+
+/* EndpointSampler */
+
+std::unordered_map<std::string, double> ParseEndpointRates(
+    const std::string& rates) {
+    std::unordered_map<std::string, double> result;
+    size_t start = 0;
+    while (start < rates.size()) {
+        size_t end = rates.find(',', start);
+        if (end == std::string::npos) {
+            end = rates.size();
+        }
+        const std::string pair = rates.substr(start, end - start);
+        const size_t eq = pair.rfind('=');
+        VERIFY(eq != std::string::npos && eq > 0,
+               "invalid endpoint rate: {}", pair);
+
+        const std::string rate = pair.substr(eq + 1);
+        char* rate_end;
+        const double value = std::strtod(rate.c_str(), &rate_end);
+        VERIFY(!rate.empty() && *rate_end == '\0',
+               "invalid endpoint rate: {}", pair);
+
+        result[pair.substr(0, eq)] = value;
+        start = end + 1;
+    }
+    return result;
+}
+
+/*
+ * Returns the path of url, without its query string and fragment.
+ */
+static std::string url_path(const std::string& url) {
+    return url.substr(0, url.find_first_of("?#"));
+}
+
+EndpointSampler::EndpointSampler(
+    std::unique_ptr<Sampler> fallback,
+    const std::unordered_map<std::string, double>& rates,
+    const int64_t min_interval_ns, const Clock clock)
+    : fallback_(std::move(fallback)),
+      min_interval_ns_(min_interval_ns),
+      clock_(clock) {
+    VERIFY(fallback_ != nullptr, "EndpointSampler needs a fallback sampler");
+    for (const auto& rate : rates) {
+        rates_.emplace(std::piecewise_construct,
+                       std::forward_as_tuple(rate.first),
+                       std::forward_as_tuple(rate.second));
+    }
+    // The first request of every path is guaranteed to be sampled
+    const int64_t now = clock_();
+    for (auto& last : last_sampled_) {
+        last.store(now - min_interval_ns_, std::memory_order_relaxed);
+    }
+}
+
+bool EndpointSampler::ShouldSample() { return fallback_->ShouldSample(); }
+
+bool EndpointSampler::ShouldSampleUrl(const std::string& url) {
+    if (url.empty()) {
+        return ShouldSample();
+    }
+
+    const std::string path = url_path(url);
+    const auto it = rates_.find(path);
+    const bool sample = it != rates_.end() ? it->second.ShouldSample()
+                                           : fallback_->ShouldSample();
+    if (min_interval_ns_ <= 0) {
+        return sample;
+    }
+
+    auto& last = last_sampled_[std::hash<std::string>()(path) % SLOTS];
+    const int64_t now = clock_();
+    if (sample) {
+        last.store(now, std::memory_order_relaxed);
+        return true;
+    }
+    // Only one of the threads racing for the guaranteed trace gets it
+    int64_t prev = last.load(std::memory_order_relaxed);
+    return now - prev >= min_interval_ns_ &&
+           last.compare_exchange_strong(prev, now, std::memory_order_relaxed);
+}
+}
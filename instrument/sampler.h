@@ -0,0 +1,250 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace microtrace {
+
+/*
+ * A Sampler decides whether a new user request should be traced.
+ *
+ * Implementations must be thread-safe, and ShouldSample() must not take any
+ * locks, since it is called on every new request received by a frontend
+ * server.
+ */
+class Sampler {
+   public:
+    virtual ~Sampler() = default;
+
+    /*
+     * Returns true if the request that is being started should be traced.
+     */
+    virtual bool ShouldSample() = 0;
+
+    /*
+     * Returns true if the request with the given url should be traced. url is
+     * empty if it couldn't be parsed from the first read of the request.
+     *
+     * Only called if uses_url() is true, otherwise requests are not parsed
+     * before the decision.
+     */
+    virtual bool ShouldSampleUrl(const std::string& url) {
+        return ShouldSample();
+    }
+
+    virtual bool uses_url() const { return false; }
+};
+
+/*
+ * Returns the current time of the steady clock in nanoseconds.
+ */
+int64_t steady_now_ns();
+
+/*
+ * Returns a random number from the calling thread's own xorshift64* generator.
+ */
+uint64_t next_random();
+
+/*
+ * Makes the calling thread's generator pick a new seed. A child of fork starts
+ * with a copy of it, and would draw the same numbers as its parent otherwise.
+ */
+void reseed_random();
+
+/*
+ * With HEAD sampling, the decision to trace a request is made when it arrives
+ * at the frontend. With TAIL sampling, every request is traced, and the
+ * decision is made when it has completed, see TailSamplingLogger.
+ */
+enum class SamplingMode { HEAD, TAIL };
+
+/*
+ * Returns the mode set in MICROTRACE_SAMPLING_MODE, either "head" (default) or
+ * "tail".
+ */
+SamplingMode GetSamplingMode();
+
+/*
+ * Creates the sampler selected by MICROTRACE_SAMPLER, which can be one of
+ * "probabilistic" (default), "ratelimiting" or "adaptive". In TAIL sampling
+ * mode, it returns a sampler that samples every request.
+ *
+ * If MICROTRACE_ENDPOINT_RATES or MICROTRACE_ENDPOINT_MIN_INTERVAL_MS is set,
+ * the sampler is wrapped in an EndpointSampler, see ParseEndpointRates for
+ * the format of the rates.
+ *
+ * span_count is only used by the adaptive sampler, see AdaptiveSampler.
+ */
+std::unique_ptr<Sampler> NewSamplerFromEnv(
+    std::function<uint64_t()> span_count);
+
+/*
+ * Samples each request independently with a fixed probability.
+ *
+ * Random numbers are generated by a per-thread xorshift generator, so no
+ * state is shared between threads.
+ */
+class ProbabilisticSampler : public Sampler {
+   public:
+    ProbabilisticSampler(const double rate);
+
+    bool ShouldSample() override;
+
+    double rate() const { return rate_; }
+
+   private:
+    const double rate_;
+
+    /*
+     * A request is sampled if the next random number is below threshold_.
+     */
+    const uint64_t threshold_;
+    const bool always_;
+};
+
+/*
+ * Samples at most traces_per_sec requests per second in the whole process,
+ * allowing bursts of up to burst requests.
+ *
+ * It uses the generic cell rate algorithm: a single atomic stores the
+ * theoretical arrival time of the next request, which is only modified when a
+ * request is sampled. Decisions that are rejected only read it.
+ */
+class RateLimitingSampler : public Sampler {
+   public:
+    typedef int64_t (*Clock)();
+
+    RateLimitingSampler(const double traces_per_sec, const int burst,
+                        const Clock clock = &steady_now_ns);
+
+    bool ShouldSample() override;
+
+   private:
+    const Clock clock_;
+
+    // Nanoseconds between two sampled requests
+    const int64_t interval_;
+
+    // How far the theoretical arrival time can be ahead of the clock
+    const int64_t tolerance_;
+
+    std::atomic<int64_t> tat_;
+};
+
+/*
+ * Adjusts the sampling probability every window so that the process emits
+ * roughly target_spans_per_sec spans.
+ *
+ * span_count must return the total number of spans logged so far by this
+ * process. It is used for measuring how many spans a sampled request produces
+ * on average.
+ *
+ * Threads count their decisions locally, and only add them to the shared
+ * counters every FLUSH_EVERY decisions, once the window is over, and when
+ * they exit.
+ */
+class AdaptiveSampler : public Sampler {
+   public:
+    typedef int64_t (*Clock)();
+
+    static const uint32_t FLUSH_EVERY = 64;
+    static constexpr double MIN_RATE = 1e-6;
+
+    AdaptiveSampler(const double target_spans_per_sec,
+                    std::function<uint64_t()> span_count,
+                    const double initial_rate = 0.01,
+                    const int64_t window_ns = 1000000000,
+                    const Clock clock = &steady_now_ns);
+
+    ~AdaptiveSampler() override;
+
+    bool ShouldSample() override;
+
+    double rate() const;
+
+   private:
+    friend struct LocalDecisions;
+
+    /*
+     * Adds the calling thread's local counts to the shared counters, and
+     * adjusts the rate if the window is over at now.
+     */
+    void Flush(uint32_t decisions, uint32_t sampled, const int64_t now);
+
+    void Adjust(const int64_t elapsed_ns);
+
+    const double target_spans_per_sec_;
+    const std::function<uint64_t()> span_count_;
+    const int64_t window_ns_;
+    const Clock clock_;
+
+    /*
+     * The sampling probability, scaled to the range of uint64_t.
+     */
+    std::atomic<uint64_t> threshold_;
+
+    std::atomic<uint64_t> decisions_;
+    std::atomic<uint64_t> sampled_;
+    std::atomic<int64_t> window_start_;
+
+    // Only modified by the thread that adjusts the rate
+    uint64_t window_spans_;
+};
+
+/*
+ * Parses a comma separated list of path=rate pairs, e.g.
+ * "/checkout=1,/search=0.05".
+ */
+std::unordered_map<std::string, double> ParseEndpointRates(
+    const std::string& rates);
+
+/*
+ * Decides based on the path of the request's url, so rare endpoints can be
+ * traced more often than the rest of the traffic.
+ *
+ * Paths that have their own rate are sampled with that probability, every
+ * other request is passed to fallback. In addition, if min_interval_ns is
+ * positive, at least one request of every path is sampled in every
+ * min_interval_ns.
+ *
+ * The last time each path was sampled is kept in a fixed table indexed by the
+ * hash of the path, so no locks are needed. Paths that share a slot also
+ * share their guarantee.
+ */
+class EndpointSampler : public Sampler {
+   public:
+    typedef int64_t (*Clock)();
+
+    static const size_t SLOTS = 1024;
+
+    EndpointSampler(std::unique_ptr<Sampler> fallback,
+                    const std::unordered_map<std::string, double>& rates,
+                    const int64_t min_interval_ns,
+                    const Clock clock = &steady_now_ns);
+
+    /*
+     * Used when the url is unknown, it is passed to fallback.
+     */
+    bool ShouldSample() override;
+
+    bool ShouldSampleUrl(const std::string& url) override;
+
+    bool uses_url() const override { return true; }
+
+   private:
+    const std::unique_ptr<Sampler> fallback_;
+
+    std::unordered_map<std::string, ProbabilisticSampler> rates_;
+
+    const int64_t min_interval_ns_;
+    const Clock clock_;
+
+    // The last time a request was sampled, for each slot
+    std::array<std::atomic<int64_t>, SLOTS> last_sampled_;
+};
+}
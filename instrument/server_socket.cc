@@ -14,86 +14,106 @@ ServerSocket::ServerSocket(const int fd,
                            const OriginalFunctions &orig)
     : InstrumentedSocket(fd, orig),
       handler_(std::move(handler)),
-      ctx_buf_start_(0) {
+      ctx_buf_start_(0),
+      context_received_(false) {
     VERIFY(fd_ == handler_->fd(),
            "handler and underlying socket's fd is not the same");
 }
 
 void ServerSocket::Async() { handler_->Async(); }
 
-ssize_t ServerSocket::ReadContextBlocking() {
-    // Since we are a blocking socket, we call read until the whole context is
-    // read. We only stop if read returns an error, if that happens, reading can
-    // be resumed later.
-    while (ctx_buf_start_ != ctx_buf_.size()) {
-        auto ret = orig_.read(fd(), ctx_buf_.data() + ctx_buf_start_,
-                              ctx_buf_.size() - ctx_buf_start_);
-        if (ret <= 0) {
-            return ret;
-        }
-        ctx_buf_start_ += ret;
+void ServerSocket::Rebind(int fd) {
+    fd_ = fd;
+    handler_->set_fd(fd);
+}
+
+void ServerSocket::NonBlocking(const bool non_blocking) {
+    handler_->set_non_blocking(non_blocking);
+}
+
+void ServerSocket::Ready() {
+    if (handler_->has_context()) {
+        set_current_context(handler_->context());
     }
+}
 
-    VERIFY(ctx_buf_start_ == ctx_buf_.size(), "Context could not be read");
-    ctx_buf_start_ = 0;  // reset start
+size_t ServerSocket::ContextBytesNeeded() const {
+    // The flags byte is peeked at before the context is read
+    return Context::WireSize(ctx_buf_[0]);
+}
 
-    ContextStorage context_storage;
-    memcpy(&context_storage, ctx_buf_.data(), ctx_buf_.size());
+void ServerSocket::ContextRead() {
+    VERIFY(ctx_buf_start_ == ContextBytesNeeded(), "Context could not be read");
+    ctx_buf_start_ = 0;  // reset start
+    context_received_ = true;
 
     // Pass context to handler
-    handler_->ContextReadCallback(
-        std::make_unique<Context>(std::move(context_storage)));
-
-    return ctx_buf_.size();
+    handler_->ContextReadCallback(Context::Deserialize(ctx_buf_.data()));
 }
 
-ssize_t ServerSocket::ReadContextAsync() {
-    // We only do 1 non-blocking read
-    auto ret = orig_.read(fd(), ctx_buf_.data() + ctx_buf_start_,
-                          ctx_buf_.size() - ctx_buf_start_);
-    if (ret <= 0) {
-        return ret;
+ssize_t ServerSocket::ReadContext() {
+    // We call read until the whole context is read. We only stop if read
+    // returns an error, if that happens, reading can be resumed later. For
+    // non-blocking sockets, this means that the application gets an EAGAIN
+    // until the whole context arrives, so it doesn't start reading the
+    // request before that.
+    //
+    // The size of the context is known from its flags byte, so it is read
+    // with a single call unless the socket returns only part of it.
+    while (ctx_buf_start_ != ContextBytesNeeded()) {
+        auto ret = orig_.read(fd(), ctx_buf_.data() + ctx_buf_start_,
+                              ContextBytesNeeded() - ctx_buf_start_);
+        if (ret <= 0) {
+            return ret;
+        }
+        ctx_buf_start_ += ret;
     }
 
-    ctx_buf_start_ += ret;
-
-    if (ctx_buf_start_ == ctx_buf_.size()) {
-        ContextStorage context_storage;
-        memcpy(&context_storage, ctx_buf_.data(), ctx_buf_.size());
-
-        // Pass context to handler
-        handler_->ContextReadCallback(
-            std::make_unique<Context>(std::move(context_storage)));
+    const size_t size = ctx_buf_start_;
+    ContextRead();
+    return size;
+}
 
-        ctx_buf_start_ = 0;  // reset start
-        return ctx_buf_.size();
-    } else {
-        // In this case we read some bytes but not the whole context, so we
-        // must not let the applcation start reading from this socket, until the
-        // whole context is read, so we return an EAGAIN.
-        errno = EAGAIN;
-        return -1;
-    }
+bool ServerSocket::ContextInBand() const {
+    // Frontend servers don't receive context, and with traceparent
+    // propagation it is in the request itself
+    return handler_->server_type() == ServerType::BACKEND &&
+           GetPropagation() != Propagation::TRACEPARENT;
 }
 
 ssize_t ServerSocket::ReadContextIfNecessary() {
-    // Frontend servers don't receive context
-    if (handler_->server_type() == ServerType::FRONTEND) {
+    if (!ContextInBand()) {
         return 1;
     }
 
     // We only receive context at the start of a new incoming request
-    if (!handler_->is_context_processed() &&
-        handler_->get_next_action(SocketOperation::READ) ==
+    if (handler_->is_context_processed() ||
+        handler_->get_next_action(SocketOperation::READ) !=
             SocketAction::RECV_REQUEST) {
-        if (handler_->type() == SocketType::BLOCKING) {
-            return ReadContextBlocking();
-        } else {
-            return ReadContextAsync();
-        }
-    } else {
         return 1;
     }
+
+    // A client only sends a context ahead of the first request of those it
+    // pipelines, the others follow the previous request directly, and
+    // requests that it wrote through io_uring have none. They are told apart
+    // by the marker in the flags byte. Pipelined requests get the context
+    // that was last received, which is still in ctx_buf_, the others aren't
+    // sampled.
+    if (ctx_buf_start_ == 0) {
+        char flags;
+        const auto ret = orig_.recv(fd(), &flags, sizeof(flags), MSG_PEEK);
+        if (ret <= 0) {
+            return ret;
+        }
+        if (!Context::IsWireFlags(flags)) {
+            handler_->ContextReadCallback(
+                context_received_ ? Context::Deserialize(ctx_buf_.data())
+                                  : Context{ContextStorage::Zero(), 0});
+            return 1;
+        }
+        ctx_buf_[0] = flags;
+    }
+    return ReadContext();
 }
 
 ssize_t ServerSocket::RecvFrom(void *buf, size_t len, int flags,
@@ -130,6 +150,56 @@ ssize_t ServerSocket::Read(void *buf, size_t count) {
     return ret;
 }
 
+ssize_t ServerSocket::Readv(const struct iovec *iov, int iovcnt) {
+    BeforeReadv(handler_.get(), iov, iovcnt);
+    auto ret = ReadContextIfNecessary();
+    if (ret <= 0) {
+        return ret;
+    }
+    ret = orig_.readv(fd(), iov, iovcnt);
+    AfterReadv(handler_.get(), iov, iovcnt, ret);
+    return ret;
+}
+
+ssize_t ServerSocket::RecvMsg(struct msghdr *msg, int flags) {
+    BeforeReadv(handler_.get(), msg->msg_iov, msg->msg_iovlen);
+    auto ret = ReadContextIfNecessary();
+    if (ret <= 0) {
+        return ret;
+    }
+    ret = orig_.recvmsg(fd(), msg, flags);
+    AfterReadv(handler_.get(), msg->msg_iov, msg->msg_iovlen, ret);
+    return ret;
+}
+
+int ServerSocket::RecvMMsg(struct mmsghdr *msgvec, unsigned int vlen,
+                           int flags, struct timespec *timeout) {
+    if (vlen == 0) {
+        return orig_.recvmmsg(fd(), msgvec, vlen, flags, timeout);
+    }
+    BeforeReadv(handler_.get(), msgvec[0].msg_hdr.msg_iov,
+                msgvec[0].msg_hdr.msg_iovlen);
+    auto ret = ReadContextIfNecessary();
+    if (ret <= 0) {
+        return ret;
+    }
+    ret = orig_.recvmmsg(fd(), msgvec, vlen, flags, timeout);
+    AfterRecvMMsg(handler_.get(), msgvec, ret);
+    return ret;
+}
+
+ssize_t ServerSocket::SpliceRead(loff_t *off_in, int fd_out, loff_t *off_out,
+                                 size_t len, unsigned int flags) {
+    handler_->BeforeRead(nullptr, len);
+    auto ret = ReadContextIfNecessary();
+    if (ret <= 0) {
+        return ret;
+    }
+    ret = orig_.splice(fd(), off_in, fd_out, off_out, len, flags);
+    handler_->AfterOpaqueRead(ret);
+    return ret;
+}
+
 ssize_t ServerSocket::Send(const void *buf, size_t len, int flags) {
     handler_->BeforeWrite(set_iovec(buf, len), SINGLE_IOVEC);
     auto ret = orig_.send(fd(), buf, len, flags);
@@ -167,6 +237,63 @@ ssize_t ServerSocket::SendMsg(const struct msghdr *msg, int flags) {
     return ret;
 }
 
+int ServerSocket::SendMMsg(struct mmsghdr *msgvec, unsigned int vlen,
+                           int flags) {
+    if (vlen == 0) {
+        return orig_.sendmmsg(fd(), msgvec, vlen, flags);
+    }
+    handler_->BeforeWrite(msgvec[0].msg_hdr.msg_iov,
+                          msgvec[0].msg_hdr.msg_iovlen);
+    auto ret = orig_.sendmmsg(fd(), msgvec, vlen, flags);
+    AfterSendMMsg(handler_.get(), msgvec, ret);
+    return ret;
+}
+
+ssize_t ServerSocket::SendFile(int in_fd, off_t *offset, size_t count) {
+    handler_->BeforeWrite(nullptr, 0);
+    auto ret = orig_.sendfile(fd(), in_fd, offset, count);
+    handler_->AfterOpaqueWrite(ret);
+    return ret;
+}
+
+ssize_t ServerSocket::SpliceWrite(int fd_in, loff_t *off_in, loff_t *off_out,
+                                  size_t len, unsigned int flags) {
+    handler_->BeforeWrite(nullptr, 0);
+    auto ret = orig_.splice(fd_in, off_in, fd(), off_out, len, flags);
+    handler_->AfterOpaqueWrite(ret);
+    return ret;
+}
+
+// The kernel reads a binary context into the buffers of the application,
+// along with the request, and it can't be taken out of them. Requests read
+// through io_uring are only traced when the context isn't sent in-band.
+
+void ServerSocket::SubmitRead(const struct iovec *iov, int iovcnt) {
+    if (!ContextInBand()) {
+        BeforeReadv(handler_.get(), iov, iovcnt);
+    }
+}
+
+void ServerSocket::CompleteRead(const struct iovec *iov, int iovcnt,
+                                ssize_t ret) {
+    if (!ContextInBand()) {
+        AfterUringRead(handler_.get(), iov, iovcnt, ret);
+    }
+}
+
+void ServerSocket::SubmitWrite(const struct iovec *iov, int iovcnt) {
+    if (!ContextInBand()) {
+        handler_->BeforeWrite(iov, iovcnt);
+    }
+}
+
+void ServerSocket::CompleteWrite(const struct iovec *iov, int iovcnt,
+                                 ssize_t ret) {
+    if (!ContextInBand()) {
+        AfterUringWrite(handler_.get(), iov, iovcnt, ret);
+    }
+}
+
 int ServerSocket::Close() {
     handler_->BeforeClose();
     auto ret = orig_.close(this->fd());
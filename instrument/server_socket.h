@@ -17,11 +17,19 @@ class ServerSocket : public InstrumentedSocket {
                  const OriginalFunctions &orig);
 
     void Async() override;
+    void Rebind(int fd) override;
+    void NonBlocking(const bool non_blocking) override;
+    void Ready() override;
+    void SocketError(const int err) override {}
 
     ssize_t RecvFrom(void *buf, size_t len, int flags,
                      struct sockaddr *src_addr, socklen_t *addrlen) override;
     ssize_t Recv(void *buf, size_t len, int flags) override;
     ssize_t Read(void *buf, size_t count) override;
+    ssize_t Readv(const struct iovec *iov, int iovcnt) override;
+    ssize_t RecvMsg(struct msghdr *msg, int flags) override;
+    int RecvMMsg(struct mmsghdr *msgvec, unsigned int vlen, int flags,
+                 struct timespec *timeout) override;
     ssize_t Write(const void *buf, size_t count) override;
     ssize_t Writev(const struct iovec *iov, int iovcnt) override;
     ssize_t Send(const void *buf, size_t len, int flags) override;
@@ -29,20 +37,53 @@ class ServerSocket : public InstrumentedSocket {
                    const struct sockaddr *dest_addr,
                    socklen_t addrlen) override;
     ssize_t SendMsg(const struct msghdr *msg, int flags) override;
+    int SendMMsg(struct mmsghdr *msgvec, unsigned int vlen,
+                 int flags) override;
+    ssize_t SendFile(int in_fd, off_t *offset, size_t count) override;
+    ssize_t SpliceRead(loff_t *off_in, int fd_out, loff_t *off_out, size_t len,
+                       unsigned int flags) override;
+    ssize_t SpliceWrite(int fd_in, loff_t *off_in, loff_t *off_out, size_t len,
+                        unsigned int flags) override;
+
+    void SubmitRead(const struct iovec *iov, int iovcnt) override;
+    void CompleteRead(const struct iovec *iov, int iovcnt,
+                      ssize_t ret) override;
+    void SubmitWrite(const struct iovec *iov, int iovcnt) override;
+    void CompleteWrite(const struct iovec *iov, int iovcnt,
+                       ssize_t ret) override;
 
     int Close() override;
 
    private:
+    /*
+     * Indicates if the context arrives ahead of requests, in binary.
+     */
+    bool ContextInBand() const;
+
     ssize_t ReadContextIfNecessary();
 
-    ssize_t ReadContextBlocking();
-    ssize_t ReadContextAsync();
+    ssize_t ReadContext();
+
+    /*
+     * Returns the number of context bytes that have to be read in total,
+     * based on the flags byte at the start of ctx_buf_.
+     */
+    size_t ContextBytesNeeded() const;
+
+    /*
+     * Decodes the context in ctx_buf_, and passes it to the handler.
+     */
+    void ContextRead();
 
     std::unique_ptr<ServerSocketHandler> handler_;
 
     // Buffer for reading context bytes
-    std::array<char, sizeof(ContextStorage)> ctx_buf_;
+    std::array<char, Context::MAX_WIRE_SIZE> ctx_buf_;
 
     size_t ctx_buf_start_;
+
+    // Set once a context was read on this connection, ctx_buf_ holds the last
+    // one from then on
+    bool context_received_;
 };
 }
@@ -5,14 +5,22 @@
 
 #include "common.h"
 #include "context.h"
+#include "http_processor.h"
 #include "orig_functions.h"
 
 namespace microtrace {
 
-ServerSocketHandlerImpl::ServerSocketHandlerImpl(int sockfd,
-                                                 TraceLogger* trace_logger,
-                                                 const OriginalFunctions& orig)
-    : ServerSocketHandler(sockfd, orig), trace_logger_(trace_logger) {}
+ServerSocketHandlerImpl::ServerSocketHandlerImpl(
+    int sockfd, TraceLogger* trace_logger, Sampler* sampler,
+    OverheadBreaker* overhead_breaker, const OriginalFunctions& orig)
+    : ServerSocketHandler(sockfd, orig),
+      trace_logger_(trace_logger),
+      sampler_(sampler),
+      overhead_breaker_(overhead_breaker),
+      request_tracker_(HttpTracker::Type::REQUEST),
+      response_tracker_(HttpTracker::Type::RESPONSE),
+      response_started_(false),
+      sessions_(ProtocolSession::Role::SERVER, {this, this, nullptr}) {}
 
 void ServerSocketHandlerImpl::Async() { type_ = SocketType::ASYNC; }
 
@@ -30,9 +38,14 @@ SocketAction ServerSocketHandlerImpl::get_next_action(
     return SocketAction::NONE;
 }
 
-void ServerSocketHandlerImpl::ContextReadCallback(std::unique_ptr<Context> c) {
-    VERIFY(c, "ContextReadCallback called with empty context");
-    context_ = std::move(c);
+void ServerSocketHandlerImpl::ContextReadCallback(const Context& c) {
+    // In pass-through mode, the rest of the trace is dropped, only an
+    // unsampled context is passed on. Debug traces are always followed.
+    if (overhead_breaker_->pass_through() && !c.debug()) {
+        SetUnsampledContext();
+    } else {
+        SetContext(c);
+    }
     context_processed_ = true;
 }
 
@@ -45,13 +58,47 @@ SocketHandler::Result ServerSocketHandlerImpl::BeforeRead(const void* buf,
     return Result::Ok;
 }
 
-bool ServerSocketHandlerImpl::ShouldTrace() const {
-    // sample 1% of reqs
-    return (std::rand() % 100) <= 0;
+bool ServerSocketHandlerImpl::ShouldTrace(const void* buf,
+                                          const size_t len) const {
+    if (!sampler_->uses_url()) {
+        return sampler_->ShouldSample();
+    }
+    // Only HTTP requests have a URL
+    if (sessions_.protocol() != Protocol::HTTP || !buf) {
+        return sampler_->ShouldSampleUrl(std::string{});
+    }
+    // The decision is deferred until the request line of the first read is
+    // parsed, the data has already been read by the application so it is not
+    // delayed
+    HttpProcessor http_processor;
+    http_processor.Process(static_cast<const char*>(buf), len);
+    return sampler_->ShouldSampleUrl(
+        http_processor.has_url() ? http_processor.url() : std::string{});
+}
+
+bool ServerSocketHandlerImpl::IsDebugRequest(const void* buf,
+                                            const size_t len) const {
+    const std::string& header = GetDebugHeader();
+    return !header.empty() && sessions_.protocol() == Protocol::HTTP && buf &&
+           HasHeader(static_cast<const char*>(buf), len, header.data(),
+                     header.size());
+}
+
+void ServerSocketHandlerImpl::ReadTraceparent(const void* buf,
+                                              const size_t len) {
+    // Requests without the header, e.g. the ones of uninstrumented clients,
+    // are not traced
+    Context context{ContextStorage::Zero(), 0};
+    if (sessions_.protocol() == Protocol::HTTP && buf) {
+        Traceparent::Find(static_cast<const char*>(buf), len, &context);
+    }
+    ContextReadCallback(context);
 }
 
 void ServerSocketHandlerImpl::AfterRead(const void* buf, size_t len,
                                         ssize_t ret) {
+    OverheadScope overhead{overhead_breaker_};
+
     if (ret == 0) {
         // peer shutdown
         return;
@@ -62,6 +109,32 @@ void ServerSocketHandlerImpl::AfterRead(const void* buf, size_t len,
 
     VERIFY(ret > 0, "read invalid return value");
 
+    // The protocol is detected from the first request. The requests of
+    // protocols that have a session of their own are sampled and timed
+    // separately.
+    if (num_transactions_ == 0 && !sessions_.bound() && buf) {
+        const char* data = static_cast<const char*>(buf);
+        if (sessions_.Bind(DetectProtocol(data, ret)) && !context_) {
+            SetUnsampledContext();
+        }
+    }
+    if (sessions_.bound()) {
+        if (get_next_action(SocketOperation::READ) ==
+            SocketAction::RECV_REQUEST) {
+            ++num_transactions_;
+        }
+        set_current_context(context());
+        if (buf) {
+            sessions_.Received(static_cast<const char*>(buf), ret);
+        } else {
+            sessions_.Skipped();
+        }
+
+        context_processed_ = false;
+        state_ = SocketState::READ;
+        return;
+    }
+
     // New transaction
     if (get_next_action(SocketOperation::READ) == SocketAction::RECV_REQUEST) {
         // If we are frontend, generate a random context
@@ -69,85 +142,319 @@ void ServerSocketHandlerImpl::AfterRead(const void* buf, size_t len,
             // We use sampling, if this request should be traced, we generate a
             // new context, otherwise we use the empty context which indicates
             // that this shouldn't be traced
-            if (ShouldTrace()) {
-                context_.reset(new Context);
-                client_txn_.reset(new Transaction);
-                client_txn_->Start();
+            if (IsDebugRequest(buf, ret)) {
+                SetContext(Context::Debug());
+            } else if (ShouldTrace(buf, ret)) {
+                SetContext(Context{});
             } else {
-                context_ = Context::Zero();
+                SetUnsampledContext();
             }
         }
         // Otherwise we are backend, it was passed to us by client
-        // and context_ is already set through ContextReadCallback.
+        // and context_ is already set through ContextReadCallback, or it is
+        // in the traceparent header of the request.
         else {
+            if (GetPropagation() == Propagation::TRACEPARENT) {
+                ReadTraceparent(buf, ret);
+            }
             VERIFY(context_, "Backend server context is empty");
-            context_->NewSpan();  // We generate new span in this case
+
+            if (sampled_) {
+                context_->NewSpan();  // We generate new span in this case
+            }
         }
 
         set_current_context(*context_);
         ++num_transactions_;
+
+        // Time sampled requests so the logger knows how long the local root
+        // of the trace took. Unsampled requests only need their context to be
+        // passed on, unless they have to be matched with their response.
+        if (sampled_ || !txns_.empty()) {
+            StartTxn(context());
+        }
     }
     // Continue reading request
     else if (state_ == SocketState::READ) {
         set_current_context(context());
     }
 
+    if (!txns_.empty()) {
+        if (buf) {
+            ProcessRequest(static_cast<const char*>(buf), ret);
+        } else {
+            // Only the body of a request, e.g. an uploaded file, can be
+            // received without being seen
+            request_tracker_.Skip(ret);
+        }
+    }
+
     context_processed_ = false;
     state_ = SocketState::READ;
 }
 
 SocketHandler::Result ServerSocketHandlerImpl::BeforeWrite(
     const struct iovec* iov, int iovcnt) {
+    OverheadScope overhead{overhead_breaker_};
+
     set_current_context(context());
     return Result::Ok;
 }
 
-void ServerSocketHandlerImpl::LogSpan() const {
-    proto::RequestLog log;
+void ServerSocketHandlerImpl::LogSpan(const Context& context,
+                                      const Transaction& txn,
+                                      proto::RequestLog& log) const {
     proto::Connection* conn = log.mutable_conn();
     conn->set_server_hostname(GetHostname());
     conn->set_client_hostname("END-USER");
 
     proto::Context* ctx = log.mutable_context();
-    ctx->mutable_trace_id()->set_high(context().trace().high());
-    ctx->mutable_trace_id()->set_low(context().trace().low());
-    ctx->mutable_span_id()->set_high(context().trace().high());
-    ctx->mutable_span_id()->set_low(context().trace().low());
-    ctx->mutable_parent_span()->set_high(context().trace().high());
-    ctx->mutable_parent_span()->set_low(context().trace().low());
-
-    log.set_time(client_txn_->start());
-    log.set_duration(client_txn_->duration());
+    ctx->mutable_trace_id()->set_high(context.trace().high());
+    ctx->mutable_trace_id()->set_low(context.trace().low());
+    ctx->mutable_span_id()->set_high(context.trace().high());
+    ctx->mutable_span_id()->set_low(context.trace().low());
+    ctx->mutable_parent_span()->set_high(context.trace().high());
+    ctx->mutable_parent_span()->set_low(context.trace().low());
+
+    txn.Fill(&log);
     log.set_transaction_count(num_transactions_);
     log.set_role(proto::RequestLog::SERVER);
+    if (context.debug()) {
+        log.set_debug(true);
+    }
 
     // Make log
     trace_logger_->Log(log);
 }
 
+void ServerSocketHandlerImpl::StartTxn(const Context& context) {
+    // A stuck response would otherwise keep every following request from
+    // being traced
+    if (txns_.full()) {
+        FinishTxn();
+    }
+
+    InFlightTxn& txn = txns_.push();
+    txn.txn.Start();
+    txn.sampled = context.sampled();
+    txn.context = context;
+    txn.head_request = false;
+    txn.status_code = 0;
+    request_tracker_.Reset();
+}
+
+void ServerSocketHandlerImpl::FinishTxn() {
+    const InFlightTxn& txn = txns_.front();
+    if (txn.sampled) {
+        // Only frontends log the end-user's request, backend requests are
+        // logged by their client
+        if (server_type() == ServerType::FRONTEND) {
+            proto::RequestLog log;
+            if (txn.status_code > 0) {
+                log.set_status_code(txn.status_code);
+                if (txn.status_code >= 500) {
+                    log.set_error(true);
+                }
+            }
+            LogSpan(txn.context, txn.txn, log);
+        }
+        trace_logger_->RootCompleted(txn.context.trace(), txn.txn.duration(),
+                                     false);
+    }
+    txns_.pop();
+    response_started_ = false;
+}
+
+Context ServerSocketHandlerImpl::MultiplexedContext(
+    const std::string& url) const {
+    if (server_type() == ServerType::FRONTEND) {
+        const bool sampled = sampler_->uses_url()
+                                 ? sampler_->ShouldSampleUrl(url)
+                                 : sampler_->ShouldSample();
+        return sampled ? Context{} : Context{ContextStorage::Zero(), 0};
+    }
+
+    Context context =
+        sampled_ ? this->context() : Context{ContextStorage::Zero(), 0};
+    context.NewSpan();
+    return context;
+}
+
+void ServerSocketHandlerImpl::StreamStarted(Http2Stream* stream) {
+    stream->context = MultiplexedContext(stream->request.path);
+    stream->sampled = stream->context.sampled();
+
+    // The application handles the stream after this read
+    set_current_context(stream->context);
+}
+
+void ServerSocketHandlerImpl::StreamCompleted(const Http2Stream& stream) {
+    if (!stream.sampled) {
+        return;
+    }
+    if (server_type() == ServerType::FRONTEND) {
+        proto::RequestLog log;
+        log.set_info(stream.info());
+        if (stream.status > 0) {
+            log.set_status_code(stream.status);
+        }
+        if (stream.error()) {
+            log.set_error(true);
+        }
+        LogSpan(stream.context, stream.txn, log);
+    }
+    trace_logger_->RootCompleted(stream.context.trace(), stream.txn.duration(),
+                                 stream.error());
+}
+
+void ServerSocketHandlerImpl::CallStarted(ThriftCall* call) {
+    // Thrift samplers match method names instead of urls
+    call->context = MultiplexedContext(call->method);
+    call->sampled = call->context.sampled();
+
+    // The application handles the call after this read
+    set_current_context(call->context);
+}
+
+void ServerSocketHandlerImpl::CallCompleted(const ThriftCall& call) {
+    if (!call.sampled) {
+        return;
+    }
+    if (server_type() == ServerType::FRONTEND) {
+        proto::RequestLog log;
+        log.set_info(call.info());
+        if (call.error) {
+            log.set_error(true);
+        }
+        LogSpan(call.context, call.txn, log);
+    }
+    trace_logger_->RootCompleted(call.context.trace(), call.txn.duration(),
+                                 call.error);
+}
+
+void ServerSocketHandlerImpl::ProcessRequest(const char* buf, size_t len) {
+    while (len > 0) {
+        // A pipelined request, read along with the previous one. The
+        // application is still in the context of the first request, so it
+        // only gets a context of its own for timing and logging.
+        if (request_tracker_.complete()) {
+            ++num_transactions_;
+            Context context = txns_.back().context;
+            if (context.sampled() && server_type() == ServerType::FRONTEND) {
+                context = Context{};
+            } else {
+                context.NewSpan();
+            }
+            StartTxn(context);
+        }
+
+        const size_t processed = request_tracker_.Process(buf, len);
+        txns_.back().head_request = request_tracker_.head_request();
+
+        // Requests of other protocols can't be told apart, they are handled
+        // as a single transaction
+        if (!request_tracker_.valid()) {
+            return;
+        }
+        buf += processed;
+        len -= processed;
+    }
+}
+
+void ServerSocketHandlerImpl::ProcessResponse(const char* buf, size_t len) {
+    while (len > 0 && !txns_.empty()) {
+        InFlightTxn& txn = txns_.front();
+        if (!response_started_) {
+            response_tracker_.Reset(txn.head_request);
+            response_started_ = true;
+        }
+
+        txn.txn.End();
+        const size_t processed = response_tracker_.Process(buf, len);
+        txn.status_code = response_tracker_.status_code();
+
+        // Responses of other protocols end at their first write
+        if (!response_tracker_.valid()) {
+            FinishTxn();
+            return;
+        }
+        if (!response_tracker_.complete()) {
+            return;
+        }
+        FinishTxn();
+        buf += processed;
+        len -= processed;
+    }
+}
+
+void ServerSocketHandlerImpl::SkipResponse(const uint64_t len) {
+    InFlightTxn& txn = txns_.front();
+    if (!response_started_) {
+        response_tracker_.Reset(txn.head_request);
+        response_started_ = true;
+    }
+
+    txn.txn.End();
+    response_tracker_.Skip(len);
+
+    // Responses whose head wasn't seen end at their first write, like the
+    // ones of other protocols
+    if (!response_tracker_.valid() || response_tracker_.complete()) {
+        FinishTxn();
+    }
+}
+
 void ServerSocketHandlerImpl::AfterWrite(const struct iovec* iov, int iovcnt,
                                          ssize_t ret) {
+    OverheadScope overhead{overhead_breaker_};
+
     if (ret == -1 || ret == 0) {
         return;
     }
 
     VERIFY(ret > 0, "write invalid return value");
 
-    // Start writing response
-    if (get_next_action(SocketOperation::WRITE) ==
-        SocketAction::SEND_RESPONSE) {
-        // If client_txn_ is not empty, it means that this trace is
-        // traced, we do not need to check for non-zero context.
-        if (client_txn_) {
-            client_txn_->End();
-            LogSpan();
+    if (sessions_.bound()) {
+        if (iov) {
+            ForEachWritten(iov, iovcnt, ret,
+                           [this](const char* buf, size_t len) {
+                               sessions_.Sent(buf, len);
+                           });
+        } else {
+            sessions_.Skipped();
+        }
+    }
+    // Responses are matched to the requests in flight in the order they
+    // were received
+    else if (!txns_.empty()) {
+        if (iov) {
+            ForEachWritten(iov, iovcnt, ret,
+                           [this](const char* buf, size_t len) {
+                               ProcessResponse(buf, len);
+                           });
+        } else {
+            SkipResponse(ret);
         }
     }
 
     state_ = SocketState::WROTE;
 }
 
+void ServerSocketHandlerImpl::AfterOpaqueRead(ssize_t ret) {
+    // The After handlers tell data that wasn't seen by its null buffer
+    AfterRead(nullptr, 0, ret);
+}
+
+void ServerSocketHandlerImpl::AfterOpaqueWrite(ssize_t ret) {
+    AfterWrite(nullptr, 0, ret);
+}
+
 SocketHandler::Result ServerSocketHandlerImpl::BeforeClose() {
+    // Responses without framing end when the connection is closed
+    while (!txns_.empty()) {
+        FinishTxn();
+    }
+    sessions_.Close();
     return Result::Ok;
 }
 
@@ -1,7 +1,13 @@
 #pragma once
 
+#include "http_tracker.h"
+#include "overhead_breaker.h"
+#include "protocol_session.h"
+#include "sampler.h"
 #include "socket_handler.h"
 #include "trace_logger.h"
+#include "traceparent.h"
+#include "txn_queue.h"
 
 namespace microtrace {
 
@@ -10,12 +16,18 @@ class ServerSocketHandler : public AbstractSocketHandler {
     ServerSocketHandler(int sockfd, const OriginalFunctions& orig)
         : AbstractSocketHandler(sockfd, SocketState::WILL_READ, orig) {}
 
-    virtual void ContextReadCallback(std::unique_ptr<Context> c) = 0;
+    /*
+     * Called when a backend server has read the context of the next request.
+     */
+    virtual void ContextReadCallback(const Context& c) = 0;
 };
 
-class ServerSocketHandlerImpl : public ServerSocketHandler {
+class ServerSocketHandlerImpl : public ServerSocketHandler,
+                                private Http2Session::Observer,
+                                private ThriftSession::Observer {
    public:
     ServerSocketHandlerImpl(int sockfd, TraceLogger* trace_logger,
+                            Sampler* sampler, OverheadBreaker* overhead_breaker,
                             const OriginalFunctions& orig);
 
     void Async() override;
@@ -26,24 +38,150 @@ class ServerSocketHandlerImpl : public ServerSocketHandler {
     Result BeforeWrite(const struct iovec* iov, int iovcnt) override;
     void AfterWrite(const struct iovec* iov, int iovcnt, ssize_t ret) override;
 
+    void AfterOpaqueRead(ssize_t ret) override;
+    void AfterOpaqueWrite(ssize_t ret) override;
+
     Result BeforeClose() override;
     void AfterClose(int ret) override;
 
     SocketAction get_next_action(const SocketOperation op) const override;
 
-    void ContextReadCallback(std::unique_ptr<Context> c) override;
+    void ContextReadCallback(const Context& c) override;
 
    private:
-    bool ShouldTrace() const;
+    /*
+     * A request that has been received, and whose response hasn't been fully
+     * sent yet.
+     */
+    struct InFlightTxn {
+        Transaction txn;
+
+        /*
+         * Unsampled requests are only kept in the queue while other requests
+         * are in flight, so that responses are matched to the right request.
+         */
+        bool sampled = false;
 
-    void LogSpan() const;
+        /*
+         * The context of the request, starts from zero because the default
+         * constructor would generate random uuids.
+         */
+        Context context{ContextStorage::Zero(), 0};
+
+        bool head_request = false;
+        int status_code = 0;
+    };
 
     /*
-     * If this is a frontend server, it stores the current transaction we are
-     * processing. Otherwise it is always empty.
+     * Maximum number of pipelined requests that can be in flight, the oldest
+     * one is completed early if a new one doesn't fit.
      */
-    std::unique_ptr<Transaction> client_txn_;
+    static const size_t MAX_IN_FLIGHT = 8;
+
+    /*
+     * Decides if the request whose first read returned buf is traced.
+     */
+    bool ShouldTrace(const void* buf, const size_t len) const;
+
+    /*
+     * Returns true if the HTTP request whose first read returned buf has the
+     * header that marks its trace for debugging.
+     */
+    bool IsDebugRequest(const void* buf, const size_t len) const;
+
+    /*
+     * Sets the context from the traceparent header of the request whose first
+     * read returned buf, used instead of ContextReadCallback with traceparent
+     * propagation.
+     */
+    void ReadTraceparent(const void* buf, const size_t len);
+
+    /*
+     * Logs the end-user's request, log may already contain the fields that
+     * depend on the protocol.
+     */
+    void LogSpan(const Context& context, const Transaction& txn,
+                 proto::RequestLog& log) const;
+
+    /*
+     * Returns the context of a request that is multiplexed on the connection,
+     * i.e. an HTTP/2 stream or a Thrift call. Frontends sample it by url,
+     * backends make it a child of the span whose context was read last.
+     */
+    Context MultiplexedContext(const std::string& url) const;
+
+    void StreamStarted(Http2Stream* stream) override;
+    void StreamCompleted(const Http2Stream& stream) override;
+
+    void CallStarted(ThriftCall* call) override;
+    void CallCompleted(const ThriftCall& call) override;
+
+    /*
+     * Adds a transaction for the request that is being received.
+     */
+    void StartTxn(const Context& context);
+
+    /*
+     * Removes the oldest transaction once its response has been sent, and
+     * completes it if it is sampled.
+     */
+    void FinishTxn();
+
+    /*
+     * Follows the requests being received. Every request that follows a
+     * complete one without waiting for its response gets a transaction of its
+     * own.
+     */
+    void ProcessRequest(const char* buf, size_t len);
+
+    /*
+     * Follows the responses being sent, and finishes the transaction of every
+     * response that completes.
+     */
+    void ProcessResponse(const char* buf, size_t len);
+
+    /*
+     * Follows the response being sent when len bytes of it couldn't be seen.
+     */
+    void SkipResponse(const uint64_t len);
+
+    /*
+     * The transactions we are processing, until we have sent their whole
+     * response. There can be more than one if requests are pipelined.
+     */
+    TxnQueue<InFlightTxn, MAX_IN_FLIGHT> txns_;
 
     TraceLogger* const trace_logger_;
+
+    /*
+     * Decides which requests are traced if this is a frontend server.
+     */
+    Sampler* const sampler_;
+
+    /*
+     * Measures the time spent in the handler, and turns off tracing of
+     * incoming traced requests in pass-through mode.
+     */
+    OverheadBreaker* const overhead_breaker_;
+
+    /*
+     * Follow the request being received and the response being sent, so
+     * every transaction ends when the last byte of its response has been
+     * written.
+     */
+    HttpTracker request_tracker_;
+    HttpTracker response_tracker_;
+
+    /*
+     * Indicates if response_tracker_ has been reset for the response of the
+     * oldest transaction.
+     */
+    bool response_started_;
+
+    /*
+     * Follows the requests instead of txns_ if the protocol of the connection
+     * has a session of its own, e.g. HTTP/2 or Thrift.
+     */
+    ProtocolSession sessions_;
 };
 }
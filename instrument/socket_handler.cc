@@ -37,5 +37,20 @@ AbstractSocketHandler::AbstractSocketHandler(int sockfd,
       type_(SocketType::BLOCKING),
       server_type_(GetServerType()),
       context_processed_(false),
+      sampled_(false),
+      non_blocking_(false),
       orig_(orig) {}
+
+void AbstractSocketHandler::SetContext(const Context& c) {
+    if (context_) {
+        *context_ = c;
+    } else {
+        context_.reset(new Context(c));
+    }
+    sampled_ = c.sampled();
+}
+
+void AbstractSocketHandler::SetUnsampledContext() {
+    SetContext(Context{ContextStorage::Zero(), 0});
+}
 }
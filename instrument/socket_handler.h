@@ -1,11 +1,13 @@
 #pragma once
 
-#include <chrono>
+#include <sys/uio.h>
+#include <algorithm>
 #include <string>
 
 #include "common.h"
 #include "context.h"
 #include "request_log.pb.h"
+#include "span_clock.h"
 
 namespace microtrace {
 
@@ -34,28 +36,60 @@ struct Connection {
 class Transaction {
    public:
     void Start() {
-        system_start_ = std::chrono::system_clock::now();
-        start_ = std::chrono::steady_clock::now();
+        start_ = span_now_ns();
+        end_ = start_;
     }
 
-    void End() { end_ = std::chrono::steady_clock::now(); }
+    void End() { end_ = span_now_ns(); }
 
-    time_t start() const {
-        return std::chrono::system_clock::to_time_t(system_start_);
-    }
+    /*
+     * The wall time of the start in seconds since epoch.
+     */
+    time_t start() const { return start_ns() / 1000000000; }
+
+    /*
+     * The wall time of the start in nanoseconds since epoch.
+     */
+    int64_t start_ns() const { return SpanClock::Default().ToWall(start_); }
+
+    /*
+     * The duration in milliseconds, with the fraction kept.
+     */
+    double duration() const { return duration_ns() / 1e6; }
+
+    int64_t duration_ns() const { return end_ - start_; }
 
-    double duration() const {
-        return std::chrono::duration_cast<std::chrono::milliseconds>(end_ -
-                                                                     start_)
-            .count();
+    /*
+     * Sets the time fields of log.
+     */
+    void Fill(proto::RequestLog* log) const {
+        const int64_t start = start_ns();
+        log->set_time(start / 1000000000);
+        log->set_time_ns(start);
+        log->set_duration(duration());
+        log->set_duration_ns(duration_ns());
     }
 
    private:
-    std::chrono::time_point<std::chrono::system_clock> system_start_;
-    std::chrono::time_point<std::chrono::steady_clock> start_;
-    std::chrono::time_point<std::chrono::steady_clock> end_;
+    // Timestamps of the monotonic span clock
+    int64_t start_ = 0;
+    int64_t end_ = 0;
 };
 
+/*
+ * Calls f(buf, len) for each part of iov that has been written by a write
+ * that returned ret.
+ */
+template <class F>
+void ForEachWritten(const struct iovec* iov, int iovcnt, ssize_t ret, F f) {
+    size_t left = static_cast<size_t>(ret);
+    for (int i = 0; i < iovcnt && left > 0; ++i) {
+        const size_t len = std::min(left, iov[i].iov_len);
+        f(static_cast<const char*>(iov[i].iov_base), len);
+        left -= len;
+    }
+}
+
 /*
  * Wraps a proto::RequestLog. On destruction, it releases the fields that have
  * been borrowed, and not owned by the underlying RequestLog.
@@ -125,7 +159,8 @@ class SocketHandler {
      *
      * Ok indicates that the operation should be executed, and Stop means
      * tha the operation should not continue, and the corresponding After
-     * handler should not be called either.
+     * handler should not be called either. A stopped call fails with the
+     * errno the handler left.
      */
     enum class Result { Ok, Stop };
 
@@ -140,6 +175,14 @@ class SocketHandler {
     virtual void AfterWrite(const struct iovec* iov, int iovcnt,
                             ssize_t ret) = 0;
 
+    /*
+     * Called instead of AfterRead and AfterWrite when the data is moved in
+     * the kernel, e.g. by sendfile or splice, so only the number of bytes
+     * is known. The Before handlers are called with an empty buffer.
+     */
+    virtual void AfterOpaqueRead(ssize_t ret) = 0;
+    virtual void AfterOpaqueWrite(ssize_t ret) = 0;
+
     virtual Result BeforeClose() = 0;
     virtual void AfterClose(int ret) = 0;
 
@@ -170,6 +213,11 @@ class AbstractSocketHandler : public SocketHandler {
 
     int fd() const override { return sockfd_; }
 
+    /*
+     * Moves the handler to another descriptor of its socket.
+     */
+    void set_fd(const int sockfd) { sockfd_ = sockfd; }
+
     SocketState state() const override { return state_; }
 
     const Context& context() const override {
@@ -185,8 +233,35 @@ class AbstractSocketHandler : public SocketHandler {
 
     bool is_context_processed() const { return context_processed_; }
 
+    /*
+     * Indicates if the current transaction is traced. Unsampled transactions
+     * only keep the state needed to pass their context on.
+     */
+    bool sampled() const { return sampled_; }
+
+    /*
+     * Indicates if the socket is in non-blocking mode, in which its calls
+     * fail with EAGAIN instead of waiting, e.g. because it is driven by an
+     * event loop.
+     */
+    bool non_blocking() const { return non_blocking_; }
+    void set_non_blocking(const bool non_blocking) {
+        non_blocking_ = non_blocking;
+    }
+
    protected:
-    const int sockfd_;
+    /*
+     * Replaces the current context with c. The previous context is reused to
+     * avoid allocating for every transaction.
+     */
+    void SetContext(const Context& c);
+
+    /*
+     * Replaces the current context with an unsampled, zero context.
+     */
+    void SetUnsampledContext();
+
+    int sockfd_;
 
     /*
      * Stores the current context. Initially empty.
@@ -204,7 +279,8 @@ class AbstractSocketHandler : public SocketHandler {
     int num_transactions_;
 
     /*
-     * Indicates if the socket is blocking or non-blocking.
+     * Indicates if the socket is used by a blocking thread, or asynchronously
+     * by a library that called Async() when the socket was created.
      */
     SocketType type_;
 
@@ -219,6 +295,13 @@ class AbstractSocketHandler : public SocketHandler {
      */
     bool context_processed_;
 
+    /*
+     * Caches context_->sampled(), updated through SetContext().
+     */
+    bool sampled_;
+
+    bool non_blocking_;
+
     const OriginalFunctions& orig_;
 };
 }
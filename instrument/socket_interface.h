@@ -12,6 +12,12 @@ class SocketInterface {
 
     virtual int fd() const = 0;
 
+    /*
+     * Moves the socket to fd, another descriptor of it, because its own one is
+     * being closed.
+     */
+    virtual void Rebind(int fd) = 0;
+
     /*
      * Calling Async() indicates that the socket will be used in asynchronous
      * mode (non-blocking). Async should be called when current context is set
@@ -19,10 +25,33 @@ class SocketInterface {
     */
     virtual void Async() = 0;
 
+    /*
+     * Records the mode the application put the socket in, with SOCK_NONBLOCK,
+     * fcntl(O_NONBLOCK) or ioctl(FIONBIO).
+     */
+    virtual void NonBlocking(const bool non_blocking) = 0;
+
+    /*
+     * Called when an event loop has been woken up by this socket alone, so
+     * that the code handling the event runs in the context of the request on
+     * the socket.
+     */
+    virtual void Ready() = 0;
+
+    /*
+     * Called with the pending error of the socket that the application got
+     * from getsockopt(SO_ERROR), zero if there was none.
+     */
+    virtual void SocketError(const int err) = 0;
+
     virtual ssize_t RecvFrom(void *buf, size_t len, int flags,
                              struct sockaddr *src_addr, socklen_t *addrlen) = 0;
     virtual ssize_t Recv(void *buf, size_t len, int flags) = 0;
     virtual ssize_t Read(void *buf, size_t count) = 0;
+    virtual ssize_t Readv(const struct iovec *iov, int iovcnt) = 0;
+    virtual ssize_t RecvMsg(struct msghdr *msg, int flags) = 0;
+    virtual int RecvMMsg(struct mmsghdr *msgvec, unsigned int vlen, int flags,
+                         struct timespec *timeout) = 0;
     virtual ssize_t Write(const void *buf, size_t count) = 0;
     virtual ssize_t Writev(const struct iovec *iov, int iovcnt) = 0;
     virtual ssize_t Send(const void *buf, size_t len, int flags) = 0;
@@ -30,6 +59,40 @@ class SocketInterface {
                            const struct sockaddr *dest_addr,
                            socklen_t addrlen) = 0;
     virtual ssize_t SendMsg(const struct msghdr *msg, int flags) = 0;
+    virtual int SendMMsg(struct mmsghdr *msgvec, unsigned int vlen,
+                         int flags) = 0;
+
+    /*
+     * The calls that move data between the socket and another file in the
+     * kernel. Their payload never reaches the application, so it can't be
+     * inspected.
+     */
+    virtual ssize_t SendFile(int in_fd, off_t *offset, size_t count) = 0;
+
+    /*
+     * Splices data read from the socket into fd_out.
+     */
+    virtual ssize_t SpliceRead(loff_t *off_in, int fd_out, loff_t *off_out,
+                               size_t len, unsigned int flags) = 0;
+
+    /*
+     * Splices data from fd_in into the socket.
+     */
+    virtual ssize_t SpliceWrite(int fd_in, loff_t *off_in, loff_t *off_out,
+                                size_t len, unsigned int flags) = 0;
+
+    /*
+     * The reads and writes submitted to io_uring. Submit is called before the
+     * kernel gets the operation, and Complete once its completion is found,
+     * with the result as the call would have returned it. iov is empty if the
+     * buffers can't be seen.
+     */
+    virtual void SubmitRead(const struct iovec *iov, int iovcnt) = 0;
+    virtual void CompleteRead(const struct iovec *iov, int iovcnt,
+                              ssize_t ret) = 0;
+    virtual void SubmitWrite(const struct iovec *iov, int iovcnt) = 0;
+    virtual void CompleteWrite(const struct iovec *iov, int iovcnt,
+                               ssize_t ret) = 0;
 
     virtual int Close() = 0;
 };
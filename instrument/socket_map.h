@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <mutex>
+#include <new>
 #include <shared_mutex>
 
 #include "common.h"
@@ -10,14 +11,16 @@
 namespace microtrace {
 
 /*
- * SocketMap associates file descriptors with SocketInterfaces.
+ * SocketMap associates file descriptors with SocketInterfaces. A socket is
+ * shared by the descriptors that dup made of it, and deleted with the last
+ * one.
  *
  * The public methods never throw an exception or do abort if an invalid fd is
  * used, instead they return null or do nothing.
  */
 class SocketMap {
    public:
-    typedef std::unique_ptr<SocketInterface> value_type;
+    typedef std::shared_ptr<SocketInterface> value_type;
 
     // Should be power of 2
     const static int DEFAULT_SIZE = 1024;
@@ -48,8 +51,49 @@ class SocketMap {
 
     void Delete(const int sockfd) {
         std::unique_lock<mutex_type> l(mu_);
-        if (in_range(sockfd)) {
-            map_[sockfd].reset();
+        DeleteLocked(sockfd);
+    }
+
+    /*
+     * Makes newfd a descriptor of the socket of oldfd as well, after
+     * dup(oldfd) returned newfd. newfd is deleted first, since dup2 closes it.
+     * Returns false if oldfd has no socket.
+     */
+    bool Dup(const int oldfd, const int newfd) {
+        std::unique_lock<mutex_type> l(mu_);
+        if (oldfd == newfd) {
+            return in_range(oldfd) && map_[oldfd];
+        }
+        DeleteLocked(newfd);
+        if (!in_range(oldfd) || !map_[oldfd]) {
+            return false;
+        }
+        if (!in_range(newfd)) {
+            Resize(newfd);
+        }
+        map_[newfd] = map_[oldfd];
+        return true;
+    }
+
+    /*
+     * Called before fork, it holds the lock until AfterForkParent or
+     * AfterForkChild.
+     */
+    void PrepareFork() { mu_.lock(); }
+
+    void AfterForkParent() { mu_.unlock(); }
+
+    /*
+     * Forgets every socket in the child of fork. The descriptors it inherited
+     * are shared with the parent, which traces them, so they are passed
+     * through from now on.
+     */
+    void AfterForkChild() {
+        // A rwlock is only unlocked as a writer by the thread id that locked
+        // it, and the thread of the child has a new id
+        new (&mu_) mutex_type;
+        for (int fd = 0; fd < size_; ++fd) {
+            map_[fd].reset();
         }
     }
 
@@ -59,6 +103,24 @@ class SocketMap {
 
     inline bool in_range(int sockfd) const { return sockfd < size_; }
 
+    void DeleteLocked(const int sockfd) {
+        if (!in_range(sockfd) || !map_[sockfd]) {
+            return;
+        }
+        value_type socket = std::move(map_[sockfd]);
+
+        // The socket is still open through another descriptor, which it has
+        // to use from now on
+        if (socket.use_count() > 1 && socket->fd() == sockfd) {
+            for (int fd = 0; fd < size_; ++fd) {
+                if (map_[fd] == socket) {
+                    socket->Rebind(fd);
+                    break;
+                }
+            }
+        }
+    }
+
     void Resize(const int min_size) {
         const int old_size = size_;
         while (!in_range(min_size)) {
@@ -0,0 +1,53 @@
+#include "span_clock.h"
+
+namespace microtrace {
+
+const int64_t SpanClock::CALIBRATION_INTERVAL_NS;
+const int SpanClock::CALIBRATION_ROUNDS;
+
+SpanClock::SpanClock(const Clock monotonic, const Clock wall)
+    : monotonic_(monotonic),
+      wall_(wall),
+      offset_(0),
+      next_calibration_(0),
+      calibrating_(false),
+      calibrations_(0) {
+    Calibrate(monotonic_());
+}
+
+SpanClock& SpanClock::Default() {
+    static SpanClock clock;
+    return clock;
+}
+
+int64_t SpanClock::ToWall(const int64_t monotonic_ns) {
+    // Timestamps are converted shortly after they are taken, so they tell
+    // the time well enough to decide when to calibrate without another read
+    if (monotonic_ns >= next_calibration_.load(std::memory_order_relaxed)) {
+        bool expected = false;
+        if (calibrating_.compare_exchange_strong(expected, true)) {
+            Calibrate(monotonic_ns);
+            calibrating_.store(false);
+        }
+    }
+    return monotonic_ns + offset_.load(std::memory_order_relaxed);
+}
+
+void SpanClock::Calibrate(const int64_t now) {
+    int64_t best_gap = INT64_MAX;
+    int64_t offset = 0;
+    for (int i = 0; i < CALIBRATION_ROUNDS; ++i) {
+        const int64_t before = monotonic_();
+        const int64_t wall = wall_();
+        const int64_t after = monotonic_();
+        if (after - before < best_gap) {
+            best_gap = after - before;
+            offset = wall - (before + (after - before) / 2);
+        }
+    }
+    offset_.store(offset, std::memory_order_relaxed);
+    next_calibration_.store(now + CALIBRATION_INTERVAL_NS,
+                            std::memory_order_relaxed);
+    ++calibrations_;
+}
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <time.h>
+#include <atomic>
+#include <cstdint>
+
+namespace microtrace {
+
+/*
+ * Returns the monotonic time in nanoseconds. clock_gettime is answered by the
+ * vDSO, from the TSC where the kernel found it reliable, so this costs about
+ * as much as reading the counter without a system call.
+ */
+inline int64_t span_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Returns the wall time in nanoseconds since epoch.
+ */
+inline int64_t wall_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Converts the monotonic timestamps of spans to wall time.
+ *
+ * Spans only read the monotonic clock, once per event. The offset between
+ * the monotonic and the wall clock is measured the first time a timestamp is
+ * converted, and again every CALIBRATION_INTERVAL_NS, so that the wall times
+ * of spans follow NTP adjustments while their durations never do.
+ */
+class SpanClock {
+   public:
+    typedef int64_t (*Clock)();
+
+    static const int64_t CALIBRATION_INTERVAL_NS = 10000000000;
+
+    /*
+     * The wall clock is read between this many pairs of monotonic reads, and
+     * the tightest pair is used.
+     */
+    static const int CALIBRATION_ROUNDS = 3;
+
+    SpanClock(const Clock monotonic = &span_now_ns,
+              const Clock wall = &wall_now_ns);
+
+    /*
+     * Returns the clock used by every span of the process.
+     */
+    static SpanClock& Default();
+
+    /*
+     * Returns the wall time, in nanoseconds since epoch, of a timestamp of
+     * the monotonic clock.
+     */
+    int64_t ToWall(const int64_t monotonic_ns);
+
+    /*
+     * The number of times the offset has been measured.
+     */
+    uint64_t calibrations() const { return calibrations_.load(); }
+
+   private:
+    void Calibrate(const int64_t now);
+
+    const Clock monotonic_;
+    const Clock wall_;
+
+    std::atomic<int64_t> offset_;
+
+    /*
+     * The monotonic time of the next calibration.
+     */
+    std::atomic<int64_t> next_calibration_;
+    std::atomic<bool> calibrating_;
+    std::atomic<uint64_t> calibrations_;
+};
+}
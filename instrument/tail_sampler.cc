@@ -0,0 +1,241 @@
+#include "tail_sampler.h"
+
+#include "common.h"
+
+namespace microtrace {
+
+TailSamplingLogger::Options TailSamplingLogger::DefaultOptions() {
+    Options options;
+    options.latency_threshold_ms =
+        GetEnvDouble("MICROTRACE_TAIL_LATENCY_MS", 500);
+    options.baseline_rate = GetEnvDouble("MICROTRACE_TAIL_BASELINE_RATE", 0.01);
+    options.budget_bytes =
+        GetEnvLong("MICROTRACE_TAIL_BUDGET_BYTES", 16 * 1024 * 1024);
+    options.max_spans_per_trace = GetEnvLong("MICROTRACE_TAIL_MAX_SPANS", 256);
+    options.ttl_ns = GetEnvLong("MICROTRACE_TAIL_TTL_MS", 30000) * 1000000;
+    return options;
+}
+
+TailSamplingLogger::TailSamplingLogger(TraceLogger* exporter,
+                                       const Options& options,
+                                       const Clock clock)
+    : exporter_(exporter),
+      options_(options),
+      clock_(clock),
+      baseline_(options.baseline_rate),
+      shard_budget_bytes_(options.budget_bytes / NUM_SHARDS),
+      next_sweep_(0),
+      buffered_bytes_(0) {}
+
+size_t TailSamplingLogger::SpanBytes(const proto::RequestLog& log) {
+    return sizeof(proto::RequestLog) + log.info().size() +
+           log.conn().server_hostname().size() +
+           log.conn().client_hostname().size();
+}
+
+TailSamplingLogger::TraceBuffer& TailSamplingLogger::GetOrCreate(
+    Shard& shard, const uuid_t& trace, const int64_t now) {
+    auto it = shard.traces.find(trace);
+    if (it != shard.traces.end()) {
+        return *it->second;
+    }
+
+    TraceBufferPtr buffer;
+    if (!shard.free_traces.empty()) {
+        buffer = std::move(shard.free_traces.back());
+        shard.free_traces.pop_back();
+        buffer->created = now;
+    } else {
+        buffer.reset(new TraceBuffer{now, 0, false, false, {}});
+    }
+    it = shard.traces.emplace(trace, std::move(buffer)).first;
+    shard.age.emplace_back(trace, now);
+    return *it->second;
+}
+
+void TailSamplingLogger::Recycle(Shard& shard, std::vector<Span>* spans) {
+    for (auto& span : *spans) {
+        if (shard.free_spans.size() >= MAX_FREE_SPANS) {
+            break;
+        }
+        span->Clear();
+        shard.free_spans.push_back(std::move(span));
+    }
+    spans->clear();
+}
+
+void TailSamplingLogger::Remove(Shard& shard, TraceMap::iterator it,
+                                std::vector<Span>* spans) {
+    TraceBuffer& buffer = *it->second;
+    buffered_bytes_ -= buffer.bytes;
+    shard.bytes -= buffer.bytes;
+
+    if (spans) {
+        for (auto& span : buffer.spans) {
+            spans->push_back(std::move(span));
+        }
+        buffer.spans.clear();
+    } else {
+        Recycle(shard, &buffer.spans);
+    }
+    buffer.bytes = 0;
+    buffer.error = false;
+    buffer.debug = false;
+
+    if (shard.free_traces.size() < MAX_FREE_TRACES) {
+        shard.free_traces.push_back(std::move(it->second));
+    }
+    shard.traces.erase(it);
+}
+
+void TailSamplingLogger::Evict(Shard& shard, const uuid_t& appending,
+                               const size_t incoming, const int64_t now) {
+    bool skipped = false;
+    while (!shard.age.empty()) {
+        const auto oldest = shard.age.front();
+        auto it = shard.traces.find(oldest.first);
+
+        // The trace has already been removed
+        if (it == shard.traces.end() || it->second->created != oldest.second) {
+            shard.age.pop_front();
+            continue;
+        }
+
+        if (now - oldest.second < options_.ttl_ns &&
+            shard.bytes + incoming <= shard_budget_bytes_) {
+            break;
+        }
+
+        shard.age.pop_front();
+        if (oldest.first == appending) {
+            // Goes behind the others, the loop ends once it is met again
+            shard.age.push_back(oldest);
+            if (skipped) {
+                break;
+            }
+            skipped = true;
+            continue;
+        }
+        Remove(shard, it, nullptr);
+        ++stats_.evicted_traces;
+    }
+}
+
+void TailSamplingLogger::SweepNextShard(const int64_t now) {
+    Shard& shard = shards_[next_sweep_++ % NUM_SHARDS];
+    std::unique_lock<std::mutex> l(shard.mu, std::try_to_lock);
+    if (l.owns_lock()) {
+        Evict(shard, uuid_t::Zero(), 0, now);
+    }
+}
+
+void TailSamplingLogger::Log(const proto::RequestLog& log) {
+    const auto& trace_id = log.context().trace_id();
+    const uuid_t trace = Uuid::FromParts(trace_id.high(), trace_id.low());
+    const int64_t now = clock_();
+    Shard& shard = this->shard(trace);
+    bool kept = false;
+
+    {
+        std::unique_lock<std::mutex> l(shard.mu);
+
+        const Decision& decision = this->decision(shard, trace);
+        if (decision.trace == trace) {
+            if (!decision.keep) {
+                return;
+            }
+            // The trace has been kept, pass the span on without buffering
+            kept = true;
+        } else {
+            TraceBuffer& buffer = GetOrCreate(shard, trace, now);
+            if (buffer.spans.size() >= options_.max_spans_per_trace) {
+                ++stats_.dropped_spans;
+                return;
+            }
+            const size_t bytes = SpanBytes(log);
+            Evict(shard, trace, bytes, now);
+
+            Span span;
+            if (!shard.free_spans.empty()) {
+                span = std::move(shard.free_spans.back());
+                shard.free_spans.pop_back();
+            } else {
+                span = std::make_unique<proto::RequestLog>();
+            }
+            span->CopyFrom(log);
+
+            buffer.bytes += bytes;
+            buffer.error |= log.error();
+            buffer.debug |= log.debug();
+            buffer.spans.push_back(std::move(span));
+            shard.bytes += bytes;
+            buffered_bytes_ += bytes;
+        }
+    }
+
+    SweepNextShard(now);
+    if (kept) {
+        exporter_->Log(log);
+    }
+}
+
+void TailSamplingLogger::RootCompleted(const uuid_t& trace,
+                                       const double duration_ms,
+                                       const bool error) {
+    Shard& shard = this->shard(trace);
+    std::vector<Span> spans;
+    bool keep;
+
+    {
+        std::unique_lock<std::mutex> l(shard.mu);
+
+        auto it = shard.traces.find(trace);
+        const bool found = it != shard.traces.end();
+        const bool has_error = error || (found && it->second->error);
+        keep = has_error || (found && it->second->debug) ||
+               duration_ms >= options_.latency_threshold_ms ||
+               baseline_.ShouldSample();
+
+        decision(shard, trace) = Decision{trace, keep};
+
+        if (it != shard.traces.end()) {
+            Remove(shard, it, keep ? &spans : nullptr);
+        }
+    }
+
+    if (!keep) {
+        ++stats_.dropped_traces;
+        return;
+    }
+
+    ++stats_.kept_traces;
+    for (const auto& span : spans) {
+        exporter_->Log(*span);
+    }
+
+    std::unique_lock<std::mutex> l(shard.mu);
+    Recycle(shard, &spans);
+}
+
+void TailSamplingLogger::PrepareFork() {
+    for (auto& shard : shards_) {
+        shard.mu.lock();
+    }
+}
+
+void TailSamplingLogger::AfterForkParent() {
+    for (auto& shard : shards_) {
+        shard.mu.unlock();
+    }
+}
+
+void TailSamplingLogger::AfterForkChild() {
+    for (auto& shard : shards_) {
+        while (!shard.traces.empty()) {
+            Remove(shard, shard.traces.begin(), nullptr);
+        }
+        shard.age.clear();
+        shard.mu.unlock();
+    }
+}
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "context.h"
+#include "request_log.pb.h"
+#include "sampler.h"
+#include "trace_logger.h"
+
+namespace microtrace {
+
+/*
+ * Implements tail-based sampling.
+ *
+ * Every request is traced, but instead of being exported right away, spans
+ * are buffered per trace. When the local root of a trace completes, the whole
+ * trace is either passed on to exporter, or its buffers are recycled:
+ *  - traces whose root took at least latency_threshold_ms are kept,
+ *  - traces with a failed span are kept,
+ *  - traces marked for debugging are kept,
+ *  - other traces are kept with probability baseline_rate.
+ *
+ * Buffered spans are limited by budget_bytes, which is split evenly among the
+ * shards. Traces whose root never completes are evicted after ttl_ns, or
+ * earlier, oldest first, if the budget of their shard is exceeded. The trace
+ * that a span is being added to is never evicted for it.
+ *
+ * Note that every process makes its own decision, a trace kept by the
+ * frontend might be dropped by a backend whose part of the request was fast.
+ */
+class TailSamplingLogger : public TraceLogger {
+   public:
+    typedef int64_t (*Clock)();
+
+    struct Options {
+        double latency_threshold_ms;
+        double baseline_rate;
+        size_t budget_bytes;
+        size_t max_spans_per_trace;
+        int64_t ttl_ns;
+    };
+
+    struct Stats {
+        std::atomic<uint64_t> kept_traces{0};
+        std::atomic<uint64_t> dropped_traces{0};
+        std::atomic<uint64_t> evicted_traces{0};
+
+        /*
+         * Spans that were discarded because their trace had too many spans.
+         */
+        std::atomic<uint64_t> dropped_spans{0};
+    };
+
+    /*
+     * Returns the options set through the environment.
+     */
+    static Options DefaultOptions();
+
+    TailSamplingLogger(TraceLogger* exporter, const Options& options,
+                       const Clock clock = &steady_now_ns);
+
+    void Log(const proto::RequestLog& log) override;
+
+    void RootCompleted(const uuid_t& trace, const double duration_ms,
+                       const bool error) override;
+
+    /*
+     * Called before fork, it holds the locks of every shard until
+     * AfterForkParent or AfterForkChild.
+     */
+    void PrepareFork();
+
+    void AfterForkParent();
+
+    /*
+     * Drops the traces that are buffered in the child of fork, their roots
+     * complete in the parent.
+     */
+    void AfterForkChild();
+
+    size_t buffered_bytes() const { return buffered_bytes_; }
+
+    const Stats& stats() const { return stats_; }
+
+   private:
+    static const int NUM_SHARDS = 16;
+    static const int NUM_DECISIONS = 256;
+
+    // Limits of the free lists of a single shard
+    static const size_t MAX_FREE_SPANS = 1024;
+    static const size_t MAX_FREE_TRACES = 128;
+
+    typedef std::unique_ptr<proto::RequestLog> Span;
+
+    struct TraceBuffer {
+        int64_t created;
+        size_t bytes;
+        bool error;
+        bool debug;
+        std::vector<Span> spans;
+    };
+
+    /*
+     * A decision that has been made about a trace. They are remembered until
+     * another trace with the same slot completes, so spans that are logged
+     * after the root completed follow the decision of their trace.
+     */
+    struct Decision {
+        uuid_t trace = uuid_t::Zero();
+        bool keep = false;
+    };
+
+    typedef std::unique_ptr<TraceBuffer> TraceBufferPtr;
+
+    typedef std::unordered_map<uuid_t, TraceBufferPtr, UuidHash> TraceMap;
+
+    /*
+     * Traces are distributed among shards by their id, so threads working on
+     * different traces rarely contend for the same lock.
+     */
+    struct Shard {
+        std::mutex mu;
+
+        TraceMap traces;
+
+        // The size of the spans that are buffered in this shard
+        size_t bytes = 0;
+
+        /*
+         * Traces in the order they were created, used for eviction. It may
+         * contain traces that have already been removed.
+         */
+        std::deque<std::pair<uuid_t, int64_t>> age;
+
+        /*
+         * Recycled spans and trace buffers, their memory is reused so that
+         * dropping a trace doesn't free memory that is needed again soon. The
+         * span vectors of recycled buffers keep their capacity.
+         */
+        std::vector<Span> free_spans;
+        std::vector<TraceBufferPtr> free_traces;
+
+        std::array<Decision, NUM_DECISIONS> decisions;
+    };
+
+    Shard& shard(const uuid_t& trace) {
+        return shards_[UuidHash{}(trace) % NUM_SHARDS];
+    }
+
+    static Decision& decision(Shard& shard, const uuid_t& trace) {
+        return shard.decisions[UuidHash{}(trace) / NUM_SHARDS % NUM_DECISIONS];
+    }
+
+    static size_t SpanBytes(const proto::RequestLog& log);
+
+    /*
+     * Evicts traces that are older than the TTL, and the oldest traces while
+     * incoming more bytes would exceed the budget of the shard, except for
+     * the trace appending. Must be called with shard.mu held.
+     */
+    void Evict(Shard& shard, const uuid_t& appending, const size_t incoming,
+               const int64_t now);
+
+    /*
+     * Evicts the expired traces of the next shard in turn, so that the
+     * traces of shards that aren't logged to expire as well. It is skipped
+     * if the shard is busy.
+     */
+    void SweepNextShard(const int64_t now);
+
+    /*
+     * Returns the buffer of trace, creating it if necessary. Must be called
+     * with shard.mu held.
+     */
+    TraceBuffer& GetOrCreate(Shard& shard, const uuid_t& trace,
+                             const int64_t now);
+
+    /*
+     * Removes a trace from shard. Its spans are moved into spans, or recycled
+     * if spans is nullptr. Must be called with shard.mu held.
+     */
+    void Remove(Shard& shard, TraceMap::iterator it, std::vector<Span>* spans);
+
+    /*
+     * Puts spans back into the free list of shard. Must be called with
+     * shard.mu held.
+     */
+    void Recycle(Shard& shard, std::vector<Span>* spans);
+
+    TraceLogger* const exporter_;
+    const Options options_;
+    const Clock clock_;
+
+    ProbabilisticSampler baseline_;
+
+    std::array<Shard, NUM_SHARDS> shards_;
+
+    const size_t shard_budget_bytes_;
+
+    // The shard that is swept next
+    std::atomic<unsigned> next_sweep_;
+
+    std::atomic<size_t> buffered_bytes_;
+
+    Stats stats_;
+};
+}
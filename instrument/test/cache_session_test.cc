@@ -0,0 +1,223 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "cache_session.h"
+#include "memcached_tracker.h"
+#include "resp_tracker.h"
+
+using namespace microtrace;
+
+static std::string Command(const std::vector<std::string>& args) {
+    std::string command = "*" + std::to_string(args.size()) + "\r\n";
+    for (const auto& arg : args) {
+        command += "$" + std::to_string(arg.size()) + "\r\n" + arg + "\r\n";
+    }
+    return command;
+}
+
+static uint64_t KeyHash(const std::string& key) {
+    return CacheKeys::Hash(CacheKeys::HASH_OFFSET, key.data(), key.size());
+}
+
+template <class Tracker>
+static size_t ProcessByteByByte(Tracker& tracker, const std::string& message) {
+    size_t processed = 0;
+    for (size_t i = 0; i < message.size() && !tracker.complete(); ++i) {
+        processed += tracker.Process(&message[i], 1);
+    }
+    return processed;
+}
+
+TEST(RespTracker, StartsWithCommand) {
+    const std::string command = Command({"GET", "key"});
+    EXPECT_TRUE(
+        RespTracker::StartsWithCommand(command.data(), command.size()));
+
+    const std::string http = "GET / HTTP/1.1\r\n\r\n";
+    EXPECT_FALSE(RespTracker::StartsWithCommand(http.data(), http.size()));
+}
+
+TEST(RespTracker, Commands) {
+    const std::string get = Command({"get", "user:1"});
+    const std::string mset = Command({"MSET", "a", "1", "b", "2", "c", "3"});
+    const std::string data = get + mset;
+
+    RespTracker tracker{RespTracker::Type::COMMAND};
+    EXPECT_EQ(get.size(), tracker.Process(data.data(), data.size()));
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_EQ("GET", tracker.verb());
+    ASSERT_EQ(1, tracker.keys().count());
+    EXPECT_EQ(KeyHash("user:1"), tracker.keys().hash(0));
+
+    tracker.Reset();
+    EXPECT_EQ(mset.size(), ProcessByteByByte(tracker, mset));
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_EQ("MSET", tracker.verb());
+    ASSERT_EQ(3, tracker.keys().count());
+    EXPECT_EQ(KeyHash("b"), tracker.keys().hash(1));
+
+    tracker.Reset();
+    const std::string blpop = Command({"BLPOP", "q1", "q2", "0"});
+    tracker.Process(blpop.data(), blpop.size());
+    EXPECT_EQ(2, tracker.keys().count());
+
+    tracker.Reset();
+    const std::string ping = Command({"PING"});
+    tracker.Process(ping.data(), ping.size());
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_EQ(0, tracker.keys().count());
+}
+
+TEST(RespTracker, Replies) {
+    RespTracker tracker{RespTracker::Type::REPLY};
+
+    // Nested arrays, null values, and a bulk string containing CRLF
+    const std::string array =
+        "*3\r\n$5\r\na\r\nbc\r\n*2\r\n:1\r\n$-1\r\n*-1\r\n";
+    EXPECT_EQ(array.size(), ProcessByteByByte(tracker, array));
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_FALSE(tracker.error());
+
+    tracker.Reset();
+    const std::string error = "-ERR unknown command 'FOO'\r\n+OK\r\n";
+    EXPECT_EQ(error.find('+'), tracker.Process(error.data(), error.size()));
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_TRUE(tracker.error());
+
+    // RESP3 map, preceded by an attribute
+    tracker.Reset();
+    const std::string map =
+        "|1\r\n+ttl\r\n:3600\r\n%2\r\n+a\r\n#t\r\n+b\r\n,1.5\r\n";
+    EXPECT_EQ(map.size(), tracker.Process(map.data(), map.size()));
+    EXPECT_TRUE(tracker.complete());
+
+    tracker.Reset();
+    const std::string invalid = "HTTP/1.1 200 OK\r\n";
+    tracker.Process(invalid.data(), invalid.size());
+    EXPECT_FALSE(tracker.valid());
+}
+
+TEST(MemcachedTracker, Commands) {
+    const std::string get = "get a b c\r\n";
+    const std::string set = "set key 0 0 5 noreply\r\nva\r\nl\r\n";
+
+    EXPECT_TRUE(MemcachedTracker::StartsWithCommand(get.data(), get.size()));
+    EXPECT_FALSE(MemcachedTracker::StartsWithCommand("GET / HTTP/1.1\r\n", 16));
+
+    const std::string data = get + set;
+    MemcachedTracker tracker{MemcachedTracker::Type::COMMAND};
+    EXPECT_EQ(get.size(), tracker.Process(data.data(), data.size()));
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_EQ("get", tracker.verb());
+    ASSERT_EQ(3, tracker.keys().count());
+    EXPECT_EQ(KeyHash("c"), tracker.keys().hash(2));
+    EXPECT_TRUE(tracker.expects_reply());
+
+    tracker.Reset();
+    EXPECT_EQ(set.size(), ProcessByteByByte(tracker, set));
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_EQ(1, tracker.keys().count());
+    EXPECT_EQ(KeyHash("key"), tracker.keys().hash(0));
+    EXPECT_FALSE(tracker.expects_reply());
+
+    tracker.Reset();
+    const std::string meta = "ms key 2 T60 q\r\nhi\r\n";
+    EXPECT_EQ(meta.size(), tracker.Process(meta.data(), meta.size()));
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_FALSE(tracker.expects_reply());
+}
+
+TEST(MemcachedTracker, Replies) {
+    MemcachedTracker tracker{MemcachedTracker::Type::REPLY};
+
+    const std::string values =
+        "VALUE a 0 3\r\nEND\r\nVALUE b 0 2 7\r\nhi\r\nEND\r\n";
+    EXPECT_EQ(values.size(), ProcessByteByByte(tracker, values));
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_FALSE(tracker.error());
+
+    tracker.Reset();
+    const std::string stored = "STORED\r\nEND\r\n";
+    EXPECT_EQ(8, tracker.Process(stored.data(), stored.size()));
+    EXPECT_TRUE(tracker.complete());
+
+    tracker.Reset();
+    const std::string error = "SERVER_ERROR out of memory\r\n";
+    tracker.Process(error.data(), error.size());
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_TRUE(tracker.error());
+
+    tracker.Reset();
+    const std::string meta = "VA 2 f0\r\nhi\r\n";
+    EXPECT_EQ(meta.size(), tracker.Process(meta.data(), meta.size()));
+    EXPECT_TRUE(tracker.complete());
+}
+
+class RecordingObserver : public CacheObserver {
+   public:
+    void CommandStarted(CacheCommand* command) override {
+        command->sampled = true;
+        ++started;
+    }
+
+    void CommandCompleted(const CacheCommand& command) override {
+        completed.push_back(command);
+    }
+
+    int started = 0;
+    std::vector<CacheCommand> completed;
+};
+
+TEST(CacheSession, PipelinedCommands) {
+    RecordingObserver observer;
+    CacheSession<RespTracker> session{&observer};
+
+    const std::string commands = Command({"SET", "a", "1"}) +
+                                 Command({"GET", "a"}) +
+                                 Command({"MGET", "a", "b"});
+    session.Sent(commands.data(), commands.size());
+    EXPECT_EQ(3, observer.started);
+    EXPECT_EQ(0, observer.completed.size());
+
+    session.Received("+OK\r\n$1\r", 8);
+    ASSERT_EQ(1, observer.completed.size());
+    EXPECT_EQ("Redis: SET (1 key)", observer.completed[0].info(false));
+
+    session.Received("\n1\r\n-WRONGTYPE\r\n", 16);
+    ASSERT_EQ(3, observer.completed.size());
+    EXPECT_EQ("Redis: GET (1 key)", observer.completed[1].info(false));
+    EXPECT_FALSE(observer.completed[1].error);
+    EXPECT_EQ("Redis: MGET (2 keys)", observer.completed[2].info(false));
+    EXPECT_TRUE(observer.completed[2].error);
+}
+
+TEST(CacheSession, CommandsWithoutReply) {
+    RecordingObserver observer;
+    CacheSession<MemcachedTracker> session{&observer};
+
+    const std::string commands =
+        "set a 0 0 1 noreply\r\nx\r\nget a\r\nversion\r\n";
+    session.Sent(commands.data(), commands.size());
+    ASSERT_EQ(1, observer.completed.size());
+    EXPECT_EQ("Memcached: set (1 key: " +
+                  [] {
+                      char hex[17];
+                      snprintf(hex, sizeof(hex), "%016llx",
+                               static_cast<unsigned long long>(KeyHash("a")));
+                      return std::string{hex};
+                  }() +
+                  ")",
+              observer.completed[0].info(true));
+
+    const std::string replies = "VALUE a 0 1\r\nx\r\nEND\r\n";
+    session.Received(replies.data(), replies.size());
+    ASSERT_EQ(2, observer.completed.size());
+    EXPECT_EQ("Memcached: get (1 key)", observer.completed[1].info(false));
+
+    // The version command is completed when the connection is closed
+    session.Close();
+    ASSERT_EQ(3, observer.completed.size());
+    EXPECT_EQ("Memcached: version", observer.completed[2].info(false));
+}
@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <vector>
+
+#include "client_socket.h"
+#include "mocks.h"
+#include "test_util.h"
+
+using namespace microtrace;
+
+const int FD = 7;
+
+/*
+ * Records the connect failures that are reported to the handler.
+ */
+class ConnectHandler : public DumbClientSocketHandler {
+   public:
+    ConnectHandler(int fd, const OriginalFunctions &orig,
+                   std::vector<int> *errors)
+        : DumbClientSocketHandler(fd, orig), errors_(errors) {}
+
+    void HandleConnectError(const int err) { errors_->push_back(err); }
+
+   private:
+    std::vector<int> *errors_;
+};
+
+/*
+ * Reads and writes fail with err while it isn't zero.
+ */
+class FailingOriginalFunctions : public EmptyOriginalFunctions {
+   public:
+    ssize_t read(int fd, void *buf, size_t count) const {
+        return Fail(count);
+    }
+    ssize_t write(int fd, const void *buf, size_t count) const {
+        return Fail(count);
+    }
+
+    int err = 0;
+
+   private:
+    ssize_t Fail(size_t count) const {
+        if (err == 0) {
+            return count;
+        }
+        errno = err;
+        return -1;
+    }
+};
+
+class ClientSocketTest : public ::testing::Test {
+   protected:
+    ClientSocketTest()
+        : socket(FD, std::make_unique<ConnectHandler>(FD, orig, &errors),
+                 orig) {}
+
+    FailingOriginalFunctions orig;
+    std::vector<int> errors;
+    ClientSocket socket;
+    char buf[8];
+};
+
+TEST_F(ClientSocketTest, SocketError) {
+    socket.ConnectPending();
+    socket.SocketError(EINPROGRESS);
+    EXPECT_TRUE(errors.empty());
+
+    socket.SocketError(ECONNREFUSED);
+    ASSERT_EQ(std::vector<int>{ECONNREFUSED}, errors);
+
+    // The error is only reported once
+    socket.SocketError(ECONNREFUSED);
+    EXPECT_EQ(1, errors.size());
+}
+
+TEST_F(ClientSocketTest, Connected) {
+    socket.ConnectPending();
+    socket.SocketError(0);
+
+    // Errors after the connect are left to the handler
+    orig.err = ECONNRESET;
+    EXPECT_EQ(-1, socket.Read(buf, sizeof(buf)));
+    EXPECT_TRUE(errors.empty());
+}
+
+TEST_F(ClientSocketTest, FailedRead) {
+    socket.ConnectPending();
+    orig.err = EAGAIN;
+    EXPECT_EQ(-1, socket.Read(buf, sizeof(buf)));
+    EXPECT_TRUE(errors.empty());
+
+    orig.err = ECONNREFUSED;
+    EXPECT_EQ(-1, socket.Read(buf, sizeof(buf)));
+    EXPECT_EQ(ECONNREFUSED, errno);
+    ASSERT_EQ(std::vector<int>{ECONNREFUSED}, errors);
+}
+
+TEST_F(ClientSocketTest, FailedWrite) {
+    socket.ConnectPending();
+    orig.err = ETIMEDOUT;
+    EXPECT_EQ(-1, socket.Write(buf, sizeof(buf)));
+    EXPECT_EQ(ETIMEDOUT, errno);
+    ASSERT_EQ(std::vector<int>{ETIMEDOUT}, errors);
+
+    // A write that succeeds ends the connect
+    ClientSocket other{FD, std::make_unique<ConnectHandler>(FD, orig, &errors),
+                       orig};
+    other.ConnectPending();
+    orig.err = 0;
+    EXPECT_EQ(sizeof(buf), other.Write(buf, sizeof(buf)));
+    orig.err = EPIPE;
+    EXPECT_EQ(-1, other.Write(buf, sizeof(buf)));
+    EXPECT_EQ(1, errors.size());
+}
@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
 
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include <condition_variable>
 #include <mutex>
 #include <thread>
@@ -106,6 +109,93 @@ TEST(Context, UniquePerThread) {
     t2.join();
 }
 
+TEST(Context, UniqueAfterFork) {
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+
+    // Generate an id, so that the generator of this thread is seeded
+    Context{};
+    const pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+    if (pid == 0) {
+        reseed_uuids();
+        const uuid_t trace = Context{}.trace();
+        const uint64_t parts[] = {trace.high(), trace.low()};
+        _exit(write(fds[1], parts, sizeof(parts)) == sizeof(parts) ? 0 : 1);
+    }
+
+    const uuid_t trace = Context{}.trace();
+    uint64_t parts[2];
+    ASSERT_EQ(sizeof(parts), read(fds[0], parts, sizeof(parts)));
+    EXPECT_NE(trace, uuid_t::FromParts(parts[0], parts[1]));
+
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(Context, SerializeSampled) {
+    Context context;
+    EXPECT_TRUE(context.sampled());
+    EXPECT_FALSE(context.debug());
+
+    char buf[Context::MAX_WIRE_SIZE];
+    EXPECT_EQ(Context::MAX_WIRE_SIZE, context.Serialize(buf));
+    EXPECT_EQ(Context::MAX_WIRE_SIZE, Context::WireSize(buf[0]));
+
+    const Context decoded = Context::Deserialize(buf);
+    EXPECT_EQ(context, decoded);
+    EXPECT_TRUE(decoded.sampled());
+}
+
+TEST(Context, SerializeUnsampled) {
+    const auto context = Context::Zero();
+    EXPECT_FALSE(context->sampled());
+
+    char buf[Context::MAX_WIRE_SIZE];
+    EXPECT_EQ(Context::FLAGS_WIRE_SIZE, context->Serialize(buf));
+    EXPECT_EQ(Context::FLAGS_WIRE_SIZE, Context::WireSize(buf[0]));
+
+    const Context decoded = Context::Deserialize(buf);
+    EXPECT_TRUE(decoded.is_zero());
+    EXPECT_FALSE(decoded.sampled());
+}
+
+TEST(Context, SerializeFlags) {
+    Context context{Context{}.storage(),
+                    Context::SAMPLED_FLAG | Context::DEBUG_FLAG};
+
+    char buf[Context::MAX_WIRE_SIZE];
+    context.Serialize(buf);
+
+    const Context decoded = Context::Deserialize(buf);
+    EXPECT_TRUE(decoded.sampled());
+    EXPECT_TRUE(decoded.debug());
+}
+
+TEST(Context, WireMarker) {
+    char buf[Context::MAX_WIRE_SIZE];
+    Context{}.Serialize(buf);
+    EXPECT_TRUE(Context::IsWireFlags(buf[0]));
+    Context::Zero()->Serialize(buf);
+    EXPECT_TRUE(Context::IsWireFlags(buf[0]));
+
+    // Requests can't be mistaken for a context
+    EXPECT_FALSE(Context::IsWireFlags('G'));
+    EXPECT_FALSE(Context::IsWireFlags(0x00));
+    EXPECT_FALSE(Context::IsWireFlags(0x80));
+    EXPECT_FALSE(Context::IsWireFlags(0x82));
+}
+
+TEST(Context, Debug) {
+    const Context context = Context::Debug();
+    EXPECT_TRUE(context.sampled());
+    EXPECT_TRUE(context.debug());
+    EXPECT_FALSE(context.is_zero());
+    EXPECT_FALSE(Context{}.debug());
+}
+
 TEST(Context, ErrorIfUndefined) {
     std::thread t1{[]() {
         ::testing::FLAGS_gtest_death_test_style = "threadsafe";
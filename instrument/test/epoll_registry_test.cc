@@ -0,0 +1,56 @@
+#include <gtest/gtest.h>
+
+#include "epoll_registry.h"
+
+using namespace microtrace;
+
+TEST(EpollRegistryTest, AddFind) {
+    EpollRegistry registry;
+    EXPECT_TRUE(registry.empty());
+    EXPECT_EQ(-1, registry.Find(3, 42));
+
+    registry.Add(3, 7, 42);
+    registry.Add(3, 8, 43);
+    EXPECT_FALSE(registry.empty());
+    EXPECT_EQ(7, registry.Find(3, 42));
+    EXPECT_EQ(8, registry.Find(3, 43));
+
+    // Registrations belong to their epoll instance
+    EXPECT_EQ(-1, registry.Find(4, 42));
+}
+
+TEST(EpollRegistryTest, Modify) {
+    EpollRegistry registry;
+    registry.Add(3, 7, 42);
+    registry.Add(3, 7, 44);
+    EXPECT_EQ(-1, registry.Find(3, 42));
+    EXPECT_EQ(7, registry.Find(3, 44));
+
+    // The data is taken over by another fd
+    registry.Add(3, 8, 44);
+    EXPECT_EQ(8, registry.Find(3, 44));
+}
+
+TEST(EpollRegistryTest, Delete) {
+    EpollRegistry registry;
+    registry.Add(3, 7, 42);
+    registry.Add(3, 8, 43);
+    registry.Delete(3, 7);
+    registry.Delete(3, 9);
+    registry.Delete(4, 7);
+    EXPECT_EQ(-1, registry.Find(3, 42));
+    EXPECT_EQ(8, registry.Find(3, 43));
+}
+
+TEST(EpollRegistryTest, Close) {
+    EpollRegistry registry;
+    registry.Add(3, 7, 42);
+    registry.Add(4, 7, 42);
+
+    registry.Close(3);
+    EXPECT_EQ(-1, registry.Find(3, 42));
+    EXPECT_EQ(7, registry.Find(4, 42));
+
+    registry.Close(4);
+    EXPECT_TRUE(registry.empty());
+}
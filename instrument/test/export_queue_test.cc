@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+
+#include "export_queue.h"
+
+using namespace microtrace;
+
+static ExportQueue::Options TestOptions() {
+    ExportQueue::Options options;
+    options.express_budget = 2;
+    options.normal_budget = 3;
+    options.batch_size = 4;
+    options.slow_span_ms = 100;
+    return options;
+}
+
+TEST(ExportQueue, Classify) {
+    ExportQueue queue{TestOptions()};
+    proto::RequestLog log;
+
+    log.set_duration(10);
+    EXPECT_EQ(Lane::NORMAL, queue.Classify(log));
+
+    log.set_duration(100);
+    EXPECT_EQ(Lane::EXPRESS, queue.Classify(log));
+
+    log.set_duration(10);
+    log.set_error(true);
+    EXPECT_EQ(Lane::EXPRESS, queue.Classify(log));
+}
+
+TEST(ExportQueue, ExpressIsReadyImmediately) {
+    ExportQueue queue{TestOptions()};
+
+    EXPECT_FALSE(queue.Push(Lane::NORMAL, "a"));
+    EXPECT_FALSE(queue.ready());
+
+    EXPECT_TRUE(queue.Push(Lane::EXPRESS, "b"));
+    EXPECT_TRUE(queue.ready());
+}
+
+TEST(ExportQueue, NormalIsReadyWhenBatchIsFull) {
+    ExportQueue queue{ExportQueue::Options{2, 10, 3, 100}};
+
+    EXPECT_FALSE(queue.Push(Lane::NORMAL, "a"));
+    EXPECT_FALSE(queue.Push(Lane::NORMAL, "b"));
+    EXPECT_TRUE(queue.Push(Lane::NORMAL, "c"));
+}
+
+TEST(ExportQueue, LanesHaveSeparateBudgets) {
+    ExportQueue queue{TestOptions()};
+
+    queue.Push(Lane::EXPRESS, "e1");
+    for (int i = 0; i < 10; ++i) {
+        queue.Push(Lane::NORMAL, "n" + std::to_string(i));
+    }
+
+    // Flooding the normal lane doesn't affect the express lane
+    EXPECT_EQ(1, queue.size(Lane::EXPRESS));
+    EXPECT_EQ(0, queue.stats(Lane::EXPRESS).dropped);
+    EXPECT_EQ(3, queue.size(Lane::NORMAL));
+    EXPECT_EQ(7, queue.stats(Lane::NORMAL).dropped);
+    EXPECT_EQ(10, queue.stats(Lane::NORMAL).queued);
+
+    // The oldest spans are dropped
+    std::vector<std::string> batch;
+    EXPECT_EQ(1, queue.TakeBatch(&batch));
+    EXPECT_EQ((std::vector<std::string>{"e1", "n7", "n8", "n9"}), batch);
+}
+
+TEST(ExportQueue, ExpressFirst) {
+    ExportQueue queue{TestOptions()};
+
+    queue.Push(Lane::NORMAL, "n1");
+    queue.Push(Lane::NORMAL, "n2");
+    queue.Push(Lane::NORMAL, "n3");
+    queue.Push(Lane::EXPRESS, "e1");
+    queue.Push(Lane::EXPRESS, "e2");
+
+    std::vector<std::string> batch;
+    EXPECT_EQ(2, queue.TakeBatch(&batch));
+    EXPECT_EQ((std::vector<std::string>{"e1", "e2", "n1", "n2"}), batch);
+    queue.Exported(2, 2);
+
+    batch.clear();
+    EXPECT_EQ(0, queue.TakeBatch(&batch));
+    EXPECT_EQ((std::vector<std::string>{"n3"}), batch);
+    queue.Exported(0, 1);
+    EXPECT_TRUE(queue.empty());
+
+    EXPECT_EQ(2, queue.stats(Lane::EXPRESS).exported);
+    EXPECT_EQ(3, queue.stats(Lane::NORMAL).exported);
+}
+
+TEST(ExportQueue, PutBackKeepsExpressOnly) {
+    ExportQueue queue{TestOptions()};
+
+    queue.Push(Lane::EXPRESS, "e1");
+    queue.Push(Lane::EXPRESS, "e2");
+    queue.Push(Lane::NORMAL, "n1");
+
+    std::vector<std::string> batch;
+    const size_t express_count = queue.TakeBatch(&batch);
+    queue.Push(Lane::EXPRESS, "e3");
+
+    // Export failed
+    queue.PutBack(&batch, express_count);
+    EXPECT_TRUE(batch.empty());
+    EXPECT_EQ(1, queue.stats(Lane::NORMAL).dropped);
+
+    // e3 was queued after the failed batch was taken, so only one of the
+    // failed spans fits in the express budget
+    EXPECT_EQ(2, queue.size(Lane::EXPRESS));
+    EXPECT_EQ(1, queue.stats(Lane::EXPRESS).dropped);
+
+    queue.TakeBatch(&batch);
+    EXPECT_EQ((std::vector<std::string>{"e2", "e3"}), batch);
+}
+
+TEST(ExportQueue, Clear) {
+    ExportQueue queue{TestOptions()};
+
+    queue.Push(Lane::EXPRESS, "e1");
+    queue.Push(Lane::NORMAL, "n1");
+    queue.Clear();
+    EXPECT_TRUE(queue.empty());
+    EXPECT_FALSE(queue.ready());
+    EXPECT_EQ(0, queue.stats(Lane::EXPRESS).dropped);
+    EXPECT_EQ(0, queue.stats(Lane::NORMAL).dropped);
+}
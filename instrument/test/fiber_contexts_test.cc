@@ -0,0 +1,158 @@
+#include <gtest/gtest.h>
+
+#include <ucontext.h>
+#include <thread>
+#include <vector>
+
+#include "context.h"
+#include "fiber_contexts.h"
+
+using namespace microtrace;
+
+TEST(FiberContextsTest, Switch) {
+    FiberContexts fibers;
+    int a, b;
+    const Context context_a;
+    const Context context_b;
+
+    set_current_context(context_b);
+    fibers.Suspend(&b);
+    set_current_context(context_a);
+
+    fibers.Switch(&a, &b);
+    EXPECT_EQ(context_b, get_current_context());
+    EXPECT_EQ(1u, fibers.size());
+
+    fibers.Switch(&b, &a);
+    EXPECT_EQ(context_a, get_current_context());
+    EXPECT_EQ(1u, fibers.size());
+
+    fibers.Exit(&b);
+    EXPECT_EQ(0u, fibers.size());
+}
+
+TEST(FiberContextsTest, Undefined) {
+    FiberContexts fibers;
+    int a, b;
+    set_current_context(Context{});
+
+    // A fiber that was never suspended has no context
+    fibers.Switch(&a, &b);
+    EXPECT_TRUE(is_context_undefined());
+
+    fibers.Switch(&b, &a);
+    EXPECT_FALSE(is_context_undefined());
+
+    reset_current_context();
+    fibers.Suspend(&b);
+    fibers.Resume(&b);
+    EXPECT_TRUE(is_context_undefined());
+    EXPECT_EQ(0u, fibers.size());
+}
+
+TEST(FiberContextsTest, Inherit) {
+    FiberContexts fibers;
+    int a, b, c;
+    const Context context;
+
+    // A new fiber starts with the context of the one that switches to it
+    set_current_context(context);
+    fibers.Switch(&a, &b, true);
+    EXPECT_EQ(context, get_current_context());
+
+    // but not a fiber that was suspended without a context
+    reset_current_context();
+    fibers.Suspend(&c);
+    set_current_context(context);
+    fibers.Switch(&b, &c, true);
+    EXPECT_TRUE(is_context_undefined());
+}
+
+TEST(FiberContextsTest, OtherThread) {
+    FiberContexts fibers;
+    int a, b;
+    const Context context;
+
+    set_current_context(context);
+    fibers.Suspend(&a);
+
+    // A fiber may be resumed by another thread than the one it ran on
+    std::thread thread{[&]() {
+        fibers.Switch(&b, &a);
+        EXPECT_EQ(context, get_current_context());
+    }};
+    thread.join();
+
+    // The thread had no context, b is kept as suspended without one
+    EXPECT_EQ(1u, fibers.size());
+    fibers.Exit(&b);
+    EXPECT_EQ(0u, fibers.size());
+}
+
+TEST(FiberContextsTest, Many) {
+    FiberContexts fibers;
+    std::vector<Context> contexts(1000);
+    for (const auto& context : contexts) {
+        set_current_context(context);
+        fibers.Suspend(&context);
+    }
+    EXPECT_EQ(contexts.size(), fibers.size());
+
+    for (const auto& context : contexts) {
+        fibers.Resume(&context);
+        EXPECT_EQ(context, get_current_context());
+    }
+    EXPECT_EQ(0u, fibers.size());
+}
+
+static FiberContexts ucontext_fibers;
+static ucontext_t main_ucontext;
+static ucontext_t fiber_ucontexts[2];
+static std::vector<Context> seen;
+
+/*
+ * Switches like the swapcontext of the library.
+ */
+static void Swap(ucontext_t* oucp, ucontext_t* ucp) {
+    ucontext_fibers.Switch(oucp, ucp, true);
+    ASSERT_EQ(0, swapcontext(oucp, ucp));
+}
+
+static void RunFiber(int index) {
+    seen.push_back(get_current_context());
+    set_current_context(Context{});
+    const Context own = get_current_context();
+    Swap(&fiber_ucontexts[index], &main_ucontext);
+
+    // Resumed after the other fiber changed its context
+    EXPECT_EQ(own, get_current_context());
+    seen.push_back(get_current_context());
+    Swap(&fiber_ucontexts[index], &main_ucontext);
+}
+
+TEST(FiberContextsTest, Ucontext) {
+    static char stacks[2][64 * 1024];
+    const Context request;
+    set_current_context(request);
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_EQ(0, getcontext(&fiber_ucontexts[i]));
+        fiber_ucontexts[i].uc_stack.ss_sp = stacks[i];
+        fiber_ucontexts[i].uc_stack.ss_size = sizeof(stacks[i]);
+        fiber_ucontexts[i].uc_link = &main_ucontext;
+        makecontext(&fiber_ucontexts[i], reinterpret_cast<void (*)()>(RunFiber),
+                    1, i);
+    }
+
+    Swap(&main_ucontext, &fiber_ucontexts[0]);
+    Swap(&main_ucontext, &fiber_ucontexts[1]);
+    EXPECT_EQ(request, get_current_context());
+    Swap(&main_ucontext, &fiber_ucontexts[0]);
+    Swap(&main_ucontext, &fiber_ucontexts[1]);
+    EXPECT_EQ(request, get_current_context());
+
+    // Both fibers started with the context they were made with
+    ASSERT_EQ(4u, seen.size());
+    EXPECT_EQ(request, seen[0]);
+    EXPECT_EQ(request, seen[1]);
+    EXPECT_NE(seen[2], seen[3]);
+}
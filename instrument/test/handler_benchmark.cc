@@ -0,0 +1,97 @@
+#include "benchmark/benchmark.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "client_socket_handler.h"
+#include "orig_functions.h"
+#include "overhead_breaker.h"
+#include "sampler.h"
+#include "server_socket_handler.h"
+
+using namespace microtrace;
+
+/*
+ * Measures the per-request overhead of the socket handlers, for sampled and
+ * unsampled requests separately. Every iteration is a whole request-response
+ * cycle, no actual socket operations are made.
+ */
+
+static const char REQUEST[] =
+    "GET /index.html HTTP/1.1\r\nHost: frontend\r\nAccept: */*\r\n\r\n";
+static const char RESPONSE[] = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+
+static const int FD = 1000;
+
+// Disabled, so only the cost of the handlers is measured
+static OverheadBreaker breaker{OverheadBreaker::Options{0, 1000000000}};
+
+class ConstSampler : public Sampler {
+   public:
+    ConstSampler(const bool decision) : decision_(decision) {}
+    bool ShouldSample() override { return decision_; }
+
+   private:
+    const bool decision_;
+};
+
+static void ClientRequests(benchmark::State& state, const Context& context) {
+    setenv("MICROTRACE_SERVER_TYPE", "frontend", 1);
+    NullTraceLogger logger;
+    ClientSocketHandlerImpl handler{FD, &logger, &breaker, orig()};
+
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>(REQUEST);
+    iov.iov_len = strlen(REQUEST);
+
+    while (state.KeepRunning()) {
+        set_current_context(context);
+        handler.BeforeWrite(&iov, 1);
+        handler.AfterWrite(&iov, 1, iov.iov_len);
+        handler.BeforeRead(RESPONSE, strlen(RESPONSE));
+        handler.AfterRead(RESPONSE, strlen(RESPONSE), strlen(RESPONSE));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void SampledClientRequests(benchmark::State& state) {
+    ClientRequests(state, Context{});
+}
+BENCHMARK(SampledClientRequests);
+
+static void UnsampledClientRequests(benchmark::State& state) {
+    ClientRequests(state, *Context::Zero());
+}
+BENCHMARK(UnsampledClientRequests);
+
+static void ServerRequests(benchmark::State& state, const bool sampled) {
+    setenv("MICROTRACE_SERVER_TYPE", "frontend", 1);
+    NullTraceLogger logger;
+    ConstSampler sampler{sampled};
+    ServerSocketHandlerImpl handler{FD, &logger, &sampler, &breaker, orig()};
+
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>(RESPONSE);
+    iov.iov_len = strlen(RESPONSE);
+
+    while (state.KeepRunning()) {
+        handler.BeforeRead(REQUEST, strlen(REQUEST));
+        handler.AfterRead(REQUEST, strlen(REQUEST), strlen(REQUEST));
+        handler.BeforeWrite(&iov, 1);
+        handler.AfterWrite(&iov, 1, iov.iov_len);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void SampledServerRequests(benchmark::State& state) {
+    ServerRequests(state, true);
+}
+BENCHMARK(SampledServerRequests);
+
+static void UnsampledServerRequests(benchmark::State& state) {
+    ServerRequests(state, false);
+}
+BENCHMARK(UnsampledServerRequests);
+
+BENCHMARK_MAIN();
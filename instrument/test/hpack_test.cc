@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "hpack.h"
+
+using namespace microtrace;
+
+static std::string FromHex(const std::string& hex) {
+    std::string bytes;
+    for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+        bytes.push_back(static_cast<char>(std::stoi(hex.substr(i, 2), 0, 16)));
+    }
+    return bytes;
+}
+
+static bool Decode(HpackDecoder& decoder, const std::string& hex,
+                   Http2Headers* headers) {
+    const std::string block = FromHex(hex);
+    headers->Reset();
+    return decoder.Decode(block.data(), block.size(), headers);
+}
+
+/*
+ * Requests of a gRPC client, Huffman coded, with a 256 byte table so entries
+ * are evicted.
+ */
+static const char* const GRPC_REQUESTS[] = {
+    "3fe101838645956272d141fc1eca245f15852a4b631b87eb1968a0ff41899ac29525b2e3"
+    "6003615f8b1d75d0620d263d4c4d656440027465864d833505b11f7a8a9acac8b4c7602b"
+    "b6f2e0",
+    "838645956272d141fc1eca245f15852a4b631b87eb1968a0ff41899ac29525b2e3600361"
+    "5f8b1d75d0620d263d4c4d656440027465864d833505b11f7a8a9acac8b4c7602bb6f2e0",
+    "828745b161051d849ffced020f497fdd07aa6ff7dad2d9ebfda1361aa9bfda671a7fdca6"
+    "a2847fb4ce5ff691c7417e281d53405abf418cf1e3c2e5f23a6ba0ab90f4ff609c415083"
+    "1ea8001132d36e3af3e38c921650044cb4db8ebcf8e3248597",
+    "8345956272d141fc1eca245f15852a4b631b87eb1968a0ff41899ac29525b2e3600361"};
+
+TEST(HpackDecoder, Requests) {
+    HpackDecoder decoder;
+    Http2Headers headers;
+
+    ASSERT_TRUE(Decode(decoder, GRPC_REQUESTS[0], &headers));
+    EXPECT_EQ("POST", headers.method);
+    EXPECT_EQ("/helloworld.Greeter/SayHello", headers.path);
+    EXPECT_TRUE(headers.grpc);
+
+    ASSERT_TRUE(Decode(decoder, GRPC_REQUESTS[1], &headers));
+    EXPECT_EQ("POST", headers.method);
+    EXPECT_EQ("/helloworld.Greeter/SayHello", headers.path);
+    EXPECT_TRUE(headers.grpc);
+
+    ASSERT_TRUE(Decode(decoder, GRPC_REQUESTS[2], &headers));
+    EXPECT_EQ("GET", headers.method);
+    EXPECT_EQ("/search?q=some+long+query+string+that+fills+the+table&lang=en",
+              headers.path);
+    EXPECT_FALSE(headers.grpc);
+    EXPECT_LE(decoder.table_size(), 256);
+
+    // Refers to entries that survived the evictions
+    ASSERT_TRUE(Decode(decoder, GRPC_REQUESTS[3], &headers));
+    EXPECT_EQ("/helloworld.Greeter/SayHello", headers.path);
+}
+
+TEST(HpackDecoder, ResponseAndTrailers) {
+    HpackDecoder decoder;
+    Http2Headers headers;
+
+    ASSERT_TRUE(Decode(decoder, "885f901d75d0620d263d4c4d6564ff75d8749f",
+                       &headers));
+    EXPECT_EQ(200, headers.status);
+    EXPECT_TRUE(headers.grpc);
+    EXPECT_EQ(-1, headers.grpc_status);
+
+    ASSERT_TRUE(Decode(decoder,
+                       "40889acac8b21234da8f02313440899acac8b5254207317f88b6a1"
+                       "f719a81c7417",
+                       &headers));
+    EXPECT_EQ(14, headers.grpc_status);
+
+    ASSERT_TRUE(Decode(decoder, "4e03353033c1", &headers));
+    EXPECT_EQ(503, headers.status);
+    EXPECT_TRUE(headers.grpc);
+}
+
+TEST(HpackDecoder, InvalidStaysInvalid) {
+    HpackDecoder decoder;
+    Http2Headers headers;
+
+    // Refers to a dynamic table entry that doesn't exist
+    EXPECT_FALSE(Decode(decoder, "be", &headers));
+    EXPECT_FALSE(decoder.valid());
+    EXPECT_FALSE(Decode(decoder, "82", &headers));
+
+    // Tables larger than MAX_TABLE_SIZE are not kept
+    HpackDecoder large;
+    EXPECT_FALSE(Decode(large, "3fe1ff03", &headers));
+}
+
+TEST(HpackDecoder, Integers) {
+    const uint8_t small[] = {0x0a};
+    const uint8_t* pos = small;
+    uint64_t value;
+    EXPECT_TRUE(HpackReadInteger(&pos, small + 1, 5, &value));
+    EXPECT_EQ(10, value);
+
+    // RFC 7541 C.1.2
+    const uint8_t large[] = {0x1f, 0x9a, 0x0a};
+    pos = large;
+    EXPECT_TRUE(HpackReadInteger(&pos, large + 3, 5, &value));
+    EXPECT_EQ(1337, value);
+    EXPECT_EQ(large + 3, pos);
+
+    pos = large;
+    EXPECT_FALSE(HpackReadInteger(&pos, large + 2, 5, &value));
+}
+
+TEST(HpackDecoder, Huffman) {
+    std::string out;
+    // "www.example.com", RFC 7541 C.4.1
+    const std::string code = FromHex("f1e3c2e5f23a6ba0ab90f4ff");
+    const uint8_t* begin = reinterpret_cast<const uint8_t*>(code.data());
+    EXPECT_TRUE(HpackHuffmanDecode(begin, begin + code.size(), &out));
+    EXPECT_EQ("www.example.com", out);
+
+    // Padding longer than 7 bits
+    const std::string padded = FromHex("f1e3c2e5f23a6ba0ab90f4ffff");
+    begin = reinterpret_cast<const uint8_t*>(padded.data());
+    EXPECT_FALSE(HpackHuffmanDecode(begin, begin + padded.size(), &out));
+}
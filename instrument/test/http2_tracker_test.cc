@@ -0,0 +1,194 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "http2_session.h"
+#include "http2_tracker.h"
+
+using namespace microtrace;
+
+static std::string FromHex(const std::string& hex) {
+    std::string bytes;
+    for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+        bytes.push_back(static_cast<char>(std::stoi(hex.substr(i, 2), 0, 16)));
+    }
+    return bytes;
+}
+
+static std::string Frame(const uint8_t type, const uint8_t flags,
+                         const uint32_t stream, const std::string& payload) {
+    std::string frame;
+    frame.push_back(static_cast<char>(payload.size() >> 16));
+    frame.push_back(static_cast<char>(payload.size() >> 8));
+    frame.push_back(static_cast<char>(payload.size()));
+    frame.push_back(static_cast<char>(type));
+    frame.push_back(static_cast<char>(flags));
+    frame.push_back(static_cast<char>(stream >> 24));
+    frame.push_back(static_cast<char>(stream >> 16));
+    frame.push_back(static_cast<char>(stream >> 8));
+    frame.push_back(static_cast<char>(stream));
+    return frame + payload;
+}
+
+static const uint8_t DATA = 0x0;
+static const uint8_t HEADERS = 0x1;
+static const uint8_t RST_STREAM = 0x3;
+static const uint8_t SETTINGS = 0x4;
+static const uint8_t CONTINUATION = 0x9;
+
+static const uint8_t END_STREAM = 0x1;
+static const uint8_t END_HEADERS = 0x4;
+static const uint8_t PADDED = 0x8;
+static const uint8_t PRIORITY = 0x20;
+
+/*
+ * Header blocks of two gRPC requests, and of responses to them.
+ */
+static const std::string REQUEST_BLOCK = FromHex(
+    "3fe101838645956272d141fc1eca245f15852a4b631b87eb1968a0ff41899ac29525b2e3"
+    "6003615f8b1d75d0620d263d4c4d656440027465864d833505b11f7a8a9acac8b4c7602b"
+    "b6f2e0");
+static const std::string SECOND_REQUEST_BLOCK = FromHex(
+    "838645956272d141fc1eca245f15852a4b631b87eb1968a0ff41899ac29525b2e3600361"
+    "5f8b1d75d0620d263d4c4d656440027465864d833505b11f7a8a9acac8b4c7602bb6f2e0");
+static const std::string RESPONSE_BLOCK =
+    FromHex("885f901d75d0620d263d4c4d6564ff75d8749f");
+static const std::string TRAILERS_BLOCK = FromHex(
+    "40889acac8b21234da8f02313440899acac8b5254207317f88b6a1f719a81c7417");
+static const std::string ERROR_RESPONSE_BLOCK = FromHex("4e03353033c1");
+
+class RecordingObserver : public Http2Session::Observer {
+   public:
+    void StreamStarted(Http2Stream* stream) override {
+        stream->sampled = true;
+        started.push_back(stream->id);
+    }
+    void StreamCompleted(const Http2Stream& stream) override {
+        completed.push_back(stream);
+    }
+
+    std::vector<uint32_t> started;
+    std::vector<Http2Stream> completed;
+};
+
+static void Feed(Http2Session& session, const bool sent,
+                 const std::string& data, const size_t piece) {
+    for (size_t i = 0; i < data.size(); i += piece) {
+        const size_t len = std::min(piece, data.size() - i);
+        if (sent) {
+            session.Sent(data.data() + i, len);
+        } else {
+            session.Received(data.data() + i, len);
+        }
+    }
+}
+
+TEST(Http2Tracker, Preface) {
+    const std::string preface{Http2Tracker::PREFACE};
+    EXPECT_TRUE(Http2Tracker::StartsWithPreface(preface.data(), preface.size()));
+    EXPECT_FALSE(Http2Tracker::StartsWithPreface(preface.data(), 10));
+
+    RecordingObserver observer;
+    Http2Session session{Http2Session::Role::SERVER, &observer};
+    const std::string http1 = "GET / HTTP/1.1\r\n\r\n";
+    session.Received(http1.data(), http1.size());
+    EXPECT_FALSE(session.valid());
+}
+
+TEST(Http2Session, MultiplexedClientStreams) {
+    const std::string requests =
+        std::string{Http2Tracker::PREFACE} + Frame(SETTINGS, 0, 0, "") +
+        Frame(HEADERS, END_HEADERS, 1, REQUEST_BLOCK) +
+        Frame(HEADERS, END_HEADERS, 3, SECOND_REQUEST_BLOCK) +
+        Frame(DATA, END_STREAM, 1, "hello") +
+        Frame(DATA, END_STREAM, 3, "world");
+    const std::string responses =
+        Frame(SETTINGS, 0, 0, "") +
+        Frame(HEADERS, END_HEADERS, 3, RESPONSE_BLOCK) +
+        Frame(DATA, 0, 3, "reply") +
+        Frame(HEADERS, END_HEADERS | END_STREAM, 3, TRAILERS_BLOCK) +
+        Frame(HEADERS, END_HEADERS | END_STREAM, 1, ERROR_RESPONSE_BLOCK);
+
+    for (const size_t piece : {size_t{1}, size_t{7}, requests.size()}) {
+        RecordingObserver observer;
+        Http2Session session{Http2Session::Role::CLIENT, &observer};
+        Feed(session, true, requests, piece);
+        EXPECT_EQ((std::vector<uint32_t>{1, 3}), observer.started);
+        EXPECT_TRUE(observer.completed.empty());
+
+        Feed(session, false, responses, piece);
+        ASSERT_EQ(2, observer.completed.size());
+        EXPECT_TRUE(session.valid());
+
+        // Completed in the order their responses ended
+        const Http2Stream& first = observer.completed[0];
+        EXPECT_EQ(3, first.id);
+        EXPECT_EQ("gRPC: /helloworld.Greeter/SayHello", first.info());
+        EXPECT_EQ(200, first.status);
+        EXPECT_EQ(14, first.grpc_status);
+        EXPECT_TRUE(first.error());
+
+        const Http2Stream& second = observer.completed[1];
+        EXPECT_EQ(1, second.id);
+        EXPECT_EQ(503, second.status);
+        EXPECT_TRUE(second.error());
+    }
+}
+
+TEST(Http2Session, PaddingAndContinuation) {
+    // Padded, with priority, and the block split into a CONTINUATION frame
+    const std::string first_half = REQUEST_BLOCK.substr(0, 20);
+    const std::string second_half = REQUEST_BLOCK.substr(20);
+    const std::string headers = std::string(1, '\x03') +
+                                std::string(5, '\x00') + first_half +
+                                std::string(3, '\x00');
+    const std::string requests =
+        std::string{Http2Tracker::PREFACE} +
+        Frame(HEADERS, PADDED | PRIORITY | END_STREAM, 5, headers) +
+        Frame(CONTINUATION, END_HEADERS, 5, second_half);
+
+    RecordingObserver observer;
+    Http2Session session{Http2Session::Role::SERVER, &observer};
+    Feed(session, false, requests, 3);
+    ASSERT_EQ(1, observer.started.size());
+
+    const std::string responses =
+        Frame(HEADERS, END_HEADERS, 5, RESPONSE_BLOCK) +
+        Frame(DATA, END_STREAM, 5, "");
+    Feed(session, true, responses, responses.size());
+    ASSERT_EQ(1, observer.completed.size());
+    EXPECT_EQ("/helloworld.Greeter/SayHello",
+              observer.completed[0].request.path);
+    EXPECT_FALSE(observer.completed[0].error());
+}
+
+TEST(Http2Session, ResetAndClose) {
+    const std::string requests =
+        std::string{Http2Tracker::PREFACE} +
+        Frame(HEADERS, END_HEADERS, 1, REQUEST_BLOCK) +
+        Frame(HEADERS, END_HEADERS, 3, SECOND_REQUEST_BLOCK) +
+        Frame(RST_STREAM, 0, 1, std::string(4, '\x08'));
+
+    RecordingObserver observer;
+    Http2Session session{Http2Session::Role::CLIENT, &observer};
+    Feed(session, true, requests, requests.size());
+    ASSERT_EQ(1, observer.completed.size());
+    EXPECT_TRUE(observer.completed[0].reset);
+
+    session.Close();
+    ASSERT_EQ(2, observer.completed.size());
+    EXPECT_EQ(3, observer.completed[1].id);
+}
+
+TEST(Http2Session, BoundedStreams) {
+    std::string requests{Http2Tracker::PREFACE};
+    for (uint32_t i = 0; i < Http2Session::MAX_STREAMS + 5; ++i) {
+        requests += Frame(HEADERS, END_HEADERS, 2 * i + 1, "");
+    }
+
+    RecordingObserver observer;
+    Http2Session session{Http2Session::Role::CLIENT, &observer};
+    Feed(session, true, requests, requests.size());
+    EXPECT_EQ(Http2Session::MAX_STREAMS, observer.started.size());
+}
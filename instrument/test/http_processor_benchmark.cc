@@ -0,0 +1,114 @@
+#include "benchmark/benchmark.h"
+
+#include <string>
+#include <vector>
+
+#include "http_processor.h"
+
+using namespace microtrace;
+
+/*
+ * Measures the throughput of HttpProcessor in bytes per second. Every
+ * iteration processes a whole corpus of requests, each of them with a new
+ * processor, the way the client socket handler does.
+ */
+
+static const std::vector<std::string> API_REQUESTS{
+    "GET /api/v1/users/12345 HTTP/1.1\r\nHost: users\r\n"
+    "Accept: application/json\r\n\r\n",
+    "POST /api/v1/orders HTTP/1.1\r\nHost: orders\r\n"
+    "Content-Type: application/json\r\nContent-Length: 27\r\n\r\n"
+    "{\"item\":42,\"quantity\":1}",
+    "DELETE /api/v1/sessions/8f2a9c1d HTTP/1.1\r\nHost: auth\r\n\r\n",
+    "GET /health HTTP/1.1\r\nHost: localhost\r\n\r\n"};
+
+static const std::vector<std::string> BROWSER_REQUESTS{
+    "GET /search?q=distributed+tracing&lang=en&page=2&sort=relevance"
+    "&filter=recent&session=3a7bd3e2360a3d29eea436fcfb7e44c735d117c4 "
+    "HTTP/1.1\r\nHost: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/61.0.3163.100 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+    "image/webp,*/*;q=0.8\r\nAccept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: en-US,en;q=0.8\r\n\r\n",
+    "GET /static/js/main.3f1c2a9b.chunk.js HTTP/1.1\r\n"
+    "Host: www.example.com\r\nReferer: https://www.example.com/\r\n\r\n"};
+
+/*
+ * Responses and other traffic that isn't an HTTP request is rejected early.
+ */
+static const std::vector<std::string> NON_HTTP{
+    "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+    "Content-Length: 2\r\n\r\n{}",
+    std::string(512, '\x17')};
+
+static size_t CorpusBytes(const std::vector<std::string>& corpus) {
+    size_t bytes = 0;
+    for (const auto& request : corpus) {
+        bytes += request.size();
+    }
+    return bytes;
+}
+
+static void ProcessCorpus(benchmark::State& state,
+                          const std::vector<std::string>& corpus) {
+    while (state.KeepRunning()) {
+        for (const auto& request : corpus) {
+            HttpProcessor processor;
+            benchmark::DoNotOptimize(
+                processor.Process(request.data(), request.size()));
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * CorpusBytes(corpus));
+}
+
+static void ApiRequests(benchmark::State& state) {
+    ProcessCorpus(state, API_REQUESTS);
+}
+BENCHMARK(ApiRequests);
+
+static void BrowserRequests(benchmark::State& state) {
+    ProcessCorpus(state, BROWSER_REQUESTS);
+}
+BENCHMARK(BrowserRequests);
+
+static void NonHttpTraffic(benchmark::State& state) {
+    ProcessCorpus(state, NON_HTTP);
+}
+BENCHMARK(NonHttpTraffic);
+
+/*
+ * Requests that arrive in small pieces, as with a slow client.
+ */
+static void FragmentedRequests(benchmark::State& state) {
+    const size_t piece = state.range(0);
+    while (state.KeepRunning()) {
+        for (const auto& request : BROWSER_REQUESTS) {
+            HttpProcessor processor;
+            for (size_t i = 0; i < request.size(); i += piece) {
+                if (!processor.Process(request.data() + i,
+                                       std::min(piece, request.size() - i))) {
+                    break;
+                }
+            }
+        }
+    }
+    state.SetBytesProcessed(state.iterations() *
+                            CorpusBytes(BROWSER_REQUESTS));
+}
+BENCHMARK(FragmentedRequests)->Arg(1)->Arg(16)->Arg(64);
+
+/*
+ * Throughput of the delimiter search on its own, over a long URL.
+ */
+static void FindSpace(benchmark::State& state) {
+    const std::string url(state.range(0), 'a');
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(
+            FindChar(url.data(), url.data() + url.size(), ' '));
+    }
+    state.SetBytesProcessed(state.iterations() * url.size());
+}
+BENCHMARK(FindSpace)->Arg(64)->Arg(512)->Arg(2048);
+
+BENCHMARK_MAIN();
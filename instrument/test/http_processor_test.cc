@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 
+#include <string.h>
+
 #include "http_processor.h"
 
 using namespace microtrace;
@@ -43,3 +45,73 @@ TEST(HttpProcessor, NoSpaceAfterURL) {
 
     EXPECT_FALSE(p.has_url());
 }
+
+TEST(HttpProcessor, Method) {
+    HttpProcessor p;
+
+    const char* msg = "POST /checkout?item=1 HTTP/1.1\r\n";
+
+    EXPECT_FALSE(p.Process(msg, strlen(msg)));
+
+    EXPECT_TRUE(p.has_url());
+    EXPECT_EQ("POST", p.method());
+    EXPECT_EQ("/checkout?item=1", p.url());
+}
+
+TEST(HttpProcessor, InvalidMethodPrefix) {
+    HttpProcessor p;
+
+    EXPECT_TRUE(p.Process("PO", 2));
+    EXPECT_FALSE(p.Process("X /index.html ", 13));
+    EXPECT_FALSE(p.has_url());
+}
+
+TEST(HttpProcessor, UrlInPieces) {
+    HttpProcessor p;
+
+    EXPECT_TRUE(p.Process("PATCH /users", 12));
+    EXPECT_TRUE(p.Process("/12", 3));
+    EXPECT_FALSE(p.Process(" HTTP/1.1\r\n", 11));
+
+    EXPECT_TRUE(p.has_url());
+    EXPECT_EQ("PATCH", p.method());
+    EXPECT_EQ("/users/12", p.url());
+}
+
+TEST(HttpProcessor, LongUrlIsCapped) {
+    HttpProcessor p;
+
+    const std::string request =
+        "GET /" + std::string(HttpProcessor::MAX_URL_LEN, 'a') + " HTTP/1.1";
+    EXPECT_FALSE(p.Process(request.data(), request.size()));
+
+    EXPECT_TRUE(p.has_url());
+    EXPECT_EQ(HttpProcessor::MAX_URL_LEN, p.url().size());
+}
+
+TEST(HttpProcessor, StartsWithRequest) {
+    EXPECT_TRUE(HttpProcessor::StartsWithRequest("GET / HTTP/1.1", 14));
+    EXPECT_TRUE(HttpProcessor::StartsWithRequest("OPTIONS *", 9));
+    // The rest of the method hasn't been written yet
+    EXPECT_TRUE(HttpProcessor::StartsWithRequest("DEL", 3));
+
+    EXPECT_FALSE(HttpProcessor::StartsWithRequest("", 0));
+    EXPECT_FALSE(HttpProcessor::StartsWithRequest("GETS /", 6));
+    EXPECT_FALSE(HttpProcessor::StartsWithRequest("get key", 7));
+    EXPECT_FALSE(HttpProcessor::StartsWithRequest("CONNECTION", 10));
+}
+
+TEST(FindChar, AllPositions) {
+    for (size_t len = 0; len < 100; ++len) {
+        std::string buf(len, 'a');
+        EXPECT_EQ(buf.data() + len,
+                  FindChar(buf.data(), buf.data() + len, ' '));
+
+        for (size_t i = 0; i < len; ++i) {
+            buf[i] = ' ';
+            EXPECT_EQ(buf.data() + i,
+                      FindChar(buf.data(), buf.data() + len, ' '));
+            buf[i] = 'a';
+        }
+    }
+}
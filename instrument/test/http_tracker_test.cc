@@ -0,0 +1,204 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "http_tracker.h"
+
+using namespace microtrace;
+
+/*
+ * Feeds msg to tracker in pieces of the given size, returns the number of
+ * bytes consumed.
+ */
+static size_t Feed(HttpTracker& tracker, const std::string& msg,
+                   const size_t piece) {
+    size_t consumed = 0;
+    for (size_t i = 0; i < msg.size(); i += piece) {
+        const size_t len = std::min(piece, msg.size() - i);
+        const size_t ret = tracker.Process(msg.data() + i, len);
+        consumed += ret;
+        if (ret < len) {
+            break;
+        }
+    }
+    return consumed;
+}
+
+static const std::string CONTENT_LENGTH_RESPONSE =
+    "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+    "Content-Length: 12\r\n\r\nhello world!";
+
+static const std::string CHUNKED_RESPONSE =
+    "HTTP/1.1 503 Service Unavailable\r\nTransfer-Encoding: gzip, Chunked\r\n"
+    "\r\n5;ext=1\r\nhello\r\n7\r\n world!\r\n0\r\nX-Trailer: 1\r\n\r\n";
+
+TEST(HttpTracker, ContentLength) {
+    for (size_t piece = 1; piece <= CONTENT_LENGTH_RESPONSE.size(); ++piece) {
+        HttpTracker tracker{HttpTracker::Type::RESPONSE};
+        EXPECT_EQ(CONTENT_LENGTH_RESPONSE.size(),
+                  Feed(tracker, CONTENT_LENGTH_RESPONSE, piece));
+        EXPECT_TRUE(tracker.complete());
+        EXPECT_EQ(200, tracker.status_code());
+    }
+}
+
+TEST(HttpTracker, IncompleteBody) {
+    HttpTracker tracker{HttpTracker::Type::RESPONSE};
+    const std::string partial =
+        CONTENT_LENGTH_RESPONSE.substr(0, CONTENT_LENGTH_RESPONSE.size() - 1);
+
+    EXPECT_EQ(partial.size(), Feed(tracker, partial, partial.size()));
+    EXPECT_FALSE(tracker.complete());
+    EXPECT_TRUE(tracker.valid());
+    EXPECT_EQ(200, tracker.status_code());
+}
+
+TEST(HttpTracker, Chunked) {
+    for (size_t piece = 1; piece <= CHUNKED_RESPONSE.size(); ++piece) {
+        HttpTracker tracker{HttpTracker::Type::RESPONSE};
+        EXPECT_EQ(CHUNKED_RESPONSE.size(),
+                  Feed(tracker, CHUNKED_RESPONSE, piece));
+        EXPECT_TRUE(tracker.complete());
+        EXPECT_EQ(503, tracker.status_code());
+    }
+}
+
+TEST(HttpTracker, StopsAtEndOfMessage) {
+    HttpTracker tracker{HttpTracker::Type::RESPONSE};
+    const std::string two = CONTENT_LENGTH_RESPONSE + CHUNKED_RESPONSE;
+
+    EXPECT_EQ(CONTENT_LENGTH_RESPONSE.size(),
+              tracker.Process(two.data(), two.size()));
+    EXPECT_TRUE(tracker.complete());
+
+    tracker.Reset();
+    const std::string rest = two.substr(CONTENT_LENGTH_RESPONSE.size());
+    EXPECT_EQ(rest.size(), tracker.Process(rest.data(), rest.size()));
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_EQ(503, tracker.status_code());
+}
+
+TEST(HttpTracker, ResponsesWithoutBody) {
+    HttpTracker tracker{HttpTracker::Type::RESPONSE};
+
+    const std::string no_content = "HTTP/1.1 204 No Content\r\n\r\n";
+    Feed(tracker, no_content, no_content.size());
+    EXPECT_TRUE(tracker.complete());
+
+    // The body of a response to HEAD is not sent
+    tracker.Reset(true);
+    const std::string head = "HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\n";
+    Feed(tracker, head, head.size());
+    EXPECT_TRUE(tracker.complete());
+}
+
+TEST(HttpTracker, InterimResponse) {
+    HttpTracker tracker{HttpTracker::Type::RESPONSE};
+    const std::string msg =
+        "HTTP/1.1 100 Continue\r\n\r\n" + CONTENT_LENGTH_RESPONSE;
+
+    EXPECT_EQ(msg.size(), Feed(tracker, msg, 7));
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_EQ(200, tracker.status_code());
+}
+
+TEST(HttpTracker, UntilClose) {
+    HttpTracker tracker{HttpTracker::Type::RESPONSE};
+    const std::string msg = "HTTP/1.0 200 OK\r\n\r\nsome data";
+
+    EXPECT_EQ(msg.size(), Feed(tracker, msg, 3));
+    EXPECT_FALSE(tracker.complete());
+    EXPECT_TRUE(tracker.until_close());
+}
+
+TEST(HttpTracker, Requests) {
+    HttpTracker tracker{HttpTracker::Type::REQUEST};
+
+    const std::string get =
+        "GET /index.html HTTP/1.1\r\nHost: frontend\r\n\r\n";
+    EXPECT_EQ(get.size(), Feed(tracker, get, 5));
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_FALSE(tracker.head_request());
+
+    tracker.Reset();
+    const std::string post =
+        "POST /orders HTTP/1.1\r\ncontent-length: 4\r\n\r\n{}{}";
+    EXPECT_EQ(post.size(), Feed(tracker, post, 1));
+    EXPECT_TRUE(tracker.complete());
+
+    tracker.Reset();
+    const std::string head = "HEAD / HTTP/1.1\r\n\r\n";
+    Feed(tracker, head, head.size());
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_TRUE(tracker.head_request());
+}
+
+TEST(HttpTracker, LongHeaders) {
+    HttpTracker tracker{HttpTracker::Type::RESPONSE};
+    const std::string msg = "HTTP/1.1 200 OK\r\nSet-Cookie: " +
+                            std::string(1000, 'x') +
+                            "\r\nContent-Length: 2\r\n\r\nok";
+
+    EXPECT_EQ(msg.size(), Feed(tracker, msg, 100));
+    EXPECT_TRUE(tracker.complete());
+}
+
+TEST(HttpTracker, Invalid) {
+    HttpTracker response{HttpTracker::Type::RESPONSE};
+    const std::string binary = "\x01\x02\x03\x04\r\n";
+    Feed(response, binary, binary.size());
+    EXPECT_FALSE(response.valid());
+
+    HttpTracker request{HttpTracker::Type::REQUEST};
+    const std::string lower = "get / HTTP/1.1\r\n\r\n";
+    Feed(request, lower, lower.size());
+    EXPECT_FALSE(request.valid());
+
+    // Other protocols are detected before a whole line arrives
+    HttpTracker thrift{HttpTracker::Type::RESPONSE};
+    const std::string frame = std::string("\x80\x01\x00\x02", 4);
+    Feed(thrift, frame, frame.size());
+    EXPECT_FALSE(thrift.valid());
+}
+
+TEST(HttpTracker, LeadingEmptyLine) {
+    HttpTracker tracker{HttpTracker::Type::REQUEST};
+    const std::string msg = "\r\nGET / HTTP/1.1\r\n\r\n";
+
+    EXPECT_EQ(msg.size(), Feed(tracker, msg, 1));
+    EXPECT_TRUE(tracker.complete());
+}
+
+TEST(HttpTracker, SkippedBody) {
+    const std::string head =
+        "HTTP/1.1 200 OK\r\nContent-Length: 12\r\n\r\n";
+    HttpTracker tracker{HttpTracker::Type::RESPONSE};
+    EXPECT_EQ(head.size(), tracker.Process(head.data(), head.size()));
+    EXPECT_EQ(5u, tracker.Skip(5));
+    EXPECT_FALSE(tracker.complete());
+    EXPECT_EQ(7u, tracker.Skip(100));
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_EQ(0u, tracker.Skip(1));
+
+    // Chunks can be skipped one at a time only
+    HttpTracker chunked{HttpTracker::Type::RESPONSE};
+    const std::string chunked_head =
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\n";
+    chunked.Process(chunked_head.data(), chunked_head.size());
+    EXPECT_EQ(5u, chunked.Skip(5));
+    EXPECT_TRUE(chunked.valid());
+    chunked.Process("\r\n5\r\n", 5);
+    EXPECT_EQ(5u, chunked.Skip(10));
+    EXPECT_FALSE(chunked.valid());
+
+    // The head can't be skipped
+    HttpTracker head_skipped{HttpTracker::Type::RESPONSE};
+    EXPECT_EQ(0u, head_skipped.Skip(10));
+    EXPECT_FALSE(head_skipped.valid());
+
+    HttpTracker until_close{HttpTracker::Type::RESPONSE};
+    const std::string until_close_head = "HTTP/1.1 200 OK\r\n\r\n";
+    until_close.Process(until_close_head.data(), until_close_head.size());
+    EXPECT_EQ(100u, until_close.Skip(100));
+    EXPECT_TRUE(until_close.until_close());
+}
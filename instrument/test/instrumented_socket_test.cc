@@ -34,6 +34,10 @@ const int IOVCNT = 1;
 
 const int RET = 55;
 
+const int PIPE_FD = 12;
+off_t* const NO_OFFSET = nullptr;
+loff_t* const NO_LOFFSET = nullptr;
+
 const EmptyOriginalFunctions empty_orig;
 NullLogger logger;
 
@@ -54,6 +58,10 @@ TEST(ClientSocketTest, SocketApiCalls) {
     Method(mock, writev) = RET;
     Method(mock, send) = RET;
     Method(mock, sendto) = RET;
+    Method(mock, readv) = RET;
+    Method(mock, recvmsg) = RET;
+    Method(mock, sendfile) = RET;
+    Method(mock, splice) = RET;
     Method(mock, close) = SUCCESSFUL_CLOSE;
 
     OriginalFunctions& mock_orig = mock.get();
@@ -83,6 +91,26 @@ TEST(ClientSocketTest, SocketApiCalls) {
     EXPECT_EQ(RET, socket.SendTo(BUF, LEN, FLAGS, SOCKADDR, ADDRLEN));
     Verify(Method(mock, sendto).Using(FD, BUF, LEN, FLAGS, SOCKADDR, ADDRLEN));
 
+    EXPECT_EQ(RET, socket.Readv(IOVEC, IOVCNT));
+    Verify(Method(mock, readv).Using(FD, IOVEC, IOVCNT));
+
+    struct msghdr msg = {};
+    EXPECT_EQ(RET, socket.RecvMsg(&msg, FLAGS));
+    Verify(Method(mock, recvmsg).Using(FD, &msg, FLAGS));
+
+    EXPECT_EQ(RET, socket.SendFile(PIPE_FD, NO_OFFSET, LEN));
+    Verify(Method(mock, sendfile).Using(FD, PIPE_FD, NO_OFFSET, LEN));
+
+    EXPECT_EQ(RET, socket.SpliceRead(NO_LOFFSET, PIPE_FD, NO_LOFFSET, LEN,
+                                     FLAGS));
+    Verify(Method(mock, splice)
+               .Using(FD, NO_LOFFSET, PIPE_FD, NO_LOFFSET, LEN, FLAGS));
+
+    EXPECT_EQ(RET, socket.SpliceWrite(PIPE_FD, NO_LOFFSET, NO_LOFFSET, LEN,
+                                      FLAGS));
+    Verify(Method(mock, splice)
+               .Using(PIPE_FD, NO_LOFFSET, FD, NO_LOFFSET, LEN, FLAGS));
+
     // Make sure to do this last
     EXPECT_EQ(SUCCESSFUL_CLOSE, socket.Close());
     Verify(Method(mock, close).Using(FD));
@@ -14,7 +14,10 @@ class DumbClientSocketHandler : public ClientSocketHandler {
 
     void Async() {}
     void HandleConnect(const std::string &ip) {}
+    void HandleConnectError(const int err) {}
     bool has_txn() const { return false; }
+    HeaderSplicer &header_splicer() { return header_splicer_; }
+    void Uring() {}
 
     Result BeforeRead(const void *buf, size_t len) { return Result::Ok; }
     void AfterRead(const void *buf, size_t len, ssize_t ret) {}
@@ -23,6 +26,8 @@ class DumbClientSocketHandler : public ClientSocketHandler {
         return Result::Ok;
     }
     void AfterWrite(const struct iovec *iov, int iovcnt, ssize_t ret) {}
+    void AfterOpaqueRead(ssize_t ret) {}
+    void AfterOpaqueWrite(ssize_t ret) {}
 
     Result BeforeClose() { return Result::Ok; }
     void AfterClose(int ret) {}
@@ -36,6 +41,9 @@ class DumbClientSocketHandler : public ClientSocketHandler {
 
     bool has_context() const { return true; }
     bool is_context_processed() const { return false; }
+
+   private:
+    HeaderSplicer header_splicer_;
 };
 
 class DumbServerSocketHandler : public ServerSocketHandler {
@@ -44,7 +52,7 @@ class DumbServerSocketHandler : public ServerSocketHandler {
         : ServerSocketHandler(fd, orig) {}
 
     void Async() {}
-    void ContextReadCallback(std::unique_ptr<Context> c) {}
+    void ContextReadCallback(const Context &c) {}
 
     Result BeforeRead(const void *buf, size_t len) { return Result::Ok; }
     void AfterRead(const void *buf, size_t len, ssize_t ret) {}
@@ -53,6 +61,8 @@ class DumbServerSocketHandler : public ServerSocketHandler {
         return Result::Ok;
     }
     void AfterWrite(const struct iovec *iov, int iovcnt, ssize_t ret) {}
+    void AfterOpaqueRead(ssize_t ret) {}
+    void AfterOpaqueWrite(ssize_t ret) {}
 
     Result BeforeClose() { return Result::Ok; }
     void AfterClose(int ret) {}
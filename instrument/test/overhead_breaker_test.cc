@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+
+#include "overhead_breaker.h"
+
+using namespace microtrace;
+
+static int64_t fake_now = 0;
+static int64_t fake_clock() { return fake_now; }
+
+// The cycle counter runs at the same speed as the clock
+static uint64_t fake_cycles() { return fake_now; }
+
+static const int64_t WINDOW = 1000000;
+
+static OverheadBreaker::Options TestOptions() {
+    return OverheadBreaker::Options{0.1, WINDOW};
+}
+
+/*
+ * Spends the given fraction of the next window in hooks, evenly spread over
+ * hooks calls, the last of which ends the window.
+ */
+static void RunWindow(OverheadBreaker& breaker, const double overhead,
+                      const uint32_t hooks = OverheadBreaker::FLUSH_EVERY) {
+    const uint64_t per_hook = WINDOW * overhead / hooks;
+    for (uint32_t i = 0; i < hooks; ++i) {
+        fake_now += WINDOW / hooks;
+        breaker.Record(fake_cycles() - per_hook, fake_cycles());
+    }
+}
+
+static int CountSampled(Sampler& sampler, const int n) {
+    int sampled = 0;
+    for (int i = 0; i < n; ++i) {
+        sampled += sampler.ShouldSample();
+    }
+    return sampled;
+}
+
+TEST(OverheadBreaker, Disabled) {
+    OverheadBreaker breaker{OverheadBreaker::Options{0, WINDOW}, &fake_clock,
+                            &fake_cycles};
+    EXPECT_FALSE(breaker.enabled());
+}
+
+TEST(OverheadBreaker, UnderBudget) {
+    fake_now = 0;
+    OverheadBreaker breaker{TestOptions(), &fake_clock, &fake_cycles};
+
+    for (int i = 0; i < 10; ++i) {
+        RunWindow(breaker, 0.05);
+    }
+    EXPECT_EQ(0, breaker.level());
+    EXPECT_EQ(10, breaker.stats().windows);
+    EXPECT_EQ(0, breaker.stats().over_budget_windows);
+    EXPECT_NEAR(50000, breaker.stats().last_overhead_ppm, 100);
+}
+
+TEST(OverheadBreaker, ThrottlesAndRecovers) {
+    fake_now = 0;
+    OverheadBreaker breaker{TestOptions(), &fake_clock, &fake_cycles};
+
+    // Every window over budget raises the level, up to pass-through
+    for (int i = 1; i <= OverheadBreaker::PASS_THROUGH_LEVEL + 2; ++i) {
+        RunWindow(breaker, 0.2);
+        EXPECT_EQ(std::min(i, OverheadBreaker::PASS_THROUGH_LEVEL),
+                  breaker.level());
+    }
+    EXPECT_TRUE(breaker.pass_through());
+    EXPECT_EQ(OverheadBreaker::PASS_THROUGH_LEVEL, breaker.stats().level);
+
+    // Between half of the budget and the budget, the level is kept
+    RunWindow(breaker, 0.08);
+    EXPECT_TRUE(breaker.pass_through());
+
+    for (int i = OverheadBreaker::PASS_THROUGH_LEVEL - 1; i >= 0; --i) {
+        RunWindow(breaker, 0.01);
+        EXPECT_EQ(i, breaker.level());
+    }
+    EXPECT_FALSE(breaker.pass_through());
+}
+
+TEST(OverheadBreaker, FewHooks) {
+    fake_now = 0;
+    OverheadBreaker breaker{TestOptions(), &fake_clock, &fake_cycles};
+
+    // The window is evaluated once it is over, long before FLUSH_EVERY hooks
+    RunWindow(breaker, 0.2, 4);
+    EXPECT_EQ(1, breaker.level());
+    EXPECT_EQ(1, breaker.stats().windows);
+    EXPECT_NEAR(200000, breaker.stats().last_overhead_ppm, 100);
+
+    RunWindow(breaker, 0.01, 2);
+    EXPECT_EQ(0, breaker.level());
+    EXPECT_EQ(2, breaker.stats().windows);
+}
+
+TEST(ThrottledSampler, FollowsLevel) {
+    fake_now = 0;
+    OverheadBreaker breaker{TestOptions(), &fake_clock, &fake_cycles};
+    ThrottledSampler sampler{std::make_unique<ProbabilisticSampler>(1),
+                             &breaker};
+
+    EXPECT_EQ(10000, CountSampled(sampler, 10000));
+
+    // One in every 4 is sampled
+    RunWindow(breaker, 0.2);
+    const int sampled = CountSampled(sampler, 100000);
+    EXPECT_GT(sampled, 23000);
+    EXPECT_LT(sampled, 27000);
+
+    while (!breaker.pass_through()) {
+        RunWindow(breaker, 0.2);
+    }
+    EXPECT_EQ(0, CountSampled(sampler, 10000));
+}
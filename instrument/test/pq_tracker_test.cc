@@ -0,0 +1,261 @@
+#include <gtest/gtest.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "context.h"
+#include "pq_tracker.h"
+
+using namespace microtrace;
+
+/*
+ * A stand-in for libpq. A connection returns the results that the test gave
+ * it for the next query.
+ */
+struct pg_result {
+    ExecStatusType status;
+    std::vector<std::vector<std::string>> rows;
+    std::string cmd_tuples;
+};
+
+struct pg_conn {
+    std::vector<pg_result> next;
+    std::deque<pg_result*> results;
+    bool fail = false;
+};
+
+static PqTracker* tracker = nullptr;
+
+static int ShimSendQuery(PGconn* conn, const char* command) {
+    if (conn->fail) {
+        return 0;
+    }
+    for (auto& res : conn->next) {
+        conn->results.push_back(new pg_result(res));
+    }
+    conn->next.clear();
+    return 1;
+}
+
+static int ShimSendQueryParams(PGconn* conn, const char* command, int nParams,
+                               const Oid* paramTypes,
+                               const char* const* paramValues,
+                               const int* paramLengths,
+                               const int* paramFormats, int resultFormat) {
+    return ShimSendQuery(conn, command);
+}
+
+static int ShimSendQueryPrepared(PGconn* conn, const char* stmtName,
+                                 int nParams, const char* const* paramValues,
+                                 const int* paramLengths,
+                                 const int* paramFormats, int resultFormat) {
+    return ShimSendQuery(conn, stmtName);
+}
+
+static PGresult* ShimGetResult(PGconn* conn) {
+    if (conn->results.empty()) {
+        return nullptr;
+    }
+    PGresult* res = conn->results.front();
+    conn->results.pop_front();
+    return res;
+}
+
+/*
+ * Like libpq, the blocking functions call the asynchronous ones, which are
+ * the hooks of the library, and return the last result.
+ */
+static PGresult* ShimExec(PGconn* conn, const char* command) {
+    if (tracker->SendQuery(conn, command) != 1) {
+        return nullptr;
+    }
+    PGresult* last = nullptr;
+    while (PGresult* res = tracker->GetResult(conn)) {
+        delete last;
+        last = res;
+    }
+    return last;
+}
+
+static PGresult* ShimExecParams(PGconn* conn, const char* command,
+                                int nParams, const Oid* paramTypes,
+                                const char* const* paramValues,
+                                const int* paramLengths,
+                                const int* paramFormats, int resultFormat) {
+    return ShimExec(conn, command);
+}
+
+static PGresult* ShimExecPrepared(PGconn* conn, const char* stmtName,
+                                  int nParams, const char* const* paramValues,
+                                  const int* paramLengths,
+                                  const int* paramFormats, int resultFormat) {
+    return ShimExec(conn, stmtName);
+}
+
+static void ShimFinish(PGconn* conn) {}
+
+static ExecStatusType ShimResultStatus(const PGresult* res) {
+    return res->status;
+}
+
+static int ShimNtuples(const PGresult* res) { return res->rows.size(); }
+
+static int ShimNfields(const PGresult* res) {
+    return res->rows.empty() ? 0 : res->rows[0].size();
+}
+
+static int ShimGetlength(const PGresult* res, int row, int field) {
+    return res->rows[row][field].size();
+}
+
+static char* ShimCmdTuples(PGresult* res) { return &res->cmd_tuples[0]; }
+
+static PqFunctions Shim() {
+    PqFunctions pq;
+    pq.exec = &ShimExec;
+    pq.exec_params = &ShimExecParams;
+    pq.exec_prepared = &ShimExecPrepared;
+    pq.send_query = &ShimSendQuery;
+    pq.send_query_params = &ShimSendQueryParams;
+    pq.send_query_prepared = &ShimSendQueryPrepared;
+    pq.get_result = &ShimGetResult;
+    pq.finish = &ShimFinish;
+    pq.result_status = &ShimResultStatus;
+    pq.ntuples = &ShimNtuples;
+    pq.nfields = &ShimNfields;
+    pq.get_length = &ShimGetlength;
+    pq.cmd_tuples = &ShimCmdTuples;
+    return pq;
+}
+
+class RecordingLogger : public TraceLogger {
+   public:
+    void Log(const proto::RequestLog& log) override { logs.push_back(log); }
+
+    std::vector<proto::RequestLog> logs;
+};
+
+class PqTrackerTest : public ::testing::Test {
+   protected:
+    PqTrackerTest() : pq_tracker(&logger, &Shim) {}
+
+    void SetUp() override {
+        tracker = &pq_tracker;
+        set_current_context(context);
+    }
+
+    void TearDown() override {
+        for (PGresult* res : conn.results) {
+            delete res;
+        }
+    }
+
+    static pg_result Rows(std::vector<std::vector<std::string>> rows) {
+        return pg_result{PGRES_TUPLES_OK, std::move(rows), ""};
+    }
+
+    static pg_result Command(const std::string& tuples) {
+        return pg_result{PGRES_COMMAND_OK, {}, tuples};
+    }
+
+    RecordingLogger logger;
+    PqTracker pq_tracker;
+    PGconn conn;
+    const Context context;
+};
+
+TEST_F(PqTrackerTest, Exec) {
+    conn.next = {Rows({{"1", "ab"}, {"2", "cde"}})};
+    PGresult* res = pq_tracker.Exec(&conn, "SELECT id, name FROM t");
+    ASSERT_NE(nullptr, res);
+    delete res;
+
+    // libpq calling itself isn't traced again
+    ASSERT_EQ(1, logger.logs.size());
+    const auto& log = logger.logs[0];
+    EXPECT_EQ("SQL: SELECT id, name FROM t", log.info());
+    EXPECT_EQ(2, log.row_count());
+    EXPECT_EQ(7, log.result_bytes());
+    EXPECT_FALSE(log.error());
+    EXPECT_EQ(proto::RequestLog::CLIENT, log.role());
+    EXPECT_EQ(context.span().low(), log.context().span_id().low());
+
+    // The next span follows the query
+    EXPECT_EQ(context.span(), get_current_context().parent_span());
+    EXPECT_EQ(0, pq_tracker.pending());
+}
+
+TEST_F(PqTrackerTest, ExecPrepared) {
+    conn.next = {Command("3")};
+    delete pq_tracker.ExecPrepared(&conn, "update_t", 0, nullptr, nullptr,
+                                   nullptr, 0);
+    conn.next = {Command("")};
+    delete pq_tracker.ExecParams(&conn, "BEGIN", 0, nullptr, nullptr, nullptr,
+                                 nullptr, 0);
+
+    ASSERT_EQ(2, logger.logs.size());
+    EXPECT_EQ("SQL: EXECUTE update_t", logger.logs[0].info());
+    EXPECT_EQ(3, logger.logs[0].row_count());
+    EXPECT_EQ("SQL: BEGIN", logger.logs[1].info());
+    EXPECT_EQ(0, logger.logs[1].row_count());
+}
+
+TEST_F(PqTrackerTest, Errors) {
+    conn.next = {pg_result{PGRES_FATAL_ERROR, {}, ""}};
+    delete pq_tracker.Exec(&conn, "SELECT x");
+
+    conn.fail = true;
+    EXPECT_EQ(nullptr, pq_tracker.Exec(&conn, "SELECT 1"));
+    EXPECT_EQ(0, pq_tracker.SendQuery(&conn, "SELECT 1"));
+
+    ASSERT_EQ(3, logger.logs.size());
+    for (const auto& log : logger.logs) {
+        EXPECT_TRUE(log.error());
+    }
+    EXPECT_EQ(0, pq_tracker.pending());
+}
+
+TEST_F(PqTrackerTest, Untraced) {
+    reset_current_context();
+    conn.next = {Command("1")};
+    delete pq_tracker.Exec(&conn, "DELETE FROM t");
+
+    set_current_context(Context{ContextStorage::Zero(), 0});
+    conn.next = {Command("1")};
+    delete pq_tracker.Exec(&conn, "DELETE FROM t");
+    EXPECT_EQ(1, pq_tracker.SendQuery(&conn, "DELETE FROM t"));
+    EXPECT_EQ(0, pq_tracker.pending());
+
+    EXPECT_TRUE(logger.logs.empty());
+}
+
+TEST_F(PqTrackerTest, Async) {
+    conn.next = {Command("2"), Rows({{"abc"}})};
+    ASSERT_EQ(1, pq_tracker.SendQuery(&conn, "UPDATE t; SELECT name FROM t"));
+    EXPECT_EQ(1, pq_tracker.pending());
+
+    // Results are read later, from another request
+    set_current_context(Context{});
+    delete pq_tracker.GetResult(&conn);
+    delete pq_tracker.GetResult(&conn);
+    EXPECT_TRUE(logger.logs.empty());
+    EXPECT_EQ(nullptr, pq_tracker.GetResult(&conn));
+
+    ASSERT_EQ(1, logger.logs.size());
+    const auto& log = logger.logs[0];
+    EXPECT_EQ(3, log.row_count());
+    EXPECT_EQ(3, log.result_bytes());
+    EXPECT_EQ(context.trace().low(), log.context().trace_id().low());
+    EXPECT_EQ(context.span().low(), log.context().span_id().low());
+    EXPECT_EQ(0, pq_tracker.pending());
+}
+
+TEST_F(PqTrackerTest, Finish) {
+    conn.next = {Command("1")};
+    ASSERT_EQ(1, pq_tracker.SendQueryPrepared(&conn, "insert_t", 0, nullptr,
+                                              nullptr, nullptr, 0));
+    pq_tracker.Finish(&conn);
+    EXPECT_EQ(0, pq_tracker.pending());
+    EXPECT_TRUE(logger.logs.empty());
+}
@@ -0,0 +1,103 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "protocol_session.h"
+
+using namespace microtrace;
+
+static Protocol Detect(const std::string& data) {
+    return DetectProtocol(data.data(), data.size());
+}
+
+TEST(DetectProtocol, FirstRequest) {
+    EXPECT_EQ(Protocol::HTTP, Detect("POST /add HTTP/1.1\r\n"));
+    EXPECT_EQ(Protocol::HTTP2, Detect("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"));
+    EXPECT_EQ(Protocol::TLS, Detect(std::string{"\x16\x03\x01\x02\x00", 5}));
+    EXPECT_EQ(Protocol::THRIFT,
+              Detect(std::string{"\x80\x01\x00\x01\x00\x00\x00\x03"
+                                 "add\x00\x00\x00\x01",
+                                 15}));
+    EXPECT_EQ(Protocol::REDIS, Detect("*2\r\n$3\r\nGET\r\n$1\r\na\r\n"));
+    EXPECT_EQ(Protocol::MEMCACHED, Detect("get a b\r\n"));
+
+    EXPECT_EQ(Protocol::UNKNOWN, Detect("SSH-2.0-OpenSSH_8.9\r\n"));
+    EXPECT_EQ(Protocol::UNKNOWN, Detect(""));
+}
+
+class NullObservers : public Http2Session::Observer,
+                      public ThriftSession::Observer,
+                      public CacheObserver {
+   public:
+    void StreamStarted(Http2Stream* stream) override {}
+    void StreamCompleted(const Http2Stream& stream) override {}
+    void CallStarted(ThriftCall* call) override {}
+    void CallCompleted(const ThriftCall& call) override {}
+    void CommandStarted(CacheCommand* command) override {}
+
+    void CommandCompleted(const CacheCommand& command) override {
+        commands.push_back(command.verb);
+    }
+
+    std::vector<std::string> commands;
+};
+
+TEST(ProtocolSession, Bind) {
+    NullObservers observers;
+
+    ProtocolSession http{ProtocolSession::Role::CLIENT,
+                         {&observers, &observers, &observers}};
+    EXPECT_EQ(Protocol::UNKNOWN, http.protocol());
+    EXPECT_FALSE(http.Bind(Protocol::HTTP));
+    EXPECT_FALSE(http.bound());
+    EXPECT_EQ(Protocol::HTTP, http.protocol());
+
+    ProtocolSession h2{ProtocolSession::Role::SERVER,
+                       {&observers, &observers, nullptr}};
+    EXPECT_TRUE(h2.Bind(Protocol::HTTP2));
+    EXPECT_TRUE(h2.bound());
+
+    // Caches are only followed from the client side
+    ProtocolSession redis_server{ProtocolSession::Role::SERVER,
+                                 {&observers, &observers, &observers}};
+    EXPECT_FALSE(redis_server.Bind(Protocol::REDIS));
+}
+
+TEST(ProtocolSession, Dispatch) {
+    NullObservers observers;
+    ProtocolSession session{ProtocolSession::Role::CLIENT,
+                            {&observers, &observers, &observers}};
+
+    const std::string command = "*1\r\n$4\r\nPING\r\n";
+    ASSERT_TRUE(session.Bind(Detect(command)));
+    session.Sent(command.data(), command.size());
+    EXPECT_TRUE(observers.commands.empty());
+
+    session.Received("+PONG\r\n", 7);
+    ASSERT_EQ(1, observers.commands.size());
+    EXPECT_EQ("PING", observers.commands[0]);
+
+    session.Sent(command.data(), command.size());
+    session.Close();
+    EXPECT_EQ(2, observers.commands.size());
+}
+
+TEST(ProtocolSession, Skipped) {
+    NullObservers observers;
+    ProtocolSession session{ProtocolSession::Role::CLIENT,
+                            {&observers, &observers, &observers}};
+
+    const std::string command = "*1\r\n$4\r\nPING\r\n";
+    ASSERT_TRUE(session.Bind(Detect(command)));
+    session.Sent(command.data(), command.size());
+    session.Skipped();
+    EXPECT_EQ(1, observers.commands.size());
+
+    // The connection isn't followed after data was skipped
+    EXPECT_TRUE(session.bound());
+    session.Sent(command.data(), command.size());
+    session.Received("+PONG\r\n", 7);
+    session.Close();
+    EXPECT_EQ(1, observers.commands.size());
+}
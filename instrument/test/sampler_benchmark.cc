@@ -0,0 +1,51 @@
+#include "benchmark/benchmark.h"
+
+#include "sampler.h"
+
+using namespace microtrace;
+
+/*
+ * Measures how many sampling decisions can be made per second, as the number
+ * of threads making decisions grows. Decisions should scale linearly with
+ * the number of threads.
+ */
+
+static void ProbabilisticDecisions(benchmark::State& state) {
+    static ProbabilisticSampler sampler{0.01};
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(sampler.ShouldSample());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(ProbabilisticDecisions)->ThreadRange(1, 16)->UseRealTime();
+
+static void RateLimitingDecisions(benchmark::State& state) {
+    static RateLimitingSampler sampler{100, 10};
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(sampler.ShouldSample());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(RateLimitingDecisions)->ThreadRange(1, 16)->UseRealTime();
+
+static void AdaptiveDecisions(benchmark::State& state) {
+    static AdaptiveSampler sampler{100, []() -> uint64_t { return 0; }};
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(sampler.ShouldSample());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(AdaptiveDecisions)->ThreadRange(1, 16)->UseRealTime();
+
+/*
+ * The sampler that was used before, for comparison.
+ */
+static void RandDecisions(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize((std::rand() % 100) <= 0);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(RandDecisions)->ThreadRange(1, 16)->UseRealTime();
+
+BENCHMARK_MAIN();
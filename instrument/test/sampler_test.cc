@@ -0,0 +1,214 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "sampler.h"
+
+using namespace microtrace;
+
+static int64_t fake_now = 0;
+static int64_t fake_clock() { return fake_now; }
+
+static int CountSampled(Sampler& sampler, const int n) {
+    int sampled = 0;
+    for (int i = 0; i < n; ++i) {
+        sampled += sampler.ShouldSample();
+    }
+    return sampled;
+}
+
+TEST(ProbabilisticSampler, Extremes) {
+    ProbabilisticSampler never{0};
+    ProbabilisticSampler always{1};
+
+    EXPECT_EQ(0, CountSampled(never, 10000));
+    EXPECT_EQ(10000, CountSampled(always, 10000));
+}
+
+TEST(ProbabilisticSampler, Rate) {
+    ProbabilisticSampler sampler{0.1};
+
+    const int sampled = CountSampled(sampler, 100000);
+    EXPECT_GT(sampled, 9000);
+    EXPECT_LT(sampled, 11000);
+}
+
+TEST(ProbabilisticSampler, Threads) {
+    ProbabilisticSampler sampler{0.5};
+    std::vector<int> sampled(4);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back(
+            [&, i]() { sampled[i] = CountSampled(sampler, 10000); });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    // Every thread has its own generator, so they must not return the same
+    // sequence
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_GT(sampled[i], 4000);
+        EXPECT_LT(sampled[i], 6000);
+    }
+}
+
+TEST(RateLimitingSampler, Burst) {
+    fake_now = 0;
+    RateLimitingSampler sampler{10, 3, &fake_clock};
+
+    EXPECT_EQ(3, CountSampled(sampler, 100));
+
+    // One trace every 100ms
+    fake_now += 50000000;
+    EXPECT_EQ(0, CountSampled(sampler, 100));
+    fake_now += 50000000;
+    EXPECT_EQ(1, CountSampled(sampler, 100));
+
+    // After an idle period, a full burst is available again
+    fake_now += 10000000000;
+    EXPECT_EQ(3, CountSampled(sampler, 100));
+}
+
+TEST(RateLimitingSampler, Threads) {
+    RateLimitingSampler sampler{1, 50};
+    std::atomic<int> sampled{0};
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back(
+            [&]() { sampled += CountSampled(sampler, 10000); });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    // The burst is shared by the whole process
+    EXPECT_GE(sampled, 50);
+    EXPECT_LE(sampled, 51);
+}
+
+TEST(AdaptiveSampler, ConvergesToTarget) {
+    fake_now = 0;
+    uint64_t spans = 0;
+
+    // 100 spans per second are wanted, every sampled request produces 5 spans
+    AdaptiveSampler sampler{100, [&spans]() { return spans; }, 1.0,
+                            1000000000, &fake_clock};
+
+    // 10000 requests per second
+    for (int second = 0; second < 5; ++second) {
+        for (int i = 0; i < 10000; ++i) {
+            if (sampler.ShouldSample()) {
+                spans += 5;
+            }
+            fake_now += 100000;
+        }
+    }
+
+    EXPECT_NEAR(0.002, sampler.rate(), 0.0005);
+}
+
+TEST(AdaptiveSampler, IncreasesRate) {
+    fake_now = 0;
+    uint64_t spans = 0;
+
+    AdaptiveSampler sampler{1000, [&spans]() { return spans; }, 0.0001,
+                            1000000000, &fake_clock};
+
+    // Traffic is low enough to trace every request
+    for (int second = 0; second < 3; ++second) {
+        for (int i = 0; i < 640; ++i) {
+            if (sampler.ShouldSample()) {
+                ++spans;
+            }
+            fake_now += 1000000000 / 640;
+        }
+    }
+
+    EXPECT_EQ(1.0, sampler.rate());
+}
+
+TEST(AdaptiveSampler, FlushesWhenWindowIsOver) {
+    fake_now = 0;
+    uint64_t spans = 0;
+
+    AdaptiveSampler sampler{1000, [&spans]() { return spans; }, 0.0001,
+                            1000000000, &fake_clock};
+
+    // Far fewer than FLUSH_EVERY decisions are made in every window
+    for (int second = 0; second < 3; ++second) {
+        for (int i = 0; i < 10; ++i) {
+            if (sampler.ShouldSample()) {
+                ++spans;
+            }
+            fake_now += 1000000000 / 10;
+        }
+    }
+
+    EXPECT_EQ(1.0, sampler.rate());
+}
+
+TEST(AdaptiveSampler, FlushesOnThreadExit) {
+    fake_now = 0;
+
+    AdaptiveSampler sampler{2, []() { return 0; }, 1.0, 1000000000,
+                            &fake_clock};
+
+    std::thread thread{[&sampler]() { CountSampled(sampler, 19); }};
+    thread.join();
+
+    // The window is adjusted with the decisions of the exited thread
+    fake_now = 1000000000;
+    sampler.ShouldSample();
+    EXPECT_NEAR(0.1, sampler.rate(), 0.001);
+}
+
+TEST(EndpointSampler, ParseRates) {
+    const auto rates = ParseEndpointRates("/checkout=1,/search=0.05");
+
+    EXPECT_EQ(2, rates.size());
+    EXPECT_EQ(1, rates.at("/checkout"));
+    EXPECT_EQ(0.05, rates.at("/search"));
+    EXPECT_TRUE(ParseEndpointRates("").empty());
+}
+
+TEST(EndpointSampler, PerEndpointRates) {
+    EndpointSampler sampler{std::make_unique<ProbabilisticSampler>(0),
+                            {{"/checkout", 1}},
+                            0};
+
+    int sampled = 0;
+    for (int i = 0; i < 100; ++i) {
+        sampled += sampler.ShouldSampleUrl("/checkout?item=" +
+                                           std::to_string(i));
+        sampled += sampler.ShouldSampleUrl("/index.html");
+    }
+    EXPECT_EQ(100, sampled);
+
+    // Requests without a url go to the fallback
+    EXPECT_EQ(0, CountSampled(sampler, 100));
+}
+
+TEST(EndpointSampler, MinInterval) {
+    fake_now = 0;
+    EndpointSampler sampler{std::make_unique<ProbabilisticSampler>(0),
+                            {},
+                            60000000000,
+                            &fake_clock};
+
+    // The first request of every endpoint is sampled
+    EXPECT_TRUE(sampler.ShouldSampleUrl("/a"));
+    EXPECT_FALSE(sampler.ShouldSampleUrl("/a"));
+    EXPECT_TRUE(sampler.ShouldSampleUrl("/b"));
+
+    fake_now += 30000000000;
+    EXPECT_FALSE(sampler.ShouldSampleUrl("/a"));
+
+    // Once a minute has passed, the next request is sampled again
+    fake_now += 30000000000;
+    EXPECT_TRUE(sampler.ShouldSampleUrl("/a"));
+    EXPECT_FALSE(sampler.ShouldSampleUrl("/a"));
+}
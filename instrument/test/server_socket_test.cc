@@ -0,0 +1,156 @@
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "mocks.h"
+#include "server_socket.h"
+#include "test_util.h"
+
+using namespace microtrace;
+
+const int FD = 7;
+
+/*
+ * Records the contexts that are read. A new request is expected whenever the
+ * previous one got its context.
+ */
+class ContextHandler : public DumbServerSocketHandler {
+   public:
+    ContextHandler(int fd, const OriginalFunctions &orig,
+                   std::vector<Context> *contexts)
+        : DumbServerSocketHandler(fd, orig), contexts_(contexts) {}
+
+    void ContextReadCallback(const Context &c) {
+        contexts_->push_back(c);
+        processed_ = true;
+    }
+
+    SocketAction get_next_action(const SocketOperation op) const {
+        return SocketAction::RECV_REQUEST;
+    }
+
+    bool is_context_processed() const { return processed_; }
+
+    /*
+     * Called when the response to the request was written.
+     */
+    void Responded() { processed_ = false; }
+
+   private:
+    std::vector<Context> *contexts_;
+    bool processed_ = false;
+};
+
+/*
+ * Reads come from the bytes that the client sent, at most chunk of them at a
+ * time.
+ */
+class StreamOriginalFunctions : public EmptyOriginalFunctions {
+   public:
+    ssize_t read(int fd, void *buf, size_t count) const {
+        ++reads;
+        return recv(fd, buf, std::min(count, chunk), 0);
+    }
+    ssize_t recv(int sockfd, void *buf, size_t len, int flags) const {
+        len = std::min(len, stream.size());
+        memcpy(buf, stream.data(), len);
+        if (!(flags & MSG_PEEK)) {
+            stream.erase(0, len);
+        }
+        return len;
+    }
+
+    mutable std::string stream;
+    mutable int reads = 0;
+    size_t chunk = SIZE_MAX;
+};
+
+class ServerSocketTest : public ::testing::Test {
+   protected:
+    ServerSocketTest() {
+        setenv("MICROTRACE_SERVER_TYPE", "backend", 1);
+        auto handler = std::make_unique<ContextHandler>(FD, orig, &contexts);
+        this->handler = handler.get();
+        socket = std::make_unique<ServerSocket>(FD, std::move(handler), orig);
+    }
+
+    void Send(const Context &context, const std::string &request) {
+        char wire[Context::MAX_WIRE_SIZE];
+        orig.stream.append(wire, context.Serialize(wire));
+        orig.stream += request;
+    }
+
+    std::string Read(size_t count) {
+        std::string buf(count, '\0');
+        buf.resize(socket->Read(&buf[0], count));
+        return buf;
+    }
+
+    StreamOriginalFunctions orig;
+    std::vector<Context> contexts;
+    ContextHandler *handler;
+    std::unique_ptr<ServerSocket> socket;
+};
+
+TEST_F(ServerSocketTest, OneContextPerRequest) {
+    const Context first;
+    const Context second;
+    Send(first, "GET /a");
+    Send(second, "GET /b");
+
+    EXPECT_EQ("GET /a", Read(6));
+    handler->Responded();
+    EXPECT_EQ("GET /b", Read(6));
+
+    ASSERT_EQ(2, contexts.size());
+    EXPECT_EQ(first.span(), contexts[0].span());
+    EXPECT_EQ(second.span(), contexts[1].span());
+
+    // Every context is read at once
+    EXPECT_EQ(4, orig.reads);
+}
+
+TEST_F(ServerSocketTest, PartialContext) {
+    const Context context;
+    Send(context, "GET /a");
+    orig.chunk = 16;
+
+    EXPECT_EQ("GET /a", Read(6));
+    ASSERT_EQ(1, contexts.size());
+    EXPECT_EQ(context, contexts[0]);
+}
+
+TEST_F(ServerSocketTest, PipelinedRequests) {
+    const Context context;
+    Send(context, "GET /a");
+    orig.stream += "GET /b";
+    Send(*Context::Zero(), "GET /c");
+
+    EXPECT_EQ("GET /a", Read(6));
+    handler->Responded();
+
+    // The second request came without a context, and is read whole
+    EXPECT_EQ("GET /b", Read(6));
+    handler->Responded();
+    EXPECT_EQ("GET /c", Read(6));
+
+    ASSERT_EQ(3, contexts.size());
+    EXPECT_EQ(context.span(), contexts[1].span());
+    EXPECT_TRUE(contexts[1].sampled());
+    EXPECT_FALSE(contexts[2].sampled());
+}
+
+TEST_F(ServerSocketTest, NoContext) {
+    // Requests that a client writes through io_uring come without a context
+    orig.stream = "GET /a";
+    EXPECT_EQ("GET /a", Read(6));
+
+    ASSERT_EQ(1, contexts.size());
+    EXPECT_FALSE(contexts[0].sampled());
+    EXPECT_TRUE(contexts[0].is_zero());
+}
@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
 
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include "socket_map.h"
 
 #include "client_socket.h"
@@ -68,3 +71,82 @@ TEST(SocketMapTest, OutOfRange) {
     EXPECT_EQ(nullptr, map.Get(SocketMap::DEFAULT_SIZE * 100));
     map.Delete(SocketMap::DEFAULT_SIZE * 20);
 }
+
+static std::shared_ptr<ClientSocket> MakeSocket(const int fd) {
+    return std::make_shared<ClientSocket>(
+        fd, std::make_unique<DumbClientSocketHandler>(fd, empty_orig),
+        empty_orig);
+}
+
+TEST(SocketMapTest, Dup) {
+    SocketMap map;
+    auto shared = MakeSocket(3);
+    std::weak_ptr<ClientSocket> socket = shared;
+    map.Set(3, std::move(shared));
+    map.Set(4, MakeSocket(4));
+
+    EXPECT_TRUE(map.Dup(3, 5));
+    EXPECT_TRUE(map.Dup(3, SocketMap::DEFAULT_SIZE * 2));
+    EXPECT_EQ(map.Get(3), map.Get(5));
+    EXPECT_EQ(map.Get(3), map.Get(SocketMap::DEFAULT_SIZE * 2));
+
+    // dup2 onto a socket closes it
+    EXPECT_TRUE(map.Dup(3, 4));
+    EXPECT_EQ(map.Get(3), map.Get(4));
+
+    // Closing the descriptor of the socket moves it to another one
+    map.Delete(3);
+    EXPECT_EQ(nullptr, map.Get(3));
+    ASSERT_NE(nullptr, map.Get(5));
+    EXPECT_EQ(4, map.Get(5)->fd());
+    EXPECT_FALSE(socket.expired());
+
+    map.Delete(4);
+    map.Delete(5);
+    EXPECT_FALSE(socket.expired());
+    EXPECT_EQ(SocketMap::DEFAULT_SIZE * 2,
+              map.Get(SocketMap::DEFAULT_SIZE * 2)->fd());
+    map.Delete(SocketMap::DEFAULT_SIZE * 2);
+    EXPECT_TRUE(socket.expired());
+}
+
+TEST(SocketMapTest, DupUntraced) {
+    SocketMap map;
+    map.Set(4, MakeSocket(4));
+
+    EXPECT_FALSE(map.Dup(3, 5));
+    EXPECT_EQ(nullptr, map.Get(5));
+
+    EXPECT_FALSE(map.Dup(3, 4));
+    EXPECT_EQ(nullptr, map.Get(4));
+
+    map.Set(4, MakeSocket(4));
+    EXPECT_TRUE(map.Dup(4, 4));
+    EXPECT_NE(nullptr, map.Get(4));
+    EXPECT_FALSE(map.Dup(SocketMap::DEFAULT_SIZE * 2, 5));
+}
+
+TEST(SocketMapTest, Fork) {
+    SocketMap map;
+    map.Set(4, MakeSocket(4));
+
+    map.PrepareFork();
+    const pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+    if (pid == 0) {
+        // The map is usable in the child, and doesn't have the inherited
+        // sockets
+        map.AfterForkChild();
+        bool ok = map.Get(4) == nullptr;
+        map.Set(4, MakeSocket(4));
+        ok = ok && map.Get(4) != nullptr;
+        _exit(ok ? 0 : 1);
+    }
+    map.AfterForkParent();
+
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(0, WEXITSTATUS(status));
+    EXPECT_NE(nullptr, map.Get(4));
+}
@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+
+#include "socket_handler.h"
+#include "span_clock.h"
+
+using namespace microtrace;
+
+static int64_t fake_now = 0;
+static int64_t fake_wall = 0;
+
+// Every read of a clock takes 10ns
+static int64_t fake_clock() {
+    fake_now += 10;
+    return fake_now;
+}
+static int64_t fake_wall_clock() { return fake_wall + fake_clock(); }
+
+static const int64_t EPOCH = 1500000000000000000;
+
+TEST(SpanClock, ToWall) {
+    fake_now = 0;
+    fake_wall = EPOCH;
+    SpanClock clock{&fake_clock, &fake_wall_clock};
+    EXPECT_EQ(1u, clock.calibrations());
+
+    EXPECT_EQ(EPOCH, clock.ToWall(0));
+    EXPECT_EQ(EPOCH + 1000, clock.ToWall(1000));
+    EXPECT_EQ(1u, clock.calibrations());
+}
+
+TEST(SpanClock, Recalibrates) {
+    fake_now = 0;
+    fake_wall = EPOCH;
+    SpanClock clock{&fake_clock, &fake_wall_clock};
+
+    // The wall clock is stepped back
+    fake_wall -= 1000000;
+    const int64_t before = SpanClock::CALIBRATION_INTERVAL_NS;
+    EXPECT_EQ(EPOCH + before, clock.ToWall(before));
+    EXPECT_EQ(1u, clock.calibrations());
+
+    // The first calibration was made 10ns after the clock was created
+    const int64_t after = before + 10;
+    fake_now = after;
+    EXPECT_EQ(EPOCH - 1000000 + after, clock.ToWall(after));
+    EXPECT_EQ(2u, clock.calibrations());
+}
+
+TEST(SpanClock, Default) {
+    const int64_t now = span_now_ns();
+    const int64_t wall = SpanClock::Default().ToWall(now);
+    EXPECT_LT(std::abs(wall - wall_now_ns()), 1000000000);
+}
+
+TEST(Transaction, Nanoseconds) {
+    Transaction txn;
+    txn.Start();
+    const int64_t start = span_now_ns();
+    while (span_now_ns() - start < 200000) {
+    }
+    txn.End();
+
+    // Calls shorter than a millisecond don't show up as 0
+    EXPECT_GE(txn.duration_ns(), 200000);
+    EXPECT_GT(txn.duration(), 0.19);
+    EXPECT_LT(txn.duration(), 1000);
+
+    proto::RequestLog log;
+    txn.Fill(&log);
+    EXPECT_EQ(txn.duration_ns(), log.duration_ns());
+    EXPECT_EQ(txn.start_ns(), log.time_ns());
+    EXPECT_EQ(log.time_ns() / 1000000000, log.time());
+    EXPECT_EQ(txn.duration(), log.duration());
+}
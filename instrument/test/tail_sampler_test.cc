@@ -0,0 +1,249 @@
+#include <gtest/gtest.h>
+
+#include "tail_sampler.h"
+
+using namespace microtrace;
+
+static int64_t fake_now = 0;
+static int64_t fake_clock() { return fake_now; }
+
+class RecordingLogger : public TraceLogger {
+   public:
+    void Log(const proto::RequestLog& log) override { logs.push_back(log); }
+
+    std::vector<proto::RequestLog> logs;
+};
+
+static TailSamplingLogger::Options TestOptions() {
+    TailSamplingLogger::Options options;
+    options.latency_threshold_ms = 100;
+    options.baseline_rate = 0;
+    options.budget_bytes = 1024 * 1024;
+    options.max_spans_per_trace = 10;
+    options.ttl_ns = 1000;
+    return options;
+}
+
+static proto::RequestLog MakeLog(const Context& context) {
+    proto::RequestLog log;
+    proto::Context* ctx = log.mutable_context();
+    ctx->mutable_trace_id()->set_high(context.trace().high());
+    ctx->mutable_trace_id()->set_low(context.trace().low());
+    ctx->mutable_span_id()->set_high(context.span().high());
+    ctx->mutable_span_id()->set_low(context.span().low());
+    ctx->mutable_parent_span()->set_high(context.parent_span().high());
+    ctx->mutable_parent_span()->set_low(context.parent_span().low());
+    log.set_info("HTTP: /index.html");
+    log.set_duration(1);
+    return log;
+}
+
+/*
+ * Returns a context whose trace goes to the given shard of the logger, which
+ * has 16 of them.
+ */
+static Context InShard(const size_t shard) {
+    Context context;
+    while (UuidHash{}(context.trace()) % 16 != shard) {
+        context = Context{};
+    }
+    return context;
+}
+
+class TailSamplingTest : public ::testing::Test {
+   public:
+    virtual void SetUp() { fake_now = 0; }
+
+    RecordingLogger exporter;
+};
+
+TEST_F(TailSamplingTest, FastTraceIsDropped) {
+    TailSamplingLogger logger{&exporter, TestOptions(), &fake_clock};
+    Context context;
+
+    logger.Log(MakeLog(context));
+    logger.Log(MakeLog(context));
+    EXPECT_GT(logger.buffered_bytes(), 0);
+
+    logger.RootCompleted(context.trace(), 10, false);
+    EXPECT_TRUE(exporter.logs.empty());
+    EXPECT_EQ(0, logger.buffered_bytes());
+    EXPECT_EQ(1, logger.stats().dropped_traces);
+}
+
+TEST_F(TailSamplingTest, SlowTraceIsKept) {
+    TailSamplingLogger logger{&exporter, TestOptions(), &fake_clock};
+    Context slow;
+    Context fast;
+
+    logger.Log(MakeLog(slow));
+    logger.Log(MakeLog(fast));
+    logger.Log(MakeLog(slow));
+
+    logger.RootCompleted(slow.trace(), 150, false);
+    ASSERT_EQ(2, exporter.logs.size());
+    EXPECT_EQ(slow.trace().low(), exporter.logs[0].context().trace_id().low());
+    EXPECT_EQ(slow.trace().low(), exporter.logs[1].context().trace_id().low());
+    EXPECT_EQ("HTTP: /index.html", exporter.logs[0].info());
+    EXPECT_EQ(1, logger.stats().kept_traces);
+
+    logger.RootCompleted(fast.trace(), 1, false);
+    EXPECT_EQ(2, exporter.logs.size());
+}
+
+TEST_F(TailSamplingTest, TraceWithErrorIsKept) {
+    TailSamplingLogger logger{&exporter, TestOptions(), &fake_clock};
+    Context context;
+
+    auto log = MakeLog(context);
+    log.set_error(true);
+    logger.Log(MakeLog(context));
+    logger.Log(log);
+
+    logger.RootCompleted(context.trace(), 1, false);
+    EXPECT_EQ(2, exporter.logs.size());
+}
+
+TEST_F(TailSamplingTest, FailedRootIsKept) {
+    TailSamplingLogger logger{&exporter, TestOptions(), &fake_clock};
+    Context context;
+
+    logger.Log(MakeLog(context));
+    logger.RootCompleted(context.trace(), 1, true);
+    EXPECT_EQ(1, exporter.logs.size());
+}
+
+TEST_F(TailSamplingTest, DebugTraceIsKept) {
+    TailSamplingLogger logger{&exporter, TestOptions(), &fake_clock};
+    const Context context = Context::Debug();
+
+    auto log = MakeLog(context);
+    log.set_debug(true);
+    logger.Log(log);
+    logger.Log(MakeLog(context));
+
+    logger.RootCompleted(context.trace(), 1, false);
+    EXPECT_EQ(2, exporter.logs.size());
+}
+
+TEST_F(TailSamplingTest, Baseline) {
+    auto options = TestOptions();
+    options.baseline_rate = 1;
+    TailSamplingLogger logger{&exporter, options, &fake_clock};
+    Context context;
+
+    logger.Log(MakeLog(context));
+    logger.RootCompleted(context.trace(), 1, false);
+    EXPECT_EQ(1, exporter.logs.size());
+}
+
+TEST_F(TailSamplingTest, LateSpansFollowDecision) {
+    TailSamplingLogger logger{&exporter, TestOptions(), &fake_clock};
+    Context kept;
+    Context dropped;
+
+    logger.RootCompleted(kept.trace(), 500, false);
+    logger.RootCompleted(dropped.trace(), 1, false);
+
+    logger.Log(MakeLog(kept));
+    logger.Log(MakeLog(dropped));
+    EXPECT_EQ(1, exporter.logs.size());
+    EXPECT_EQ(0, logger.buffered_bytes());
+}
+
+TEST_F(TailSamplingTest, MaxSpansPerTrace) {
+    TailSamplingLogger logger{&exporter, TestOptions(), &fake_clock};
+    Context context;
+
+    for (int i = 0; i < 15; ++i) {
+        logger.Log(MakeLog(context));
+    }
+    EXPECT_EQ(5, logger.stats().dropped_spans);
+
+    logger.RootCompleted(context.trace(), 500, false);
+    EXPECT_EQ(10, exporter.logs.size());
+}
+
+TEST_F(TailSamplingTest, IncompleteTracesExpire) {
+    TailSamplingLogger logger{&exporter, TestOptions(), &fake_clock};
+    Context old_trace;
+    Context new_trace;
+
+    logger.Log(MakeLog(old_trace));
+    fake_now += 2000;
+
+    // Eviction is done lazily, so log enough traces to hit every shard
+    for (int i = 0; i < 200; ++i) {
+        logger.Log(MakeLog(new_trace));
+        new_trace = Context{};
+    }
+    EXPECT_EQ(1, logger.stats().evicted_traces);
+
+    // The evicted trace is gone, even if it turns out to be slow
+    logger.RootCompleted(old_trace.trace(), 500, false);
+    EXPECT_TRUE(exporter.logs.empty());
+}
+
+TEST_F(TailSamplingTest, Budget) {
+    auto options = TestOptions();
+    options.budget_bytes = 0;
+    options.ttl_ns = 1000000;
+    TailSamplingLogger logger{&exporter, options, &fake_clock};
+
+    for (int i = 0; i < 100; ++i) {
+        logger.Log(MakeLog(Context{}));
+    }
+
+    // Every shard keeps at most the trace that was last added to it
+    EXPECT_GE(logger.stats().evicted_traces, 100 - 16);
+    EXPECT_LT(logger.stats().evicted_traces, 100);
+}
+
+TEST_F(TailSamplingTest, BudgetOfOtherShard) {
+    auto options = TestOptions();
+    options.budget_bytes = 16 * 4096;
+    options.ttl_ns = 1000000;
+    TailSamplingLogger logger{&exporter, options, &fake_clock};
+
+    // One shard is filled far beyond its budget
+    Context last;
+    for (int i = 0; i < 200; ++i) {
+        last = InShard(0);
+        logger.Log(MakeLog(last));
+    }
+    EXPECT_GT(logger.stats().evicted_traces, 0);
+    const uint64_t evicted = logger.stats().evicted_traces;
+
+    // A new trace in another shard isn't evicted for it
+    const Context other = InShard(1);
+    logger.Log(MakeLog(other));
+    EXPECT_EQ(evicted, logger.stats().evicted_traces);
+    logger.RootCompleted(other.trace(), 500, false);
+    EXPECT_EQ(1, exporter.logs.size());
+
+    // Nor is the trace that was added to the full shard last
+    logger.RootCompleted(last.trace(), 500, false);
+    EXPECT_EQ(2, exporter.logs.size());
+}
+
+TEST_F(TailSamplingTest, Fork) {
+    TailSamplingLogger logger{&exporter, TestOptions(), &fake_clock};
+    Context parent;
+    Context child;
+
+    logger.Log(MakeLog(parent));
+    logger.PrepareFork();
+    logger.AfterForkParent();
+    EXPECT_GT(logger.buffered_bytes(), 0);
+
+    // The trace of the parent is dropped in the child
+    logger.PrepareFork();
+    logger.AfterForkChild();
+    EXPECT_EQ(0, logger.buffered_bytes());
+    logger.RootCompleted(parent.trace(), 150, false);
+    EXPECT_TRUE(exporter.logs.empty());
+
+    logger.Log(MakeLog(child));
+    logger.RootCompleted(child.trace(), 150, false);
+    EXPECT_EQ(1, exporter.logs.size());
+}
@@ -0,0 +1,67 @@
+#include "benchmark/benchmark.h"
+
+#include "tail_sampler.h"
+
+using namespace microtrace;
+
+/*
+ * Compares the cost of tracing a request with head-based and tail-based
+ * sampling. Every request produces SPANS_PER_TRACE spans. Exporting is not
+ * included, spans that are kept are passed to a logger that discards them.
+ */
+
+static const int SPANS_PER_TRACE = 4;
+
+class NullLogger : public TraceLogger {
+   public:
+    void Log(const proto::RequestLog& log) override {
+        benchmark::DoNotOptimize(log.duration());
+    }
+};
+
+static proto::RequestLog MakeLog(const Context& context) {
+    proto::RequestLog log;
+    proto::Context* ctx = log.mutable_context();
+    ctx->mutable_trace_id()->set_high(context.trace().high());
+    ctx->mutable_trace_id()->set_low(context.trace().low());
+    ctx->mutable_span_id()->set_high(context.span().high());
+    ctx->mutable_span_id()->set_low(context.span().low());
+    log.set_info("HTTP: /index.html");
+    log.set_duration(1);
+    return log;
+}
+
+static void HeadSampling(benchmark::State& state) {
+    static NullLogger exporter;
+    static ProbabilisticSampler sampler{0.01};
+    while (state.KeepRunning()) {
+        if (!sampler.ShouldSample()) {
+            continue;
+        }
+        Context context;
+        const auto log = MakeLog(context);
+        for (int i = 0; i < SPANS_PER_TRACE; ++i) {
+            exporter.Log(log);
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(HeadSampling)->ThreadRange(1, 16)->UseRealTime();
+
+static void TailSampling(benchmark::State& state) {
+    static NullLogger exporter;
+    static TailSamplingLogger logger{&exporter,
+                                     TailSamplingLogger::DefaultOptions()};
+    while (state.KeepRunning()) {
+        Context context;
+        const auto log = MakeLog(context);
+        for (int i = 0; i < SPANS_PER_TRACE; ++i) {
+            logger.Log(log);
+        }
+        logger.RootCompleted(context.trace(), 1, false);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(TailSampling)->ThreadRange(1, 16)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -170,6 +170,9 @@ class EmptyOriginalFunctions : public OriginalFunctions {
         return 0;
     }
     int close(int fd) const { return 0; }
+    int dup(int oldfd) const { return ++last_socket; }
+    int dup2(int oldfd, int newfd) const { return newfd; }
+    int dup3(int oldfd, int newfd, int flags) const { return newfd; }
     int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) const {
         return ++last_socket;
     }
@@ -185,6 +188,16 @@ class EmptyOriginalFunctions : public OriginalFunctions {
                      struct sockaddr *src_addr, socklen_t *addrlen) const {
         return len;
     }
+    ssize_t readv(int fd, const struct iovec *iov, int iovcnt) const {
+        return 11;
+    }
+    ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) const {
+        return 11;
+    }
+    int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
+                 int flags, struct timespec *timeout) const {
+        return vlen;
+    }
     ssize_t write(int fd, const void *buf, size_t count) const { return count; }
     ssize_t writev(int fd, const struct iovec *iov, int iovcnt) const {
         return 11;
@@ -203,6 +216,57 @@ class EmptyOriginalFunctions : public OriginalFunctions {
                  int flags) const {
         return 11;
     }
+    ssize_t sendfile(int out_fd, int in_fd, off_t *offset,
+                     size_t count) const {
+        return count;
+    }
+    ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out,
+                   size_t len, unsigned int flags) const {
+        return len;
+    }
+    int fcntl(int fd, int cmd, void *arg) const { return 0; }
+    int ioctl(int fd, unsigned long request, void *arg) const { return 0; }
+    int getsockopt(int sockfd, int level, int optname, void *optval,
+                   socklen_t *optlen) const {
+        return 0;
+    }
+    int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) const {
+        return 0;
+    }
+    int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+                   int timeout) const {
+        return 0;
+    }
+    int pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                       void *(*start_routine)(void *), void *arg) const {
+        return 0;
+    }
+    int swapcontext(ucontext_t *oucp, const ucontext_t *ucp) const {
+        return 0;
+    }
+    int setcontext(const ucontext_t *ucp) const { return 0; }
+    int io_uring_submit(struct io_uring *ring) const { return 0; }
+    int io_uring_submit_and_wait(struct io_uring *ring,
+                                 unsigned wait_nr) const {
+        return 0;
+    }
+    int __io_uring_get_cqe(struct io_uring *ring,
+                           struct io_uring_cqe **cqe_ptr, unsigned submit,
+                           unsigned wait_nr, sigset_t *sigmask) const {
+        return 0;
+    }
+    int io_uring_wait_cqes(struct io_uring *ring,
+                           struct io_uring_cqe **cqe_ptr, unsigned wait_nr,
+                           struct __kernel_timespec *ts,
+                           sigset_t *sigmask) const {
+        return 0;
+    }
+    unsigned io_uring_peek_batch_cqe(struct io_uring *ring,
+                                     struct io_uring_cqe **cqes,
+                                     unsigned count) const {
+        return 0;
+    }
+    void io_uring_queue_exit(struct io_uring *ring) const {}
     int uv_tcp_connect(uv_connect_t *req, uv_tcp_t *handle,
                        const struct sockaddr *addr, uv_connect_cb cb) const {
         return 0;
@@ -217,6 +281,45 @@ class EmptyOriginalFunctions : public OriginalFunctions {
                        const struct addrinfo *hints) const {
         return 0;
     }
+    int uv_write(uv_write_t *req, uv_stream_t *handle, const uv_buf_t *bufs,
+                 unsigned int nbufs, uv_write_cb cb) const {
+        return 0;
+    }
+    int uv_queue_work(uv_loop_t *loop, uv_work_t *req, uv_work_cb work_cb,
+                      uv_after_work_cb after_work_cb) const {
+        return 0;
+    }
+    int uv_timer_start(uv_timer_t *handle, uv_timer_cb cb, uint64_t timeout,
+                       uint64_t repeat) const {
+        return 0;
+    }
+    void uv_close(uv_handle_t *handle, uv_close_cb close_cb) const {}
+    int uv_fs_open(uv_loop_t *loop, uv_fs_t *req, const char *path, int flags,
+                   int mode, uv_fs_cb cb) const {
+        return 0;
+    }
+    int uv_fs_close(uv_loop_t *loop, uv_fs_t *req, uv_file file,
+                    uv_fs_cb cb) const {
+        return 0;
+    }
+    int uv_fs_read(uv_loop_t *loop, uv_fs_t *req, uv_file file,
+                   const uv_buf_t *bufs, unsigned int nbufs, int64_t offset,
+                   uv_fs_cb cb) const {
+        return 0;
+    }
+    int uv_fs_write(uv_loop_t *loop, uv_fs_t *req, uv_file file,
+                    const uv_buf_t *bufs, unsigned int nbufs, int64_t offset,
+                    uv_fs_cb cb) const {
+        return 0;
+    }
+    int uv_fs_stat(uv_loop_t *loop, uv_fs_t *req, const char *path,
+                   uv_fs_cb cb) const {
+        return 0;
+    }
+    int uv_fs_fstat(uv_loop_t *loop, uv_fs_t *req, uv_file file,
+                    uv_fs_cb cb) const {
+        return 0;
+    }
     int getpeername(int sockfd, struct sockaddr *addr,
                     socklen_t *addrlen) const {
         struct sockaddr_in *addr_in = (struct sockaddr_in *)addr;
@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+
+#include <pthread.h>
+#include <thread>
+#include <vector>
+
+#include "context.h"
+#include "thread_start.h"
+
+using namespace microtrace;
+
+static void* GetContext(void* arg) {
+    auto* context = static_cast<Context*>(arg);
+    if (!is_context_undefined()) {
+        *context = get_current_context();
+    }
+    return nullptr;
+}
+
+TEST(ThreadStartTest, InheritsContext) {
+    ThreadStartPool pool;
+    const Context parent;
+    set_current_context(parent);
+
+    Context child{ContextStorage::Zero(), 0};
+    ThreadStart* start =
+        pool.Take(&GetContext, &child, get_current_context());
+    EXPECT_TRUE(start->pooled);
+    EXPECT_EQ(ThreadStartPool::SIZE - 1, pool.available());
+
+    pthread_t thread;
+    ASSERT_EQ(0, pthread_create(&thread, nullptr, &ThreadStartPool::Run,
+                                start));
+    ASSERT_EQ(0, pthread_join(thread, nullptr));
+    EXPECT_EQ(parent, child);
+    EXPECT_TRUE(child.sampled());
+    EXPECT_EQ(ThreadStartPool::SIZE, pool.available());
+}
+
+TEST(ThreadStartTest, UndefinedWithoutStart) {
+    set_current_context(Context{});
+    bool undefined = false;
+    std::thread thread{[&]() { undefined = is_context_undefined(); }};
+    thread.join();
+    EXPECT_TRUE(undefined);
+}
+
+TEST(ThreadStartTest, Exhausted) {
+    ThreadStartPool pool;
+    const Context context;
+    std::vector<ThreadStart*> starts;
+    for (size_t i = 0; i < ThreadStartPool::SIZE + 2; ++i) {
+        starts.push_back(pool.Take(&GetContext, nullptr, context));
+    }
+    EXPECT_EQ(0u, pool.available());
+    EXPECT_TRUE(starts[ThreadStartPool::SIZE - 1]->pooled);
+    EXPECT_FALSE(starts[ThreadStartPool::SIZE]->pooled);
+    EXPECT_EQ(context, starts[ThreadStartPool::SIZE + 1]->context);
+
+    for (ThreadStart* start : starts) {
+        pool.Give(start);
+    }
+    EXPECT_EQ(ThreadStartPool::SIZE, pool.available());
+
+    // Every start is reused
+    for (size_t i = 0; i < ThreadStartPool::SIZE; ++i) {
+        EXPECT_TRUE(pool.Take(&GetContext, nullptr, context)->pooled);
+    }
+}
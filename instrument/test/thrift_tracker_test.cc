@@ -0,0 +1,308 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "thrift_session.h"
+#include "thrift_tracker.h"
+
+using namespace microtrace;
+
+using MessageType = ThriftTracker::MessageType;
+
+static std::string Uint32(const uint32_t value) {
+    std::string bytes;
+    bytes.push_back(static_cast<char>(value >> 24));
+    bytes.push_back(static_cast<char>(value >> 16));
+    bytes.push_back(static_cast<char>(value >> 8));
+    bytes.push_back(static_cast<char>(value));
+    return bytes;
+}
+
+static std::string Varint(uint64_t value) {
+    std::string bytes;
+    while (value >= 0x80) {
+        bytes.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    bytes.push_back(static_cast<char>(value));
+    return bytes;
+}
+
+static std::string Framed(const std::string& message) {
+    return Uint32(message.size()) + message;
+}
+
+static std::string BinaryHeader(const MessageType type, const std::string& name,
+                                const int32_t seqid) {
+    return std::string{"\x80\x01\x00", 3} + static_cast<char>(type) +
+           Uint32(name.size()) + name + Uint32(seqid);
+}
+
+static std::string CompactHeader(const MessageType type,
+                                 const std::string& name,
+                                 const int32_t seqid) {
+    return std::string{"\x82"} +
+           static_cast<char>((static_cast<int>(type) << 5) | 0x01) +
+           Varint(static_cast<uint32_t>(seqid)) + Varint(name.size()) + name;
+}
+
+/*
+ * Arguments of Calculator.add(1: i32 num1, 2: i32 num2) in the binary
+ * protocol.
+ */
+static std::string BinaryAddArgs() {
+    return std::string{"\x08\x00\x01", 3} + Uint32(10) +
+           std::string{"\x08\x00\x02", 3} + Uint32(9) + std::string{"\x00", 1};
+}
+
+/*
+ * A struct with a string, a list of strings, a map of string to i64, and a
+ * nested struct with a double, in the binary protocol.
+ */
+static std::string BinaryNestedArgs() {
+    std::string args;
+    args += std::string{"\x0b\x00\x01", 3} + Uint32(5) + "hello";
+    args += std::string{"\x0f\x00\x02\x0b", 4} + Uint32(2) + Uint32(1) + "a" +
+            Uint32(2) + "bc";
+    args += std::string{"\x0d\x00\x03\x0b\x0a", 5} + Uint32(1) + Uint32(3) +
+            "key" + std::string(8, '\x01');
+    args += std::string{"\x0c\x00\x04", 3} + std::string{"\x04\x00\x01", 3} +
+            std::string(8, '\x02') + std::string{"\x00", 1};
+    // Empty list
+    args += std::string{"\x0e\x00\x05\x08", 4} + Uint32(0);
+    args += std::string{"\x00", 1};
+    return args;
+}
+
+/*
+ * The same kind of struct in the compact protocol, with a boolean field, a
+ * field id that isn't a delta, and a list with a varint size.
+ */
+static std::string CompactNestedArgs() {
+    std::string args;
+    // Field 1, i32 -1 zigzag encoded
+    args += "\x15\x01";
+    // Field 2, true
+    args += "\x11";
+    // Field 3, binary
+    args += "\x18" + Varint(5) + "hello";
+    // Field 100, list of 20 i64
+    args += "\x09" + Varint(200);
+    args += "\xf6" + Varint(20);
+    for (int i = 0; i < 20; ++i) {
+        args += Varint(300);
+    }
+    // Field 101, map of binary to bool
+    args += "\x1b" + Varint(1) + "\x81" + Varint(1) + "k" + "\x01";
+    // Field 102, empty map
+    args += "\x1b" + Varint(0);
+    // Field 103, struct with a double
+    args += "\x1c" + std::string{"\x17"} + std::string(8, '\x03');
+    args += std::string{"\x00", 1};
+    args += std::string{"\x00", 1};
+    return args;
+}
+
+static size_t ProcessByteByByte(ThriftTracker& tracker,
+                                const std::string& message) {
+    size_t processed = 0;
+    for (size_t i = 0; i < message.size() && !tracker.complete(); ++i) {
+        processed += tracker.Process(&message[i], 1);
+    }
+    return processed;
+}
+
+TEST(ThriftTracker, StartsWithMessage) {
+    const std::string binary =
+        BinaryHeader(MessageType::CALL, "add", 1) + BinaryAddArgs();
+    const std::string compact = CompactHeader(MessageType::CALL, "add", 1);
+
+    EXPECT_TRUE(ThriftTracker::StartsWithMessage(binary.data(), binary.size()));
+    EXPECT_TRUE(
+        ThriftTracker::StartsWithMessage(compact.data(), compact.size()));
+    EXPECT_TRUE(ThriftTracker::StartsWithMessage(Framed(binary).data(),
+                                                 Framed(binary).size()));
+    EXPECT_TRUE(ThriftTracker::StartsWithMessage(Framed(compact).data(),
+                                                 Framed(compact).size()));
+
+    const std::string http = "GET / HTTP/1.1\r\n\r\n";
+    EXPECT_FALSE(ThriftTracker::StartsWithMessage(http.data(), http.size()));
+    EXPECT_FALSE(ThriftTracker::StartsWithMessage(binary.data(), 2));
+}
+
+TEST(ThriftTracker, BinaryMessages) {
+    const std::string call =
+        BinaryHeader(MessageType::CALL, "add", 7) + BinaryAddArgs();
+    const std::string next =
+        BinaryHeader(MessageType::CALL, "proxy_add", 8) + BinaryNestedArgs();
+    const std::string data = call + next;
+
+    ThriftTracker tracker;
+    EXPECT_EQ(call.size(), tracker.Process(data.data(), data.size()));
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_EQ(MessageType::CALL, tracker.message_type());
+    EXPECT_EQ("add", tracker.name());
+    EXPECT_EQ(7, tracker.seqid());
+
+    tracker.Reset();
+    EXPECT_FALSE(tracker.header_complete());
+    EXPECT_EQ(next.size(),
+              ProcessByteByByte(tracker, data.substr(call.size())));
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_EQ("proxy_add", tracker.name());
+    EXPECT_EQ(8, tracker.seqid());
+}
+
+TEST(ThriftTracker, CompactMessages) {
+    const std::string reply =
+        CompactHeader(MessageType::REPLY, "add", 300) + CompactNestedArgs();
+
+    ThriftTracker tracker;
+    EXPECT_EQ(reply.size(), ProcessByteByByte(tracker, reply));
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_EQ(MessageType::REPLY, tracker.message_type());
+    EXPECT_EQ("add", tracker.name());
+    EXPECT_EQ(300, tracker.seqid());
+
+    tracker.Reset();
+    const std::string data = reply + reply;
+    EXPECT_EQ(reply.size(), tracker.Process(data.data(), data.size()));
+    EXPECT_TRUE(tracker.complete());
+}
+
+TEST(ThriftTracker, FramedMessages) {
+    // The body isn't walked, only skipped
+    const std::string binary = Framed(
+        BinaryHeader(MessageType::EXCEPTION, "add", 3) + std::string(100, 'x'));
+    const std::string compact = Framed(
+        CompactHeader(MessageType::ONEWAY, "log", 4) + std::string(10, '\xff'));
+
+    ThriftTracker tracker;
+    EXPECT_EQ(binary.size(), ProcessByteByByte(tracker, binary));
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_EQ(MessageType::EXCEPTION, tracker.message_type());
+    EXPECT_EQ(3, tracker.seqid());
+
+    tracker.Reset();
+    const std::string data = compact + binary;
+    EXPECT_EQ(compact.size(), tracker.Process(data.data(), data.size()));
+    EXPECT_TRUE(tracker.complete());
+    EXPECT_EQ(MessageType::ONEWAY, tracker.message_type());
+    EXPECT_EQ("log", tracker.name());
+}
+
+TEST(ThriftTracker, Invalid) {
+    ThriftTracker tracker;
+    const std::string http = "GET / HTTP/1.1\r\n\r\n";
+    tracker.Process(http.data(), http.size());
+    EXPECT_FALSE(tracker.valid());
+
+    // Unknown field type
+    tracker.Reset();
+    const std::string call = BinaryHeader(MessageType::CALL, "add", 1) +
+                             std::string{"\x63\x00\x01", 3};
+    tracker.Process(call.data(), call.size());
+    EXPECT_FALSE(tracker.valid());
+
+    // Too deeply nested
+    tracker.Reset();
+    std::string nested = BinaryHeader(MessageType::CALL, "add", 1);
+    for (size_t i = 0; i < ThriftTracker::MAX_DEPTH; ++i) {
+        nested += std::string{"\x0c\x00\x01", 3};
+    }
+    tracker.Process(nested.data(), nested.size());
+    EXPECT_FALSE(tracker.valid());
+}
+
+class RecordingObserver : public ThriftSession::Observer {
+   public:
+    void CallStarted(ThriftCall* call) override {
+        call->sampled = true;
+        started.push_back(call->method);
+    }
+
+    void CallCompleted(const ThriftCall& call) override {
+        completed.push_back(call);
+    }
+
+    std::vector<std::string> started;
+    std::vector<ThriftCall> completed;
+};
+
+TEST(ThriftSession, MatchesRepliesBySeqid) {
+    RecordingObserver observer;
+    ThriftSession session{ThriftSession::Role::CLIENT, &observer};
+
+    const std::string calls =
+        BinaryHeader(MessageType::CALL, "add", 1) + BinaryAddArgs() +
+        BinaryHeader(MessageType::CALL, "proxy_add", 2) + BinaryAddArgs() +
+        BinaryHeader(MessageType::ONEWAY, "log", 3) + BinaryAddArgs();
+    session.Sent(calls.data(), calls.size());
+    ASSERT_EQ(3, observer.started.size());
+    ASSERT_EQ(1, observer.completed.size());
+    EXPECT_EQ("Thrift: log", observer.completed[0].info());
+
+    // Replies out of order, the second one split in two
+    const std::string reply = std::string{"\x00", 1};
+    const std::string second =
+        BinaryHeader(MessageType::REPLY, "proxy_add", 2) + reply;
+    session.Received(second.data(), 5);
+    session.Received(second.data() + 5, second.size() - 5);
+    ASSERT_EQ(2, observer.completed.size());
+    EXPECT_EQ("proxy_add", observer.completed[1].method);
+    EXPECT_FALSE(observer.completed[1].error);
+
+    const std::string first =
+        BinaryHeader(MessageType::EXCEPTION, "add", 1) + reply;
+    session.Received(first.data(), first.size());
+    ASSERT_EQ(3, observer.completed.size());
+    EXPECT_EQ("add", observer.completed[2].method);
+    EXPECT_TRUE(observer.completed[2].error);
+    EXPECT_TRUE(session.valid());
+}
+
+TEST(ThriftSession, SameSeqidInOrder) {
+    RecordingObserver observer;
+    ThriftSession session{ThriftSession::Role::SERVER, &observer};
+
+    const std::string empty_struct{"\x00", 1};
+    const std::string calls =
+        Framed(CompactHeader(MessageType::CALL, "first", 0) + empty_struct) +
+        Framed(CompactHeader(MessageType::CALL, "second", 0) + empty_struct);
+    session.Received(calls.data(), calls.size());
+    ASSERT_EQ(2, observer.started.size());
+
+    const std::string reply =
+        Framed(CompactHeader(MessageType::REPLY, "first", 0) + empty_struct);
+    session.Sent(reply.data(), reply.size());
+    ASSERT_EQ(1, observer.completed.size());
+    EXPECT_EQ("first", observer.completed[0].method);
+
+    // Calls without a reply are completed when the connection is closed
+    session.Close();
+    ASSERT_EQ(2, observer.completed.size());
+    EXPECT_EQ("second", observer.completed[1].method);
+}
+
+TEST(ThriftSession, BoundedCalls) {
+    RecordingObserver observer;
+    ThriftSession session{ThriftSession::Role::CLIENT, &observer};
+
+    for (size_t i = 0; i <= ThriftSession::MAX_CALLS; ++i) {
+        const std::string call =
+            BinaryHeader(MessageType::CALL, "add", i) + BinaryAddArgs();
+        session.Sent(call.data(), call.size());
+    }
+    // The oldest call is completed to make room for the last one
+    ASSERT_EQ(1, observer.completed.size());
+    EXPECT_EQ(0, observer.completed[0].seqid);
+
+    const std::string reply =
+        BinaryHeader(MessageType::REPLY, "add", ThriftSession::MAX_CALLS) +
+        std::string{"\x00", 1};
+    session.Received(reply.data(), reply.size());
+    ASSERT_EQ(2, observer.completed.size());
+    EXPECT_EQ(static_cast<int32_t>(ThriftSession::MAX_CALLS),
+              observer.completed[1].seqid);
+}
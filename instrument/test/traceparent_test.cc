@@ -0,0 +1,166 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "traceparent.h"
+
+using namespace microtrace;
+
+static std::string Header(const Context& context) {
+    char buf[Traceparent::HEADER_SIZE];
+    return std::string(buf, Traceparent::Format(context, buf));
+}
+
+TEST(Traceparent, Format) {
+    ContextStorage storage = ContextStorage::Zero();
+    storage.trace_id =
+        Uuid::FromParts(0x0af7651916cd43ddULL, 0x8448eb211c80319cULL);
+    storage.span_id =
+        Uuid::FromParts(0x1122334455667788ULL, 0xb7ad6b7169203331ULL);
+
+    EXPECT_EQ(
+        "traceparent: "
+        "00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01\r\n"
+        "tracestate: microtrace=1122334455667788\r\n",
+        Header(Context{storage}));
+}
+
+TEST(Traceparent, RoundTrip) {
+    const Context context;
+    const std::string request =
+        "GET /users HTTP/1.1\r\n" + Header(context) + "Host: a\r\n\r\n";
+
+    Context found{ContextStorage::Zero(), 0};
+    ASSERT_TRUE(Traceparent::Find(request.data(), request.size(), &found));
+    EXPECT_EQ(context.trace(), found.trace());
+    EXPECT_EQ(context.span(), found.span());
+    EXPECT_TRUE(found.sampled());
+}
+
+TEST(Traceparent, FromOtherTracers) {
+    // Header names are case insensitive, and tracestate may be missing
+    const std::string request =
+        "POST / HTTP/1.1\r\nHost: a\r\n"
+        "TraceParent: 00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-00"
+        "\r\n\r\n";
+
+    Context found{ContextStorage::Zero(), 0};
+    ASSERT_TRUE(Traceparent::Find(request.data(), request.size(), &found));
+    EXPECT_EQ(Uuid::FromParts(0x0af7651916cd43ddULL, 0x8448eb211c80319cULL),
+              found.trace());
+    EXPECT_EQ(Uuid::FromParts(0, 0xb7ad6b7169203331ULL), found.span());
+    EXPECT_FALSE(found.sampled());
+}
+
+TEST(Traceparent, NotFound) {
+    Context found{ContextStorage::Zero(), 0};
+    const std::vector<std::string> requests = {
+        "GET / HTTP/1.1\r\nHost: a\r\n\r\n",
+        // Only the head is searched
+        "GET / HTTP/1.1\r\n\r\ntraceparent: "
+        "00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01\r\n",
+        // Zero trace id
+        "GET / HTTP/1.1\r\ntraceparent: "
+        "00-00000000000000000000000000000000-b7ad6b7169203331-01\r\n\r\n",
+        // Upper case hex
+        "GET / HTTP/1.1\r\ntraceparent: "
+        "00-0AF7651916CD43DD8448EB211C80319C-B7AD6B7169203331-01\r\n\r\n",
+        // Cut off
+        "GET / HTTP/1.1\r\ntraceparent: 00-0af7651916cd43dd8448eb211c80319c",
+    };
+    for (const auto& request : requests) {
+        EXPECT_FALSE(Traceparent::Find(request.data(), request.size(), &found))
+            << request;
+    }
+}
+
+TEST(HasHeader, Found) {
+    static const char NAME[] = "X-Debug-Trace:";
+    const std::string request =
+        "GET / HTTP/1.1\r\nHost: a\r\nx-debug-trace: 1\r\n\r\n";
+    EXPECT_TRUE(HasHeader(request.data(), request.size(), NAME,
+                          sizeof(NAME) - 1));
+
+    // The head may be cut off by the end of the first read
+    const std::string partial = "GET / HTTP/1.1\r\nX-Debug-Trace: 1";
+    EXPECT_TRUE(HasHeader(partial.data(), partial.size(), NAME,
+                          sizeof(NAME) - 1));
+
+    const std::vector<std::string> requests = {
+        "GET / HTTP/1.1\r\nHost: a\r\n\r\n",
+        "GET /X-Debug-Trace: HTTP/1.1\r\n\r\n",
+        "GET / HTTP/1.1\r\n\r\nX-Debug-Trace: 1\r\n",
+        "GET / HTTP/1.1\r\nX-Debug-Trace-Id: 1\r\n\r\n",
+    };
+    for (const auto& request : requests) {
+        EXPECT_FALSE(HasHeader(request.data(), request.size(), NAME,
+                               sizeof(NAME) - 1))
+            << request;
+    }
+}
+
+/*
+ * Writes iov through splicer, at most limit bytes at a time, and returns what
+ * has been written.
+ */
+static std::string WriteAll(HeaderSplicer& splicer, const std::string& data,
+                            size_t limit) {
+    std::string written;
+    size_t offset = 0;
+    while (offset < data.size()) {
+        struct iovec iov = {const_cast<char*>(data.data()) + offset,
+                            data.size() - offset};
+        const auto& spliced = splicer.Splice(&iov, 1);
+
+        size_t left = limit;
+        for (const auto& part : spliced) {
+            const size_t len = std::min(left, part.iov_len);
+            written.append(static_cast<const char*>(part.iov_base), len);
+            left -= len;
+        }
+        const ssize_t ret = splicer.Written(limit - left);
+        EXPECT_GE(ret, 0);
+        offset += ret;
+    }
+    return written;
+}
+
+TEST(HeaderSplicer, AfterRequestLine) {
+    const std::string request = "GET / HTTP/1.1\r\nHost: a\r\n\r\n";
+    const std::string header = "traceparent: x\r\n";
+    const std::string expected =
+        "GET / HTTP/1.1\r\ntraceparent: x\r\nHost: a\r\n\r\n";
+
+    for (size_t limit = 1; limit <= expected.size(); ++limit) {
+        HeaderSplicer splicer;
+        splicer.Start(header.data(), header.size());
+        EXPECT_EQ(expected, WriteAll(splicer, request, limit)) << limit;
+        EXPECT_FALSE(splicer.active());
+    }
+}
+
+TEST(HeaderSplicer, RequestLineInPieces) {
+    const std::string header = "traceparent: x\r\n";
+    HeaderSplicer splicer;
+    splicer.Start(header.data(), header.size());
+
+    std::string written = WriteAll(splicer, "GET /lo", 100);
+    EXPECT_TRUE(splicer.active());
+    written += WriteAll(splicer, "ng HTTP/1.1\r\n", 100);
+    EXPECT_FALSE(splicer.active());
+    written += WriteAll(splicer, "\r\n", 100);
+
+    EXPECT_EQ("GET /long HTTP/1.1\r\ntraceparent: x\r\n\r\n", written);
+}
+
+TEST(HeaderSplicer, Idle) {
+    HeaderSplicer splicer;
+    EXPECT_FALSE(splicer.active());
+
+    struct iovec iov[2] = {{const_cast<char*>("a\n"), 2},
+                           {const_cast<char*>("b"), 1}};
+    EXPECT_EQ(2, splicer.Splice(iov, 2).size());
+    EXPECT_EQ(3, splicer.Written(3));
+    EXPECT_EQ(-1, splicer.Written(-1));
+}
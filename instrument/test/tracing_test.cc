@@ -2,6 +2,7 @@
 
 #include <arpa/inet.h>
 #include <assert.h>
+#include <dlfcn.h>
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
@@ -12,6 +13,7 @@
 
 #include "context.h"
 #include "test_util.h"
+#include "tracing.h"
 
 using namespace microtrace;
 using namespace fakeit;
@@ -31,6 +33,19 @@ int DUMP_SERVER_PORT = 7354;
 const char *const MSG = "aaaaaaaaaa";
 const int MSG_LEN = 10;
 
+/*
+ * std::thread goes through the pthread_create hook, which starts the thread
+ * with the function that the hook interposes.
+ */
+static int RealPthreadCreate(pthread_t *thread, const pthread_attr_t *attr,
+                             void *(*start_routine)(void *), void *arg) {
+    typedef int (*pthread_create_t)(pthread_t *, const pthread_attr_t *,
+                                    void *(*)(void *), void *);
+    static const auto create = reinterpret_cast<pthread_create_t>(
+        dlsym(RTLD_NEXT, "pthread_create"));
+    return create(thread, attr, start_routine, arg);
+}
+
 void CreateMock() {
     mock.Reset();
 
@@ -48,6 +63,7 @@ void CreateMock() {
         });
     When(Method(mock, connect)).AlwaysReturn(0);
     When(Method(mock, close)).AlwaysReturn(0);
+    When(Method(mock, pthread_create)).AlwaysDo(&RealPthreadCreate);
 
     orig_obj = &mock.get();
 }
@@ -349,7 +365,8 @@ TEST_F(TraceTest, ContextIsSentToInternalServices) {
             // Context is sent first
             Method(mock, write)
                 .Matching([dump_client](int fd, const void *buf, size_t count) {
-                    return fd == dump_client && count == sizeof(ContextStorage);
+                    return fd == dump_client &&
+                           count == Context::MAX_WIRE_SIZE;
                 }),
 
             // Next, the actual message
@@ -426,13 +443,22 @@ TEST_F(TraceTest, BackendServerReadsContext) {
     // Create a random context
     Context ctx;
 
+    char wire[Context::MAX_WIRE_SIZE];
+    ctx.Serialize(wire);
+
     // Set up read, so it first returns the context, and next the message
     When(Method(mock, read))
-        .Do([&ctx](int fd, void *buf, size_t count) {
-            std::memcpy(buf, (void *)&ctx.storage(), sizeof(ContextStorage));
+        .Do([&wire](int fd, void *buf, size_t count) {
+            std::memcpy(buf, wire, count);
             return count;
         })
         .Do([](int fd, void *buf, size_t count) { return count; });
+    // The server peeks at the flags byte before it reads the context
+    When(Method(mock, recv))
+        .AlwaysDo([&wire](int fd, void *buf, size_t len, int flags) {
+            std::memcpy(buf, wire, Context::FLAGS_WIRE_SIZE);
+            return static_cast<ssize_t>(Context::FLAGS_WIRE_SIZE);
+        });
     orig_obj = &mock.get();
 
     std::thread server_thread{[&ctx]() {
@@ -458,10 +484,11 @@ TEST_F(TraceTest, BackendServerReadsContext) {
         EXPECT_FALSE(first_context.is_zero());
 
         Verify(
-            // Verify that the context is read first
+            // Verify that the whole context is read first, with a single
+            // read since its flags byte was peeked at
             Method(mock, read)
                 .Matching([client](int fd, const void *buf, size_t count) {
-                    return fd == client && count == sizeof(ContextStorage);
+                    return fd == client && count == Context::MAX_WIRE_SIZE;
                 }),
 
             // Next, the actual message is read
@@ -483,6 +510,166 @@ TEST_F(TraceTest, BackendServerReadsContext) {
     server_thread.join();
 }
 
+/*
+ * In this test, a thread-per-connection server hands the connection it
+ * accepted to a new thread, which calls another service. We verify that the
+ * context of the request is sent with that call.
+ */
+TEST_F(TraceTest, ContextIsSentFromConnectionThread) {
+    putenv("MICROTRACE_SERVER_TYPE=backend");
+
+    Context ctx;
+
+    char wire[Context::MAX_WIRE_SIZE];
+    ctx.Serialize(wire);
+
+    When(Method(mock, read))
+        .Do([&wire](int fd, void *buf, size_t count) {
+            std::memcpy(buf, wire, count);
+            return count;
+        })
+        .Do([](int fd, void *buf, size_t count) { return count; });
+    When(Method(mock, recv))
+        .AlwaysDo([&wire](int fd, void *buf, size_t len, int flags) {
+            std::memcpy(buf, wire, Context::FLAGS_WIRE_SIZE);
+            return static_cast<ssize_t>(Context::FLAGS_WIRE_SIZE);
+        });
+
+    // Keep the context that is sent to the other service
+    Context sent{ContextStorage::Zero(), 0};
+    When(Method(mock, write))
+        .AlwaysDo([&sent](int fd, const void *buf, size_t count) {
+            if (count == Context::MAX_WIRE_SIZE) {
+                sent = Context::Deserialize(static_cast<const char *>(buf));
+            }
+            return count;
+        });
+    orig_obj = &mock.get();
+
+    std::thread server_thread{[&ctx, &sent]() {
+        int ret;
+
+        const int server = CreateServerSocket(SERVER_PORT);
+        ret = listen(server, 5);
+
+        // Accept client
+        struct sockaddr_in cli_addr;
+        socklen_t clilen = sizeof(cli_addr);
+        memset(&cli_addr, 0, sizeof(cli_addr));
+        const int client =
+            accept(server, (struct sockaddr *)&cli_addr, &clilen);
+        ASSERT_GT(client, -1);
+
+        // Read request
+        char buf[MSG_LEN];
+        ret = read(client, &buf, MSG_LEN);
+        const Context request_context = get_current_context();
+        EXPECT_TRUE(request_context.IsChildOf(ctx));
+
+        // The connection is served by a thread of its own, which starts with
+        // the context of the request
+        int dump_client = -1;
+        std::thread connection_thread{[&request_context, &dump_client]() {
+            ASSERT_FALSE(is_context_undefined());
+            EXPECT_EQ(request_context, get_current_context());
+
+            // Send request to an internal microservice
+            char request[MSG_LEN] = {'a', 'a', 'a', 'a', 'a',
+                                     'a', 'a', 'a', 'a', 'a'};
+            dump_client = CreateClientSocketIp("10.0.2.15", DUMP_SERVER_PORT);
+            EXPECT_EQ(MSG_LEN, write(dump_client, &request, MSG_LEN));
+        }};
+        connection_thread.join();
+
+        Verify(
+            // Context is sent first
+            Method(mock, write)
+                .Matching([dump_client](int fd, const void *buf, size_t count) {
+                    return fd == dump_client &&
+                           count == Context::MAX_WIRE_SIZE;
+                }),
+
+            // Next, the actual message
+            Method(mock, write)
+                .Matching([dump_client](int fd, const void *b, size_t count) {
+                    return fd == dump_client && count == MSG_LEN;
+                }))
+            .Exactly(Once);
+
+        // The context that was sent belongs to the trace of the request
+        EXPECT_TRUE(sent.sampled());
+        EXPECT_TRUE(Context::IsSameTrace(ctx, sent));
+
+        close(dump_client);
+        close(client);
+        close(server);
+    }};
+    server_thread.join();
+}
+
+/*
+ * In this test, we verify that backend servers only read the flags byte of
+ * unsampled requests, and don't start a new span for them.
+ */
+TEST_F(TraceTest, BackendServerReadsUnsampledContext) {
+    putenv("MICROTRACE_SERVER_TYPE=backend");
+
+    char wire[Context::MAX_WIRE_SIZE];
+    Context::Zero()->Serialize(wire);
+
+    When(Method(mock, read))
+        .Do([&wire](int fd, void *buf, size_t count) {
+            std::memcpy(buf, wire, count);
+            return count;
+        })
+        .Do([](int fd, void *buf, size_t count) { return count; });
+    When(Method(mock, recv))
+        .AlwaysDo([&wire](int fd, void *buf, size_t len, int flags) {
+            std::memcpy(buf, wire, Context::FLAGS_WIRE_SIZE);
+            return static_cast<ssize_t>(Context::FLAGS_WIRE_SIZE);
+        });
+    orig_obj = &mock.get();
+
+    std::thread server_thread{[]() {
+        int ret;
+
+        const int server = CreateServerSocket(SERVER_PORT);
+        ret = listen(server, 5);
+
+        struct sockaddr_in cli_addr;
+        socklen_t clilen = sizeof(cli_addr);
+        memset(&cli_addr, 0, sizeof(cli_addr));
+        const int client =
+            accept(server, (struct sockaddr *)&cli_addr, &clilen);
+        ASSERT_GT(client, -1);
+
+        char buf[MSG_LEN];
+
+        ret = read(client, &buf, MSG_LEN);
+        EXPECT_FALSE(is_context_undefined());
+        EXPECT_TRUE(get_current_context().is_zero());
+        EXPECT_FALSE(get_current_context().sampled());
+
+        Verify(
+            // Only the flags byte is read
+            Method(mock, read)
+                .Matching([client](int fd, const void *buf, size_t count) {
+                    return fd == client && count == Context::FLAGS_WIRE_SIZE;
+                }),
+
+            // Next, the actual message is read
+            Method(mock, read)
+                .Matching([client](int fd, const void *buf, size_t count) {
+                    return fd == client && count == MSG_LEN;
+                }))
+            .Exactly(Once);
+
+        VerifyNoOtherInvocations(Method(mock, read));
+
+    }};
+    server_thread.join();
+}
+
 /*
  * In this test we verify that frontend servers do not try to read the context
  * at the start of every new transaction.
@@ -526,3 +713,24 @@ TEST_F(TraceTest, FrontendServerDoesNotReadContext) {
     }};
     server_thread.join();
 }
+
+/*
+ * The overhead breaker is disabled unless a budget is set.
+ */
+TEST_F(TraceTest, Stats) {
+    struct microtrace_stats stats;
+    memset(&stats, 0xff, sizeof(stats));
+    microtrace_get_stats(&stats);
+
+    EXPECT_EQ(0, stats.overhead_level);
+    EXPECT_FALSE(stats.pass_through);
+    EXPECT_EQ(0u, stats.overhead_windows);
+    EXPECT_EQ(0u, stats.over_budget_windows);
+
+    // The counters of the export lanes are filled in as well
+    const uint64_t unset = UINT64_MAX;
+    EXPECT_NE(unset, stats.express.queued);
+    EXPECT_NE(unset, stats.express.dropped);
+    EXPECT_NE(unset, stats.normal.queued);
+    EXPECT_NE(unset, stats.normal.dropped);
+}
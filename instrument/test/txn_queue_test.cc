@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "txn_queue.h"
+
+using namespace microtrace;
+
+TEST(TxnQueue, Fifo) {
+    TxnQueue<int, 3> queue;
+    EXPECT_TRUE(queue.empty());
+
+    queue.push() = 1;
+    queue.push() = 2;
+    EXPECT_EQ(2, queue.size());
+    EXPECT_EQ(1, queue.front());
+    EXPECT_EQ(2, queue.back());
+
+    queue.pop();
+    EXPECT_EQ(2, queue.front());
+    EXPECT_EQ(2, queue.back());
+}
+
+TEST(TxnQueue, WrapsAround) {
+    TxnQueue<int, 3> queue;
+    for (int i = 0; i < 10; ++i) {
+        queue.push() = i;
+        if (queue.full()) {
+            EXPECT_EQ(i - 2, queue.front());
+            queue.pop();
+        }
+        EXPECT_EQ(i, queue.back());
+    }
+    EXPECT_EQ(2, queue.size());
+    EXPECT_EQ(8, queue.front());
+}
+
+TEST(TxnQueue, PopBack) {
+    TxnQueue<int, 3> queue;
+    queue.push() = 1;
+    queue.push() = 2;
+    queue.pop_back();
+    EXPECT_EQ(1, queue.size());
+    EXPECT_EQ(1, queue.back());
+
+    queue.push() = 3;
+    EXPECT_EQ(1, queue.front());
+    EXPECT_EQ(3, queue.back());
+}
+
+TEST(TxnQueue, ItemsAreReused) {
+    TxnQueue<std::string, 2> queue;
+    queue.push() = "first";
+    queue.pop();
+    queue.clear();
+
+    // The caller is responsible for resetting the item
+    EXPECT_EQ("first", queue.push());
+    EXPECT_FALSE(queue.empty());
+}
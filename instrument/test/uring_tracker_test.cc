@@ -0,0 +1,296 @@
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <liburing.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "uring_tracker.h"
+
+using namespace microtrace;
+
+class RecordingObserver : public UringTracker::Observer {
+   public:
+    bool OpSubmitted(const UringOp& op) override {
+        submitted.push_back(op);
+        return true;
+    }
+
+    void OpCompleted(const UringOp& op, int res) override {
+        completed.emplace_back(op, res);
+    }
+
+    std::vector<UringOp> submitted;
+    std::vector<std::pair<UringOp, int>> completed;
+};
+
+/*
+ * The rings of an io_uring instance as liburing sees them, written by the
+ * test instead of the kernel.
+ */
+class FakeRing {
+   public:
+    static const unsigned ENTRIES = 4;
+
+    FakeRing() {
+        memset(&ring, 0, sizeof(ring));
+        ring.sq.khead = &sq_khead_;
+        ring.sq.ktail = &sq_ktail_;
+        ring.sq.kring_mask = &mask_;
+        ring.sq.kring_entries = &entries_;
+        ring.sq.sqes = sqes_;
+        ring.cq.khead = &cq_head;
+        ring.cq.ktail = &cq_tail;
+        ring.cq.kring_mask = &mask_;
+        ring.cq.kring_entries = &entries_;
+        ring.cq.cqes = cqes_;
+    }
+
+    /*
+     * Queues an entry, like io_uring_get_sqe.
+     */
+    struct io_uring_sqe* GetSqe(const uint8_t opcode, const int fd,
+                                const uint64_t user_data) {
+        auto* sqe = &sqes_[ring.sq.sqe_tail++ & mask_];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->user_data = user_data;
+        return sqe;
+    }
+
+    /*
+     * Hands the queued entries to the kernel, like io_uring_submit.
+     */
+    void Flush() { ring.sq.sqe_head = ring.sq.sqe_tail; }
+
+    /*
+     * Posts a completion, like the kernel.
+     */
+    void Post(const uint64_t user_data, const int res,
+              const unsigned flags = 0) {
+        auto& cqe = cqes_[cq_tail & mask_];
+        cqe.user_data = user_data;
+        cqe.res = res;
+        cqe.flags = flags;
+        ++cq_tail;
+    }
+
+    struct io_uring ring;
+    unsigned cq_head = 0;
+    unsigned cq_tail = 0;
+
+   private:
+    unsigned mask_ = ENTRIES - 1;
+    unsigned entries_ = ENTRIES;
+    unsigned sq_khead_ = 0;
+    unsigned sq_ktail_ = 0;
+    struct io_uring_sqe sqes_[ENTRIES];
+    struct io_uring_cqe cqes_[ENTRIES];
+};
+
+TEST(UringTrackerTest, Decode) {
+    struct io_uring_sqe sqe;
+    UringOp op;
+    char buf[16];
+    struct iovec iov[2] = {{buf, 4}, {buf + 4, 12}};
+
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READV;
+    sqe.fd = 7;
+    sqe.addr = reinterpret_cast<uint64_t>(iov);
+    sqe.len = 2;
+    ASSERT_TRUE(UringTracker::Decode(sqe, &op));
+    EXPECT_EQ(UringOp::Kind::READ, op.kind);
+    EXPECT_EQ(7, op.fd);
+    ASSERT_EQ(2, op.iovcnt);
+    EXPECT_EQ(buf + 4, op.iov[1].iov_base);
+    EXPECT_EQ(12u, op.iov[1].iov_len);
+
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 1;
+    sqe.opcode = IORING_OP_SENDMSG;
+    sqe.addr = reinterpret_cast<uint64_t>(&msg);
+    ASSERT_TRUE(UringTracker::Decode(sqe, &op));
+    EXPECT_EQ(UringOp::Kind::WRITE, op.kind);
+    EXPECT_EQ(1, op.iovcnt);
+
+    // The buffers of a receive aren't known before it completes
+    sqe.opcode = IORING_OP_RECV;
+    sqe.addr = 0;
+    sqe.len = 100;
+    sqe.flags = IOSQE_BUFFER_SELECT;
+    ASSERT_TRUE(UringTracker::Decode(sqe, &op));
+    EXPECT_EQ(0, op.iovcnt);
+    EXPECT_EQ(nullptr, op.iov_data());
+
+    // Registered files are not sockets that can be looked up
+    sqe.flags = IOSQE_FIXED_FILE;
+    EXPECT_FALSE(UringTracker::Decode(sqe, &op));
+
+    sqe.flags = 0;
+    sqe.opcode = IORING_OP_NOP;
+    EXPECT_FALSE(UringTracker::Decode(sqe, &op));
+}
+
+TEST(UringTrackerTest, SubmitComplete) {
+    FakeRing fake;
+    RecordingObserver observer;
+    UringTracker tracker{&fake.ring, &observer};
+
+    char buf[16];
+    fake.GetSqe(IORING_OP_RECV, 5, 1)->addr = reinterpret_cast<uint64_t>(buf);
+    fake.GetSqe(IORING_OP_SEND, 6, 2);
+    tracker.Submitting(&fake.ring);
+    EXPECT_EQ(2u, observer.submitted.size());
+
+    // Entries that haven't been flushed yet are only read once
+    fake.GetSqe(IORING_OP_CLOSE, 6, 3);
+    tracker.Submitting(&fake.ring);
+    fake.Flush();
+    tracker.Submitting(&fake.ring);
+    ASSERT_EQ(3u, observer.submitted.size());
+    EXPECT_EQ(UringOp::Kind::CLOSE, observer.submitted[2].kind);
+    EXPECT_EQ(3u, tracker.pending());
+
+    fake.Post(2, -EPIPE);
+    fake.Post(1, 4);
+    fake.Post(42, 0);
+    tracker.Completing(&fake.ring);
+    ASSERT_EQ(2u, observer.completed.size());
+    EXPECT_EQ(6, observer.completed[0].first.fd);
+    EXPECT_EQ(-EPIPE, observer.completed[0].second);
+    EXPECT_EQ(buf, observer.completed[1].first.iov[0].iov_base);
+    EXPECT_EQ(4, observer.completed[1].second);
+    EXPECT_EQ(1u, tracker.pending());
+
+    // Completions are only read once
+    tracker.Completing(&fake.ring);
+    EXPECT_EQ(2u, observer.completed.size());
+}
+
+TEST(UringTrackerTest, Multishot) {
+    FakeRing fake;
+    RecordingObserver observer;
+    UringTracker tracker{&fake.ring, &observer};
+
+    fake.GetSqe(IORING_OP_ACCEPT, 3, 1);
+    tracker.Submitting(&fake.ring);
+    fake.Flush();
+
+    fake.Post(1, 10, IORING_CQE_F_MORE);
+    fake.Post(1, 11, IORING_CQE_F_MORE);
+    tracker.Completing(&fake.ring);
+    EXPECT_EQ(2u, observer.completed.size());
+    EXPECT_EQ(1u, tracker.pending());
+
+    fake.Post(1, -ECANCELED);
+    tracker.Completing(&fake.ring);
+    EXPECT_EQ(3u, observer.completed.size());
+    EXPECT_EQ(0u, tracker.pending());
+}
+
+TEST(UringTrackerTest, ReusedCompletions) {
+    FakeRing fake;
+    RecordingObserver observer;
+    UringTracker tracker{&fake.ring, &observer};
+
+    for (uint64_t i = 1; i <= 6; ++i) {
+        fake.GetSqe(IORING_OP_SEND, 5, i);
+        tracker.Submitting(&fake.ring);
+        fake.Flush();
+    }
+
+    // The application consumes every completion without calling liburing,
+    // so the kernel reuses the entries of the first two, and may be writing
+    // the next one over the third
+    for (uint64_t i = 1; i <= 6; ++i) {
+        fake.Post(i, 1);
+        fake.cq_head = fake.cq_tail;
+    }
+    tracker.Completing(&fake.ring);
+    EXPECT_EQ(3u, observer.completed.size());
+    EXPECT_EQ(3u, tracker.pending());
+}
+
+/*
+ * A loopback server whose accept, receive and send go through io_uring.
+ */
+TEST(UringTrackerTest, Loopback) {
+    const int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrlen = sizeof(addr);
+    ASSERT_EQ(0, bind(listener, reinterpret_cast<sockaddr*>(&addr), addrlen));
+    ASSERT_EQ(0, listen(listener, 1));
+    ASSERT_EQ(0, getsockname(listener, reinterpret_cast<sockaddr*>(&addr),
+                             &addrlen));
+
+    struct io_uring ring;
+    ASSERT_EQ(0, io_uring_queue_init(8, &ring, 0));
+    RecordingObserver observer;
+    UringTracker tracker{&ring, &observer};
+
+    auto submit = [&]() {
+        tracker.Completing(&ring);
+        tracker.Submitting(&ring);
+        EXPECT_EQ(1, io_uring_submit(&ring));
+    };
+    auto wait = [&]() {
+        struct io_uring_cqe* cqe;
+        EXPECT_EQ(0, io_uring_wait_cqe(&ring, &cqe));
+        tracker.Completing(&ring);
+        const int res = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+        return res;
+    };
+
+    auto* sqe = io_uring_get_sqe(&ring);
+    io_uring_prep_accept(sqe, listener, nullptr, nullptr, 0);
+    io_uring_sqe_set_data64(sqe, 1);
+    submit();
+    const int client = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_EQ(0, connect(client, reinterpret_cast<sockaddr*>(&addr), addrlen));
+    const int conn = wait();
+    ASSERT_GE(conn, 0);
+
+    char buf[64];
+    sqe = io_uring_get_sqe(&ring);
+    io_uring_prep_recv(sqe, conn, buf, sizeof(buf), 0);
+    io_uring_sqe_set_data64(sqe, 2);
+    submit();
+    ASSERT_EQ(4, write(client, "ping", 4));
+    EXPECT_EQ(4, wait());
+
+    sqe = io_uring_get_sqe(&ring);
+    io_uring_prep_send(sqe, conn, "pong", 4, 0);
+    io_uring_sqe_set_data64(sqe, 3);
+    submit();
+    EXPECT_EQ(4, wait());
+    char reply[4];
+    ASSERT_EQ(4, read(client, reply, sizeof(reply)));
+    EXPECT_EQ("pong", std::string(reply, sizeof(reply)));
+
+    ASSERT_EQ(3u, observer.completed.size());
+    EXPECT_EQ(UringOp::Kind::ACCEPT, observer.completed[0].first.kind);
+    EXPECT_EQ(conn, observer.completed[0].second);
+    const UringOp& recv = observer.completed[1].first;
+    EXPECT_EQ(UringOp::Kind::READ, recv.kind);
+    EXPECT_EQ(conn, recv.fd);
+    const auto* received = static_cast<const char*>(recv.iov[0].iov_base);
+    EXPECT_EQ("ping", std::string(received, observer.completed[1].second));
+    EXPECT_EQ(UringOp::Kind::WRITE, observer.completed[2].first.kind);
+    EXPECT_EQ(0u, tracker.pending());
+
+    io_uring_queue_exit(&ring);
+    close(client);
+    close(conn);
+    close(listener);
+}
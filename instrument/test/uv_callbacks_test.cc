@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "context.h"
+#include "uv_callbacks.h"
+
+using namespace microtrace;
+
+static Context called_context{ContextStorage::Zero(), 0};
+static int called_status = 0;
+static int calls = 0;
+
+static void OnWrite(uv_write_t* req, int status) {
+    called_context = get_current_context();
+    called_status = status;
+    ++calls;
+}
+
+static void OnWork(uv_work_t* req) {
+    called_context = get_current_context();
+    ++calls;
+}
+
+static void OnTimer(uv_timer_t* timer) {
+    called_context = get_current_context();
+    ++calls;
+}
+
+class UvCallbacksTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        calls = 0;
+        set_current_context(context);
+    }
+
+    void TearDown() override {
+        EXPECT_EQ(UvCallbackPool::SIZE, uv_callbacks().available());
+    }
+
+    const Context context;
+};
+
+TEST_F(UvCallbacksTest, Request) {
+    uv_write_t req;
+    uv_write_cb cb = &OnWrite;
+    ASSERT_NE(nullptr, WrapUvRequestCallback(&req, &cb));
+    EXPECT_NE(&OnWrite, cb);
+    EXPECT_EQ(UvCallbackPool::SIZE - 1, uv_callbacks().available());
+
+    set_current_context(Context{});
+    cb(&req, -32);
+    EXPECT_EQ(1, calls);
+    EXPECT_EQ(-32, called_status);
+    EXPECT_EQ(context, called_context);
+    EXPECT_EQ(context, get_current_context());
+}
+
+TEST_F(UvCallbacksTest, Unwrapped) {
+    uv_write_t req;
+    uv_write_cb cb = nullptr;
+    EXPECT_EQ(nullptr, WrapUvRequestCallback(&req, &cb));
+    EXPECT_EQ(nullptr, cb);
+
+    // A thread starts without a context
+    cb = &OnWrite;
+    std::thread thread{
+        [&]() { EXPECT_EQ(nullptr, WrapUvRequestCallback(&req, &cb)); }};
+    thread.join();
+    EXPECT_EQ(&OnWrite, cb);
+}
+
+TEST_F(UvCallbacksTest, Work) {
+    uv_work_t req;
+    uv_work_cb work_cb = &OnWork;
+    uv_after_work_cb after_work_cb = nullptr;
+    UvCallback* wrap = TakeUvCallback(&req, 1);
+    ASSERT_NE(nullptr, wrap);
+    WrapUvCallback<0>(wrap, &work_cb);
+    WrapUvCallback<1>(wrap, &after_work_cb);
+
+    std::thread thread{[&]() { work_cb(&req); }};
+    thread.join();
+    EXPECT_EQ(1, calls);
+    EXPECT_EQ(context, called_context);
+    EXPECT_EQ(UvCallbackPool::SIZE - 1, uv_callbacks().available());
+
+    // Not passing after_work_cb to libuv would leak wrap
+    ASSERT_NE(nullptr, after_work_cb);
+    after_work_cb(&req, 0);
+    EXPECT_EQ(1, calls);
+}
+
+TEST_F(UvCallbacksTest, Timer) {
+    uv_timer_t timer;
+    memset(&timer, 0xab, sizeof(timer));
+    EXPECT_EQ(nullptr, FindUvCallback(&timer));
+
+    uv_timer_cb cb = &OnTimer;
+    UvCallback* wrap = TakeUvCallback(&timer, UvCallback::REPEATED);
+    ASSERT_NE(nullptr, wrap);
+    WrapUvCallback<0>(wrap, &cb);
+    EXPECT_EQ(wrap, FindUvCallback(&timer));
+
+    set_current_context(Context{});
+    cb(&timer);
+    cb(&timer);
+    EXPECT_EQ(2, calls);
+    EXPECT_EQ(context, called_context);
+
+    // Another timer that got the same field doesn't own it
+    uv_timer_t other;
+    UvCallbackField(&other) = UvCallbackField(&timer);
+    EXPECT_EQ(nullptr, FindUvCallback(&other));
+
+    GiveUvCallback(&timer);
+    EXPECT_EQ(nullptr, FindUvCallback(&timer));
+}
+
+TEST_F(UvCallbacksTest, Exhausted) {
+    std::vector<uv_write_t> reqs(UvCallbackPool::SIZE + 1);
+    std::vector<UvCallback*> wraps;
+    for (auto& req : reqs) {
+        wraps.push_back(TakeUvCallback(&req, 0));
+    }
+    EXPECT_EQ(nullptr, wraps.back());
+    wraps.pop_back();
+
+    for (UvCallback* wrap : wraps) {
+        ASSERT_NE(nullptr, wrap);
+        uv_callbacks().Give(wrap);
+    }
+}
@@ -0,0 +1,41 @@
+#include "thread_start.h"
+
+namespace microtrace {
+
+const size_t ThreadStartPool::SIZE;
+
+ThreadStart* ThreadStartPool::Take(void* (*start_routine)(void*), void* arg,
+                                   const Context& context) {
+    ThreadStart* start = starts_.Take();
+    if (start != nullptr) {
+        start->pooled = true;
+    } else {
+        start = new ThreadStart;
+        start->pooled = false;
+    }
+
+    start->pool = this;
+    start->start_routine = start_routine;
+    start->arg = arg;
+    start->context = context;
+    return start;
+}
+
+void ThreadStartPool::Give(ThreadStart* start) {
+    if (start->pooled) {
+        starts_.Give(start);
+    } else {
+        delete start;
+    }
+}
+
+void* ThreadStartPool::Run(void* arg) {
+    auto* start = static_cast<ThreadStart*>(arg);
+    void* (*start_routine)(void*) = start->start_routine;
+    void* const routine_arg = start->arg;
+    set_current_context(start->context);
+    start->pool->Give(start);
+
+    return start_routine(routine_arg);
+}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "context.h"
+#include "fixed_pool.h"
+
+namespace microtrace {
+
+class ThreadStartPool;
+
+/*
+ * The start routine of a thread with its argument, and the context of the
+ * thread that created it.
+ */
+struct ThreadStart {
+    ThreadStart() : context(ContextStorage::Zero(), 0) {}
+
+    ThreadStartPool* pool = nullptr;
+
+    /*
+     * False if the start was allocated because the pool was exhausted.
+     */
+    bool pooled = false;
+
+    void* (*start_routine)(void*) = nullptr;
+    void* arg = nullptr;
+    Context context;
+};
+
+/*
+ * ThreadStartPool hands the current context of a thread over to the threads
+ * it creates, which start with ThreadStartPool::Run and a ThreadStart as their
+ * argument.
+ *
+ * The starts are kept in a fixed pool so that creating a thread doesn't
+ * allocate, unless more than SIZE threads are being started at once. A start
+ * is given back as soon as the new thread runs.
+ */
+class ThreadStartPool {
+   public:
+    static const size_t SIZE = 64;
+
+    ThreadStartPool() = default;
+
+    ThreadStartPool(const ThreadStartPool&) = delete;
+
+    /*
+     * Returns the start of a thread that runs start_routine(arg) with context
+     * as its current context.
+     */
+    ThreadStart* Take(void* (*start_routine)(void*), void* arg,
+                      const Context& context);
+
+    /*
+     * Gives start back, called by Run, or if the thread couldn't be created.
+     */
+    void Give(ThreadStart* start);
+
+    /*
+     * The start routine of threads created with a ThreadStart as argument.
+     */
+    static void* Run(void* start);
+
+    /*
+     * Returns the number of starts left in the pool.
+     */
+    size_t available() const { return starts_.available(); }
+
+   private:
+    FixedPool<ThreadStart, SIZE> starts_;
+};
+}
@@ -0,0 +1,145 @@
+#include "thrift_session.h"
+
+namespace microtrace {
+
+const size_t ThriftSession::MAX_CALLS;
+
+ThriftSession::ThriftSession(const Role role, Observer* observer)
+    : role_(role),
+      observer_(observer),
+      request_call_(nullptr),
+      reply_call_(nullptr),
+      next_order_(0) {}
+
+void ThriftSession::Sent(const char* buf, size_t len) {
+    if (role_ == Role::CLIENT) {
+        ProcessRequests(buf, len);
+    } else {
+        ProcessReplies(buf, len);
+    }
+}
+
+void ThriftSession::Received(const char* buf, size_t len) {
+    if (role_ == Role::CLIENT) {
+        ProcessReplies(buf, len);
+    } else {
+        ProcessRequests(buf, len);
+    }
+}
+
+void ThriftSession::Close() {
+    // Complete the calls in the order they were made
+    ThriftCall* oldest;
+    do {
+        oldest = nullptr;
+        for (auto& call : calls_) {
+            if (call.active && (!oldest || call.order < oldest->order)) {
+                oldest = &call;
+            }
+        }
+        if (oldest) {
+            Complete(oldest);
+        }
+    } while (oldest);
+    request_call_ = nullptr;
+    reply_call_ = nullptr;
+}
+
+void ThriftSession::ProcessRequests(const char* buf, size_t len) {
+    while (len > 0 && requests_.valid()) {
+        const bool header_complete = requests_.header_complete();
+        const size_t processed = requests_.Process(buf, len);
+        if (!header_complete && requests_.header_complete()) {
+            request_call_ = StartCall();
+        }
+
+        if (requests_.complete()) {
+            // Oneway calls have no reply
+            if (request_call_ && requests_.message_type() ==
+                                     ThriftTracker::MessageType::ONEWAY) {
+                Complete(request_call_);
+            }
+            request_call_ = nullptr;
+            requests_.Reset();
+        }
+        buf += processed;
+        len -= processed;
+    }
+}
+
+void ThriftSession::ProcessReplies(const char* buf, size_t len) {
+    while (len > 0 && replies_.valid()) {
+        const bool header_complete = replies_.header_complete();
+        const size_t processed = replies_.Process(buf, len);
+        if (!header_complete && replies_.header_complete()) {
+            reply_call_ = Find(replies_.seqid());
+        }
+
+        if (replies_.complete()) {
+            if (reply_call_) {
+                reply_call_->error = replies_.message_type() ==
+                                     ThriftTracker::MessageType::EXCEPTION;
+                Complete(reply_call_);
+                reply_call_ = nullptr;
+            }
+            replies_.Reset();
+        }
+        buf += processed;
+        len -= processed;
+    }
+}
+
+ThriftCall* ThriftSession::StartCall() {
+    if (requests_.message_type() != ThriftTracker::MessageType::CALL &&
+        requests_.message_type() != ThriftTracker::MessageType::ONEWAY) {
+        return nullptr;
+    }
+
+    ThriftCall* slot = nullptr;
+    ThriftCall* oldest = nullptr;
+    for (auto& call : calls_) {
+        if (!call.active) {
+            slot = &call;
+            break;
+        }
+        if (!oldest || call.order < oldest->order) {
+            oldest = &call;
+        }
+    }
+    // A call whose reply never comes would otherwise keep every following
+    // call from being traced
+    if (!slot) {
+        if (oldest == reply_call_) {
+            reply_call_ = nullptr;
+        }
+        Complete(oldest);
+        slot = oldest;
+    }
+
+    slot->active = true;
+    slot->order = next_order_++;
+    slot->seqid = requests_.seqid();
+    slot->method = requests_.name();
+    slot->txn.Start();
+    slot->error = false;
+    observer_->CallStarted(slot);
+    return slot;
+}
+
+ThriftCall* ThriftSession::Find(const int32_t seqid) {
+    ThriftCall* oldest = nullptr;
+    for (auto& call : calls_) {
+        if (call.active && call.seqid == seqid &&
+            (!oldest || call.order < oldest->order)) {
+            oldest = &call;
+        }
+    }
+    return oldest;
+}
+
+void ThriftSession::Complete(ThriftCall* call) {
+    call->txn.End();
+    observer_->CallCompleted(*call);
+    call->active = false;
+}
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "context.h"
+#include "socket_handler.h"
+#include "thrift_tracker.h"
+
+namespace microtrace {
+
+/*
+ * A call of a Thrift connection, i.e. a request and its reply.
+ */
+struct ThriftCall {
+    /*
+     * Returns the info logged with the span, e.g. Thrift: add
+     */
+    std::string info() const { return "Thrift: " + method; }
+
+    /*
+     * Indicates if the slot holds a call whose reply hasn't been processed
+     * yet.
+     */
+    bool active = false;
+
+    /*
+     * Calls are started in increasing order, it tells apart calls with the
+     * same seqid.
+     */
+    uint64_t order = 0;
+
+    int32_t seqid = 0;
+    std::string method;
+
+    Transaction txn;
+    bool sampled = false;
+
+    /*
+     * Starts from zero because the default constructor would generate random
+     * uuids.
+     */
+    Context context{ContextStorage::Zero(), 0};
+
+    /*
+     * Indicates if the reply is an exception.
+     */
+    bool error = false;
+};
+
+/*
+ * Follows the calls of a Thrift connection. Replies are matched to calls by
+ * their seqid, so clients that have more than one call in flight, and servers
+ * that reply out of order, are timed correctly. Calls with the same seqid are
+ * matched in the order they were made.
+ *
+ * At most MAX_CALLS calls are followed at the same time, the oldest one is
+ * completed early if a new one doesn't fit.
+ */
+class ThriftSession {
+   public:
+    /*
+     * Indicates which end of the connection we are.
+     */
+    enum class Role { CLIENT, SERVER };
+
+    class Observer {
+       public:
+        virtual ~Observer() = default;
+
+        /*
+         * Called when the header of a new call has been sent or received, it
+         * should decide if the call is sampled, and set its context.
+         */
+        virtual void CallStarted(ThriftCall* call) = 0;
+
+        /*
+         * Called when the reply of a call has ended, or when a oneway call
+         * has been sent or received.
+         */
+        virtual void CallCompleted(const ThriftCall& call) = 0;
+    };
+
+    static const size_t MAX_CALLS = 32;
+
+    ThriftSession(const Role role, Observer* observer);
+
+    /*
+     * Processes data written to the connection.
+     */
+    void Sent(const char* buf, size_t len);
+
+    /*
+     * Processes data read from the connection.
+     */
+    void Received(const char* buf, size_t len);
+
+    /*
+     * Completes the calls that are still in flight, called when the
+     * connection is closed.
+     */
+    void Close();
+
+    /*
+     * Returns false if the connection turned out not to be Thrift.
+     */
+    bool valid() const { return requests_.valid() && replies_.valid(); }
+
+   private:
+    void ProcessRequests(const char* buf, size_t len);
+    void ProcessReplies(const char* buf, size_t len);
+
+    /*
+     * Adds a call for the request whose header has just been processed.
+     */
+    ThriftCall* StartCall();
+
+    /*
+     * Returns the oldest call in flight with seqid, or nullptr.
+     */
+    ThriftCall* Find(const int32_t seqid);
+
+    void Complete(ThriftCall* call);
+
+    const Role role_;
+    Observer* const observer_;
+
+    ThriftTracker requests_;
+    ThriftTracker replies_;
+
+    /*
+     * The calls whose request and reply are being processed, nullptr if they
+     * aren't followed.
+     */
+    ThriftCall* request_call_;
+    ThriftCall* reply_call_;
+
+    uint64_t next_order_;
+
+    std::array<ThriftCall, MAX_CALLS> calls_;
+};
+}
@@ -0,0 +1,491 @@
+#include "thrift_tracker.h"
+
+#include <string.h>
+#include <algorithm>
+
+namespace microtrace {
+
+const size_t ThriftTracker::MAX_NAME_LEN;
+const size_t ThriftTracker::MAX_DEPTH;
+
+// First byte of strict binary messages, and the protocol id of compact ones
+static const uint8_t BINARY_PROTOCOL_ID = 0x80;
+static const uint8_t COMPACT_PROTOCOL_ID = 0x82;
+
+static const uint8_t BINARY_VERSION_1 = 0x01;
+static const uint8_t COMPACT_VERSION_1 = 0x01;
+
+// Types of the binary protocol
+static const uint8_t T_STOP = 0;
+static const uint8_t T_BOOL = 2;
+static const uint8_t T_BYTE = 3;
+static const uint8_t T_DOUBLE = 4;
+static const uint8_t T_I16 = 6;
+static const uint8_t T_I32 = 8;
+static const uint8_t T_I64 = 10;
+static const uint8_t T_STRING = 11;
+static const uint8_t T_STRUCT = 12;
+static const uint8_t T_MAP = 13;
+static const uint8_t T_SET = 14;
+static const uint8_t T_LIST = 15;
+static const uint8_t T_UUID = 16;
+
+// Types of the compact protocol
+static const uint8_t C_BOOLEAN_TRUE = 1;
+static const uint8_t C_BOOLEAN_FALSE = 2;
+static const uint8_t C_BYTE = 3;
+static const uint8_t C_I16 = 4;
+static const uint8_t C_I32 = 5;
+static const uint8_t C_I64 = 6;
+static const uint8_t C_DOUBLE = 7;
+static const uint8_t C_BINARY = 8;
+static const uint8_t C_LIST = 9;
+static const uint8_t C_SET = 10;
+static const uint8_t C_MAP = 11;
+static const uint8_t C_STRUCT = 12;
+static const uint8_t C_UUID = 13;
+
+static bool ValidMessageType(const uint8_t type) {
+    return type >= static_cast<uint8_t>(ThriftTracker::MessageType::CALL) &&
+           type <= static_cast<uint8_t>(ThriftTracker::MessageType::ONEWAY);
+}
+
+/*
+ * Returns true if buf starts with an unframed message header.
+ */
+static bool StartsWithUnframedMessage(const uint8_t* buf, size_t len) {
+    if (len >= 4 && buf[0] == BINARY_PROTOCOL_ID &&
+        buf[1] == BINARY_VERSION_1 && buf[2] == 0) {
+        return ValidMessageType(buf[3]);
+    }
+    if (len >= 2 && buf[0] == COMPACT_PROTOCOL_ID &&
+        (buf[1] & 0x1f) == COMPACT_VERSION_1) {
+        return ValidMessageType(buf[1] >> 5);
+    }
+    return false;
+}
+
+bool ThriftTracker::StartsWithMessage(const char* buf, size_t len) {
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(buf);
+    if (StartsWithUnframedMessage(data, len)) {
+        return true;
+    }
+    // Frame size, which is positive
+    return len > 4 && data[0] < 0x80 &&
+           (data[0] | data[1] | data[2] | data[3]) != 0 &&
+           StartsWithUnframedMessage(data + 4, len - 4);
+}
+
+ThriftTracker::ThriftTracker() { Reset(); }
+
+void ThriftTracker::Reset() {
+    framed_ = false;
+    compact_ = false;
+    frame_size_ = 0;
+    message_read_ = 0;
+    depth_ = 0;
+    header_complete_ = false;
+    message_type_ = MessageType::NONE;
+    name_.clear();
+    seqid_ = 0;
+    ReadFixed(Token::FIRST_BYTE, 1);
+}
+
+void ThriftTracker::ReadFixed(const Token token, const size_t len) {
+    token_ = token;
+    read_ = Read::FIXED;
+    scratch_len_ = 0;
+    scratch_need_ = len;
+}
+
+void ThriftTracker::ReadVarint(const Token token) {
+    token_ = token;
+    read_ = Read::VARINT;
+    varint_ = 0;
+    varint_shift_ = 0;
+}
+
+void ThriftTracker::ReadName(const size_t len) {
+    token_ = Token::NAME;
+    read_ = Read::NAME;
+    remaining_ = len;
+}
+
+void ThriftTracker::Skip(const Token token, const uint64_t len) {
+    token_ = token;
+    read_ = Read::SKIP;
+    remaining_ = len;
+}
+
+uint32_t ThriftTracker::ReadUint32(const size_t offset) const {
+    return (static_cast<uint32_t>(scratch_[offset]) << 24) |
+           (static_cast<uint32_t>(scratch_[offset + 1]) << 16) |
+           (static_cast<uint32_t>(scratch_[offset + 2]) << 8) |
+           scratch_[offset + 3];
+}
+
+size_t ThriftTracker::Process(const char* buf, size_t len) {
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(buf);
+    size_t processed = 0;
+
+    // Tokens of zero length complete without any data
+    while (valid() && !complete()) {
+        const size_t left = len - processed;
+        size_t count = 0;
+        bool done = false;
+
+        switch (read_) {
+            case Read::FIXED:
+                count = std::min(left, scratch_need_ - scratch_len_);
+                memcpy(scratch_.data() + scratch_len_, data + processed, count);
+                scratch_len_ += count;
+                done = scratch_len_ == scratch_need_;
+                break;
+            case Read::VARINT:
+                while (count < left && !done) {
+                    const uint8_t byte = data[processed + count];
+                    ++count;
+                    varint_ |= static_cast<uint64_t>(byte & 0x7f)
+                               << varint_shift_;
+                    varint_shift_ += 7;
+                    if (!(byte & 0x80)) {
+                        done = true;
+                    } else if (varint_shift_ >= 64) {
+                        token_ = Token::INVALID;
+                        return processed + count;
+                    }
+                }
+                break;
+            case Read::NAME:
+                count = std::min<uint64_t>(left, remaining_);
+                name_.append(buf + processed, count);
+                remaining_ -= count;
+                done = remaining_ == 0;
+                break;
+            case Read::SKIP:
+                count = std::min<uint64_t>(left, remaining_);
+                remaining_ -= count;
+                done = remaining_ == 0;
+                break;
+        }
+
+        processed += count;
+        message_read_ += count;
+        if (!done) {
+            break;
+        }
+        TokenDone();
+    }
+    return processed;
+}
+
+void ThriftTracker::TokenDone() {
+    switch (token_) {
+        case Token::FIRST_BYTE:
+            if (scratch_[0] == BINARY_PROTOCOL_ID) {
+                ReadFixed(Token::BINARY_VERSION, 3);
+            } else if (scratch_[0] == COMPACT_PROTOCOL_ID) {
+                compact_ = true;
+                ReadFixed(Token::COMPACT_TYPE, 1);
+            } else if (scratch_[0] < 0x80) {
+                // The first byte of the frame size
+                framed_ = true;
+                frame_size_ = scratch_[0];
+                ReadFixed(Token::FRAME_SIZE, 3);
+            } else {
+                token_ = Token::INVALID;
+            }
+            break;
+        case Token::FRAME_SIZE:
+            frame_size_ = (frame_size_ << 24) |
+                          (static_cast<uint32_t>(scratch_[0]) << 16) |
+                          (static_cast<uint32_t>(scratch_[1]) << 8) |
+                          scratch_[2];
+            ReadFixed(Token::PROTOCOL_ID, 1);
+            break;
+        case Token::PROTOCOL_ID:
+            if (scratch_[0] == BINARY_PROTOCOL_ID) {
+                ReadFixed(Token::BINARY_VERSION, 3);
+            } else if (scratch_[0] == COMPACT_PROTOCOL_ID) {
+                compact_ = true;
+                ReadFixed(Token::COMPACT_TYPE, 1);
+            } else {
+                token_ = Token::INVALID;
+            }
+            break;
+        case Token::BINARY_VERSION:
+            if (scratch_[0] != BINARY_VERSION_1 || scratch_[1] != 0 ||
+                !ValidMessageType(scratch_[2])) {
+                token_ = Token::INVALID;
+                break;
+            }
+            message_type_ = static_cast<MessageType>(scratch_[2]);
+            ReadFixed(Token::BINARY_NAME_LEN, 4);
+            break;
+        case Token::BINARY_NAME_LEN: {
+            const uint32_t len = ReadUint32(0);
+            if (len > MAX_NAME_LEN) {
+                token_ = Token::INVALID;
+                break;
+            }
+            ReadName(len);
+            break;
+        }
+        case Token::NAME:
+            if (compact_) {
+                HeaderDone();
+            } else {
+                ReadFixed(Token::BINARY_SEQID, 4);
+            }
+            break;
+        case Token::BINARY_SEQID:
+            seqid_ = static_cast<int32_t>(ReadUint32(0));
+            HeaderDone();
+            break;
+        case Token::COMPACT_TYPE:
+            if ((scratch_[0] & 0x1f) != COMPACT_VERSION_1 ||
+                !ValidMessageType(scratch_[0] >> 5)) {
+                token_ = Token::INVALID;
+                break;
+            }
+            message_type_ = static_cast<MessageType>(scratch_[0] >> 5);
+            ReadVarint(Token::COMPACT_SEQID);
+            break;
+        case Token::COMPACT_SEQID:
+            seqid_ = static_cast<int32_t>(varint_);
+            ReadVarint(Token::COMPACT_NAME_LEN);
+            break;
+        case Token::COMPACT_NAME_LEN:
+            if (varint_ > MAX_NAME_LEN) {
+                token_ = Token::INVALID;
+                break;
+            }
+            ReadName(varint_);
+            break;
+        case Token::FRAME_BODY:
+            token_ = Token::DONE;
+            break;
+        case Token::FIELD_TYPE: {
+            const uint8_t byte = scratch_[0];
+            if (byte == T_STOP) {
+                --depth_;
+                ValueDone();
+            } else if (!compact_) {
+                pending_type_ = byte;
+                ReadFixed(Token::FIELD_ID, 2);
+            } else if ((byte >> 4) == 0) {
+                // The field id is not a delta, but a varint of its own
+                pending_type_ = byte & 0x0f;
+                ReadVarint(Token::FIELD_ID);
+            } else {
+                BeginValue(byte & 0x0f);
+            }
+            break;
+        }
+        case Token::FIELD_ID:
+            BeginValue(pending_type_);
+            break;
+        case Token::VALUE:
+            ValueDone();
+            break;
+        case Token::STRING_LEN:
+            if (compact_) {
+                Skip(Token::VALUE, varint_);
+            } else if (ReadUint32(0) & 0x80000000) {
+                token_ = Token::INVALID;
+            } else {
+                Skip(Token::VALUE, ReadUint32(0));
+            }
+            break;
+        case Token::LIST_HEADER:
+            if (!compact_) {
+                if (ReadUint32(1) & 0x80000000) {
+                    token_ = Token::INVALID;
+                    break;
+                }
+                PushContainer(scratch_[0], scratch_[0], ReadUint32(1));
+            } else if ((scratch_[0] >> 4) == 0x0f) {
+                // Long lists have their size in a varint
+                pending_type_ = scratch_[0] & 0x0f;
+                ReadVarint(Token::LIST_SIZE);
+            } else {
+                PushContainer(scratch_[0] & 0x0f, scratch_[0] & 0x0f,
+                              scratch_[0] >> 4);
+            }
+            break;
+        case Token::LIST_SIZE:
+            PushContainer(pending_type_, pending_type_, varint_);
+            break;
+        case Token::MAP_HEADER:
+            if (!compact_) {
+                if (ReadUint32(2) & 0x80000000) {
+                    token_ = Token::INVALID;
+                    break;
+                }
+                PushContainer(scratch_[0], scratch_[1],
+                              2 * static_cast<uint64_t>(ReadUint32(2)));
+            } else if (varint_ == 0) {
+                // Empty maps have no key and value types
+                ValueDone();
+            } else if (varint_ > UINT32_MAX) {
+                token_ = Token::INVALID;
+            } else {
+                pending_size_ = varint_;
+                ReadFixed(Token::MAP_TYPES, 1);
+            }
+            break;
+        case Token::MAP_TYPES:
+            PushContainer(scratch_[0] >> 4, scratch_[0] & 0x0f,
+                          2 * pending_size_);
+            break;
+        case Token::DONE:
+        case Token::INVALID:
+            break;
+    }
+}
+
+void ThriftTracker::HeaderDone() {
+    header_complete_ = true;
+
+    if (framed_) {
+        // The frame size doesn't include itself
+        const uint64_t header_len = message_read_ - 4;
+        if (header_len > frame_size_) {
+            token_ = Token::INVALID;
+            return;
+        }
+        Skip(Token::FRAME_BODY, frame_size_ - header_len);
+        return;
+    }
+    // The arguments or the result of the call
+    PushStruct();
+}
+
+void ThriftTracker::PushStruct() {
+    if (depth_ == MAX_DEPTH) {
+        token_ = Token::INVALID;
+        return;
+    }
+    Level& level = levels_[depth_++];
+    level.container = false;
+    ReadFixed(Token::FIELD_TYPE, 1);
+}
+
+void ThriftTracker::PushContainer(const uint8_t key_type,
+                                  const uint8_t value_type,
+                                  const uint64_t count) {
+    if (count == 0) {
+        ValueDone();
+        return;
+    }
+    if (depth_ == MAX_DEPTH) {
+        token_ = Token::INVALID;
+        return;
+    }
+    Level& level = levels_[depth_++];
+    level.container = true;
+    level.types = {{key_type, value_type}};
+    level.remaining = count;
+    BeginValue(key_type);
+}
+
+void ThriftTracker::BeginValue(const uint8_t type) {
+    if (compact_) {
+        switch (type) {
+            case C_BOOLEAN_TRUE:
+            case C_BOOLEAN_FALSE:
+                // The value of boolean fields is in their type
+                if (!levels_[depth_ - 1].container) {
+                    ValueDone();
+                } else {
+                    Skip(Token::VALUE, 1);
+                }
+                return;
+            case C_BYTE:
+                Skip(Token::VALUE, 1);
+                return;
+            case C_I16:
+            case C_I32:
+            case C_I64:
+                ReadVarint(Token::VALUE);
+                return;
+            case C_DOUBLE:
+                Skip(Token::VALUE, 8);
+                return;
+            case C_UUID:
+                Skip(Token::VALUE, 16);
+                return;
+            case C_BINARY:
+                ReadVarint(Token::STRING_LEN);
+                return;
+            case C_LIST:
+            case C_SET:
+                ReadFixed(Token::LIST_HEADER, 1);
+                return;
+            case C_MAP:
+                ReadVarint(Token::MAP_HEADER);
+                return;
+            case C_STRUCT:
+                PushStruct();
+                return;
+            default:
+                token_ = Token::INVALID;
+                return;
+        }
+    }
+
+    switch (type) {
+        case T_BOOL:
+        case T_BYTE:
+            Skip(Token::VALUE, 1);
+            return;
+        case T_I16:
+            Skip(Token::VALUE, 2);
+            return;
+        case T_I32:
+            Skip(Token::VALUE, 4);
+            return;
+        case T_DOUBLE:
+        case T_I64:
+            Skip(Token::VALUE, 8);
+            return;
+        case T_UUID:
+            Skip(Token::VALUE, 16);
+            return;
+        case T_STRING:
+            ReadFixed(Token::STRING_LEN, 4);
+            return;
+        case T_LIST:
+        case T_SET:
+            ReadFixed(Token::LIST_HEADER, 5);
+            return;
+        case T_MAP:
+            ReadFixed(Token::MAP_HEADER, 6);
+            return;
+        case T_STRUCT:
+            PushStruct();
+            return;
+        default:
+            token_ = Token::INVALID;
+            return;
+    }
+}
+
+void ThriftTracker::ValueDone() {
+    while (depth_ > 0) {
+        Level& level = levels_[depth_ - 1];
+        if (!level.container) {
+            ReadFixed(Token::FIELD_TYPE, 1);
+            return;
+        }
+        if (--level.remaining > 0) {
+            // Keys of maps are followed by values
+            BeginValue(level.types[level.remaining & 1]);
+            return;
+        }
+        // The container is a complete value of the level above
+        --depth_;
+    }
+    token_ = Token::DONE;
+}
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace microtrace {
+
+/*
+ * Follows a single Thrift message as it is sent or received, to find out its
+ * method name, sequence id, and where it ends. Messages can be passed in pieces
+ * of any size.
+ *
+ * Both the binary (strict) and the compact protocol are supported, with or
+ * without the framed transport. Framed messages are skipped once their header
+ * has been read. Unframed messages are walked field by field without copying
+ * them, since the end of their struct is the only way to find their end.
+ */
+class ThriftTracker {
+   public:
+    enum class MessageType {
+        NONE = 0,
+        CALL = 1,
+        REPLY = 2,
+        EXCEPTION = 3,
+        ONEWAY = 4
+    };
+
+    /*
+     * Messages with longer method names are considered invalid.
+     */
+    static const size_t MAX_NAME_LEN = 256;
+
+    /*
+     * Maximum number of nested structs and containers in a message.
+     */
+    static const size_t MAX_DEPTH = 32;
+
+    /*
+     * Returns true if buf starts with the header of a Thrift message.
+     */
+    static bool StartsWithMessage(const char* buf, size_t len);
+
+    ThriftTracker();
+
+    /*
+     * Starts tracking a new message.
+     */
+    void Reset();
+
+    /*
+     * Processes the next len bytes of the message. Returns the number of bytes
+     * that belong to it, which is less than len only if the message has
+     * completed or turned out to be invalid.
+     */
+    size_t Process(const char* buf, size_t len);
+
+    /*
+     * Returns true once the message header, i.e. the method name and the
+     * sequence id, has been read.
+     */
+    bool header_complete() const { return header_complete_; }
+
+    /*
+     * Returns true if the whole message has been processed.
+     */
+    bool complete() const { return token_ == Token::DONE; }
+
+    /*
+     * Returns false if the data is not a Thrift message.
+     */
+    bool valid() const { return token_ != Token::INVALID; }
+
+    MessageType message_type() const { return message_type_; }
+    const std::string& name() const { return name_; }
+    int32_t seqid() const { return seqid_; }
+
+   private:
+    /*
+     * What the bytes being read are.
+     */
+    enum class Token {
+        FIRST_BYTE,
+        FRAME_SIZE,
+        PROTOCOL_ID,
+        BINARY_VERSION,
+        BINARY_NAME_LEN,
+        NAME,
+        BINARY_SEQID,
+        COMPACT_TYPE,
+        COMPACT_SEQID,
+        COMPACT_NAME_LEN,
+        FRAME_BODY,
+        FIELD_TYPE,
+        FIELD_ID,
+        VALUE,
+        STRING_LEN,
+        LIST_HEADER,
+        LIST_SIZE,
+        MAP_HEADER,
+        MAP_TYPES,
+        DONE,
+        INVALID
+    };
+
+    /*
+     * How the bytes being read are consumed.
+     */
+    enum class Read { FIXED, VARINT, NAME, SKIP };
+
+    /*
+     * A struct or container being walked.
+     */
+    struct Level {
+        bool container;
+
+        /*
+         * Key and value types of a map, both are the element type for lists
+         * and sets.
+         */
+        std::array<uint8_t, 2> types;
+
+        /*
+         * Elements left, keys and values counted separately.
+         */
+        uint64_t remaining;
+    };
+
+    void ReadFixed(const Token token, const size_t len);
+    void ReadVarint(const Token token);
+    void ReadName(const size_t len);
+    void Skip(const Token token, const uint64_t len);
+
+    /*
+     * Handles a token once all of its bytes have been read.
+     */
+    void TokenDone();
+
+    void HeaderDone();
+
+    /*
+     * Starts reading a value of type in the current struct or container.
+     */
+    void BeginValue(const uint8_t type);
+
+    /*
+     * Called when a value has been read, moves on to the next field or
+     * element.
+     */
+    void ValueDone();
+
+    void PushStruct();
+    /*
+     * Pushes a container of count elements, keys and values of maps counted
+     * separately.
+     */
+    void PushContainer(const uint8_t key_type, const uint8_t value_type,
+                       const uint64_t count);
+
+    uint32_t ReadUint32(const size_t offset) const;
+
+    Token token_;
+    Read read_;
+
+    bool framed_;
+    bool compact_;
+    uint32_t frame_size_;
+
+    /*
+     * Bytes of the message processed so far.
+     */
+    uint64_t message_read_;
+
+    /*
+     * Bytes of a fixed size token.
+     */
+    std::array<uint8_t, 8> scratch_;
+    size_t scratch_len_;
+    size_t scratch_need_;
+
+    uint64_t varint_;
+    size_t varint_shift_;
+
+    /*
+     * Bytes left to skip, or of the method name.
+     */
+    uint64_t remaining_;
+
+    /*
+     * Type of the field whose id is being read, or of the elements of the
+     * container whose header is being read.
+     */
+    uint8_t pending_type_;
+    uint64_t pending_size_;
+
+    std::array<Level, MAX_DEPTH> levels_;
+    size_t depth_;
+
+    bool header_complete_;
+    MessageType message_type_;
+    std::string name_;
+    int32_t seqid_;
+};
+}
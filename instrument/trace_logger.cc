@@ -1,12 +1,15 @@
 #include "trace_logger.h"
 
 #include <math.h>
+#include <unistd.h>
 #include <iostream>
 #include <mutex>
+#include <new>
 #include <sstream>
 
 #include "google/protobuf/text_format.h"
 
+#include <thrift/Thrift.h>
 #include <thrift/protocol/TBinaryProtocol.h>
 #include <thrift/transport/TSocket.h>
 #include <thrift/transport/TTransportUtils.h>
@@ -29,30 +32,121 @@ void StdoutTraceLogger::Log(const proto::RequestLog& log) {
     std::cout << std::flush;
 }
 
-ThriftLogger::ThriftLogger() : connected_(false) {
-    boost::shared_ptr<TTransport> socket(
-        new TSocket("localhost", COLLECTOR_PORT));
-    transport_.reset(new TBufferedTransport(socket));
+constexpr std::chrono::milliseconds ThriftLogger::flush_interval_;
+
+ThriftLogger::ThriftLogger()
+    : queue_(ExportQueue::DefaultOptions()),
+      shutdown_(false),
+      connected_(false) {
+    ResetConnection();
+}
+
+ThriftLogger::~ThriftLogger() {
+    {
+        std::unique_lock<std::mutex> l(mu_);
+        shutdown_ = true;
+    }
+    cv_.notify_one();
+    if (exporter_.joinable()) {
+        exporter_.join();
+    }
+}
+
+void ThriftLogger::ResetConnection() {
+    socket_.reset(new TSocket("localhost", COLLECTOR_PORT));
+    transport_.reset(new TBufferedTransport(socket_));
     boost::shared_ptr<TProtocol> protocol(new TBinaryProtocol(transport_));
     client_.reset(new CollectorClient(protocol));
+    connected_ = false;
 }
 
 void ThriftLogger::Log(const proto::RequestLog& log) {
     std::string str;
     log.SerializeToString(&str);
 
+    const Lane lane = queue_.Classify(log);
+    bool flush;
     {
         std::unique_lock<std::mutex> l(mu_);
-        buffer_.push_back(std::move(str));
-        if (buffer_.size() >= max_size_) {
-            if (!connected_) {
-                transport_->open();
-                connected_ = true;
-            }
-            client_->Collect(buffer_);
-            buffer_.clear();
+        if (!exporter_.joinable()) {
+            exporter_ = std::thread{&ThriftLogger::Export, this};
+        }
+        flush = queue_.Push(lane, std::move(str));
+    }
+    if (flush) {
+        cv_.notify_one();
+    }
+}
+
+bool ThriftLogger::Send(const std::vector<std::string>& batch) {
+    try {
+        if (!connected_) {
+            transport_->open();
+            connected_ = true;
         }
+        client_->Collect(batch);
+        return true;
+    } catch (const TException& e) {
+        connected_ = false;
+        transport_->close();
+        return false;
+    }
+}
+
+void ThriftLogger::Export() {
+    // The thread may have inherited a context, the spans it sends must not be
+    // traced
+    reset_current_context();
+
+    std::vector<std::string> batch;
+
+    std::unique_lock<std::mutex> l(mu_);
+    while (true) {
+        cv_.wait_for(l, flush_interval_,
+                     [this]() { return shutdown_ || queue_.ready(); });
+        if (queue_.empty()) {
+            if (shutdown_) break;
+            continue;
+        }
+
+        const size_t express_count = queue_.TakeBatch(&batch);
+        l.unlock();
+        const bool sent = Send(batch);
+        l.lock();
+
+        if (sent) {
+            queue_.Exported(express_count, batch.size() - express_count);
+            batch.clear();
+        } else {
+            queue_.PutBack(&batch, express_count);
+            if (shutdown_) break;
+            // The Collector is unavailable, wait before trying again
+            cv_.wait_for(l, flush_interval_, [this]() { return shutdown_; });
+        }
+    }
+}
+
+void ThriftLogger::PrepareFork() { mu_.lock(); }
+
+void ThriftLogger::AfterForkParent() { mu_.unlock(); }
+
+void ThriftLogger::AfterForkChild() {
+    mu_.unlock();
+
+    // The exporter may have been waiting on cv_ and its thread is gone, so
+    // neither of them can be destroyed, they are replaced in place instead
+    new (&cv_) std::condition_variable;
+    new (&exporter_) std::thread;
+
+    queue_.Clear();
+
+    // The descriptor is closed first, otherwise closing the socket would shut
+    // down the connection of the parent
+    const int fd = socket_->getSocketFD();
+    if (fd >= 0) {
+        ::close(fd);
     }
+    ResetConnection();
 }
 
 ThriftLoggerInstance::ThriftLoggerInstance() : logger_(new ThriftLogger) {}
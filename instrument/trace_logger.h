@@ -1,10 +1,15 @@
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
 #include <memory>
 #include <mutex>
+#include <thread>
 
 #include <thrift/transport/TSocket.h>
 
+#include "context.h"
+#include "export_queue.h"
 #include "gen-cpp/Collector.h"
 #include "request_log.pb.h"
 
@@ -27,6 +32,16 @@ class TraceLogger {
      * It shouldn't keep a reference to the given log after the method returns.
      */
     virtual void Log(const proto::RequestLog& log) = 0;
+
+    /*
+     * Called when this process has finished handling a request of trace, i.e.
+     * the local root span of the trace has completed.
+     *
+     * Loggers that hold on to spans until the fate of their trace is known
+     * can use this to make their decision.
+     */
+    virtual void RootCompleted(const uuid_t& trace, const double duration_ms,
+                               const bool error) {}
 };
 
 /*
@@ -45,29 +60,84 @@ class StdoutTraceLogger : public TraceLogger {
     void Log(const proto::RequestLog& log) override;
 };
 
+/*
+ * Sends logs to the Collector in batches from a background exporter thread, so
+ * the application's threads never wait for the Collector.
+ *
+ * Logs are queued in lanes (see ExportQueue): slow and failed spans are
+ * flushed as soon as they arrive, other spans are flushed when a batch is full
+ * or flush_interval_ has passed.
+ *
+ * The exporter thread is started by the first Log, so a process that never
+ * logs, e.g. a child of fork that calls exec, doesn't start one.
+ */
 class ThriftLogger : public TraceLogger {
    public:
     const static int COLLECTOR_PORT = 9934;
 
     ThriftLogger();
+    ~ThriftLogger();
 
     void Log(const proto::RequestLog& log) override;
 
+    const LaneStats& stats(const Lane lane) const { return queue_.stats(lane); }
+
+    /*
+     * Called before fork, it holds mu_ until AfterForkParent or
+     * AfterForkChild.
+     */
+    void PrepareFork();
+
+    void AfterForkParent();
+
+    /*
+     * Only the thread that forked exists in the child. The spans that were
+     * queued are discarded, since the parent exports them, and the connection
+     * to the Collector is replaced without closing the one of the parent.
+     */
+    void AfterForkChild();
+
    private:
+    /*
+     * Creates a connection to the Collector, which is opened by Send.
+     */
+    void ResetConnection();
+
+    /*
+     * Main loop of the exporter thread.
+     */
+    void Export();
+
+    /*
+     * Sends batch to the Collector, connecting to it first if necessary.
+     *
+     * Returns false if the batch could not be sent.
+     */
+    bool Send(const std::vector<std::string>& batch);
+
+    static constexpr std::chrono::milliseconds flush_interval_{1000};
+
+    // Guards queue_, shutdown_ and exporter_
     std::mutex mu_;
+    std::condition_variable cv_;
 
-    // TODO reset to 200
-    static const int max_size_ = 200;
-    std::vector<std::string> buffer_;
+    ExportQueue queue_;
+
+    bool shutdown_;
 
     /*
-     * Indicates if we have connected to the Collector
+     * Indicates if we have connected to the Collector. Only used by the
+     * exporter thread.
      */
     bool connected_;
 
+    boost::shared_ptr<apache::thrift::transport::TSocket> socket_;
+
     boost::shared_ptr<apache::thrift::transport::TTransport> transport_;
 
     std::unique_ptr<CollectorClient> client_;
+
+    std::thread exporter_;
 };
 
 class ThriftLoggerInstance {
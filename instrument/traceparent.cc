@@ -0,0 +1,288 @@
+#include "traceparent.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <cstdlib>
+
+#include "common.h"
+
+namespace microtrace {
+
+const size_t Traceparent::HEADER_SIZE;
+const size_t HeaderSplicer::MAX_HEADER_SIZE;
+
+static_assert(Traceparent::HEADER_SIZE <= HeaderSplicer::MAX_HEADER_SIZE,
+              "the traceparent headers must fit into HeaderSplicer");
+
+static const char TRACEPARENT[] = "traceparent:";
+static const char TRACESTATE[] = "tracestate:";
+static const char TRACESTATE_KEY[] = "microtrace=";
+
+Propagation GetPropagation() {
+    static const Propagation propagation = [] {
+        const char* mode = std::getenv("MICROTRACE_PROPAGATION");
+        if (mode == nullptr || strcmp(mode, "binary") == 0) {
+            return Propagation::BINARY;
+        } else if (strcmp(mode, "traceparent") == 0) {
+            return Propagation::TRACEPARENT;
+        }
+        VERIFY(false, "invalid MICROTRACE_PROPAGATION env {}", mode);
+    }();
+    return propagation;
+}
+
+size_t Traceparent::Format(const Context& context, char* buf) {
+    const int len = snprintf(
+        buf, HEADER_SIZE + 1,
+        "traceparent: 00-%016llx%016llx-%016llx-%02x\r\n"
+        "tracestate: microtrace=%016llx\r\n",
+        static_cast<unsigned long long>(context.trace().high()),
+        static_cast<unsigned long long>(context.trace().low()),
+        static_cast<unsigned long long>(context.span().low()),
+        context.sampled() ? 1 : 0,
+        static_cast<unsigned long long>(context.span().high()));
+    VERIFY(len == static_cast<int>(HEADER_SIZE),
+           "traceparent header has invalid size {}", len);
+    return len;
+}
+
+/*
+ * Parses len lowercase hex digits, returns false if there is anything else.
+ */
+static bool ParseHex(const char* buf, size_t len, uint64_t* value) {
+    *value = 0;
+    for (size_t i = 0; i < len; ++i) {
+        const char c = buf[i];
+        uint64_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else {
+            return false;
+        }
+        *value = (*value << 4) | digit;
+    }
+    return true;
+}
+
+/*
+ * Returns the value of the header on the line [begin, end) if its name is
+ * name, without leading whitespace, or nullptr.
+ */
+static const char* HeaderValue(const char* begin, const char* end,
+                               const char* name, size_t name_len) {
+    if (static_cast<size_t>(end - begin) < name_len ||
+        strncasecmp(begin, name, name_len) != 0) {
+        return nullptr;
+    }
+    const char* value = begin + name_len;
+    while (value != end && (*value == ' ' || *value == '\t')) {
+        ++value;
+    }
+    return value;
+}
+
+/*
+ * Parses version-trace_id-parent_id-flags. Versions other than 00 may have
+ * more fields after the flags.
+ */
+static bool ParseTraceparent(const char* value, const char* end,
+                             uint64_t* trace_high, uint64_t* trace_low,
+                             uint64_t* parent, uint8_t* flags) {
+    static const size_t VALUE_LEN = 55;
+    uint64_t version;
+    uint64_t trace_flags;
+    if (static_cast<size_t>(end - value) < VALUE_LEN ||
+        !ParseHex(value, 2, &version) || version == 0xff ||
+        value[2] != '-' || !ParseHex(value + 3, 16, trace_high) ||
+        !ParseHex(value + 19, 16, trace_low) || value[35] != '-' ||
+        !ParseHex(value + 36, 16, parent) || value[52] != '-' ||
+        !ParseHex(value + 53, 2, &trace_flags)) {
+        return false;
+    }
+    if (version == 0 && end - value > static_cast<ssize_t>(VALUE_LEN) &&
+        value[VALUE_LEN] != '\r') {
+        return false;
+    }
+    // All zero ids are invalid
+    if ((*trace_high == 0 && *trace_low == 0) || *parent == 0) {
+        return false;
+    }
+    *flags = (trace_flags & 1) ? Context::SAMPLED_FLAG : 0;
+    return true;
+}
+
+/*
+ * Finds the microtrace entry of a tracestate value.
+ */
+static bool ParseTracestate(const char* value, const char* end,
+                            uint64_t* span_high) {
+    static const size_t KEY_LEN = sizeof(TRACESTATE_KEY) - 1;
+    while (value != end) {
+        while (value != end && (*value == ' ' || *value == ',')) {
+            ++value;
+        }
+        if (static_cast<size_t>(end - value) >= KEY_LEN + 16 &&
+            memcmp(value, TRACESTATE_KEY, KEY_LEN) == 0) {
+            return ParseHex(value + KEY_LEN, 16, span_high);
+        }
+        value = std::find(value, end, ',');
+    }
+    return false;
+}
+
+const std::string& GetDebugHeader() {
+    static const std::string header = [] {
+        const char* name = std::getenv("MICROTRACE_DEBUG_HEADER");
+        return name == nullptr || *name == '\0' ? std::string{}
+                                                 : std::string{name} + ":";
+    }();
+    return header;
+}
+
+bool HasHeader(const char* buf, size_t len, const char* name,
+               size_t name_len) {
+    const char* const buf_end = buf + len;
+
+    // The request line is skipped
+    const char* line = static_cast<const char*>(memchr(buf, '\n', len));
+    while (line != nullptr) {
+        ++line;
+        const char* end =
+            static_cast<const char*>(memchr(line, '\n', buf_end - line));
+        if (end == nullptr) {
+            end = buf_end;
+        }
+        // The head ends with an empty line
+        if (end - line <= 1) {
+            return false;
+        }
+        if (HeaderValue(line, end, name, name_len)) {
+            return true;
+        }
+        line = end == buf_end ? nullptr : end;
+    }
+    return false;
+}
+
+bool Traceparent::Find(const char* buf, size_t len, Context* context) {
+    const char* const buf_end = buf + len;
+
+    // The request line is skipped
+    const char* line = static_cast<const char*>(memchr(buf, '\n', len));
+    bool found = false;
+    uint64_t trace_high = 0;
+    uint64_t trace_low = 0;
+    uint64_t parent = 0;
+    uint64_t span_high = 0;
+    uint8_t flags = 0;
+
+    while (line != nullptr) {
+        ++line;
+        const char* end =
+            static_cast<const char*>(memchr(line, '\n', buf_end - line));
+        if (end == nullptr) {
+            break;
+        }
+        // The head ends with an empty line
+        if (end - line <= 1) {
+            break;
+        }
+
+        const char* value;
+        if (!found && (value = HeaderValue(line, end, TRACEPARENT,
+                                           sizeof(TRACEPARENT) - 1))) {
+            found = ParseTraceparent(value, end, &trace_high, &trace_low,
+                                     &parent, &flags);
+        } else if ((value = HeaderValue(line, end, TRACESTATE,
+                                        sizeof(TRACESTATE) - 1))) {
+            ParseTracestate(value, end, &span_high);
+        }
+        line = end;
+    }
+
+    if (!found) {
+        return false;
+    }
+    ContextStorage storage = ContextStorage::Zero();
+    storage.trace_id = Uuid::FromParts(trace_high, trace_low);
+    storage.span_id = Uuid::FromParts(span_high, parent);
+    *context = Context{storage, flags};
+    return true;
+}
+
+HeaderSplicer::HeaderSplicer()
+    : state_(State::IDLE),
+      header_len_(0),
+      header_written_(0),
+      header_spliced_(false),
+      prefix_len_(0) {}
+
+void HeaderSplicer::Start(const char* header, size_t len) {
+    VERIFY(len <= MAX_HEADER_SIZE, "header is too long: {}", len);
+    memcpy(header_.data(), header, len);
+    header_len_ = len;
+    header_written_ = 0;
+    state_ = len > 0 ? State::SEEKING : State::IDLE;
+}
+
+const std::vector<struct iovec>& HeaderSplicer::Splice(
+    const struct iovec* iov, int iovcnt) {
+    spliced_.clear();
+    header_spliced_ = false;
+    prefix_len_ = 0;
+
+    const struct iovec header = {header_.data() + header_written_,
+                                 header_len_ - header_written_};
+    if (state_ == State::FLUSHING) {
+        spliced_.push_back(header);
+        header_spliced_ = true;
+    }
+
+    for (int i = 0; i < iovcnt; ++i) {
+        if (state_ != State::SEEKING || header_spliced_) {
+            spliced_.push_back(iov[i]);
+            continue;
+        }
+
+        char* base = static_cast<char*>(iov[i].iov_base);
+        const char* lf =
+            static_cast<const char*>(memchr(base, '\n', iov[i].iov_len));
+        if (lf == nullptr) {
+            spliced_.push_back(iov[i]);
+            prefix_len_ += iov[i].iov_len;
+            continue;
+        }
+
+        // The header goes right after the request line
+        const size_t line_len = lf - base + 1;
+        spliced_.push_back({base, line_len});
+        spliced_.push_back(header);
+        if (line_len < iov[i].iov_len) {
+            spliced_.push_back({base + line_len, iov[i].iov_len - line_len});
+        }
+        prefix_len_ += line_len;
+        header_spliced_ = true;
+    }
+    return spliced_;
+}
+
+ssize_t HeaderSplicer::Written(ssize_t ret) {
+    if (ret <= 0 || !header_spliced_ ||
+        static_cast<size_t>(ret) < prefix_len_) {
+        return ret;
+    }
+
+    // Once the request line has been written, the header has to come next,
+    // even if none of it has been written yet
+    const size_t header_bytes =
+        std::min(static_cast<size_t>(ret) - prefix_len_,
+                 header_len_ - header_written_);
+    header_written_ += header_bytes;
+    state_ = header_written_ == header_len_ ? State::IDLE : State::FLUSHING;
+    return ret - header_bytes;
+}
+}
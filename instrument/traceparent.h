@@ -0,0 +1,147 @@
+#pragma once
+
+#include <sys/uio.h>
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "context.h"
+
+namespace microtrace {
+
+/*
+ * Indicates how contexts are passed on to other services.
+ *
+ * BINARY writes the wire format of the context before every request, and the
+ * server reads it before the application reads the request. It works with
+ * any protocol, but only if both ends are instrumented.
+ *
+ * TRACEPARENT splices a W3C traceparent header into HTTP/1.x requests
+ * instead, which uninstrumented servers and proxies ignore or pass on, and
+ * which costs no extra syscalls. Only sampled contexts are passed on, and
+ * only through HTTP/1.x.
+ */
+enum class Propagation { BINARY, TRACEPARENT };
+
+/*
+ * Returns the propagation set in MICROTRACE_PROPAGATION, binary by default.
+ */
+Propagation GetPropagation();
+
+/*
+ * Returns the name of the request header that marks a trace for debugging,
+ * MICROTRACE_DEBUG_HEADER followed by a colon, e.g. "X-Debug-Trace:". It is
+ * empty if the variable isn't set, and requests aren't looked at.
+ */
+const std::string& GetDebugHeader();
+
+/*
+ * Returns true if the head of the HTTP request in buf, or the part of it that
+ * buf contains, has the header line that starts with name.
+ */
+bool HasHeader(const char* buf, size_t len, const char* name, size_t name_len);
+
+/*
+ * Encodes and decodes contexts as W3C Trace Context headers. The trace id is
+ * the traceparent trace-id, and the low 64 bits of the span id are its
+ * parent-id. The high 64 bits of the span id don't fit in it, they are passed
+ * in a microtrace entry of the tracestate header.
+ */
+class Traceparent {
+   public:
+    /*
+     * Size of the headers written by Format.
+     */
+    static const size_t HEADER_SIZE = 111;
+
+    /*
+     * Writes the traceparent and tracestate header lines of context to buf,
+     * which must have room for HEADER_SIZE bytes. Returns the number of bytes
+     * written.
+     */
+    static size_t Format(const Context& context, char* buf);
+
+    /*
+     * Looks for the traceparent header in the head of the HTTP request in buf.
+     * Returns true and sets context if a valid one is found before the end of
+     * the head, or of buf.
+     */
+    static bool Find(const char* buf, size_t len, Context* context);
+};
+
+/*
+ * Splices a header into the request being written, right after its request
+ * line, without copying the request.
+ *
+ * Writes can end anywhere, so the request line may span several writes, and
+ * the header may only be written partly. The rest of it is then written before
+ * the rest of the request.
+ */
+class HeaderSplicer {
+   public:
+    static const size_t MAX_HEADER_SIZE = 128;
+
+    HeaderSplicer();
+
+    /*
+     * Starts splicing header into the request that is about to be written.
+     */
+    void Start(const char* header, size_t len);
+
+    /*
+     * Indicates if there are header bytes left to be written.
+     */
+    bool active() const { return state_ != State::IDLE; }
+
+    /*
+     * Drops the rest of the header, for requests that are written where it
+     * can't be spliced in.
+     */
+    void Cancel() { state_ = State::IDLE; }
+
+    /*
+     * Returns the iovecs to write instead of iov. They are valid until the
+     * next call.
+     */
+    const std::vector<struct iovec>& Splice(const struct iovec* iov,
+                                            int iovcnt);
+
+    /*
+     * Called with the result of writing the iovecs returned by Splice. Returns
+     * the number of bytes of iov that have been written, the rest of ret was
+     * the header.
+     */
+    ssize_t Written(ssize_t ret);
+
+   private:
+    enum class State {
+        IDLE,
+
+        /*
+         * The end of the request line hasn't been written yet.
+         */
+        SEEKING,
+
+        /*
+         * The request line has been written, but not all of the header.
+         */
+        FLUSHING
+    };
+
+    State state_;
+
+    std::array<char, MAX_HEADER_SIZE> header_;
+    size_t header_len_;
+    size_t header_written_;
+
+    std::vector<struct iovec> spliced_;
+
+    /*
+     * Indicates if the last Splice included the header, and how many bytes
+     * of the request preceded it.
+     */
+    bool header_spliced_;
+    size_t prefix_len_;
+};
+}
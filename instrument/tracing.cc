@@ -1,9 +1,16 @@
 #include <arpa/inet.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <ucontext.h>
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <memory>
@@ -14,12 +21,21 @@
 #include "client_socket.h"
 #include "client_socket_handler.h"
 #include "context.h"
+#include "epoll_registry.h"
+#include "fiber_contexts.h"
 #include "orig_functions.h"
+#include "overhead_breaker.h"
+#include "pq_tracker.h"
+#include "sampler.h"
 #include "server_socket.h"
 #include "server_socket_handler.h"
 #include "socket_map.h"
+#include "tail_sampler.h"
+#include "thread_start.h"
 #include "trace_logger.h"
 #include "tracing.h"
+#include "uring_tracker.h"
+#include "uv_callbacks.h"
 
 #define SOCK_CALL(fd, traced, normal) \
     do {                              \
@@ -42,32 +58,75 @@ static const int PG_PORT = 5432;
 static std::shared_ptr<TraceLogger> null_logger(new NullTraceLogger);
 static std::shared_ptr<TraceLogger> stdout_logger(new StdoutTraceLogger);
 
-template <class CbType>
-struct CallbackWrap {
-    CallbackWrap(void* req_ptr, uv_getaddrinfo_cb orig_cb, Context context)
-        : req_ptr(req_ptr), orig_cb(orig_cb), context(context) {}
-
-    void* const req_ptr;
-    const CbType orig_cb;
-    const Context context;
-};
-
-typedef CallbackWrap<uv_getaddrinfo_cb> GetAddrinfoCbWrap;
-
 static auto& thrift_instance() {
     static ThriftLoggerInstance thrift;
     return thrift;
 }
 
+/*
+ * Returns the logger that buffers spans per trace in tail sampling mode, or
+ * null.
+ */
+static TailSamplingLogger* tail_logger() {
+    static std::unique_ptr<TailSamplingLogger> tail_logger_ =
+        GetSamplingMode() == SamplingMode::TAIL
+            ? std::make_unique<TailSamplingLogger>(
+                  thrift_instance().get(), TailSamplingLogger::DefaultOptions())
+            : nullptr;
+    return tail_logger_.get();
+}
+
+/*
+ * Returns the logger used by the handlers. In tail sampling mode, spans are
+ * buffered per trace before they are passed on to the Collector.
+ */
+static TraceLogger* trace_logger() {
+    if (auto* logger = tail_logger()) {
+        return logger;
+    }
+    return thrift_instance().get();
+}
+
+static auto& overhead_breaker() {
+    static OverheadBreaker breaker{OverheadBreaker::DefaultOptions()};
+    return breaker;
+}
+
+static auto& sampler() {
+    static std::unique_ptr<Sampler> sampler_ =
+        std::make_unique<ThrottledSampler>(
+            NewSamplerFromEnv([]() {
+                const auto* logger = thrift_instance().get();
+                return logger->stats(Lane::EXPRESS).queued +
+                       logger->stats(Lane::NORMAL).queued;
+            }),
+            &overhead_breaker());
+    return *sampler_;
+}
+
 static auto& socket_map() {
     static SocketMap socket_map_;
     return socket_map_;
 }
 
-static auto& getaddrinfo_cbs() {
-    static std::unordered_map<void*, std::unique_ptr<GetAddrinfoCbWrap>>
-        getaddrinfo_cbs;
-    return getaddrinfo_cbs;
+static auto& epoll_registry() {
+    static EpollRegistry epoll_registry_;
+    return epoll_registry_;
+}
+
+static auto& fiber_contexts() {
+    static FiberContexts fiber_contexts_;
+    return fiber_contexts_;
+}
+
+static auto& thread_starts() {
+    static ThreadStartPool thread_starts_;
+    return thread_starts_;
+}
+
+static auto& pq_tracker() {
+    static PqTracker pq_tracker_{trace_logger()};
+    return pq_tracker_;
 }
 
 static void SaveSocket(std::unique_ptr<SocketInterface> entry) {
@@ -81,28 +140,30 @@ static SocketInterface* GetSocket(const int sockfd) {
 
 static void DeleteSocket(const int sockfd) { socket_map().Delete(sockfd); }
 
-static void SaveGetAddrinfoCb(std::unique_ptr<GetAddrinfoCbWrap> wrap) {
-    getaddrinfo_cbs()[wrap->req_ptr] = std::move(wrap);
-}
-
-static const GetAddrinfoCbWrap& GetGetAddrinfoCb(void* req_ptr) {
-    return *(getaddrinfo_cbs().at(req_ptr));
-}
-
-static void DeleteGetAddrinfoCb(void* req_ptr) {
-    getaddrinfo_cbs().erase(req_ptr);
+/*
+ * Gives back wrap if the call that it was taken for failed, libuv doesn't call
+ * the callbacks then.
+ */
+static int UvSubmitted(UvCallback* wrap, const int ret) {
+    if (ret < 0 && wrap != nullptr) {
+        uv_callbacks().Give(wrap);
+    }
+    return ret;
 }
 
 /* Accept */
 
-static void HandleAccept(const int sockfd) {
+static void HandleAccept(const int sockfd, const int flags = 0) {
     if (sockfd == -1) {
         return;
     }
     auto handler = std::make_unique<ServerSocketHandlerImpl>(
-        sockfd, thrift_instance().get(), orig());
+        sockfd, trace_logger(), &sampler(), &overhead_breaker(), orig());
     auto socket =
         std::make_unique<ServerSocket>(sockfd, std::move(handler), orig());
+    if (flags & SOCK_NONBLOCK) {
+        socket->NonBlocking(true);
+    }
     SaveSocket(std::move(socket));
 }
 }  // namespace microtrace
@@ -115,7 +176,7 @@ int accept(int sockfd, struct sockaddr* addr, socklen_t* addrlen) {
 
 int accept4(int sockfd, struct sockaddr* addr, socklen_t* addrlen, int flags) {
     int ret = orig().accept4(sockfd, addr, addrlen, flags);
-    HandleAccept(ret);
+    HandleAccept(ret, flags);
     return ret;
 }
 
@@ -145,9 +206,12 @@ int socket(int domain, int type, int protocol) {
     }
 
     auto handler = std::make_unique<ClientSocketHandlerImpl>(
-        sockfd, thrift_instance().get(), orig());
+        sockfd, trace_logger(), &overhead_breaker(), orig());
     auto socket =
         std::make_unique<ClientSocket>(sockfd, std::move(handler), orig());
+    if (type & SOCK_NONBLOCK) {
+        socket->NonBlocking(true);
+    }
     SaveSocket(std::move(socket));
 
     return sockfd;
@@ -175,7 +239,12 @@ void HandleConnect(SocketInterface* sock, const struct sockaddr* addr) {
 /*
  * We use connect to fiter out sockets that we are not interested in.
  */
-int connect(int sockfd, const struct sockaddr* addr, socklen_t addrlen) {
+namespace microtrace {
+
+/*
+ * Stops tracing sockets that are connected to ports that aren't traced.
+ */
+static void FilterConnect(const int sockfd, const struct sockaddr* addr) {
     const int port = get_port(addr);
 
     // Don't trace connections to the collector
@@ -195,12 +264,24 @@ int connect(int sockfd, const struct sockaddr* addr, socklen_t addrlen) {
     if (port == PG_PORT) {
         DeleteSocket(sockfd);
     }
+}
+}  // namespace microtrace
+
+int connect(int sockfd, const struct sockaddr* addr, socklen_t addrlen) {
+    FilterConnect(sockfd, addr);
 
     int ret = orig().connect(sockfd, addr, addrlen);
 
     auto* sock = GetSocket(sockfd);
     if (sock) {
+        const int err = errno;
         HandleConnect(sock, addr);
+        if (ret == -1 && err == EINPROGRESS) {
+            static_cast<ClientSocket*>(sock)->ConnectPending();
+        } else if (ret == -1) {
+            static_cast<ClientSocket*>(sock)->ConnectFailed(err);
+        }
+        errno = err;
     }
 
     return ret;
@@ -212,7 +293,8 @@ int connect(int sockfd, const struct sockaddr* addr, socklen_t addrlen) {
  */
 int uv_tcp_connect(uv_connect_t* req, uv_tcp_t* handle,
                    const struct sockaddr* addr, uv_connect_cb cb) {
-    int ret = orig().uv_tcp_connect(req, handle, addr, cb);
+    UvCallback* wrap = WrapUvRequestCallback(req, &cb);
+    int ret = UvSubmitted(wrap, orig().uv_tcp_connect(req, handle, addr, cb));
 
     auto* sock = GetSocket(uv_fd(handle));
     if (ret == 0 && sock) {
@@ -224,32 +306,97 @@ int uv_tcp_connect(uv_connect_t* req, uv_tcp_t* handle,
     return ret;
 }
 
-/* uv_getaddrinfo */
+/* libuv callbacks */
+
+/*
+ * The callbacks of libuv requests and timers are called with the context that
+ * was current when they were passed.
+ */
+int uv_getaddrinfo(uv_loop_t* loop, uv_getaddrinfo_t* req,
+                   uv_getaddrinfo_cb getaddrinfo_cb, const char* node,
+                   const char* service, const struct addrinfo* hints) {
+    UvCallback* wrap = WrapUvRequestCallback(req, &getaddrinfo_cb);
+    return UvSubmitted(wrap, orig().uv_getaddrinfo(loop, req, getaddrinfo_cb,
+                                                   node, service, hints));
+}
+
+int uv_write(uv_write_t* req, uv_stream_t* handle, const uv_buf_t bufs[],
+             unsigned int nbufs, uv_write_cb cb) {
+    UvCallback* wrap = WrapUvRequestCallback(req, &cb);
+    return UvSubmitted(wrap, orig().uv_write(req, handle, bufs, nbufs, cb));
+}
 
-void unwrap_getaddrinfo(uv_getaddrinfo_t* req, int status,
-                        struct addrinfo* res) {
-    const GetAddrinfoCbWrap& cb_wrap = GetGetAddrinfoCb(req);
+int uv_queue_work(uv_loop_t* loop, uv_work_t* req, uv_work_cb work_cb,
+                  uv_after_work_cb after_work_cb) {
+    // The work runs in the thread pool, and after_work_cb in the loop
+    UvCallback* wrap = work_cb != nullptr ? TakeUvCallback(req, 1) : nullptr;
+    if (wrap != nullptr) {
+        WrapUvCallback<0>(wrap, &work_cb);
+        WrapUvCallback<1>(wrap, &after_work_cb);
+    }
+    return UvSubmitted(
+        wrap, orig().uv_queue_work(loop, req, work_cb, after_work_cb));
+}
 
-    set_current_context(cb_wrap.context);
+int uv_timer_start(uv_timer_t* handle, uv_timer_cb cb, uint64_t timeout,
+                   uint64_t repeat) {
+    // A failed call leaves the previous callback
+    if (cb == nullptr) {
+        return orig().uv_timer_start(handle, cb, timeout, repeat);
+    }
 
-    uv_getaddrinfo_cb orig_cb = cb_wrap.orig_cb;
-    DeleteGetAddrinfoCb(cb_wrap.req_ptr);
-    orig_cb(req, status, res);
+    GiveUvCallback(handle);
+    UvCallback* wrap = TakeUvCallback(handle, UvCallback::REPEATED);
+    if (wrap != nullptr) {
+        WrapUvCallback<0>(wrap, &cb);
+    }
+    return UvSubmitted(wrap,
+                       orig().uv_timer_start(handle, cb, timeout, repeat));
 }
 
-int uv_getaddrinfo(uv_loop_t* loop, uv_getaddrinfo_t* req,
-                   uv_getaddrinfo_cb getaddrinfo_cb, const char* node,
-                   const char* service, const struct addrinfo* hints) {
-    if (is_context_undefined()) {
-        return orig().uv_getaddrinfo(loop, req, getaddrinfo_cb, node, service,
-                                     hints);
+void uv_close(uv_handle_t* handle, uv_close_cb close_cb) {
+    if (handle->type == UV_TIMER) {
+        GiveUvCallback(reinterpret_cast<uv_timer_t*>(handle));
     }
+    orig().uv_close(handle, close_cb);
+}
 
-    auto cb_wrap = std::make_unique<GetAddrinfoCbWrap>(req, getaddrinfo_cb,
-                                                       get_current_context());
-    SaveGetAddrinfoCb(std::move(cb_wrap));
-    return orig().uv_getaddrinfo(loop, req, &unwrap_getaddrinfo, node, service,
-                                 hints);
+int uv_fs_open(uv_loop_t* loop, uv_fs_t* req, const char* path, int flags,
+               int mode, uv_fs_cb cb) {
+    UvCallback* wrap = WrapUvRequestCallback(req, &cb);
+    return UvSubmitted(wrap,
+                       orig().uv_fs_open(loop, req, path, flags, mode, cb));
+}
+
+int uv_fs_close(uv_loop_t* loop, uv_fs_t* req, uv_file file, uv_fs_cb cb) {
+    UvCallback* wrap = WrapUvRequestCallback(req, &cb);
+    return UvSubmitted(wrap, orig().uv_fs_close(loop, req, file, cb));
+}
+
+int uv_fs_read(uv_loop_t* loop, uv_fs_t* req, uv_file file,
+               const uv_buf_t bufs[], unsigned int nbufs, int64_t offset,
+               uv_fs_cb cb) {
+    UvCallback* wrap = WrapUvRequestCallback(req, &cb);
+    return UvSubmitted(
+        wrap, orig().uv_fs_read(loop, req, file, bufs, nbufs, offset, cb));
+}
+
+int uv_fs_write(uv_loop_t* loop, uv_fs_t* req, uv_file file,
+                const uv_buf_t bufs[], unsigned int nbufs, int64_t offset,
+                uv_fs_cb cb) {
+    UvCallback* wrap = WrapUvRequestCallback(req, &cb);
+    return UvSubmitted(
+        wrap, orig().uv_fs_write(loop, req, file, bufs, nbufs, offset, cb));
+}
+
+int uv_fs_stat(uv_loop_t* loop, uv_fs_t* req, const char* path, uv_fs_cb cb) {
+    UvCallback* wrap = WrapUvRequestCallback(req, &cb);
+    return UvSubmitted(wrap, orig().uv_fs_stat(loop, req, path, cb));
+}
+
+int uv_fs_fstat(uv_loop_t* loop, uv_fs_t* req, uv_file file, uv_fs_cb cb) {
+    UvCallback* wrap = WrapUvRequestCallback(req, &cb);
+    return UvSubmitted(wrap, orig().uv_fs_fstat(loop, req, file, cb));
 }
 
 /* SocketInterface calls */
@@ -268,6 +415,20 @@ ssize_t recvfrom(int sockfd, void* buf, size_t len, int flags,
               recvfrom(sockfd, buf, len, flags, src_addr, addrlen));
 }
 
+ssize_t readv(int fd, const struct iovec* iov, int iovcnt) {
+    SOCK_CALL(fd, Readv(iov, iovcnt), readv(fd, iov, iovcnt));
+}
+
+ssize_t recvmsg(int sockfd, struct msghdr* msg, int flags) {
+    SOCK_CALL(sockfd, RecvMsg(msg, flags), recvmsg(sockfd, msg, flags));
+}
+
+int recvmmsg(int sockfd, struct mmsghdr* msgvec, unsigned int vlen, int flags,
+             struct timespec* timeout) {
+    SOCK_CALL(sockfd, RecvMMsg(msgvec, vlen, flags, timeout),
+              recvmmsg(sockfd, msgvec, vlen, flags, timeout));
+}
+
 ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
     SOCK_CALL(fd, Writev(iov, iovcnt), writev(fd, iov, iovcnt));
 }
@@ -290,68 +451,554 @@ ssize_t sendmsg(int sockfd, const struct msghdr* msg, int flags) {
     SOCK_CALL(sockfd, SendMsg(msg, flags), sendmsg(sockfd, msg, flags));
 }
 
+int sendmmsg(int sockfd, struct mmsghdr* msgvec, unsigned int vlen,
+             int flags) {
+    SOCK_CALL(sockfd, SendMMsg(msgvec, vlen, flags),
+              sendmmsg(sockfd, msgvec, vlen, flags));
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t* offset, size_t count) {
+    SOCK_CALL(out_fd, SendFile(in_fd, offset, count),
+              sendfile(out_fd, in_fd, offset, count));
+}
+
+// Programs built with 64-bit file offsets call sendfile64, which is the same
+// as sendfile where off_t is 64 bits
+static_assert(sizeof(off_t) == sizeof(off64_t), "off_t is not 64 bits");
+
+ssize_t sendfile64(int out_fd, int in_fd, off64_t* offset, size_t count) {
+    return sendfile(out_fd, in_fd, reinterpret_cast<off_t*>(offset), count);
+}
+
+ssize_t splice(int fd_in, loff_t* off_in, int fd_out, loff_t* off_out,
+               size_t len, unsigned int flags) {
+    // Only one end can be a socket, the other one must be a pipe
+    auto* sock = GetSocket(fd_in);
+    if (sock) {
+        return sock->SpliceRead(off_in, fd_out, off_out, len, flags);
+    }
+    SOCK_CALL(fd_out, SpliceWrite(fd_in, off_in, off_out, len, flags),
+              splice(fd_in, off_in, fd_out, off_out, len, flags));
+}
+
 int close(int fd) {
     auto* sock = GetSocket(fd);
     if (sock) {
         // IMPORTANT: do this before executing close, because it might get
         // interrupted
         DeleteSocket(fd);
+    } else {
+        epoll_registry().Close(fd);
     }
 
     return orig().close(fd);
 }
 
-typedef PGresult* (*pg_t)(PGconn* conn, const char* command);
+/* Duplicated descriptors */
 
-pg_t pg() {
-    static thread_local pg_t fun = nullptr;
-    if (fun == nullptr) {
-        void* handle = dlopen(
-            "/usr/local/lib/python2.7/site-packages/psycopg2/.libs/"
-            "libpq-9c51d239.so.5.9",
-            RTLD_NOW);
-        fun = (pg_t)dlsym(handle, "PQexec");
-        dlclose(handle);
+namespace microtrace {
+
+/*
+ * Shares the socket of oldfd with newfd, which dup has just made of it. dup2
+ * and dup3 close what newfd was before.
+ */
+static int HandleDup(const int oldfd, const int newfd) {
+    if (newfd != -1) {
+        epoll_registry().Close(newfd);
+        socket_map().Dup(oldfd, newfd);
     }
-    return fun;
+    return newfd;
 }
+}  // namespace microtrace
 
-PGresult* PQexec(PGconn* conn, const char* command) {
-    if (!is_context_undefined() && !get_current_context().is_zero()) {
-        Context context = get_current_context();
+int dup(int oldfd) __THROW { return HandleDup(oldfd, orig().dup(oldfd)); }
 
-        proto::RequestLog log;
-        proto::Connection* log_conn = log.mutable_conn();
-        log_conn->set_server_hostname("Postgres Database");
-        log_conn->set_client_hostname(GetHostname());
+int dup2(int oldfd, int newfd) __THROW {
+    return HandleDup(oldfd, orig().dup2(oldfd, newfd));
+}
 
-        proto::Context* ctx = log.mutable_context();
-        ctx->mutable_trace_id()->set_high(context.trace().high());
-        ctx->mutable_trace_id()->set_low(context.trace().low());
-        ctx->mutable_span_id()->set_high(context.span().high());
-        ctx->mutable_span_id()->set_low(context.span().low());
-        ctx->mutable_parent_span()->set_high(context.parent_span().high());
-        ctx->mutable_parent_span()->set_low(context.parent_span().low());
+int dup3(int oldfd, int newfd, int flags) __THROW {
+    return HandleDup(oldfd, orig().dup3(oldfd, newfd, flags));
+}
 
-        log.set_transaction_count(1);
-        log.set_role(proto::RequestLog::CLIENT);
-        log.set_info("SQL: " + std::string{command, strlen(command)});
+/* Non-blocking mode */
 
-        Transaction txn;
+namespace microtrace {
 
-        txn.Start();
-        PGresult* res = pg()(conn, command);
-        txn.End();
+static int HandleFcntl(int fd, int cmd, void* arg) {
+    int ret = orig().fcntl(fd, cmd, arg);
+    if (cmd == F_DUPFD || cmd == F_DUPFD_CLOEXEC) {
+        return HandleDup(fd, ret);
+    }
+    if (cmd == F_SETFL && ret != -1) {
+        auto* sock = GetSocket(fd);
+        if (sock) {
+            const auto flags = reinterpret_cast<intptr_t>(arg);
+            sock->NonBlocking(flags & O_NONBLOCK);
+        }
+    }
+    return ret;
+}
+}  // namespace microtrace
 
-        log.set_time(txn.start());
-        log.set_duration(txn.duration());
-        thrift_instance().get()->Log(log);
+int fcntl(int fd, int cmd, ...) {
+    va_list args;
+    va_start(args, cmd);
+    void* arg = va_arg(args, void*);
+    va_end(args);
+    return HandleFcntl(fd, cmd, arg);
+}
 
-        context.NewSpan();
-        set_current_context(context);
+int fcntl64(int fd, int cmd, ...) {
+    va_list args;
+    va_start(args, cmd);
+    void* arg = va_arg(args, void*);
+    va_end(args);
+    return HandleFcntl(fd, cmd, arg);
+}
 
-        return res;
-    } else {
-        return pg()(conn, command);
+int ioctl(int fd, unsigned long request, ...) __THROW {
+    va_list args;
+    va_start(args, request);
+    void* arg = va_arg(args, void*);
+    va_end(args);
+
+    int ret = orig().ioctl(fd, request, arg);
+    if (request == FIONBIO && ret != -1) {
+        auto* sock = GetSocket(fd);
+        if (sock) {
+            sock->NonBlocking(*static_cast<const int*>(arg) != 0);
+        }
+    }
+    return ret;
+}
+
+/*
+ * Non-blocking connects report their outcome through SO_ERROR, which also
+ * clears it.
+ */
+int getsockopt(int sockfd, int level, int optname, void* optval,
+               socklen_t* optlen) __THROW {
+    int ret = orig().getsockopt(sockfd, level, optname, optval, optlen);
+    if (ret == 0 && level == SOL_SOCKET && optname == SO_ERROR &&
+        *optlen >= sizeof(int)) {
+        auto* sock = GetSocket(sockfd);
+        if (sock) {
+            sock->SocketError(*static_cast<const int*>(optval));
+        }
+    }
+    return ret;
+}
+
+/* Event loops */
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event) __THROW {
+    int ret = orig().epoll_ctl(epfd, op, fd, event);
+    // Only sockets that are traced are registered
+    if (ret == 0 && GetSocket(fd)) {
+        if (op == EPOLL_CTL_DEL) {
+            epoll_registry().Delete(epfd, fd);
+        } else {
+            epoll_registry().Add(epfd, fd, event->data.u64);
+        }
+    }
+    return ret;
+}
+
+int epoll_wait(int epfd, struct epoll_event* events, int maxevents,
+               int timeout) {
+    int ret = orig().epoll_wait(epfd, events, maxevents, timeout);
+    // When the loop is woken up by a single socket, the code handling it works
+    // on the request of that socket. Events of several sockets can't be told
+    // apart, they are handled one after the other without further calls.
+    if (ret == 1) {
+        const int fd = epoll_registry().Find(epfd, events[0].data.u64);
+        auto* sock = fd == -1 ? nullptr : GetSocket(fd);
+        if (sock) {
+            sock->Ready();
+        }
+    }
+    return ret;
+}
+
+/* Threads */
+
+/*
+ * New threads start with the current context of the thread that creates them,
+ * which also covers std::thread.
+ */
+int pthread_create(pthread_t* thread, const pthread_attr_t* attr,
+                   void* (*start_routine)(void*), void* arg) __THROWNL {
+    if (is_context_undefined()) {
+        return orig().pthread_create(thread, attr, start_routine, arg);
+    }
+
+    ThreadStart* start =
+        thread_starts().Take(start_routine, arg, get_current_context());
+    const int ret =
+        orig().pthread_create(thread, attr, &ThreadStartPool::Run, start);
+    if (ret != 0) {
+        thread_starts().Give(start);
+    }
+    return ret;
+}
+
+/* Fibers */
+
+/*
+ * Fibers that share a thread each switch to their own context. Returns to
+ * uc_link happen inside libc, so the linked fiber resumes with the context of
+ * the one that returned.
+ *
+ * A new fiber starts with the context of the one that first switches to it,
+ * like a new thread. makecontext isn't hooked, its arguments can't be passed
+ * on whatever their number.
+ */
+int swapcontext(ucontext_t* oucp, const ucontext_t* ucp) __THROWNL {
+    fiber_contexts().Switch(oucp, ucp, true);
+    const int ret = orig().swapcontext(oucp, ucp);
+
+    // Otherwise this fiber has been resumed with its context by now
+    if (ret != 0) {
+        fiber_contexts().Switch(ucp, oucp);
+    }
+    return ret;
+}
+
+int setcontext(const ucontext_t* ucp) __THROWNL {
+    fiber_contexts().Resume(ucp, true);
+    return orig().setcontext(ucp);
+}
+
+void microtrace_fiber_start(const void* fiber) {
+    fiber_contexts().Suspend(fiber);
+}
+
+void microtrace_fiber_switch(const void* from, const void* to) {
+    fiber_contexts().Switch(from, to);
+}
+
+void microtrace_fiber_exit(const void* fiber) { fiber_contexts().Exit(fiber); }
+
+static void GetLaneStats(const LaneStats& lane,
+                         struct microtrace_lane_stats* stats) {
+    stats->queued = lane.queued.load();
+    stats->exported = lane.exported.load();
+    stats->dropped = lane.dropped.load();
+}
+
+void microtrace_get_stats(struct microtrace_stats* stats) {
+    const auto& breaker = overhead_breaker();
+    const auto& overhead = breaker.stats();
+    stats->overhead_level = breaker.level();
+    stats->pass_through = breaker.pass_through();
+    stats->overhead_ppm = overhead.last_overhead_ppm.load();
+    stats->overhead_windows = overhead.windows.load();
+    stats->over_budget_windows = overhead.over_budget_windows.load();
+
+    const auto* logger = thrift_instance().get();
+    GetLaneStats(logger->stats(Lane::EXPRESS), &stats->express);
+    GetLaneStats(logger->stats(Lane::NORMAL), &stats->normal);
+}
+
+/* io_uring */
+
+namespace microtrace {
+
+/*
+ * Passes the socket operations of io_uring to the sockets, as if they had
+ * been calls.
+ */
+class UringObserver : public UringTracker::Observer {
+   public:
+    bool OpSubmitted(const UringOp& op) override {
+        // The listening socket isn't traced, only the ones it accepts
+        if (op.kind == UringOp::Kind::ACCEPT) {
+            return true;
+        }
+        auto* sock = GetSocket(op.fd);
+        if (sock == nullptr) {
+            return false;
+        }
+        switch (op.kind) {
+            case UringOp::Kind::READ:
+                sock->SubmitRead(op.iov_data(), op.iovcnt);
+                return true;
+            case UringOp::Kind::WRITE:
+                sock->SubmitWrite(op.iov_data(), op.iovcnt);
+                return true;
+            case UringOp::Kind::CONNECT:
+                FilterConnect(op.fd, op.addr);
+                sock = GetSocket(op.fd);
+                if (sock) {
+                    HandleConnect(sock, op.addr);
+                }
+                return sock != nullptr;
+            case UringOp::Kind::CLOSE:
+                DeleteSocket(op.fd);
+                return false;
+            default:
+                return false;
+        }
+    }
+
+    void OpCompleted(const UringOp& op, int res) override {
+        if (op.kind == UringOp::Kind::ACCEPT) {
+            if (res >= 0) {
+                HandleAccept(res, op.flags);
+            }
+            return;
+        }
+        auto* sock = GetSocket(op.fd);
+        if (sock == nullptr) {
+            return;
+        }
+        const ssize_t ret = res < 0 ? -1 : res;
+        switch (op.kind) {
+            case UringOp::Kind::READ:
+                sock->CompleteRead(op.iov_data(), op.iovcnt, ret);
+                break;
+            case UringOp::Kind::WRITE:
+                sock->CompleteWrite(op.iov_data(), op.iovcnt, ret);
+                break;
+            case UringOp::Kind::CONNECT:
+                if (res < 0) {
+                    static_cast<ClientSocket*>(sock)->ConnectFailed(-res);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+};
+
+static std::mutex uring_mu;
+
+/*
+ * The trackers of the io_uring instances by their address. Guarded by
+ * uring_mu.
+ */
+static auto& uring_trackers() {
+    static std::unordered_map<const struct io_uring*,
+                              std::unique_ptr<UringTracker>>
+        trackers;
+    return trackers;
+}
+
+/*
+ * Counts the trackers that were deleted, a ring may be created again at the
+ * address of one that was exited.
+ */
+static std::atomic<uint64_t> uring_generation{0};
+
+/*
+ * The tracker that the calling thread used last, rings are mostly used by a
+ * single thread. It is valid as long as no tracker was deleted since.
+ */
+struct CachedUringTracker {
+    const struct io_uring* ring = nullptr;
+    UringTracker* tracker = nullptr;
+    uint64_t generation = 0;
+};
+
+static thread_local CachedUringTracker cached_uring_tracker;
+
+static UringTracker& GetUringTracker(const struct io_uring* ring) {
+    static UringObserver observer;
+
+    auto& cached = cached_uring_tracker;
+    if (cached.ring == ring &&
+        cached.generation ==
+            uring_generation.load(std::memory_order_acquire)) {
+        return *cached.tracker;
+    }
+
+    std::lock_guard<std::mutex> l(uring_mu);
+    auto& tracker = uring_trackers()[ring];
+    if (!tracker) {
+        tracker = std::make_unique<UringTracker>(ring, &observer);
+    }
+    cached.ring = ring;
+    cached.tracker = tracker.get();
+    cached.generation = uring_generation.load(std::memory_order_relaxed);
+    return *tracker;
+}
+
+static void DeleteUringTracker(const struct io_uring* ring) {
+    std::lock_guard<std::mutex> l(uring_mu);
+    uring_trackers().erase(ring);
+    uring_generation.fetch_add(1, std::memory_order_release);
+}
+
+/*
+ * Reads the rings before a call that may submit, the completions come first
+ * because they are older.
+ */
+static UringTracker& BeforeUringCall(const struct io_uring* ring) {
+    auto& tracker = GetUringTracker(ring);
+    tracker.Completing(ring);
+    tracker.Submitting(ring);
+    return tracker;
+}
+}  // namespace microtrace
+
+int io_uring_submit(struct io_uring* ring) {
+    BeforeUringCall(ring);
+    return orig().io_uring_submit(ring);
+}
+
+int io_uring_submit_and_wait(struct io_uring* ring, unsigned wait_nr) {
+    auto& tracker = BeforeUringCall(ring);
+    int ret = orig().io_uring_submit_and_wait(ring, wait_nr);
+    tracker.Completing(ring);
+    return ret;
+}
+
+/*
+ * io_uring_wait_cqe and io_uring_peek_cqe are inline functions that end up
+ * here when no completion is ready.
+ */
+int __io_uring_get_cqe(struct io_uring* ring, struct io_uring_cqe** cqe_ptr,
+                       unsigned submit, unsigned wait_nr, sigset_t* sigmask) {
+    auto& tracker = BeforeUringCall(ring);
+    int ret =
+        orig().__io_uring_get_cqe(ring, cqe_ptr, submit, wait_nr, sigmask);
+    tracker.Completing(ring);
+    return ret;
+}
+
+int io_uring_wait_cqes(struct io_uring* ring, struct io_uring_cqe** cqe_ptr,
+                       unsigned wait_nr, struct __kernel_timespec* ts,
+                       sigset_t* sigmask) {
+    auto& tracker = BeforeUringCall(ring);
+    int ret = orig().io_uring_wait_cqes(ring, cqe_ptr, wait_nr, ts, sigmask);
+    tracker.Completing(ring);
+    return ret;
+}
+
+unsigned io_uring_peek_batch_cqe(struct io_uring* ring,
+                                 struct io_uring_cqe** cqes, unsigned count) {
+    unsigned ret = orig().io_uring_peek_batch_cqe(ring, cqes, count);
+    GetUringTracker(ring).Completing(ring);
+    return ret;
+}
+
+void io_uring_queue_exit(struct io_uring* ring) {
+    DeleteUringTracker(ring);
+    orig().io_uring_queue_exit(ring);
+}
+
+/* Fork */
+
+namespace microtrace {
+
+/*
+ * Only the thread that calls fork exists in the child, the locks held by the
+ * others would never be released there. Every lock is taken before fork, in
+ * the order in which the hooks nest them, and released after it.
+ */
+static void PrepareFork() {
+    uring_mu.lock();
+    for (auto& tracker : uring_trackers()) {
+        tracker.second->PrepareFork();
+    }
+    socket_map().PrepareFork();
+    epoll_registry().PrepareFork();
+    pq_tracker().PrepareFork();
+    if (auto* logger = tail_logger()) {
+        logger->PrepareFork();
     }
+    thrift_instance().get()->PrepareFork();
 }
+
+static void AfterForkParent() {
+    thrift_instance().get()->AfterForkParent();
+    if (auto* logger = tail_logger()) {
+        logger->AfterForkParent();
+    }
+    pq_tracker().AfterFork();
+    epoll_registry().AfterFork();
+    socket_map().AfterForkParent();
+    for (auto& tracker : uring_trackers()) {
+        tracker.second->AfterFork();
+    }
+    uring_mu.unlock();
+}
+
+/*
+ * Besides the locks, the child drops the state that belongs to the requests
+ * of the parent, and reseeds the generators of the forking thread so that it
+ * doesn't make the same ids and sampling decisions.
+ */
+static void AfterForkChild() {
+    for (auto& tracker : uring_trackers()) {
+        tracker.second->AfterFork();
+    }
+    uring_mu.unlock();
+    socket_map().AfterForkChild();
+    epoll_registry().AfterFork();
+    pq_tracker().AfterFork();
+    if (auto* logger = tail_logger()) {
+        logger->AfterForkChild();
+    }
+
+    // Last, it closes a descriptor through the hooks
+    thrift_instance().get()->AfterForkChild();
+
+    reseed_uuids();
+    reseed_random();
+}
+
+__attribute__((constructor)) static void RegisterForkHandlers() {
+    pthread_atfork(&PrepareFork, &AfterForkParent, &AfterForkChild);
+}
+}  // namespace microtrace
+
+/* Postgres */
+
+PGresult* PQexec(PGconn* conn, const char* command) {
+    return pq_tracker().Exec(conn, command);
+}
+
+PGresult* PQexecParams(PGconn* conn, const char* command, int nParams,
+                       const Oid* paramTypes, const char* const* paramValues,
+                       const int* paramLengths, const int* paramFormats,
+                       int resultFormat) {
+    return pq_tracker().ExecParams(conn, command, nParams, paramTypes,
+                                   paramValues, paramLengths, paramFormats,
+                                   resultFormat);
+}
+
+PGresult* PQexecPrepared(PGconn* conn, const char* stmtName, int nParams,
+                         const char* const* paramValues,
+                         const int* paramLengths, const int* paramFormats,
+                         int resultFormat) {
+    return pq_tracker().ExecPrepared(conn, stmtName, nParams, paramValues,
+                                     paramLengths, paramFormats, resultFormat);
+}
+
+int PQsendQuery(PGconn* conn, const char* command) {
+    return pq_tracker().SendQuery(conn, command);
+}
+
+int PQsendQueryParams(PGconn* conn, const char* command, int nParams,
+                      const Oid* paramTypes, const char* const* paramValues,
+                      const int* paramLengths, const int* paramFormats,
+                      int resultFormat) {
+    return pq_tracker().SendQueryParams(conn, command, nParams, paramTypes,
+                                        paramValues, paramLengths,
+                                        paramFormats, resultFormat);
+}
+
+int PQsendQueryPrepared(PGconn* conn, const char* stmtName, int nParams,
+                        const char* const* paramValues,
+                        const int* paramLengths, const int* paramFormats,
+                        int resultFormat) {
+    return pq_tracker().SendQueryPrepared(conn, stmtName, nParams, paramValues,
+                                          paramLengths, paramFormats,
+                                          resultFormat);
+}
+
+PGresult* PQgetResult(PGconn* conn) { return pq_tracker().GetResult(conn); }
+
+void PQfinish(PGconn* conn) { pq_tracker().Finish(conn); }
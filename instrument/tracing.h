@@ -1,7 +1,7 @@
 #pragma once
 
-struct PGconn;
-struct PGresult;
+#include <libpq-fe.h>
+#include <stdint.h>
 
 /*
  * These are the functions that we instrument in order to trace requests.
@@ -14,6 +14,10 @@ int socket(int domain, int type, int protocol);
 int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
 int close(int fd);
 
+int dup(int oldfd) __THROW;
+int dup2(int oldfd, int newfd) __THROW;
+int dup3(int oldfd, int newfd, int flags) __THROW;
+
 int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
 int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
 
@@ -21,6 +25,10 @@ ssize_t recv(int sockfd, void *buf, size_t len, int flags);
 ssize_t read(int fd, void *buf, size_t count);
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags,
                  struct sockaddr *src_addr, socklen_t *addrlen);
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt);
+ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags);
+int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+             struct timespec *timeout);
 
 ssize_t send(int sockfd, const void *buf, size_t len, int flags);
 ssize_t write(int fd, const void *buf, size_t count);
@@ -30,6 +38,105 @@ ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
 ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags);
 int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags);
 
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count);
+ssize_t sendfile64(int out_fd, int in_fd, off64_t *offset, size_t count);
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out,
+               size_t len, unsigned int flags);
+
+int fcntl(int fd, int cmd, ...);
+int fcntl64(int fd, int cmd, ...);
+int ioctl(int fd, unsigned long request, ...) __THROW;
+
+int getsockopt(int sockfd, int level, int optname, void *optval,
+               socklen_t *optlen) __THROW;
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) __THROW;
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+               int timeout);
+
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                   void *(*start_routine)(void *), void *arg) __THROWNL;
+
+int swapcontext(ucontext_t *oucp, const ucontext_t *ucp) __THROWNL;
+int setcontext(const ucontext_t *ucp) __THROWNL;
+
+/*
+ * Coroutine runtimes that switch stacks without ucontext, e.g. greenlet or
+ * boost.context, call these so that each fiber keeps its own context. A fiber
+ * is any pointer that stays the same while it lives.
+ */
+
+/*
+ * Called when fiber is created, it starts with the current context.
+ */
+LIBMICROTRACE_EXPORTED void microtrace_fiber_start(const void *fiber);
+
+/*
+ * Called before switching from a fiber to another one.
+ */
+LIBMICROTRACE_EXPORTED void microtrace_fiber_switch(const void *from,
+                                                    const void *to);
+
+/*
+ * Called when fiber won't run again.
+ */
+LIBMICROTRACE_EXPORTED void microtrace_fiber_exit(const void *fiber);
+
+/*
+ * Number of spans that were accepted by a lane of the export queue, handed
+ * over to the exporter, and discarded because the lane was over its budget.
+ */
+struct microtrace_lane_stats {
+    uint64_t queued;
+    uint64_t exported;
+    uint64_t dropped;
+};
+
+/*
+ * The state of the tracing of this process, for operators and health checks,
+ * which can look up microtrace_get_stats with dlsym.
+ */
+struct microtrace_stats {
+    /*
+     * Throttle level of the overhead breaker, 0 if tracing is unaffected.
+     * Nothing is traced in pass-through, only the context is passed on.
+     */
+    int overhead_level;
+    int pass_through;
+
+    /*
+     * Time spent in hooks during the last window, in parts per million of
+     * the window, and how many windows were over the budget.
+     */
+    uint64_t overhead_ppm;
+    uint64_t overhead_windows;
+    uint64_t over_budget_windows;
+
+    /*
+     * Slow or failed spans go through the express lane, all others through
+     * the normal one.
+     */
+    struct microtrace_lane_stats express;
+    struct microtrace_lane_stats normal;
+};
+
+/*
+ * Fills stats with the current state.
+ */
+LIBMICROTRACE_EXPORTED void microtrace_get_stats(
+    struct microtrace_stats *stats);
+
+int io_uring_submit(struct io_uring *ring);
+int io_uring_submit_and_wait(struct io_uring *ring, unsigned wait_nr);
+int __io_uring_get_cqe(struct io_uring *ring, struct io_uring_cqe **cqe_ptr,
+                       unsigned submit, unsigned wait_nr, sigset_t *sigmask);
+int io_uring_wait_cqes(struct io_uring *ring, struct io_uring_cqe **cqe_ptr,
+                       unsigned wait_nr, struct __kernel_timespec *ts,
+                       sigset_t *sigmask);
+unsigned io_uring_peek_batch_cqe(struct io_uring *ring,
+                                 struct io_uring_cqe **cqes, unsigned count);
+void io_uring_queue_exit(struct io_uring *ring);
+
 int uv_tcp_connect(uv_connect_t *req, uv_tcp_t *handle,
                    const struct sockaddr *addr, uv_connect_cb cb);
 int uv_listen(uv_stream_t *stream, int backlog, uv_connection_cb cb);
@@ -37,6 +144,43 @@ int uv_accept(uv_stream_t *server, uv_stream_t *client);
 int uv_getaddrinfo(uv_loop_t *loop, uv_getaddrinfo_t *req,
                    uv_getaddrinfo_cb getaddrinfo_cb, const char *node,
                    const char *service, const struct addrinfo *hints);
+int uv_write(uv_write_t *req, uv_stream_t *handle, const uv_buf_t bufs[],
+             unsigned int nbufs, uv_write_cb cb);
+int uv_queue_work(uv_loop_t *loop, uv_work_t *req, uv_work_cb work_cb,
+                  uv_after_work_cb after_work_cb);
+int uv_timer_start(uv_timer_t *handle, uv_timer_cb cb, uint64_t timeout,
+                   uint64_t repeat);
+void uv_close(uv_handle_t *handle, uv_close_cb close_cb);
+int uv_fs_open(uv_loop_t *loop, uv_fs_t *req, const char *path, int flags,
+               int mode, uv_fs_cb cb);
+int uv_fs_close(uv_loop_t *loop, uv_fs_t *req, uv_file file, uv_fs_cb cb);
+int uv_fs_read(uv_loop_t *loop, uv_fs_t *req, uv_file file,
+               const uv_buf_t bufs[], unsigned int nbufs, int64_t offset,
+               uv_fs_cb cb);
+int uv_fs_write(uv_loop_t *loop, uv_fs_t *req, uv_file file,
+                const uv_buf_t bufs[], unsigned int nbufs, int64_t offset,
+                uv_fs_cb cb);
+int uv_fs_stat(uv_loop_t *loop, uv_fs_t *req, const char *path, uv_fs_cb cb);
+int uv_fs_fstat(uv_loop_t *loop, uv_fs_t *req, uv_file file, uv_fs_cb cb);
 
 PGresult *PQexec(PGconn *conn, const char *command);
+PGresult *PQexecParams(PGconn *conn, const char *command, int nParams,
+                       const Oid *paramTypes, const char *const *paramValues,
+                       const int *paramLengths, const int *paramFormats,
+                       int resultFormat);
+PGresult *PQexecPrepared(PGconn *conn, const char *stmtName, int nParams,
+                         const char *const *paramValues,
+                         const int *paramLengths, const int *paramFormats,
+                         int resultFormat);
+int PQsendQuery(PGconn *conn, const char *command);
+int PQsendQueryParams(PGconn *conn, const char *command, int nParams,
+                      const Oid *paramTypes, const char *const *paramValues,
+                      const int *paramLengths, const int *paramFormats,
+                      int resultFormat);
+int PQsendQueryPrepared(PGconn *conn, const char *stmtName, int nParams,
+                        const char *const *paramValues,
+                        const int *paramLengths, const int *paramFormats,
+                        int resultFormat);
+PGresult *PQgetResult(PGconn *conn);
+void PQfinish(PGconn *conn);
 }
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+#include "common.h"
+
+namespace microtrace {
+
+/*
+ * TxnQueue holds the transactions that are in flight on a connection, in the
+ * order their requests were sent. Responses arrive in the same order, so the
+ * oldest transaction is the one the next response belongs to.
+ *
+ * It has a fixed capacity, and its items are reused, so it never allocates.
+ */
+template <class T, size_t N>
+class TxnQueue {
+   public:
+    static const size_t CAPACITY = N;
+
+    bool empty() const { return size_ == 0; }
+    bool full() const { return size_ == N; }
+    size_t size() const { return size_; }
+
+    /*
+     * Returns the oldest transaction.
+     */
+    T& front() {
+        VERIFY(!empty(), "front called on empty TxnQueue");
+        return items_[head_];
+    }
+
+    /*
+     * Returns the newest transaction.
+     */
+    T& back() {
+        VERIFY(!empty(), "back called on empty TxnQueue");
+        return items_[(head_ + size_ - 1) % N];
+    }
+
+    /*
+     * Appends a transaction and returns it. The returned item still holds the
+     * values of the transaction that used it before, so the caller must reset
+     * it.
+     */
+    T& push() {
+        VERIFY(!full(), "push called on full TxnQueue");
+        ++size_;
+        return back();
+    }
+
+    /*
+     * Removes the oldest transaction.
+     */
+    void pop() {
+        VERIFY(!empty(), "pop called on empty TxnQueue");
+        head_ = (head_ + 1) % N;
+        --size_;
+    }
+
+    /*
+     * Removes the newest transaction.
+     */
+    void pop_back() {
+        VERIFY(!empty(), "pop_back called on empty TxnQueue");
+        --size_;
+    }
+
+    void clear() {
+        head_ = 0;
+        size_ = 0;
+    }
+
+   private:
+    std::array<T, N> items_;
+    size_t head_ = 0;
+    size_t size_ = 0;
+};
+
+template <class T, size_t N>
+const size_t TxnQueue<T, N>::CAPACITY;
+}
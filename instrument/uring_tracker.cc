@@ -0,0 +1,161 @@
+#include "uring_tracker.h"
+
+#include <algorithm>
+
+namespace microtrace {
+
+const int UringOp::MAX_IOVECS;
+
+static void SetBuffer(UringOp* op, const uint64_t addr, const uint32_t len) {
+    op->iov[0].iov_base = reinterpret_cast<void*>(addr);
+    op->iov[0].iov_len = len;
+    op->iovcnt = 1;
+}
+
+static void SetIovecs(UringOp* op, const struct iovec* iov, size_t iovcnt) {
+    if (iovcnt > static_cast<size_t>(UringOp::MAX_IOVECS)) {
+        return;
+    }
+    std::copy(iov, iov + iovcnt, op->iov.begin());
+    op->iovcnt = iovcnt;
+}
+
+UringTracker::UringTracker(const struct io_uring* ring, Observer* observer)
+    : observer_(observer),
+      sq_tail_(ring->sq.sqe_tail),
+      cq_head_(__atomic_load_n(ring->cq.ktail, __ATOMIC_ACQUIRE)) {}
+
+void UringTracker::Submitting(const struct io_uring* ring) {
+    std::lock_guard<std::mutex> l(mu_);
+    const unsigned head = ring->sq.sqe_head;
+    const unsigned tail = ring->sq.sqe_tail;
+
+    // The entries up to the last tail have been read already, unless they
+    // have been flushed since
+    unsigned pos = head;
+    if (static_cast<int>(sq_tail_ - head) > 0 &&
+        static_cast<int>(tail - sq_tail_) >= 0) {
+        pos = sq_tail_;
+    }
+
+    const unsigned mask = *ring->sq.kring_mask;
+    const int shift = (ring->flags & IORING_SETUP_SQE128) ? 1 : 0;
+    for (; pos != tail; ++pos) {
+        const struct io_uring_sqe& sqe = ring->sq.sqes[(pos & mask) << shift];
+        UringOp op;
+        if (Decode(sqe, &op) && observer_->OpSubmitted(op)) {
+            Submitted(sqe.user_data, op);
+        }
+    }
+    sq_tail_ = tail;
+}
+
+void UringTracker::Completing(const struct io_uring* ring) {
+    std::lock_guard<std::mutex> l(mu_);
+    const unsigned tail = __atomic_load_n(ring->cq.ktail, __ATOMIC_ACQUIRE);
+    if (ops_.empty()) {
+        cq_head_ = tail;
+        return;
+    }
+
+    const unsigned mask = *ring->cq.kring_mask;
+    const unsigned entries = *ring->cq.kring_entries;
+    const int shift = (ring->flags & IORING_SETUP_CQE32) ? 1 : 0;
+
+    // The kernel reuses the entries that the application has consumed, so
+    // the ones more than a ring behind the tail are gone
+    unsigned pos = tail - cq_head_ > entries ? tail - entries : cq_head_;
+    for (; pos != tail; ++pos) {
+        const struct io_uring_cqe cqe = ring->cq.cqes[(pos & mask) << shift];
+
+        // A consumed entry may have been reused while it was copied
+        const unsigned head = __atomic_load_n(ring->cq.khead, __ATOMIC_ACQUIRE);
+        const unsigned now = __atomic_load_n(ring->cq.ktail, __ATOMIC_ACQUIRE);
+        if (static_cast<int>(head - pos) > 0 && now - pos >= entries) {
+            continue;
+        }
+        Completed(cqe);
+    }
+    cq_head_ = tail;
+}
+
+bool UringTracker::Decode(const struct io_uring_sqe& sqe, UringOp* op) {
+    if (sqe.flags & IOSQE_FIXED_FILE) {
+        return false;
+    }
+    op->fd = sqe.fd;
+    op->iovcnt = 0;
+
+    // Buffers selected by the kernel are only known from the completion
+    const bool selected = sqe.flags & IOSQE_BUFFER_SELECT;
+    switch (sqe.opcode) {
+        case IORING_OP_READ:
+        case IORING_OP_READ_FIXED:
+        case IORING_OP_RECV:
+            op->kind = UringOp::Kind::READ;
+            if (!selected) {
+                SetBuffer(op, sqe.addr, sqe.len);
+            }
+            return true;
+        case IORING_OP_READV:
+            op->kind = UringOp::Kind::READ;
+            if (!selected) {
+                SetIovecs(op, reinterpret_cast<const struct iovec*>(sqe.addr),
+                          sqe.len);
+            }
+            return true;
+        case IORING_OP_RECVMSG:
+            op->kind = UringOp::Kind::READ;
+            if (!selected) {
+                const auto* msg = reinterpret_cast<const msghdr*>(sqe.addr);
+                SetIovecs(op, msg->msg_iov, msg->msg_iovlen);
+            }
+            return true;
+        case IORING_OP_WRITE:
+        case IORING_OP_WRITE_FIXED:
+        case IORING_OP_SEND:
+            op->kind = UringOp::Kind::WRITE;
+            SetBuffer(op, sqe.addr, sqe.len);
+            return true;
+        case IORING_OP_WRITEV:
+            op->kind = UringOp::Kind::WRITE;
+            SetIovecs(op, reinterpret_cast<const struct iovec*>(sqe.addr),
+                      sqe.len);
+            return true;
+        case IORING_OP_SENDMSG: {
+            op->kind = UringOp::Kind::WRITE;
+            const auto* msg = reinterpret_cast<const msghdr*>(sqe.addr);
+            SetIovecs(op, msg->msg_iov, msg->msg_iovlen);
+            return true;
+        }
+        case IORING_OP_ACCEPT:
+            op->kind = UringOp::Kind::ACCEPT;
+            op->flags = sqe.accept_flags;
+            return true;
+        case IORING_OP_CONNECT:
+            op->kind = UringOp::Kind::CONNECT;
+            op->addr = reinterpret_cast<const struct sockaddr*>(sqe.addr);
+            return true;
+        case IORING_OP_CLOSE:
+            op->kind = UringOp::Kind::CLOSE;
+            return true;
+        default:
+            return false;
+    }
+}
+
+void UringTracker::Submitted(const uint64_t user_data, const UringOp& op) {
+    ops_[user_data] = op;
+}
+
+void UringTracker::Completed(const struct io_uring_cqe& cqe) {
+    auto it = ops_.find(cqe.user_data);
+    if (it == ops_.end()) {
+        return;
+    }
+    observer_->OpCompleted(it->second, cqe.res);
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        ops_.erase(it);
+    }
+}
+}
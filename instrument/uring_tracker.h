@@ -0,0 +1,139 @@
+#pragma once
+
+#include <liburing.h>
+#include <sys/uio.h>
+#include <array>
+#include <mutex>
+#include <unordered_map>
+
+namespace microtrace {
+
+/*
+ * A socket operation that has been submitted to io_uring.
+ */
+struct UringOp {
+    static const int MAX_IOVECS = 8;
+
+    enum class Kind { READ, WRITE, ACCEPT, CONNECT, CLOSE };
+
+    Kind kind = Kind::READ;
+    int fd = -1;
+
+    /*
+     * The flags of the socket being accepted.
+     */
+    int flags = 0;
+
+    /*
+     * The address being connected to, which the kernel has copied by the time
+     * the operation is submitted.
+     */
+    const struct sockaddr* addr = nullptr;
+
+    /*
+     * The buffers of a read or a write. There are none if they can't be seen,
+     * because the kernel selects the buffer, or there are more than
+     * MAX_IOVECS of them.
+     */
+    std::array<struct iovec, MAX_IOVECS> iov;
+    int iovcnt = 0;
+
+    const struct iovec* iov_data() const {
+        return iovcnt > 0 ? iov.data() : nullptr;
+    }
+};
+
+/*
+ * UringTracker follows the socket operations that go through an io_uring
+ * instance of liburing, from the submission queue entries it flushes to the
+ * completion queue entries that the kernel posts.
+ *
+ * Both rings are read in place, from the calls of liburing that are
+ * intercepted, so no system call is added. Completions are seen even if the
+ * application took them without calling liburing, unless the kernel has
+ * reused their entries since. The operations of those stay pending.
+ */
+class UringTracker {
+   public:
+    class Observer {
+       public:
+        virtual ~Observer() = default;
+
+        /*
+         * Called before op is submitted. Returns true if its completion has
+         * to be followed.
+         */
+        virtual bool OpSubmitted(const UringOp& op) = 0;
+
+        /*
+         * Called with the result of op, a negative errno on failure.
+         */
+        virtual void OpCompleted(const UringOp& op, int res) = 0;
+    };
+
+    /*
+     * Starts following ring from its current position.
+     */
+    UringTracker(const struct io_uring* ring, Observer* observer);
+
+    UringTracker(const UringTracker&) = delete;
+
+    /*
+     * Reads the submission queue entries that have been added since the last
+     * call, called before liburing flushes them to the kernel.
+     */
+    void Submitting(const struct io_uring* ring);
+
+    /*
+     * Reads the completion queue entries that have been posted since the last
+     * call.
+     */
+    void Completing(const struct io_uring* ring);
+
+    /*
+     * Decodes the socket operation of sqe. Returns false for other operations,
+     * and for registered files, whose fd is an index.
+     */
+    static bool Decode(const struct io_uring_sqe& sqe, UringOp* op);
+
+    /*
+     * Follows the completion of the operation submitted with user_data.
+     */
+    void Submitted(const uint64_t user_data, const UringOp& op);
+
+    /*
+     * Passes the operation that cqe completes to the observer. Operations
+     * that complete more than once, e.g. multishot receives, are kept until
+     * their last completion.
+     */
+    void Completed(const struct io_uring_cqe& cqe);
+
+    size_t pending() const { return ops_.size(); }
+
+    /*
+     * Hold the tracker across fork. The child keeps the operations that have
+     * been submitted, since it shares the rings of the parent.
+     */
+    void PrepareFork() { mu_.lock(); }
+
+    void AfterFork() { mu_.unlock(); }
+
+   private:
+    Observer* const observer_;
+
+    // Guards the tracker, rings can be shared by threads
+    std::mutex mu_;
+
+    /*
+     * The positions up to which the submission queue and the completion queue
+     * have been read.
+     */
+    unsigned sq_tail_;
+    unsigned cq_head_;
+
+    /*
+     * The pending operations by their user_data.
+     */
+    std::unordered_map<uint64_t, UringOp> ops_;
+};
+}
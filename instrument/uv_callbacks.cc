@@ -0,0 +1,12 @@
+#include "uv_callbacks.h"
+
+namespace microtrace {
+
+const size_t UvCallback::MAX_CALLBACKS;
+const size_t UvCallback::REPEATED;
+
+UvCallbackPool& uv_callbacks() {
+    static UvCallbackPool uv_callbacks_;
+    return uv_callbacks_;
+}
+}
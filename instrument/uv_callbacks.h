@@ -0,0 +1,151 @@
+#pragma once
+
+#include <array>
+
+#include "context.h"
+#include "fixed_pool.h"
+#include "uv.h"
+
+namespace microtrace {
+
+/*
+ * The callbacks passed to libuv with a request or a handle, and the context
+ * that was current then.
+ */
+struct UvCallback {
+    static const size_t MAX_CALLBACKS = 2;
+
+    /*
+     * The value of last for callbacks that are called until their handle is
+     * closed.
+     */
+    static const size_t REPEATED = MAX_CALLBACKS;
+
+    UvCallback() : context(ContextStorage::Zero(), 0) {}
+
+    /*
+     * The request or handle the callbacks were passed with.
+     */
+    const void* owner = nullptr;
+
+    std::array<void (*)(), MAX_CALLBACKS> cbs;
+
+    /*
+     * The index of the callback after which libuv calls none of them again.
+     */
+    size_t last = REPEATED;
+
+    Context context;
+};
+
+typedef FixedPool<UvCallback, 1024> UvCallbackPool;
+
+/*
+ * Returns the pool that the UvCallbacks of every loop are taken from.
+ */
+UvCallbackPool& uv_callbacks();
+
+/*
+ * Returns the field of a request or a handle in which its UvCallback is kept.
+ * Requests and handles have pointers reserved for future versions of libuv.
+ * Those of handles share a union with an fd, so the second one is used.
+ */
+template <typename T>
+void*& UvCallbackField(T* req) {
+    return reinterpret_cast<uv_req_t*>(req)->reserved[0];
+}
+
+inline void*& UvCallbackField(uv_timer_t* timer) {
+    return reinterpret_cast<uv_handle_t*>(timer)->u.reserved[1];
+}
+
+/*
+ * Returns the UvCallback of owner, or null if it has none. The field of owner
+ * may hold anything before the first one is taken.
+ */
+template <typename T>
+UvCallback* FindUvCallback(T* owner) {
+    UvCallback* wrap = uv_callbacks().Find(UvCallbackField(owner));
+    return wrap != nullptr && wrap->owner == owner ? wrap : nullptr;
+}
+
+/*
+ * Takes a UvCallback for owner with the current context, that is given back
+ * after the callback at index last. Returns null if the context is undefined,
+ * or if the pool is exhausted, the callbacks are passed on unchanged then.
+ */
+template <typename T>
+UvCallback* TakeUvCallback(T* owner, const size_t last) {
+    if (is_context_undefined()) {
+        return nullptr;
+    }
+    UvCallback* wrap = uv_callbacks().Take();
+    if (wrap == nullptr) {
+        return nullptr;
+    }
+
+    wrap->owner = owner;
+    wrap->cbs.fill(nullptr);
+    wrap->last = last;
+    wrap->context = get_current_context();
+    UvCallbackField(owner) = wrap;
+    return wrap;
+}
+
+/*
+ * Gives back the UvCallback of owner, if it has one.
+ */
+template <typename T>
+void GiveUvCallback(T* owner) {
+    UvCallback* wrap = FindUvCallback(owner);
+    if (wrap != nullptr) {
+        uv_callbacks().Give(wrap);
+    }
+}
+
+/*
+ * Calls the callback at index I of the UvCallback of owner, with its context
+ * set as the current one.
+ */
+template <size_t I, typename T, typename... Args>
+void RunUvCallback(T* owner, Args... args) {
+    auto* wrap = static_cast<UvCallback*>(UvCallbackField(owner));
+    auto cb = reinterpret_cast<void (*)(T*, Args...)>(wrap->cbs[I]);
+    set_current_context(wrap->context);
+
+    // The callback may pass the request to libuv again
+    if (wrap->last == I) {
+        uv_callbacks().Give(wrap);
+    }
+    if (cb != nullptr) {
+        cb(owner, args...);
+    }
+}
+
+/*
+ * Keeps *cb at index I of wrap, and replaces it with a callback that calls it
+ * with the context of wrap.
+ */
+template <size_t I, typename T, typename... Args>
+void WrapUvCallback(UvCallback* wrap, void (**cb)(T*, Args...)) {
+    static_assert(I < UvCallback::MAX_CALLBACKS, "Too many callbacks");
+    wrap->cbs[I] = reinterpret_cast<void (*)()>(*cb);
+    *cb = &RunUvCallback<I, T, Args...>;
+}
+
+/*
+ * Wraps *cb, the only callback of req, unless it is null, which makes most
+ * requests synchronous. Returns the UvCallback, or null if *cb is unchanged.
+ */
+template <typename T, typename Cb>
+UvCallback* WrapUvRequestCallback(T* req, Cb* cb) {
+    if (*cb == nullptr) {
+        return nullptr;
+    }
+    UvCallback* wrap = TakeUvCallback(req, 0);
+    if (wrap != nullptr) {
+        WrapUvCallback<0>(wrap, cb);
+    }
+    return wrap;
+}
+}
@@ -27,9 +27,16 @@ def load_spans():
         db_id = proto[0]
         ret = span.ParseFromString(proto[1])
 
+        # Spans of newer libraries have nanosecond times
+        time = span.time
+        duration = span.duration
+        if span.HasField('time_ns'):
+            time = span.time_ns / 1e9
+            duration = span.duration_ns / 1e6
+
         # Convert into custom Span obj
         span_obj = trace.make_span(db_id,
-                span.time,
+                time,
                 trace.UUID(span.context.trace_id.high,
                     span.context.trace_id.low),
                 trace.UUID(span.context.span_id.high,
@@ -38,7 +45,7 @@ def load_spans():
                     span.context.parent_span.low),
                 span.conn.client_hostname,
                 span.conn.server_hostname,
-                span.duration,
+                duration,
                 span.info)
 
         spans.append(span_obj)